@@ -11,8 +11,25 @@
  *   -- each reticulation node must an out-degree 1;
  *   -- only one root and no node has both in- and out-degree > 1
  *
- *   The compiling command:  gcc -o ccp ClusterContainment.c
- *   The run command:        ./ccp <network_file_name> <leave_file_name>
+ *   The compiling command:  gcc -o ccp ClusterContainment.c -lz
+ *   or, to search the branches of unstable components in parallel:
+ *                           gcc -fopenmp -o ccp ClusterContainment.c -lz
+ *   The run command:        ./ccp [-q | -b <witness_file>] [-c <cache_dir>] <network_file_name> <leave_file_name>
+ *
+ *   The input is first resolved with the blob decomposition of the network; the CCP
+ *   search runs on the whole network for the inputs that this does not decide.
+ *   If the input is a soft cluster, the tree displaying it is printed as a list of edges.
+ *   With -q it is not printed, for batch queries that only need the answer.
+ *   With -b it is written to the witness file in binary: the number of nodes (uint16_t),
+ *   the node names each ending with '\0', the number of edges (uint16_t), then the
+ *   two endpoints of each edge as uint16_t node indices.
+ *   With -c the answers of the CCP search are kept in the cache directory, keyed by a
+ *   128-bit hash of a canonical form of the network and the leaves, so that a repeated
+ *   query is answered without searching again, whatever the labels of the internal
+ *   nodes and the order of the edges. The form is kept with the answer and compared.
+ *   The least recently used answers are removed when it grows over CACHE_LIMIT bytes.
+ *
+ *   The network and leaf files may be gzip-compressed.
  *
  *   The leaves is represented as a list of nodes, each on
  *   a line. For example, this is a file of the input leaves
@@ -42,6 +59,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>		/* for CHAR_BIT */
+#include <ctype.h>
+#include <zlib.h>		/* to read compressed input */
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>	/* for flock */
+#include <fcntl.h>
+
+#define WLEN (sizeof(unsigned int) * CHAR_BIT)
+#define BITMASK(b) (1U << ((b) % WLEN))
+#define BITSLOT(b) ((b) / WLEN)
+#define BITSET(a, b) ((a)[BITSLOT(b)] |= BITMASK(b))
+#define BITCLEAR(a, b) ((a)[BITSLOT(b)] &= ~BITMASK(b))
+#define BITTEST(a, b) ((a)[BITSLOT(b)] & BITMASK(b))
+#define BITNSLOTS(nb) ((nb + WLEN - 1) / WLEN)
 
 #define ROOT 0
 #define TREE 1
@@ -50,15 +85,40 @@
 #define INNER 4
 #define CROSS 5
 #define REVISED 6
+/* the node types as label ranges, once Renumber_Nodes has ordered the nodes */
+#define IS_LEAF(x) ((unsigned int) (x) < (unsigned int) first_ret)
+#define IS_RET(x) ((unsigned int) ((x) - first_ret) \
+		< (unsigned int) (first_tree - first_ret))
 #define MAXDEGREE 20
 #define MAXSIZE  350
 #define MAXEDGE  520
+#define MINTASKCOMPS 4	/* split branches with fewer components left are not run as tasks */
+#define NO_WITNESS 0
+#define TEXT_WITNESS 1
+#define BINARY_WITNESS 2
+#define CACHE_LIMIT (64L << 20)	/* bytes kept in the result cache directory */
+#define CANONICAL_BASIS (((unsigned __int128) 0x6c62272e07bb0142ULL << 64) \
+		| 0x62b821756295c58dULL)	/* the 128-bit FNV-1a offset basis */
 
 struct lnode {
 	int leaf;
 	struct lnode *next;
 };
 
+/* a string that grows as text is appended to it */
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+/* a file of the cache directory, for eviction */
+struct cache_entry {
+	char *path;
+	long size;
+	struct timespec used;	/* when it was last read or written */
+};
+
 struct arb_tnode { /* arbitrary tree node */
 	int label;
 	int flag;
@@ -71,6 +131,7 @@ struct components {
 	int inner;
 	int size;	// used for copying network with array
 	int no_tree_node; // used for checking degenerate case
+	int visible;	/* whether the root of the component is visible in the input network */
 	struct arb_tnode *tree_com;
 	struct components *next;
 };
@@ -82,6 +143,24 @@ struct temp_node{
 	int index;
 };
 
+/* the tree found to display the input as a soft cluster, kept as a list of edges */
+struct witness {
+	int mode;	/* how to output the tree */
+	int node;	/* the node whose cluster is the input */
+	int no_break;
+	int no_edges;
+	int start[MAXEDGE];
+	int end[MAXEDGE];
+	int top[MAXSIZE];	/* the node a leaf stands for once contracted, or -1 */
+};
+
+/* set once some branch of the search finds the input to be a soft cluster */
+int cluster_found = 0;
+struct witness witness;
+char *cache_dir = NULL;	/* where the answers to queries are cached, if set */
+int first_ret = 0;	/* the labels of the reticulations, see Renumber_Nodes */
+int first_tree = 0;
+
 int tnode_comparator(const void *v1, const void *v2)
 {
     const struct temp_node *p1 = (struct temp_node *)v1;
@@ -94,6 +173,17 @@ int tnode_comparator(const void *v1, const void *v2)
         return 0;
 }
 
+/* count the number of 1 in the binary representation of x. */
+int pop(unsigned int x) {
+	int n;
+	n = 0;
+	while (x != 0) {
+		n = n + 1;
+		x = x & (x - 1);
+	}
+	return n;
+}
+
 struct lnode *ListExtend(struct lnode *list, int lf) {
 	struct lnode *p, *q;
 	p = (struct lnode*) malloc(sizeof(struct lnode));
@@ -110,26 +200,6 @@ struct lnode *ListExtend(struct lnode *list, int lf) {
 	return list;
 }
 
-struct arb_tnode *Search_Revised(struct arb_tnode *tree, int node) {
-	struct arb_tnode *p;
-	int i, deg;
-
-	if (tree != NULL) {
-		if (tree->label == node)
-			return tree;
-		else {
-			deg = tree->no_children;
-			p = NULL;
-			for (i = 0; i < deg; i++) {
-				p = Search_Revised((tree->child)[i], node);
-				if (p != NULL)
-					return p;
-			}
-		}
-	}
-	return NULL;
-}
-
 // Find whether an element is in an array
 int Is_In(int elt, int Ambig[], int n) {
 	int i;
@@ -140,6 +210,13 @@ int Is_In(int elt, int Ambig[], int n) {
 	return -1;
 }
 
+/* same as Is_In for the input leaves, kept as a bitset */
+int Is_In_B(int leaf, unsigned int in_cluster[]) {
+	if (leaf >= 0 && BITTEST(in_cluster, leaf))
+		return 1;
+	return -1;
+}
+
 int Is_In_Str(char* node, char* leaves[], int n) {
 	int i;
 
@@ -149,70 +226,6 @@ int Is_In_Str(char* node, char* leaves[], int n) {
 	return 0;
 }
 
-/* mark forbidden nodes in the multi-labelled tree */
-void Mark_Revised(struct arb_tnode *tree, int leaf, int *no_mark) {
-	int i, deg, x, y;
-
-	if (tree == NULL)
-		return;
-	else {
-		deg = tree->no_children;
-		if (deg == 0 && tree->label == leaf) {
-			tree->flag = 1;
-			*no_mark += 1;
-			return;
-		}
-		x = 0;
-		y = -1;
-		for (i = 0; i < deg; i++) {
-			if (Search_Revised((tree->child)[i], leaf) != NULL) {
-				x = x + 1;
-				y = i;
-			}
-		}
-		if (x == 1) {
-			tree->flag = 1;
-			*no_mark += 1;
-			Mark_Revised((tree->child)[y], leaf, no_mark);
-		} else if (x > 1) {
-			tree->flag = 1;
-			*no_mark += 1;
-			return;
-		} else
-			return;
-	}
-}
-
-void Find_Vmax(struct arb_tnode *tree, int vmax[], int *no_vmax) {
-	int i, k, y, deg;
-
-	if (tree == NULL)
-		return;
-	else {
-		if (tree->flag == 1) {
-			deg = tree->no_children;
-			for (i = 0; i < deg; i++) {
-				if ((tree->child)[i]->flag == 0) {
-					y = 0;
-					for (k = 0; k < *no_vmax; k++) {
-						if (vmax[k] == (tree->child)[i]->label) {
-							y = -1;
-							break;
-						}
-					}
-					if (y == 0) {
-						vmax[*no_vmax] = (tree->child)[i]->label;
-						*no_vmax = 1 + *no_vmax;
-					}
-				} else {
-					Find_Vmax((tree->child)[i], vmax, no_vmax);
-				}
-			}
-		}
-	}
-	return;
-}
-
 int Count_Child(struct lnode *p) {
 	if (p == NULL)
 		return 0;
@@ -306,40 +319,55 @@ void Print_Comp_Revised(struct arb_tnode *tree, char *node_strings[]) {
 	}
 }
 
-int Is_In_Comp(struct arb_tnode *tree, int node) {
+/* collect the reticulations at the leaves of a component tree, return how many were found */
+int Comp_Rets(struct arb_tnode *tree, int node_type[], int rets[]) {
 	int i, k;
 
-	k = 0;
-	if (tree != NULL) {
-		if (tree->no_children == 0) {
-			if (node == tree->label)
-				k = 1;
-			else
-				k = 0;
-		} else {
-			for (i = 0; i < tree->no_children; i++) {
-				k = k + Is_In_Comp((tree->child)[i], node);
-			}
-		}
-	} else
-		k = 0;
-
-	if (k > 0)
-		return 1;
-	else
+	if (tree == NULL)
 		return 0;
+	if (tree->no_children == 0) {
+		if (node_type[tree->label] != RET)
+			return 0;
+		rets[0] = tree->label;
+		return 1;
+	}
+	k = 0;
+	for (i = 0; i < tree->no_children; i++)
+		k += Comp_Rets((tree->child)[i], node_type, rets + k);
+	return k;
 }
 
-void Initiallize(struct arb_tnode *tree) {
-	int i, deg;
+/*
+ * Build the trees of the components and count, for each reticulation, the components
+ * having it at a leaf (its super degree).
+ * The components do not depend on each other once the reticulations are known, so they
+ * are built on all cores; each lists its own reticulations, and the lists are summed up
+ * afterwards, a reticulation counting once per component however often it appears.
+ */
+void Build_Components(struct components *cps[], int no_comps,
+		struct lnode *child_array[], int node_type[], int no_nodes, int super_deg[]) {
+	int *rets[no_comps], no_rets[no_comps], last[no_nodes];
+	int i, j;
 
-	if (tree != NULL) {
-		tree->flag = 0;
-		deg = tree->no_children;
-		for (i = 0; i < deg; i++)
-			Initiallize((tree->child)[i]);
-	} else
-		return;
+	#pragma omp parallel for schedule(dynamic)
+	for (j = 0; j < no_comps; j++) {
+		Build_Comp_Revised(cps[j]->tree_com, child_array, node_type, no_nodes,
+				&cps[j]->size, &cps[j]->no_tree_node);
+		rets[j] = (int *) malloc((cps[j]->size + 1) * sizeof(int));
+		no_rets[j] = Comp_Rets(cps[j]->tree_com, node_type, rets[j]);
+	}
+
+	for (i = 0; i < no_nodes; i++)
+		last[i] = -1;
+	for (j = 0; j < no_comps; j++) {
+		for (i = 0; i < no_rets[j]; i++) {
+			if (last[rets[j][i]] != j) {
+				super_deg[rets[j][i]] += 1;
+				last[rets[j][i]] = j;
+			}
+		}
+		free(rets[j]);
+	}
 }
 
 // Find the size of the tree component
@@ -365,41 +393,117 @@ void PrintList_Revised(struct arb_tnode *PostList[], char *names[], int no) {
 	printf("\n");
 }
 
-int Check_List(int list_a[], int no, int b) {
-	int i;
-	for (i = 0; i < no; i++) {
-		if (list_a[i] == b)
-			return i;
+/*
+ * Check whether the input leaves are the cluster of some node of a stable component,
+ * once its reticulations are replaced by leaves (a reticulation may leave several copies).
+ * A node is forbidden if all copies of a stable leaf not in B are below it, since
+ * that leaf cannot be moved away from it. Return the highest node that is not
+ * forbidden and has all the input leaves below it, or -1.
+ * This is one pass over the component with per-node counts of the input leaves,
+ * so subtrees with no input leaves or no forbidden leaf are not searched again.
+ */
+int Find_Cluster_Node(struct arb_tnode *tree, int no, int sleaves[], int no_slf,
+		int ambig[], int no_ambig, unsigned int in_cluster[], int no1, int n_l) {
+	int nslots = BITNSLOTS(n_l);
+	struct arb_tnode *pre[no], *x;
+	int parent[no], depth[no], forb[no], stack[no], first[n_l], last[n_l];
+	unsigned int in_b[no][nslots];
+	int i, j, k, n, top, u, v, leaf, count;
+
+	for (i = 0; i < n_l; i++)
+		first[i] = -1;
+
+	/* list the nodes in pre-order */
+	n = 0;
+	top = 0;
+	pre[n] = tree;
+	parent[n] = -1;
+	depth[n] = 0;
+	stack[top++] = n++;
+	while (top > 0) {
+		u = stack[--top];
+		x = pre[u];
+		forb[u] = 0;
+		for (j = 0; j < nslots; j++)
+			in_b[u][j] = 0;
+		if (x->no_children == 0 && x->label >= 0 && x->label < n_l) {
+			leaf = x->label;
+			if (first[leaf] == -1)
+				first[leaf] = u;
+			last[leaf] = u;
+			if (BITTEST(in_cluster, leaf))
+				BITSET(in_b[u], leaf);
+		}
+		for (i = x->no_children - 1; i >= 0; i--) {
+			pre[n] = (x->child)[i];
+			parent[n] = u;
+			depth[n] = depth[u] + 1;
+			stack[top++] = n++;
+		}
+	}
+
+	/* forbid the ancestors of the lowest common ancestor of the copies of each leaf not in B */
+	for (k = 0; k < no_slf + no_ambig; k++) {
+		leaf = (k < no_slf) ? sleaves[k] : ambig[k - no_slf];
+		if (BITTEST(in_cluster, leaf) || first[leaf] == -1)
+			continue;
+		u = first[leaf];
+		v = last[leaf];
+		while (depth[u] > depth[v])
+			u = parent[u];
+		while (depth[v] > depth[u])
+			v = parent[v];
+		while (u != v) {
+			u = parent[u];
+			v = parent[v];
+		}
+		forb[u] = 1;
+	}
+
+	/* children come after their parent in pre-order */
+	for (u = n - 1; u > 0; u--) {
+		if (forb[u] == 1)
+			forb[parent[u]] = 1;
+		for (j = 0; j < nslots; j++)
+			in_b[parent[u]][j] |= in_b[u][j];
+	}
+
+	for (u = 0; u < n; u++) {
+		if (forb[u] == 1)
+			continue;
+		count = 0;
+		for (j = 0; j < nslots; j++)
+			count += pop(in_b[u][j]);
+		if (count == no1)
+			return pre[u]->label;
 	}
 	return -1;
 }
 
 /*
- check whether the set of input leaves is a cluster of some node a tree component
+ * Read the next word of a file, which may be gzip-compressed: it is decompressed as it
+ * is read. *str is grown to hold the word, *size being its size, so that long node
+ * names are kept whole. Return 0 at the end of the file.
  */
-int DProgram_Revised(char *node_strings[], struct arb_tnode *super_t,
-		int n_embed, int map_nodes[][MAXSIZE], int vmax[], int no_vmax,
-		int input_leaves[], int node_type[]) {
-	int i, j, k, x;
-	struct arb_tnode *p;
-	/* each node in the cluster corresponds to a column */
-	/* each node in V_max corresponds to a row */
-	for (j = 0; j < no_vmax; j++) {
-		k = 0;
-		p = Search_Revised(super_t, vmax[j]);
-		for (i = 0; i < n_embed; i++) {
-			x = Is_Below(p, input_leaves[i], node_type);
-			if (x == 1) {
-				map_nodes[j][i] = 1;
-				k += 1;
-			}
-		}
-		/* B is a cluster of some node if there is one row of 1 */
-		if (k == n_embed) {
-			return vmax[j];
-		}
+int Read_Word(gzFile in, char **str, int *size) {
+	int c, n;
+
+	do
+		c = gzgetc(in);
+	while (c != -1 && isspace(c));
+	n = 0;
+	while (1) {
+		if (n + 1 >= *size) {
+			*size = *size > 0 ? 2 * *size : 32;
+			*str = (char *) realloc(*str, *size);
+		}
+		if (c == -1 || isspace(c))
+			break;
+		(*str)[n++] = c;
+		c = gzgetc(in);
 	}
-	return -1;
+	(*str)[n] = '\0';
+	return n > 0;
 }
 
 int Check_Name(char *node_strings[], int no_nodes, char *str1) {
@@ -509,28 +613,6 @@ int Is_Below_revised(int ret_x, int y, struct lnode *parent_array[],
 		return -1;
 }
 
-/* if a leaf y is below a node p */
-int Is_Below(struct arb_tnode *p, int y, int node_type[]) {
-	int i, x;
-
-	x = p->label;
-	if (node_type[x] == LEAVE) {
-		if (x == y) {
-			return 1;
-		} else {
-			return 0;
-		}
-	}
-
-	for (i = 0; i < p->no_children; i++) {
-		if (Is_Below((p->child)[i], y, node_type) == 1) {
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
 /* Determine if all the parents of node is in a component */
 int Is_Inner_Revised(int node, struct lnode *parent_array[], int node_type[],
 		int no_nodes) {
@@ -613,49 +695,87 @@ void Sort_Rets_Revised(int r_nodes[], int n_r, struct lnode *child_array[],
 }
 
 
-int Is_Tree_Component(int rnode, int node_type[], struct lnode *child_array[]){
-	struct lnode *p;
-	p = child_array[rnode];
-	int res=0;
-	while (p != NULL) {
-		if (node_type[p->leaf] == LEAVE){
-		}
-		else if (node_type[p->leaf] == RET){ // There is a reticulate node below current reticulate node
-			return 1;
+/*
+ * A node is visible if some leaf can only be reached from the root through it, that is,
+ * if it dominates a leaf. Compute the immediate dominators in topological order, the
+ * dominator of a node with several parents being the lowest common dominator of its
+ * parents, then mark the nodes with a leaf below them in the dominator tree.
+ */
+void Visible_Nodes(int no_nodes, int root, struct lnode *child_array[],
+		struct lnode *parent_array[], int node_type[], int visible[]) {
+	int order[no_nodes], indeg[no_nodes], idom[no_nodes], depth[no_nodes];
+	int i, u, v, head, tail;
+	struct lnode *q;
+
+	for (i = 0; i < no_nodes; i++) {
+		indeg[i] = 0;
+		for (q = parent_array[i]; q != NULL; q = q->next)
+			indeg[i] += 1;
+		visible[i] = 0;
+	}
+	head = 0;
+	tail = 0;
+	order[tail++] = root;
+	idom[root] = root;
+	depth[root] = 0;
+	while (head < tail) {
+		u = order[head++];
+		if (u != root) {
+			q = parent_array[u];
+			v = q->leaf;
+			for (q = q->next; q != NULL; q = q->next) {
+				i = q->leaf;
+				while (v != i) {
+					if (depth[v] > depth[i])
+						v = idom[v];
+					else
+						i = idom[i];
+				}
+			}
+			idom[u] = v;
+			depth[u] = depth[v] + 1;
 		}
-		else // if(node_type[p->leaf] == TREE)
-		{
-			res= Is_Tree_Component(p->leaf, node_type, child_array);
-			if (res==1) return 1;
+		for (q = child_array[u]; q != NULL; q = q->next) {
+			indeg[q->leaf] -= 1;
+			if (indeg[q->leaf] == 0)
+				order[tail++] = q->leaf;
 		}
-		p = p->next;
 	}
-		return res;
+
+	for (i = tail - 1; i >= 0; i--) {
+		u = order[i];
+		if (node_type[u] == LEAVE)
+			visible[u] = 1;
+		if (visible[u] == 1)
+			visible[idom[u]] = 1;
+	}
 }
 
+/*
+ * The root of the tree component of each node: the node itself for a reticulation or
+ * the root, else the reticulation or the root found going up through tree nodes.
+ * Each node is walked over once, the nodes on the way up taking the root found.
+ */
+void Component_Roots(int no_nodes, struct lnode *parent_array[], int node_type[],
+		int comp_root[]) {
+	int path[no_nodes];
+	int i, k, v;
 
-void Count_Ret_Child(int rnode, int *count, int *flag, int *size, int n_r, int orig_rnodes[], int node_type[], struct lnode *child_array[]){
-	struct lnode *p;
-	p = child_array[rnode];
-	while (p != NULL) {
-		if (node_type[p->leaf] == LEAVE){
-			*size +=1;
-		}
-		else if (node_type[p->leaf] == RET){
-			*count += 1;
-			if (Is_In(p->leaf, orig_rnodes, n_r)==-1)
-			{
-				*flag+=1;
-			}
-		}
-		else // if(node_type[p->leaf] == TREE)
-		{
-			*size +=1;
-			Count_Ret_Child(p->leaf, count, flag, size, n_r, orig_rnodes, node_type, child_array);
+	for (i = 0; i < no_nodes; i++)
+		comp_root[i] = -1;
+	for (i = 0; i < no_nodes; i++) {
+		k = 0;
+		v = i;
+		while (comp_root[v] == -1 && node_type[v] != RET && node_type[v] != ROOT
+				&& parent_array[v] != NULL) {
+			path[k++] = v;
+			v = parent_array[v]->leaf;
 		}
-		p = p->next;
+		if (comp_root[v] == -1)
+			comp_root[v] = v;
+		while (k > 0)
+			comp_root[path[--k]] = comp_root[v];
 	}
-		return;
 }
 
 int Is_Empty(int n_r, int r_nodes[]){
@@ -674,6 +794,34 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 	int k = 0;
 	int size = 0;
 	struct lnode *p;
+	int comp_root[no_nodes], no_ret_child[no_nodes], comp_size[no_nodes], pending[no_nodes];
+	struct lnode *ret_child[no_nodes];
+
+	/*
+	 * Find once, for each tree component, its reticulate children and the number of its
+	 * other nodes, instead of walking the component again at every level.
+	 */
+	Component_Roots(no_nodes, parent_array, node_type, comp_root);
+	for (i = 0; i < no_nodes; i++) {
+		no_ret_child[i] = 0;
+		comp_size[i] = 0;
+		ret_child[i] = NULL;
+		pending[i] = 0;
+	}
+	for (i = 0; i < no_nodes; i++) {
+		if (node_type[i] != RET && node_type[i] != TREE)
+			continue;
+		for (p = child_array[i]; p != NULL; p = p->next) {
+			if (node_type[p->leaf] == RET) {
+				no_ret_child[comp_root[i]] += 1;
+				ret_child[comp_root[i]] = ListExtend(ret_child[comp_root[i]], p->leaf);
+			} else
+				comp_size[comp_root[i]] += 1;
+		}
+	}
+	for (i = 0; i < n_r; i++)
+		if (orig_rnodes[i] != -2)
+			pending[orig_rnodes[i]] = 1;
 
 	// Move reticulate nodes just above a single leaf to front
 	j = 0;
@@ -691,6 +839,7 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		}
 		if (flag == 0) {
 			r_nodes[j] = orig_rnodes[i];
+			pending[orig_rnodes[i]] = 0;
 			orig_rnodes[i] = -2;	// not consider this node later
 			j = j + 1;
 		}
@@ -699,9 +848,9 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 	// Moving reticulate nodes with only tree nodes
 	for (i = 0; i < n_r; i++) {
 		if (orig_rnodes[i]==-2) continue;
-		flag =  Is_Tree_Component(orig_rnodes[i], node_type, child_array);
-		if (flag == 0) {
+		if (no_ret_child[orig_rnodes[i]] == 0) {
 			r_nodes[j] = orig_rnodes[i];
+			pending[orig_rnodes[i]] = 0;
 			orig_rnodes[i] = -2;
 			j = j + 1;
 		}
@@ -713,10 +862,12 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		k=0;	// store the real size of the array
 		for (i = 0; i < n_r; i++) {
 			if (orig_rnodes[i]==-2) continue;
-			count = 0;	// Count the number of reticulate children
+			count = no_ret_child[orig_rnodes[i]];	// Count the number of reticulate children
 			flag = 0;	// Count the number of reticulate children which have been resolved
-			size = 0;
-			Count_Ret_Child(orig_rnodes[i], &count, &flag, &size, n_r, orig_rnodes, node_type, child_array);
+			for (p = ret_child[orig_rnodes[i]]; p != NULL; p = p->next)
+				if (pending[p->leaf] == 0)
+					flag += 1;
+			size = comp_size[orig_rnodes[i]];
 			if (flag > 0 && flag == count) {
 				struct temp_node tnode;
 				tnode.index = i;
@@ -728,9 +879,18 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		qsort(level_ret, k, sizeof(struct temp_node), tnode_comparator);
 		for (i = 0; i < k; i++){
 			r_nodes[j++] = level_ret[i].pnode;
+			pending[level_ret[i].pnode] = 0;
 			orig_rnodes[level_ret[i].index] = -2;	//update later to avoid handling reticulate nodes at a higher level
 		}
 	}
+
+	for (i = 0; i < no_nodes; i++) {
+		while (ret_child[i] != NULL) {
+			p = ret_child[i];
+			ret_child[i] = p->next;
+			free(p);
+		}
+	}
 }
 
 
@@ -739,7 +899,7 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
  * leaf_set: stable leaves, no_lf: no. of stable leaves
  */
 void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
-		int node_type[], int leaf_below[], int leaf_set[], int *no_lf,
+		int leaf_below[], int leaf_set[], int *no_lf,
 		int ambig[], int *no_ambig, int optional[], int *no_opt,
 		char *node_strings[], int *rpl_comp, int super_deg[]) {
 	int i, k, j, x, y;
@@ -748,7 +908,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 		return;
 	if (tree != NULL) {
 		if (tree->no_children == 0) {
-			if (node_type[tree->label] == LEAVE) {
+			if (IS_LEAF(tree->label)) {
 				i = *no_lf;
 				y = 0;
 
@@ -762,7 +922,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 					leaf_set[*no_lf] = tree->label;
 					*no_lf = 1 + *no_lf;
 				}
-			} else if (node_type[tree->label] == RET) {
+			} else if (IS_RET(tree->label)) {
 				if(leaf_below[tree->label] == -2) return;
 				if (inner_flag[tree->label] == INNER) {
 					x = tree->label;
@@ -852,7 +1012,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 			/* non leaf */
 		} else {
 			for (i = 0; i < tree->no_children; i++) {
-				Replace_Ret_Revised((tree->child)[i], inner_flag, node_type,
+				Replace_Ret_Revised((tree->child)[i], inner_flag,
 						leaf_below, leaf_set, no_lf, ambig, no_ambig, optional,
 						no_opt, node_strings, rpl_comp, super_deg);
 			}
@@ -864,8 +1024,8 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 
 void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 		int start1[], int end1[], int no_edges1) {
-	int count, count1, i, j, x, y, k;
-	char str1[50];
+	int count, count1, i, j, x, y;
+	char *name;
 
 	count = 0;
 	for (i = 0; i < no1; i++) {
@@ -873,15 +1033,9 @@ void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 			count1 = node_type1[count];
 			node_type1[count] = LEAVE;
 			node_type1[i] = count1;
-			strcpy(str1, leave_names[count]);
-			k = strlen(leave_names[i]);
-			free(leave_names[count]);
-			leave_names[count] = (char *) malloc(k + 1);
-			strcpy(leave_names[count], leave_names[i]);
-			k = strlen(str1);
-			free(leave_names[i]);
-			leave_names[i] = (char *) malloc(k + 1);
-			strcpy(leave_names[i], str1);
+			name = leave_names[count];
+			leave_names[count] = leave_names[i];
+			leave_names[i] = name;
 			x = -1;
 			y = -1;
 			for (j = 0; j < no_edges1; j++) {
@@ -915,22 +1069,18 @@ void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 /* if any leaf is not in the network, report -1 */
 int Move_Leaves_Front(char *ntk_names[], int no, int start[], int end[],
 		int no_edges, char *leave_names[], int n_l) {
-	char str1[20];
+	char *name;
 	int i, j, k, count;
 
 	for (i = 0; i < n_l; i++) {
 		count = 0;
 		for (j = 0; j < no; j++) {
 			if (strcmp(leave_names[i], ntk_names[j]) == 0) {
-				strcpy(str1, ntk_names[i]);
-				free(ntk_names[i]);
-				k = strlen(ntk_names[j]);
-				ntk_names[i] = (char *) malloc(k + 1);
-				strcpy(ntk_names[i], ntk_names[j]);
-				free(ntk_names[j]);
-				k = strlen(str1);
-				ntk_names[j] = (char *) malloc(k + 1);
-				strcpy(ntk_names[j], str1);
+				if (j == i)	// already in front
+					break;
+				name = ntk_names[i];
+				ntk_names[i] = ntk_names[j];
+				ntk_names[j] = name;
 
 				for (k = 0; k < no_edges; k++) {
 					if (start[k] == i) {
@@ -972,6 +1122,82 @@ int Move_Leaves_Front(char *ntk_names[], int no, int start[], int end[],
 	return 0;
 }
 
+/*
+ * Renumber the nodes so that the per-node arrays are read in order during a traversal:
+ * the leaves keep their labels at the front, the reticulations follow in the order
+ * they are reached, then the tree nodes of each component in post-order.
+ * The search then tells a leaf or a reticulation from its label, see IS_LEAF and IS_RET.
+ */
+void Renumber_Nodes(char *ntk_names[], int no, int start[], int end[],
+		int no_edges, int n_l) {
+	int indeg[no], first[no], pos[no], label[no], stack[no], comp[no];
+	int next[no_edges];
+	char *names[no];
+	int i, j, k, u, v, top, no_comp, n_ret, n_tree;
+
+	for (i = 0; i < no; i++) {
+		indeg[i] = 0;
+		first[i] = -1;
+		label[i] = -1;
+	}
+	for (k = no_edges - 1; k >= 0; k--) {
+		next[k] = first[start[k]];
+		first[start[k]] = k;
+		indeg[end[k]] += 1;
+	}
+	n_tree = n_l;
+	no_comp = 0;
+	for (i = 0; i < no; i++) {
+		if (i < n_l)
+			label[i] = i;
+		else if (indeg[i] > 1)
+			n_tree += 1;
+		else if (indeg[i] == 0)
+			comp[no_comp++] = i;
+	}
+
+	/* each component is rooted at the root or at a reticulation */
+	n_ret = n_l;
+	for (j = 0; j < no_comp; j++) {
+		top = 0;
+		stack[top++] = comp[j];
+		pos[comp[j]] = first[comp[j]];
+		while (top > 0) {
+			u = stack[top - 1];
+			k = pos[u];
+			if (k == -1) {
+				top -= 1;
+				if (label[u] == -1)
+					label[u] = n_tree++;
+				continue;
+			}
+			pos[u] = next[k];
+			v = end[k];
+			if (label[v] != -1)
+				continue;
+			if (indeg[v] > 1) {
+				label[v] = n_ret++;
+				comp[no_comp++] = v;
+			} else {
+				stack[top++] = v;
+				pos[v] = first[v];
+			}
+		}
+	}
+	for (i = 0; i < no; i++) {
+		if (label[i] == -1)
+			label[i] = n_tree++;
+		names[label[i]] = ntk_names[i];
+	}
+	for (i = 0; i < no; i++)
+		ntk_names[i] = names[i];
+	for (k = 0; k < no_edges; k++) {
+		start[k] = label[start[k]];
+		end[k] = label[end[k]];
+	}
+}
+
+
 void Child_Parent_Inform(struct lnode *child_array[],
 		struct lnode *parent_array[], int no_nodes, int start[], int end[],
 		int no_edges) {
@@ -1027,7 +1253,7 @@ int Node_Type_Inform(int node_type[], int r_nodes[], int no_nodes, int start[],
 			node_type[i] = RET;
 			n_r = n_r + 1;
 		}
-		if (in > 1 && out > 1) {
+		if (in > 1 && out != 1) {
 			check_node = check_node + 1;
 		}
 	}
@@ -1067,7 +1293,7 @@ int Node_Type_Inform1(int node_type[], int no_nodes, int start[], int end[],
 		if (in > 1 && out == 1) {
 			node_type[i] = RET;
 		}
-		if (in > 1 && out > 1) {
+		if (in > 1 && out != 1) {
 			check_node = check_node + 1;
 		}
 	}
@@ -1078,26 +1304,25 @@ int Node_Type_Inform1(int node_type[], int no_nodes, int start[], int end[],
 }
 
 /* The component is stable if it contains a leaf or a reticulation node below it is 'INNER' */
-int Is_Stable(struct arb_tnode *comp_ptr, int node_type[], int inner_flag[],
+int Is_Stable(struct arb_tnode *comp_ptr, int inner_flag[],
 		int lf_below[]) {
 	int i, deg;
 
 	if (comp_ptr == NULL)
 		return -1;
 	else {
-		if (node_type[comp_ptr->label] == LEAVE)
+		if (IS_LEAF(comp_ptr->label))
 			return 1;
-		else if (node_type[comp_ptr->label] == RET) {
+		else if (IS_RET(comp_ptr->label)) {
 			if (inner_flag[comp_ptr->label] == INNER
 					&& lf_below[comp_ptr->label] >= 0)
 				return 1;
 			else
 				return 0;
-		} else if (node_type[comp_ptr->label] == TREE
-				|| node_type[comp_ptr->label] == ROOT) {
+		} else {
 			deg = comp_ptr->no_children;
 			for (i = 0; i < deg; i++) {
-				if (Is_Stable((comp_ptr->child)[i], node_type, inner_flag,
+				if (Is_Stable((comp_ptr->child)[i], inner_flag,
 						lf_below) == 1)
 					return 1;
 			}
@@ -1107,22 +1332,22 @@ int Is_Stable(struct arb_tnode *comp_ptr, int node_type[], int inner_flag[],
 }
 
 /* lf_below_comp: the leaves below the component (to simply the component) */
-void Find_UnStable(struct arb_tnode *comp_ptr, int input_leaves[], int no_leaf,
+void Find_UnStable(struct arb_tnode *comp_ptr, unsigned int in_cluster[],
 		int unstb_rets_in[], int *no_rets_in, int unstb_rets_out[],
-		int *no_rets_out, int node_type[], int inner_flag[], int lf_below[], int lf_in_comp[], int *no_in_lfb, int lf_out_comp[], int *no_out_lfb) {
+		int *no_rets_out, int inner_flag[], int lf_below[], int lf_in_comp[], int *no_in_lfb, int lf_out_comp[], int *no_out_lfb) {
 	int i, deg;
 
 	if (comp_ptr == NULL)
 		return;
 	else {
-		if (node_type[comp_ptr->label] == LEAVE){ // should not occur, since the component is invisible
+		if (IS_LEAF(comp_ptr->label)){ // should not occur, since the component is invisible
 			return;
 		}
-		else if (node_type[comp_ptr->label] == RET) {
+		else if (IS_RET(comp_ptr->label)) {
 			if (inner_flag[comp_ptr->label] == CROSS) {
 				int leaf = lf_below[comp_ptr->label];
 				if (leaf == -2) return;
-				if (Is_In(leaf, input_leaves, no_leaf) == 1) {
+				if (BITTEST(in_cluster, leaf)) {
 					unstb_rets_in[*no_rets_in] = comp_ptr->label;
 					*no_rets_in = *no_rets_in + 1;
 					lf_in_comp[*no_in_lfb] = leaf;
@@ -1134,13 +1359,12 @@ void Find_UnStable(struct arb_tnode *comp_ptr, int input_leaves[], int no_leaf,
 					*no_out_lfb = *no_out_lfb + 1;
 				}
 			}
-		} else if (node_type[comp_ptr->label] == TREE
-				|| node_type[comp_ptr->label] == ROOT) {
+		} else {
 			deg = comp_ptr->no_children;
 			for (i = 0; i < deg; i++) {
-				Find_UnStable((comp_ptr->child)[i], input_leaves, no_leaf,
+				Find_UnStable((comp_ptr->child)[i], in_cluster,
 						unstb_rets_in, no_rets_in, unstb_rets_out, no_rets_out,
-						node_type, inner_flag, lf_below, lf_in_comp, no_in_lfb, lf_out_comp, no_out_lfb);
+						inner_flag, lf_below, lf_in_comp, no_in_lfb, lf_out_comp, no_out_lfb);
 			}
 		}
 		return;
@@ -1192,6 +1416,7 @@ void *Make_Current_Network(struct components *p, int no_comp,
 		network[i].inner = ptr->inner;
 		network[i].size = ptr->size;
 		network[i].no_tree_node = ptr->no_tree_node;
+		network[i].visible = ptr->visible;
 		//printf("copy trees\n");
 		if (ptr->size == 0){
 			network[i].tree_com = NULL;
@@ -1239,6 +1464,102 @@ void Destroy_Network(struct components *cmp) {
 	}
 }
 
+/* count the nodes below a node */
+int Count_Below(struct arb_tnode *tree) {
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < tree->no_children; i++)
+		n += 1 + Count_Below(tree->child[i]);
+	return n;
+}
+
+/* contract the subtree below a node into its first leaf, see Contract_Tree */
+void Contract_Leaf(struct arb_tnode *tree, int top[], int *size) {
+	struct arb_tnode *x;
+	int i;
+
+	for (x = tree; x->no_children > 0; x = x->child[0])
+		;
+	*size -= Count_Below(tree);
+	top[x->label] = tree->label;
+	tree->label = x->label;
+	for (i = 0; i < tree->no_children; i++)
+		Destroy_Arbtree(tree->child[i]);
+	tree->no_children = 0;
+}
+
+/*
+ * Within a query, a subtree with no reticulation below it whose leaves are all
+ * in B or all outside B is a single leaf: it stays whole in every displayed tree.
+ * Contract every such subtree below a node of a component into its first leaf,
+ * which top[] maps back to the root of the subtree.
+ * The other leaves keep their bits in B, as the search still reads them in the
+ * network, but no longer count in *no1. Return the number of leaves below the
+ * node, with those in B in *no_in, or -1 if a reticulation is below it, as the
+ * caller contracts the highest nodes.
+ */
+int Contract_Tree(struct arb_tnode *tree, unsigned int in_cluster[], int top[], int *no_in,
+		int *no1, int *size) {
+	int no_lf[MAXDEGREE], in[MAXDEGREE];
+	int i, n;
+
+	*no_in = 0;
+	if (tree->no_children == 0) {
+		if (!IS_LEAF(tree->label))
+			return -1;
+		if (BITTEST(in_cluster, tree->label))
+			*no_in = 1;
+		return 1;
+	}
+	n = 0;
+	for (i = 0; i < tree->no_children; i++) {
+		no_lf[i] = Contract_Tree(tree->child[i], in_cluster, top, &in[i], no1, size);
+		if (no_lf[i] == -1 || n == -1)
+			n = -1;
+		else
+			n += no_lf[i];
+		*no_in += in[i];
+	}
+	if (n != -1)
+		return n;
+	for (i = 0; i < tree->no_children; i++) {
+		if (no_lf[i] < 2 || (in[i] != 0 && in[i] != no_lf[i]))
+			continue;
+		Contract_Leaf(tree->child[i], top, size);
+		if (in[i] != 0)
+			*no1 -= no_lf[i] - 1;
+	}
+	return -1;
+}
+
+/*
+ * Contract the subtrees of all components for the query B, so that the search
+ * runs on a network whose size depends on how B cuts it rather than on the
+ * number of leaves. Return the number of leaves of B left.
+ */
+int Contract_Components(struct components *cps, unsigned int in_cluster[],
+		int top[], int n_l,
+		int no1) {
+	struct components *p;
+	int n, no_in;
+	int i;
+
+	for (i = 0; i < n_l; i++)
+		top[i] = -1;
+	for (p = cps; p != NULL; p = p->next) {
+		if (p->tree_com == NULL)
+			continue;
+		n = Contract_Tree(p->tree_com, in_cluster, top, &no_in, &no1, &p->size);
+		if (n < 2 || (no_in != 0 && no_in != n))
+			continue;
+		Contract_Leaf(p->tree_com, top, &p->size);
+		if (no_in != 0)
+			no1 -= n - 1;
+	}
+	return no1;
+}
+
 void Free_Lnodes(struct lnode* head) {
 	struct lnode* tmp;
 
@@ -1249,63 +1570,37 @@ void Free_Lnodes(struct lnode* head) {
 	}
 }
 
-void Modify1(struct arb_tnode *p, int node_type[], int unstb_ret,
+/*
+ * Remove the edges into unstb_ret from the component tree below p. The last child of a
+ * node is moved into the slot of a deleted one, so that no compaction loop is needed,
+ * and a node is only looked into if it has children.
+ */
+void Modify1(struct arb_tnode *p, int unstb_ret,
 		int *comp_size, int no_nodes, int net_edges[no_nodes][no_nodes]) {
-	struct arb_tnode *ptr;
-	int i, k, j, deg;
-	struct arb_tnode *tmp;
+	int i;
 
 	if (p == NULL)
 		return;
-
-	if (node_type[p->label] == LEAVE) {
-		return;
-	} else if (node_type[p->label] == RET) {
-		return;
-	} else if (node_type[p->label] == TREE || node_type[p->label] == ROOT) {
-		deg = p->no_children;
-		for (i = 0; i < deg; i++) {
-			ptr = (p->child)[i];
-			if (ptr->label == unstb_ret) {
-//				tmp = (p->child)[i];
-//				Destroy_Arbtree(tmp);
-				// printf("delete edge %d\t%d\n", p->label, ptr->label);
-				net_edges[p->label][ptr->label] = 0;
-				(p->child)[i] = NULL;
-				*comp_size = *comp_size - 1;
-			} else {
-				Modify1((p->child)[i], node_type, unstb_ret, comp_size, no_nodes, net_edges);
-			}
-		}
-
-		k = deg;
-		for (i = 0; i < deg; i++) {
-			if ((p->child)[i] == NULL)
-				k = k - 1;
-		}
-
-		p->no_children = k;
-
-		for (i = 0; i < deg; i++) {
-			if ((p->child)[i] == NULL) {
-				j = i + 1;
-				while ((p->child)[j] == NULL && j < deg)
-					j = j + 1;
-				(p->child)[i] = (p->child)[j];
-				(p->child)[j] = NULL;
-			}
-		}
+	for (i = p->no_children - 1; i >= 0; i--) {
+		if ((p->child)[i]->label == unstb_ret) {
+			net_edges[p->label][unstb_ret] = 0;
+			*comp_size = *comp_size - 1;
+			p->no_children -= 1;
+			(p->child)[i] = (p->child)[p->no_children];
+			(p->child)[p->no_children] = NULL;
+		} else if ((p->child)[i]->no_children > 0)
+			Modify1((p->child)[i], unstb_ret, comp_size, no_nodes, net_edges);
 	}
 }
 
-void Modify2(struct components *p, int node_type[], int x, int no_nodes, int net_edges[no_nodes][no_nodes]) {
+void Modify2(struct components *p, int x, int no_nodes, int net_edges[no_nodes][no_nodes]) {
 	struct components *p_copy;
 
 	if (p != NULL) {
 		p_copy = p;
 		while (p_copy != NULL) {
 			if (p_copy->tree_com != NULL)
-				Modify1(p_copy->tree_com, node_type, x, &p_copy->size, no_nodes, net_edges);
+				Modify1(p_copy->tree_com, x, &p_copy->size, no_nodes, net_edges);
 			p_copy = p_copy->next;
 		}
 	}
@@ -1315,7 +1610,7 @@ void Modify2(struct components *p, int node_type[], int x, int no_nodes, int net
  *	For network pointed by p, remove all parents of unstb_ret in other components. (The size of these other components reduce by 1)
  * For network pointed by p1, exclude current component from new network. (The size of current component reduce by 1)
  */
-void Modify(struct components *p, struct components *p1, int node_type[],
+void Modify(struct components *p, struct components *p1,
 		int unstb_ret, int no_nodes, int net_edges[no_nodes][no_nodes], int net_edges1[no_nodes][no_nodes]) {
 	struct components *ptr;
 	//struct arb_tnode *tmp;
@@ -1335,7 +1630,7 @@ void Modify(struct components *p, struct components *p1, int node_type[],
 				ptr->size = ptr->size - 1;
 			} else {
 				// search the ret node recursively in the tree comp
-				Modify1(ptr->tree_com, node_type, unstb_ret, &ptr->size, no_nodes, net_edges);
+				Modify1(ptr->tree_com, unstb_ret, &ptr->size, no_nodes, net_edges);
 			}
 		}
 		ptr = ptr->next;
@@ -1351,36 +1646,340 @@ void Modify(struct components *p, struct components *p1, int node_type[],
 		p1->tree_com = NULL;
 		p1->size = p1->size - 1;
 	} else {
-		Modify1(p1->tree_com, node_type, unstb_ret, &p1->size, no_nodes, net_edges1);
+		Modify1(p1->tree_com, unstb_ret, &p1->size, no_nodes, net_edges1);
 	}
 }
 
-void Print_tree11(struct arb_tnode *tree, int node_type[],
-		struct lnode *child_array[], char *node_strings[]) {
-	int deg, i;
-	struct lnode *tmp;
+/* collect the leaves below a node into its bitset */
+void Leaf_Set_Below(int node, struct lnode *child_array[], int node_type[],
+		unsigned int *lf_set[], int nslots, int visited[]) {
+	int i;
+	struct lnode *c;
 
-	if (tree != NULL) {
-		deg = tree->no_children;
-		for (i = 0; i < deg; i++) {
-			printf("%s %s\n", node_strings[tree->label],
-					node_strings[(tree->child[i])->label]);
-			Print_tree11(tree->child[i], node_type, child_array, node_strings);
-		}
-		if (deg == 0 && node_type[tree->label] == RET
-				&& child_array[tree->label] != NULL) {
-			printf("%s %s\n", node_strings[tree->label],
-					node_strings[child_array[tree->label]->leaf]);
-			tmp = child_array[tree->label];
-			free(tmp);
-			child_array[tree->label] = NULL;
-		}
-	} else
+	if (visited[node] == 1)
 		return;
+	visited[node] = 1;
+	if (node_type[node] == LEAVE) {
+		BITSET(lf_set[node], node);
+		return;
+	}
+	c = child_array[node];
+	while (c != NULL) {
+		Leaf_Set_Below(c->leaf, child_array, node_type, lf_set, nslots,
+				visited);
+		for (i = 0; i < nslots; i++)
+			lf_set[node][i] |= lf_set[c->leaf][i];
+		c = c->next;
+	}
+}
+
+/* the edge entering a tree node is a cut edge iff no node below it has a parent outside the subnetwork below it */
+int Is_Cut_Head(int node, struct lnode *child_array[],
+		struct lnode *parent_array[], int node_type[], int no_nodes) {
+	int below[no_nodes], stack[no_nodes];
+	int i, u, top;
+	struct lnode *q;
+
+	if (node_type[node] == ROOT || node_type[node] == LEAVE)
+		return 1;
+	if (node_type[node] == RET)
+		return 0;
+
+	for (i = 0; i < no_nodes; i++)
+		below[i] = 0;
+	below[node] = 1;
+	top = 0;
+	stack[top++] = node;
+	while (top > 0) {
+		u = stack[--top];
+		q = child_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0) {
+				below[q->leaf] = 1;
+				stack[top++] = q->leaf;
+			}
+			q = q->next;
+		}
+	}
+
+	for (u = 0; u < no_nodes; u++) {
+		if (below[u] == 0 || u == node)
+			continue;
+		q = parent_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0)
+				return 0;
+			q = q->next;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Collect the blob below cut head v, i.e. the nodes reached from v without
+ * passing another cut head. The cut heads met on the way become the leaves of
+ * the blob. blob_node maps the nodes of the blob to the nodes of the network.
+ */
+void Extract_Blob(int v, struct lnode *child_array[], int cut_head[],
+		int no_nodes, int blob_node[], int *no_blob_nodes, int start[],
+		int end[], int *no_edges) {
+	int local[no_nodes];
+	int i, u, n, head;
+	struct lnode *q;
+
+	for (i = 0; i < no_nodes; i++)
+		local[i] = -1;
+	local[v] = 0;
+	blob_node[0] = v;
+	n = 1;
+	head = 0;
+	*no_edges = 0;
+	while (head < n) {
+		u = blob_node[head++];
+		if (u != v && cut_head[u] == 1)
+			continue;
+		q = child_array[u];
+		while (q != NULL) {
+			if (local[q->leaf] == -1) {
+				local[q->leaf] = n;
+				blob_node[n++] = q->leaf;
+			}
+			start[*no_edges] = local[u];
+			end[*no_edges] = local[q->leaf];
+			*no_edges += 1;
+			q = q->next;
+		}
+	}
+	*no_blob_nodes = n;
+}
+
+/*
+ * Count the leaves of B and all the leaves below each node of the displayed tree
+ * in which ret keeps only its edge from p. Return a node whose cluster is B, or -1.
+ */
+int Galled_Count(int u, int p, int ret, struct lnode *child_array[],
+		unsigned int in_b[], int no1, int no_in[], int no_all[]) {
+	struct lnode *q;
+	int x, found;
+
+	found = -1;
+	no_in[u] = 0;
+	no_all[u] = 0;
+	if (child_array[u] == NULL) {
+		no_all[u] = 1;
+		if (BITTEST(in_b, u))
+			no_in[u] = 1;
+		return -1;
+	}
+	for (q = child_array[u]; q != NULL; q = q->next) {
+		x = q->leaf;
+		if (x == ret && u != p)
+			continue;
+		if (found == -1)
+			found = Galled_Count(x, p, ret, child_array, in_b, no1, no_in, no_all);
+		else
+			Galled_Count(x, p, ret, child_array, in_b, no1, no_in, no_all);
+		no_in[u] += no_in[x];
+		no_all[u] += no_all[x];
+	}
+	if (found == -1 && no_in[u] == no1 && no_all[u] == no1)
+		found = u;
+	return found;
+}
+
+/*
+ * CCP for a network with a single reticulation, such as a blob of a level-1 network (galled tree).
+ * Each parent of the reticulation gives one displayed tree, so B is a soft cluster iff
+ * it is the cluster of a node in one of them. B is a bitset over the nodes.
+ * Return 50 or 10 with the node in *node, the reticulation in *ret and the parent
+ * it keeps in *keep, or 0 if the network has more reticulations.
+ */
+int Galled_Containment(int no_nodes, int root, struct lnode *child_array[],
+		struct lnode *parent_array[], unsigned int in_b[], int no1, int *node,
+		int *ret, int *keep) {
+	int no_in[no_nodes], no_all[no_nodes];
+	int i, no_ret;
+	struct lnode *q;
+
+	*ret = -1;
+	no_ret = 0;
+	for (i = 0; i < no_nodes; i++) {
+		if (parent_array[i] != NULL && parent_array[i]->next != NULL) {
+			*ret = i;
+			no_ret += 1;
+		}
+	}
+	if (no_ret != 1)
+		return 0;
+
+	for (q = parent_array[*ret]; q != NULL; q = q->next) {
+		*node = Galled_Count(root, q->leaf, *ret, child_array, in_b, no1, no_in,
+				no_all);
+		if (*node != -1) {
+			*keep = q->leaf;
+			return 50;
+		}
+	}
+	return 10;
+}
+
+/*
+ * Keep as the witness the tree displayed by the network in which each reticulation
+ * keeps its edge from keep[], or from its first parent if keep[] is -1.
+ */
+void Displayed_Witness(int no_nodes, int node_type[], struct lnode *child_array[],
+		struct lnode *parent_array[], int keep[], struct witness *w) {
+	struct lnode *q;
+	int u, x;
+
+	w->no_edges = 0;
+	for (u = 0; u < no_nodes; u++) {
+		for (q = child_array[u]; q != NULL; q = q->next) {
+			x = q->leaf;
+			if (node_type[x] == RET && u != (keep[x] == -1 ?
+					parent_array[x]->leaf : keep[x]))
+				continue;
+			w->start[w->no_edges] = u;
+			w->end[w->no_edges] = x;
+			w->no_edges += 1;
+		}
+	}
+}
+
+/*
+ * Resolve the input leaves B with the blob decomposition of the network.
+ * Let v be the lowest cut head with B below v. B is a soft cluster iff
+ * B is all the leaves below v, or every other cut head has none or all of
+ * its leaves in B and B is a soft cluster of the blob below v, in which
+ * the cut heads are leaves.
+ * Only a blob with one reticulation is resolved on its own (Galled_Containment).
+ * The other blobs are left to CCP on the whole network, without building them:
+ * CCP run on a blob alone can miss a soft cluster (see test/pairs/blob_m2_1.txt).
+ * B is a bitset over the leaves, which are numbered first. Return 50 with the
+ * witness kept, 10, or 0 if CCP has to decide B.
+ */
+int Blob_Containment(int no_nodes, int root, int node_type[],
+		struct lnode *child_array[], struct lnode *parent_array[],
+		unsigned int in_cluster[], int no1, int n_l) {
+	int nslots = BITNSLOTS(n_l);
+	unsigned int *lf_set[no_nodes], in_blob[BITNSLOTS(no_nodes)], x;
+	int lf_count[no_nodes], cut_head[no_nodes], visited[no_nodes];
+	int blob_node[no_nodes], keep[no_nodes];
+	int start[MAXEDGE], end[MAXEDGE];
+	struct lnode *blob_child[no_nodes], *blob_parent[no_nodes], *q;
+	int i, j, v, in, full, res, no_in, no_blob_nodes, no_edges, ret, p;
+
+	memset(lf_count, 0, sizeof(lf_count));
+	for (i = 0; i < no_nodes; i++) {
+		lf_set[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited[i] = 0;
+		keep[i] = -1;
+	}
+	Leaf_Set_Below(root, child_array, node_type, lf_set, nslots, visited);
+	for (i = 0; i < no_nodes; i++) {
+		for (j = 0; j < nslots; j++)
+			lf_count[i] += pop(lf_set[i][j]);
+		cut_head[i] = Is_Cut_Head(i, child_array, parent_array, node_type,
+				no_nodes);
+	}
+
+	v = root;
+	for (i = 0; i < no_nodes; i++) {
+		if (cut_head[i] == 0 || node_type[i] == LEAVE
+				|| lf_count[i] >= lf_count[v])
+			continue;
+		for (j = 0; j < nslots; j++)
+			if ((in_cluster[j] & ~lf_set[i][j]) != 0)
+				break;
+		if (j == nslots)
+			v = i;
+	}
+	if (lf_count[v] == no1) {
+		res = 50;
+		goto found;
+	}
+
+	/* B must not cut the subnetwork below any other cut head */
+	res = 10;
+	for (i = 0; i < no_nodes; i++) {
+		if (cut_head[i] == 0 || node_type[i] == LEAVE
+				|| lf_count[i] >= lf_count[v])
+			continue;
+		in = 0;
+		full = 1;
+		for (j = 0; j < nslots; j++) {
+			x = in_cluster[j] & lf_set[i][j];
+			if (x != 0)
+				in = 1;
+			if (x != lf_set[i][j])
+				full = 0;
+		}
+		if (in == 1 && full == 0)
+			goto free_sets;
+	}
+
+	/* no blob below v if all its out-edges are cut edges */
+	q = child_array[v];
+	while (q != NULL && cut_head[q->leaf] == 1)
+		q = q->next;
+	if (q == NULL)
+		goto free_sets;
+
+	Extract_Blob(v, child_array, cut_head, no_nodes, blob_node, &no_blob_nodes,
+			start, end, &no_edges);
+	/* leave the blob to CCP before building it unless it has one reticulation */
+	res = 0;
+	for (i = 1; i < no_blob_nodes; i++)
+		if (node_type[blob_node[i]] == RET)
+			res += 1;
+	if (res != 1) {
+		res = 0;
+		goto free_sets;
+	}
+	for (j = 0; j < (int) BITNSLOTS(no_blob_nodes); j++)
+		in_blob[j] = 0;
+	no_in = 0;
+	for (i = 1; i < no_blob_nodes; i++) {
+		x = blob_node[i];
+		if (cut_head[x] == 0)
+			continue;
+		for (j = 0; j < nslots; j++)
+			if ((lf_set[x][j] & ~in_cluster[j]) != 0)
+				break;
+		if (j == nslots) {
+			BITSET(in_blob, i);
+			no_in += 1;
+		}
+	}
+	Child_Parent_Inform(blob_child, blob_parent, no_blob_nodes, start, end,
+			no_edges);
+	res = Galled_Containment(no_blob_nodes, 0, blob_child, blob_parent, in_blob,
+			no_in, &v, &ret, &p);
+	if (res == 50) {
+		keep[blob_node[ret]] = blob_node[p];
+		v = blob_node[v];
+	}
+	for (i = 0; i < no_blob_nodes; i++) {
+		Free_Lnodes(blob_child[i]);
+		Free_Lnodes(blob_parent[i]);
+	}
+
+found:
+	if (res == 50) {
+		witness.node = v;
+		witness.no_break = 0;
+		if (witness.mode != NO_WITNESS)
+			Displayed_Witness(no_nodes, node_type, child_array, parent_array,
+					keep, &witness);
+	}
+free_sets:
+	for (i = 0; i < no_nodes; i++)
+		free(lf_set[i]);
+	return res;
 }
 
 /* Replace the leaf by the reticulation node above it, since all the reticulation nodes have been replaced by leaves */
-void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
+void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp,
 		char *node_strings[]) {
 	int i, x, y;
 
@@ -1389,7 +1988,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 	if (tree != NULL) {
 		if (tree->no_children == 0) {
 			x = tree->label;
-			if (node_type[x] == LEAVE) {
+			if (IS_LEAF(x)) {
 				/* the leaf is used to replace ret node */
 				if (rpl_comp[x] != -1) {
 					/* y is the child of tree->label, parent of x */
@@ -1401,7 +2000,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 			/* non leaf */
 		} else {
 			for (i = 0; i < tree->no_children; i++) {
-				Rebuilt_Component((tree->child)[i], rpl_comp, node_type,
+				Rebuilt_Component((tree->child)[i], rpl_comp,
 						node_strings);
 			}
 			return;
@@ -1409,33 +2008,528 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 	} /* end non trivial case */
 }
 
-void Print_Final_Tree(struct components *out, int node_type[],
-		struct lnode *child_array[], char *node_strings[]) {
-	struct components *ptr1;
+/* add the edges of a component to the witness, without changing the network */
+/* keep the edges of the network below a node with no reticulation below it */
+void Collect_Subtree(int u, struct lnode *child_array[], struct witness *w) {
+	struct lnode *q;
+
+	for (q = child_array[u]; q != NULL; q = q->next) {
+		w->start[w->no_edges] = u;
+		w->end[w->no_edges] = q->leaf;
+		w->no_edges += 1;
+		Collect_Subtree(q->leaf, child_array, w);
+	}
+}
+
+void Collect_Tree(struct arb_tnode *tree, int node_type[],
+		struct lnode *child_array[], int done[], struct witness *w) {
+	int i, x;
+
+	if (tree == NULL)
+		return;
+	for (i = 0; i < tree->no_children; i++) {
+		x = (tree->child[i])->label;
+		w->start[w->no_edges] = tree->label;
+		w->end[w->no_edges] = (IS_LEAF(x) && w->top[x] != -1) ? w->top[x] : x;
+		w->no_edges += 1;
+		Collect_Tree(tree->child[i], node_type, child_array, done, w);
+	}
+	/* a contracted leaf stands for the subtree of the network below top, kept once
+	 * as the leaf may also stand in for a component */
+	if (tree->no_children == 0 && IS_LEAF(tree->label)
+			&& w->top[tree->label] != -1 && done[w->top[tree->label]] == 0) {
+		Collect_Subtree(w->top[tree->label], child_array, w);
+		done[w->top[tree->label]] = 1;
+	}
+	/* a reticulation may end several components, keep its edge once */
+	if (tree->no_children == 0 && node_type[tree->label] == RET
+			&& child_array[tree->label] != NULL && done[tree->label] == 0) {
+		w->start[w->no_edges] = tree->label;
+		w->end[w->no_edges] = child_array[tree->label]->leaf;
+		w->no_edges += 1;
+		done[tree->label] = 1;
+	}
+}
+
+void Collect_Witness(struct components *out, int node_type[],
+		struct lnode *child_array[], int no_nodes, struct witness *w) {
+	int done[no_nodes];
+	int i;
+
+	for (i = 0; i < no_nodes; i++)
+		done[i] = 0;
+	w->no_edges = 0;
+	while (out != NULL) {
+		Collect_Tree(out->tree_com, node_type, child_array, done, w);
+		out = out->next;
+	}
+}
+
+/* print the witness edges with a single write */
+void Write_Witness_Text(FILE *out, struct witness *w, char *node_strings[]) {
+	size_t len, size;
+	char *buf;
+	int i;
+
+	size = 1;
+	for (i = 0; i < w->no_edges; i++)
+		size += strlen(node_strings[w->start[i]])
+				+ strlen(node_strings[w->end[i]]) + 2;
+	buf = (char *) malloc(size);
+	len = 0;
+	for (i = 0; i < w->no_edges; i++) {
+		len += sprintf(buf + len, "%s %s\n", node_strings[w->start[i]],
+				node_strings[w->end[i]]);
+	}
+	fwrite(buf, 1, len, out);
+	free(buf);
+}
+
+void Write_Witness_Binary(FILE *out, struct witness *w, char *node_strings[],
+		int no_nodes) {
+	uint16_t x, edges[2 * w->no_edges];
+	int i;
+
+	x = no_nodes;
+	fwrite(&x, sizeof(uint16_t), 1, out);
+	for (i = 0; i < no_nodes; i++)
+		fwrite(node_strings[i], 1, strlen(node_strings[i]) + 1, out);
+	x = w->no_edges;
+	fwrite(&x, sizeof(uint16_t), 1, out);
+	for (i = 0; i < w->no_edges; i++) {
+		edges[2 * i] = w->start[i];
+		edges[2 * i + 1] = w->end[i];
+	}
+	fwrite(edges, sizeof(uint16_t), 2 * w->no_edges, out);
+}
+
+int str_comparator(const void *v1, const void *v2) {
+	return strcmp(*(char **) v1, *(char **) v2);
+}
+
+/* continue a 128-bit FNV-1a hash h over a string */
+unsigned __int128 Hash_String128(const char *s, unsigned __int128 h) {
+	const unsigned __int128 prime = ((unsigned __int128) 1 << 88) + 0x13B;
+
+	while (*s != '\0') {
+		h ^= (unsigned char) *s++;
+		h *= prime;
+	}
+	return h;
+}
+
+void Append_Text(struct text *t, const char *s) {
+	size_t n = strlen(s);
+
+	if (t->len + n + 1 > t->size) {
+		t->size = 2 * (t->len + n + 1);
+		t->buf = (char *) realloc(t->buf, t->size);
+	}
+	memcpy(t->buf + t->len, s, n + 1);
+	t->len += n;
+}
+
+int hash_comparator(const void *v1, const void *v2)
+{
+    const unsigned long long h1 = *(const unsigned long long *)v1;
+    const unsigned long long h2 = *(const unsigned long long *)v2;
+    if (h1 < h2)
+        return -1;
+    else if (h1 > h2)
+        return +1;
+    else
+        return 0;
+}
+
+unsigned long long Mix_Hash(unsigned long long h, unsigned long long x) {
+	h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	return h;
+}
 
-	ptr1 = out;
-	while (ptr1 != NULL) {
-		Print_tree11(ptr1->tree_com, node_type, child_array, node_strings);
-		ptr1 = ptr1->next;
+/*
+ * hash of the subnetwork below a node unfolded into a tree, leaves hashed by their
+ * names, as ccp keeps them in input order
+ */
+unsigned long long Unfold_Hash(int node, char *node_strings[],
+		struct lnode *child_array[], int node_type[], unsigned long long hash[],
+		int visited[]) {
+	int i, deg;
+	struct lnode *c;
+
+	if (visited[node] == 1)
+		return hash[node];
+	visited[node] = 1;
+	if (node_type[node] == LEAVE) {
+		hash[node] = Mix_Hash(LEAVE, (unsigned long long)
+				Hash_String128(node_strings[node], CANONICAL_BASIS));
+		return hash[node];
+	}
+	deg = Count_Child(child_array[node]);
+	unsigned long long ch[deg];
+	c = child_array[node];
+	for (i = 0; i < deg; i++) {
+		ch[i] = Unfold_Hash(c->leaf, node_strings, child_array, node_type, hash,
+				visited);
+		c = c->next;
 	}
+	qsort(ch, deg, sizeof(unsigned long long), hash_comparator);
+	hash[node] = Mix_Hash(node_type[node] == RET ? RET : TREE, deg);
+	for (i = 0; i < deg; i++)
+		hash[node] = Mix_Hash(hash[node], ch[i]);
+	return hash[node];
+}
+
+/*
+ * Write the edges below u, numbering the internal nodes in the order they are reached.
+ * The children of a node are taken in the order of their unfolding hashes.
+ */
+void Canonical_Edges(int u, char *node_strings[], struct lnode *child_array[],
+		int node_type[], unsigned long long hash[], int label[], int *no_labels,
+		struct text *form) {
+	int ch[MAXDEGREE];
+	char str[32];
+	int i, j, c, deg;
+	struct lnode *q;
 
+	deg = 0;
+	for (q = child_array[u]; q != NULL; q = q->next) {
+		for (j = deg; j > 0 && hash[ch[j - 1]] > hash[q->leaf]; j--)
+			ch[j] = ch[j - 1];
+		ch[j] = q->leaf;
+		deg += 1;
+	}
+	for (i = 0; i < deg; i++) {
+		c = ch[i];
+		sprintf(str, "#%d ", label[u]);
+		Append_Text(form, str);
+		if (node_type[c] == LEAVE) {
+			Append_Text(form, node_strings[c]);
+			Append_Text(form, "\n");
+			continue;
+		}
+		j = label[c];
+		if (j == -1)
+			label[c] = (*no_labels)++;
+		sprintf(str, "#%d\n", label[c]);
+		Append_Text(form, str);
+		if (j == -1)
+			Canonical_Edges(c, node_strings, child_array, node_type, hash, label,
+					no_labels, form);
+	}
 }
 
-void Print_Final_Tree1(struct components *out, int node_type[],
-		struct lnode *child_array[], char *node_strings[],
-		struct components *curr) {
-	struct components *ptr1;
+/* open a cached entry and mark it as recently used, NULL if it is not cached */
+FILE *Cache_Open(unsigned __int128 key, const char *ext) {
+	char path[strlen(cache_dir) + 48];
+	FILE *in;
+
+	sprintf(path, "%s/%016llx%016llx.%s", cache_dir,
+			(unsigned long long) (key >> 64), (unsigned long long) key, ext);
+	in = fopen(path, "rb");
+	if (in != NULL)
+		utimensat(AT_FDCWD, path, NULL, 0);
+	return in;
+}
+
+int cache_entry_comparator(const void *v1, const void *v2)
+{
+    const struct cache_entry *p1 = (struct cache_entry *)v1;
+    const struct cache_entry *p2 = (struct cache_entry *)v2;
+    if (p1->used.tv_sec != p2->used.tv_sec)
+        return p1->used.tv_sec < p2->used.tv_sec ? -1 : +1;
+    else if (p1->used.tv_nsec != p2->used.tv_nsec)
+        return p1->used.tv_nsec < p2->used.tv_nsec ? -1 : +1;
+    else
+        return 0;
+}
 
-	ptr1 = out;
-	while (ptr1 != curr) {
-		Print_tree11(ptr1->tree_com, node_type, child_array, node_strings);
-		ptr1 = ptr1->next;
+/*
+ * Remove the least recently used entries, by their modification times to the
+ * nanosecond, until the cache holds at most 3/4 of CACHE_LIMIT bytes, so that it is
+ * not scanned again at the next store. Return the bytes left.
+ */
+long Cache_Evict() {
+	struct cache_entry *entries;
+	DIR *dir;
+	struct dirent *e;
+	struct stat st;
+	long total, no, size, i;
+
+	dir = opendir(cache_dir);
+	if (dir == NULL)
+		return 0;
+	total = 0;
+	no = 0;
+	size = 64;
+	entries = (struct cache_entry *) malloc(size * sizeof(struct cache_entry));
+	while ((e = readdir(dir)) != NULL) {
+		if (e->d_name[0] == '.' || strstr(e->d_name, ".tmp") != NULL)
+			continue;
+		if (no == size) {
+			size = 2 * size;
+			entries = (struct cache_entry *) realloc(entries,
+					size * sizeof(struct cache_entry));
+		}
+		entries[no].path = (char *) malloc(strlen(cache_dir) + strlen(e->d_name) + 2);
+		sprintf(entries[no].path, "%s/%s", cache_dir, e->d_name);
+		if (stat(entries[no].path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			free(entries[no].path);
+			continue;
+		}
+		entries[no].size = st.st_size;
+		entries[no].used = st.st_mtim;
+		total += st.st_size;
+		no += 1;
+	}
+	closedir(dir);
+	if (total > CACHE_LIMIT) {
+		qsort(entries, no, sizeof(struct cache_entry), cache_entry_comparator);
+		for (i = 0; i < no && total > CACHE_LIMIT / 4 * 3; i++) {
+			if (unlink(entries[i].path) == 0)
+				total -= entries[i].size;
+		}
+	}
+	for (i = 0; i < no; i++)
+		free(entries[i].path);
+	free(entries);
+	return total;
+}
+
+/*
+ * Add len bytes to the size of the cache, kept in the file .size under a lock, and
+ * evict entries once it passes CACHE_LIMIT; the directory is only scanned then, or if
+ * the size is not known. A rewritten entry is counted twice, which only brings the
+ * next scan forward, the scan setting the size to what is found.
+ */
+void Cache_Account(long len) {
+	char path[strlen(cache_dir) + 16];
+	FILE *f;
+	long total;
+	int fd;
+
+	sprintf(path, "%s/.size", cache_dir);
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return;
+	f = fdopen(fd, "r+");
+	if (f == NULL) {
+		close(fd);
+		return;
 	}
-	Print_tree11(ptr1->tree_com, node_type, child_array, node_strings);
+	flock(fd, LOCK_EX);
+	if (fscanf(f, "%ld", &total) != 1 || total < 0)
+		total = CACHE_LIMIT;
+	total += len;
+	if (total > CACHE_LIMIT)
+		total = Cache_Evict();
+	rewind(f);
+	fprintf(f, "%ld\n", total);
+	fflush(f);
+	if (ftruncate(fd, ftell(f)) != 0)
+		rewind(f);
+	fclose(f);
+}
+
+/*
+ * Store an entry in the cache. It is written to a temporary file first and renamed,
+ * so that concurrent readers and writers only ever see complete entries.
+ */
+void Cache_Store(unsigned __int128 key, const char *ext, const void *buf,
+		size_t len) {
+	char path[strlen(cache_dir) + 48], tmp[strlen(cache_dir) + 80];
+	FILE *out;
+
+	sprintf(path, "%s/%016llx%016llx.%s", cache_dir,
+			(unsigned long long) (key >> 64), (unsigned long long) key, ext);
+	sprintf(tmp, "%s.tmp%ld", path, (long) getpid());
+	out = fopen(tmp, "wb");
+	if (out == NULL)
+		return;
+	if (fwrite(buf, 1, len, out) != len) {
+		fclose(out);
+		unlink(tmp);
+		return;
+	}
+	fclose(out);
+	if (rename(tmp, path) != 0)
+		unlink(tmp);
+	else
+		Cache_Account(len);
+}
+
+/*
+ * Write a query up to the labels of the internal nodes and the order of the edges:
+ * the edges of the network as srfd writes its canonical form, then a line "#" and the
+ * input leaves sorted by name. label gets the numbers of the nodes in the form, -1 for
+ * a node that is not reached. The cache key is the hash of form->buf, to be freed by
+ * the caller. Siblings with equal unfolding hashes are taken in input order, so the
+ * same query may get different forms then.
+ */
+void Query_Form(int root, char *node_strings[], int no_nodes,
+		struct lnode *child_array[], int node_type[], char *leave_names[], int no1,
+		int label[], struct text *form) {
+	char *names[no1];
+	unsigned long long hash[no_nodes];
+	int visited[no_nodes];
+	int i, no_labels;
+
+	form->buf = NULL;
+	form->len = 0;
+	form->size = 0;
+	Append_Text(form, "");
+	for (i = 0; i < no_nodes; i++) {
+		visited[i] = 0;
+		label[i] = -1;
+	}
+	Unfold_Hash(root, node_strings, child_array, node_type, hash, visited);
+	label[root] = 0;
+	no_labels = 1;
+	Canonical_Edges(root, node_strings, child_array, node_type, hash, label,
+			&no_labels, form);
+
+	for (i = 0; i < no1; i++)
+		names[i] = leave_names[i];
+	qsort(names, no1, sizeof(char *), str_comparator);
+	Append_Text(form, "#\n");
+	for (i = 0; i < no1; i++) {
+		Append_Text(form, names[i]);
+		Append_Text(form, "\n");
+	}
+}
+
+/*
+ * The node a word of a cache entry stands for: a leaf by its name, an internal node by
+ * its number in the form of the query, see Query_Form. Return -1 if there is none.
+ */
+int Cache_Node(char *word, char *node_strings[], int n_l, int node_of[],
+		int no_labels) {
+	int x;
+
+	x = Check_Name(node_strings, n_l, word);
+	if (x == -1 && word[0] == '#' && sscanf(word + 1, "%d", &x) == 1)
+		x = (x >= 0 && x < no_labels) ? node_of[x] : -1;
+	return x;
+}
+
+/* the word for a node in a cache entry, see Cache_Node */
+void Cache_Word(char *word, int node, char *node_strings[], int n_l, int label[]) {
+	if (node < n_l)
+		strcpy(word, node_strings[node]);
+	else
+		sprintf(word, "#%d", label[node]);
+}
+
+/*
+ * Read the answer to a query from the cache, along with its witness tree.
+ * An entry holds the length of the form of the query and the form itself, then the
+ * answer; it is only taken if the form is that of the query, so that queries with the
+ * same hash are told apart.
+ * Return 50 or 10 as Cluster_Containment does, or 0 if the query is not cached
+ * or the witness tree is asked for but was not kept.
+ */
+int Cache_Load_Answer(unsigned __int128 key, struct text *form,
+		char *node_strings[], int no_nodes, int n_l, int label[], int *no_break) {
+	int node_of[no_nodes];
+	char *str1, *str2, *buf;
+	FILE *in;
+	int i, res, no_edges, x, found;
+	size_t len;
+
+	in = Cache_Open(key, "ccp");
+	if (in == NULL)
+		return 0;
+	found = fscanf(in, "%zu\n", &len) == 1 && len == form->len;
+	if (found == 1) {
+		buf = (char *) malloc(len + 1);
+		found = fread(buf, 1, len, in) == len && memcmp(buf, form->buf, len) == 0;
+		free(buf);
+	}
+	if (found == 0 || fscanf(in, "%d %d %d %ms\n", &res, &x, &no_edges, &str1) != 4) {
+		fclose(in);
+		return 0;
+	}
+	for (i = 0; i < no_nodes; i++)
+		node_of[i] = -1;
+	for (i = 0; i < no_nodes; i++)
+		if (label[i] >= 0)
+			node_of[label[i]] = i;
+	if (no_edges > MAXEDGE)
+		res = 0;
+	if (res == 50) {
+		witness.node = Cache_Node(str1, node_strings, n_l, node_of, no_nodes);
+		free(str1);
+		witness.no_break = x;
+		witness.no_edges = 0;
+		if (witness.mode != NO_WITNESS) {
+			for (i = 0; i < no_edges; i++) {
+				if (fscanf(in, "%ms %ms\n", &str1, &str2) != 2)
+					break;
+				witness.start[i] = Cache_Node(str1, node_strings, n_l, node_of,
+						no_nodes);
+				witness.end[i] = Cache_Node(str2, node_strings, n_l, node_of,
+						no_nodes);
+				free(str1);
+				free(str2);
+				if (witness.start[i] == -1 || witness.end[i] == -1)
+					break;
+				witness.no_edges += 1;
+			}
+			if (no_edges < 0 || witness.no_edges != no_edges)
+				res = 0;
+		}
+		if (witness.node == -1)
+			res = 0;
+	} else
+		free(str1);
+	fclose(in);
+	if (res != 0)
+		*no_break = x;
+	return res;
+}
+
+/*
+ * Keep the answer to a query in the cache, after the form of the query, with the
+ * witness tree if it was collected. Its nodes are written as Cache_Node reads them.
+ */
+void Cache_Store_Answer(unsigned __int128 key, struct text *form, int res,
+		int no_break, char *node_strings[], int n_l, int label[]) {
+	size_t len, size, longest;
+	char *buf;
+	int i, no_edges;
+
+	longest = 32;
+	for (i = 0; i < n_l; i++)
+		if (strlen(node_strings[i]) >= longest)
+			longest = strlen(node_strings[i]) + 1;
+	char word1[longest], word2[longest];
+	no_edges = -1;
+	if (res == 50 && witness.mode != NO_WITNESS)
+		no_edges = witness.no_edges;
+	size = form->len + 128;
+	if (res == 50)
+		size += longest;
+	for (i = 0; i < no_edges; i++)
+		size += 2 * longest;
+	buf = (char *) malloc(size);
+	len = sprintf(buf, "%zu\n", form->len);
+	memcpy(buf + len, form->buf, form->len);
+	len += form->len;
+	if (res == 50)
+		Cache_Word(word1, witness.node, node_strings, n_l, label);
+	else
+		strcpy(word1, "-");
+	len += sprintf(buf + len, "%d %d %d %s\n", res, no_break, no_edges, word1);
+	for (i = 0; i < no_edges; i++) {
+		Cache_Word(word1, witness.start[i], node_strings, n_l, label);
+		Cache_Word(word2, witness.end[i], node_strings, n_l, label);
+		len += sprintf(buf + len, "%s %s\n", word1, word2);
+	}
+	Cache_Store(key, "ccp", buf, len);
+	free(buf);
 }
 
 void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
-		int node_type[], int* optional, char* node_strings[], int* in_cluster,
+		int* optional, char* node_strings[], unsigned int *in_cluster,
 		struct components* p, int no_nodes, int net_edges[no_nodes][no_nodes]) {
 	int i, x;
 	/* remove edges entering CR(C) */
@@ -1445,16 +2539,16 @@ void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
 			if (Is_In(x, optional, no_opt) == 1) {
 				/*				printf("remove %s leaf %s\n", node_strings[r_nodes[i]],
 				 node_strings[x]);*/
-				if (in_cluster[x] == 1) {
+				if (BITTEST(in_cluster, x)) {
 					/*					printf(
 					 "The optional leaf is in the cluster. delete edges incoming from other components.\n");*/
-					Modify2(p->next, node_type, r_nodes[i], no_nodes, net_edges);
+					Modify2(p->next, r_nodes[i], no_nodes, net_edges);
 					// printf("Replace reticulation node %s by null, orig: %s \n", node_strings[r_nodes[i]], node_strings[lf_below[r_nodes[i]]]);
 					lf_below[r_nodes[i]] = -2;
-				} else if (in_cluster[x] == 0) {
+				} else {
 					/*					printf(
 					 "The optional leaf is not in the cluster. delete edges incoming from the current component.\n");*/
-					Modify1(p->tree_com, node_type, r_nodes[i], &p->size, no_nodes, net_edges);
+					Modify1(p->tree_com, r_nodes[i], &p->size, no_nodes, net_edges);
 					//Print_Comp_Revised(p->tree_com, node_strings);
 				}
 			}
@@ -1463,7 +2557,7 @@ void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
 }
 
 void Modify_Cross_Ret1(int n_r, int lf_below[], int r_nodes[], int no_opt,
-		int node_type[], int* optional, char* node_strings[], int* in_cluster,
+		int* optional, char* node_strings[], unsigned int *in_cluster,
 		struct components* p, int no_nodes, int net_edges[no_nodes][no_nodes]) {
 	int i, x;
 	for (i = 0; i < n_r; i++) {
@@ -1471,18 +2565,18 @@ void Modify_Cross_Ret1(int n_r, int lf_below[], int r_nodes[], int no_opt,
 		if (x >= 0 && Is_In(x, optional, no_opt) == 1) {
 			/*			printf("remove %s leaf %s\n", node_strings[r_nodes[i]],
 			 node_strings[x]);*/
-			if (in_cluster[x] == 0) {
+			if (!BITTEST(in_cluster, x)) {
 				/*				printf(
 				 "The optional leaf is not in the cluster. delete edges incoming from the other component.\n");*/
-				Modify2(p->next, node_type, r_nodes[i], no_nodes, net_edges);
+				Modify2(p->next, r_nodes[i], no_nodes, net_edges);
 				// printf("Replace reticulation node %s by null, orig: %s \n", node_strings[r_nodes[i]], node_strings[lf_below[r_nodes[i]]]);
 				lf_below[r_nodes[i]] = -2;
-			} else if (in_cluster[x] == 1) {
+			} else {
 				/*				printf(
 				 "The optional leaf is in the cluster. delete edges incoming from the current component.\n");
 				 printf("ret node %s and leave %s to be removed.\n",
 				 node_strings[r_nodes[i]], node_strings[x]);*/
-				Modify1(p->tree_com, node_type, r_nodes[i], &p->size, no_nodes, net_edges);
+				Modify1(p->tree_com, r_nodes[i], &p->size, no_nodes, net_edges);
 				//Print_Comp_Revised(p->tree_com, node_strings);
 			}
 		}
@@ -1509,7 +2603,7 @@ int Count_Parent(int child, struct lnode *parent_array[], int no_nodes, int net_
 
 // Check whether it is feasible for the subtree below a node to display the input cluster
 // indicator -- to show whether the leaf should be in the input or not. For 1st network, indicator=1. For 2nd network, indicator=-1.
-int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int no1, int input_leaves[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
+int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, unsigned int in_cluster[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
 	struct lnode *parent_array[], int net_edges[no_nodes][no_nodes])
 {
 	int i;
@@ -1523,23 +2617,23 @@ int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int
 		if (a_leaf==curr_leaf){child = child->next; continue;}
 		if (net_edges[parent][a_leaf]==0 ){child = child->next; continue;}
 
-		if (node_type[a_leaf]==RET)
+		if (IS_RET(a_leaf))
 		{
 			int l_below = lf_below[a_leaf];
 			// printf("l_below %s\n", node_strings[l_below]);
 			if (l_below!=-2 && l_below==curr_leaf) {child = child->next; continue;}
 			num_parent = Count_Parent(a_leaf, parent_array, no_nodes, net_edges);
 			if(num_parent>=2 && l_below==-2) return 1;	// reticulate node that has not been processed
-			if(num_parent<=1 && Is_In(l_below, input_leaves, no1) == indicator) return 0;
+			if(num_parent<=1 && Is_In_B(l_below, in_cluster) == indicator) return 0;
 		}
-		else if (node_type[a_leaf]==LEAVE)
+		else if (IS_LEAF(a_leaf))
 		{
-			if (Is_In(a_leaf, input_leaves, no1) == indicator){
+			if (Is_In_B(a_leaf, in_cluster) == indicator){
 				return 0;
 			}
 		}
 		else{ // TREE node, traverse until leaves
-			res= Is_Feasible_Node(a_leaf, curr_leaf, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+			res= Is_Feasible_Node(a_leaf, curr_leaf, indicator, no_nodes, in_cluster, inner_flag, lf_below, node_strings, child_array,
 				parent_array, net_edges);
 			if(res==0) return 0;
 		}
@@ -1551,7 +2645,7 @@ int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int
 
 
 // Check whether to continue running on one network
-int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int input_leaves[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
+int To_Run_Network(int unstb_ret, int indicator, int no_nodes, unsigned int in_cluster[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
 	struct lnode *parent_array[], int net_edges[no_nodes][no_nodes]){
 	int to_run=1;
 	int curr_leaf = lf_below[unstb_ret];
@@ -1563,7 +2657,7 @@ int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int inpu
 			continue;	// The edge has been deleted
 		}
 
-		to_run = Is_Feasible_Node(parent->leaf, curr_leaf, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+		to_run = Is_Feasible_Node(parent->leaf, curr_leaf, indicator, no_nodes, in_cluster, inner_flag, lf_below, node_strings, child_array,
 			parent_array, net_edges);
 		if (to_run==0)	break;
 
@@ -1573,34 +2667,61 @@ int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int inpu
 }
 
 
+/*
+ * Keep the displayed tree in which the input is a soft cluster, for output at the end.
+ * Only the first branch of the search to get here keeps it, the others stop.
+ */
+int Report_Cluster(int node, struct components *cps, int node_type[],
+		struct lnode *child_array[], int no_nodes, int no_break) {
+	#pragma omp critical(report_cluster)
+	{
+		if (cluster_found == 0) {
+			witness.node = node;
+			witness.no_break = no_break;
+			if (witness.mode != NO_WITNESS)
+				Collect_Witness(cps, node_type, child_array, no_nodes, &witness);
+			#pragma omp atomic write
+			cluster_found = 1;
+		}
+	}
+	return 50;
+}
+
 int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 		int no_nodes, int node_type[], int inner_flag[], int lf_below[],
-		char *node_strings[], int no1, int *input_leaves, int* in_cluster,
+		char *node_strings[], int no1, unsigned int *in_cluster,
 		int super_deg[], struct components *cps, struct lnode *child_array[], struct lnode *parent_array[], int net_edges[no_nodes][no_nodes],
 		int n_l, int *no_break) {
 	int i, j;
 	int no, no_slf, no_ambig, no_opt;
 
 	int nlf_kept; /* no. of leaves to keep in B */
-	int no_vmax, no_mark;
 
 	struct components *p, *p_copy;
 	struct components *p1, *whole_copy;
 	int unstb_ret;
 	int no1_1;	// copy of no1
 	int res, is_cluster, num_inleaf, count_in, count_out;
+	int nslots = BITNSLOTS(n_l);
+	int res_2nd, no_comps, found;
 
 	p = ptr;
 	if (p == NULL)
 		return 0;
 
+	/* another branch has found the input to be a soft cluster */
+	#pragma omp atomic read
+	found = cluster_found;
+	if (found == 1)
+		return 0;
+
 	if (p->tree_com == NULL) {
-		Modify2(p->next, node_type, p->ret_node, no_nodes, net_edges);
+		Modify2(p->next, p->ret_node, no_nodes, net_edges);
 		return Cluster_Containment(p->next, r_nodes, n_r, no_nodes, node_type,
-				inner_flag, lf_below, node_strings, no1, input_leaves,
-				in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l, no_break);
+				inner_flag, lf_below, node_strings, no1, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l, no_break);
 	}
-	else if (Is_Stable(p->tree_com, node_type, inner_flag, lf_below) == 1) {
+	else if (p->visible == 1
+			|| Is_Stable(p->tree_com, inner_flag, lf_below) == 1) {
 		struct arb_tnode* postList[2 * no_nodes];
 		no = 0;
 		PostTrans_Revised(p->tree_com, postList, &no);
@@ -1614,7 +2735,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 		}
 
 		/* build a tree from the component */
-		Replace_Ret_Revised(p->tree_com, inner_flag, node_type, lf_below,
+		Replace_Ret_Revised(p->tree_com, inner_flag, lf_below,
 				sleaves, &no_slf, ambig, &no_ambig, optional, &no_opt,
 				node_strings, rpl_comp, super_deg);
 
@@ -1632,64 +2753,31 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 		if (no_slf > 0) {
 			if(no_opt == 0 && no_slf == 1 ){	// There are only one stable leaf below the component
-				if (no1 == 1 && sleaves[0] == input_leaves[0]){
-					printf("The input is the soft cluster of node: %s\n",
-							node_strings[p->ret_node]);
-					Print_Final_Tree(cps, node_type, child_array, node_strings);
-					printf("\n\n\n The no. of rets eliminated: %d\n", *no_break);
-					return 50;
+				if (no1 == 1 && BITTEST(in_cluster, sleaves[0])){
+					return Report_Cluster(p->ret_node, cps, node_type,
+							child_array, no_nodes, *no_break);
 				}
 				else{	// There are more than one input leaves
 					lf_below[p->ret_node] = sleaves[0];
 					return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+							in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 							no_break);
 				}
 			}
 			else	// There are more than one stable leaves below the component
 			{
-				/* mark nodes and find Vmax */
-				Initiallize(p->tree_com);
-				no_mark = 0;
-				no_vmax = 0;
-				/* mark ambiguous leaves */
-				for (i = 0; i < no_ambig; i++) {
-					if (in_cluster[ambig[i]] == 0) {
-						Mark_Revised(p->tree_com, ambig[i], &no_mark);
-					}
-				}
-				/* mark a leaf that is neither ambiguous nor optional */
-				for (i = 0; i < no_slf; i++) {
-					if (Check_List(ambig, no_ambig, sleaves[i]) == -1
-							&& in_cluster[sleaves[i]] == 0) {
-						Mark_Revised(p->tree_com, sleaves[i], &no_mark);
-					}
-				}
-
-				int vmax[no];
-				if (no_mark == 0) {
-					vmax[0] = p->tree_com->label;
-					no_vmax = 1;
-				} else {
-					Find_Vmax(p->tree_com, vmax, &no_vmax);
-				}
-
-				int map_nodes[no_vmax][MAXSIZE];
-				is_cluster = DProgram_Revised(node_strings, p->tree_com, no1,
-						map_nodes, vmax, no_vmax, input_leaves, node_type);
-				Rebuilt_Component(p->tree_com, rpl_comp, node_type, node_strings);
+				is_cluster = Find_Cluster_Node(p->tree_com, no, sleaves, no_slf,
+						ambig, no_ambig, in_cluster, no1, n_l);
+				Rebuilt_Component(p->tree_com, rpl_comp, node_strings);
 			}
 
 			if (is_cluster >= 0) {
 				/* remove edges entering CR(C) for visualization */
-				Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt, node_type,
+				Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
 						optional, node_strings, in_cluster, p, no_nodes, net_edges);
-				printf("The input is the soft cluster of node: %s\n",
-						node_strings[is_cluster]);
-				Print_Final_Tree(cps, node_type, child_array, node_strings);
-				printf("\n\n\n The no. of rets eliminated: %d\n", *no_break);
-				return 50;
+				return Report_Cluster(is_cluster, cps, node_type,
+						child_array, no_nodes, *no_break);
 			} else {
 				/* use one stable leaf to replace the current component */
 				if (node_type[p->ret_node] != ROOT){
@@ -1701,86 +2789,70 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 					lf_below[p->ret_node] = sleaves[0];
 				}
 
+				unsigned int slf_set[nslots], opt_set[nslots];
+				for (j = 0; j < nslots; j++) {
+					slf_set[j] = 0;
+					opt_set[j] = 0;
+				}
+				for (i = 0; i < no_slf; i++)
+					BITSET(slf_set, sleaves[i]);
+				for (i = 0; i < no_opt; i++)
+					BITSET(opt_set, optional[i]);
+
 				count_out = 0;
 				count_in = 0;
-				for (i = 0; i < no_slf; i++) {
-					if (in_cluster[sleaves[i]] == 0) {
-						count_out += 1;
-					} else if (in_cluster[sleaves[i]] == 1) {
-						count_in += 1;
-					}
+				for (j = 0; j < nslots; j++) {
+					count_out += pop(slf_set[j] & ~in_cluster[j]);
+					count_in += pop(slf_set[j] & in_cluster[j]);
 				}
 
 				/* L and B are disjoint */
-				if (count_out == no_slf) {
-					Modify_Cross_Ret1(n_r, lf_below, r_nodes, no_opt, node_type,
+				if (count_in == 0) {
+					Modify_Cross_Ret1(n_r, lf_below, r_nodes, no_opt,
 							optional, node_strings, in_cluster, p, no_nodes, net_edges);
 					return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps,
+							in_cluster, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 				/* L and notB are disjoint */
-				else if (count_in == no_slf) {
+				else if (count_out == 0) {
 					/* check whether B^==B */
 					num_inleaf = 0;
-					for (i = 0; i < no_slf; i++) {
-						if (in_cluster[sleaves[i]] == 1)
-							num_inleaf += 1;
-					}
-					for (i = 0; i < no_opt; i++) {
-						if (in_cluster[optional[i]] == 1)
-							num_inleaf += 1;
-					}
+					for (j = 0; j < nslots; j++)
+						num_inleaf += pop((slf_set[j] | opt_set[j]) & in_cluster[j]);
 
 					if (num_inleaf == no1) {
 						/* remove edges related to CR(C) */
 						Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
-								node_type, optional, node_strings, in_cluster,
+								optional, node_strings, in_cluster,
 								p, no_nodes, net_edges);
-						printf("The input is the soft cluster of node: %s\n",
-								node_strings[p->tree_com->label]);
-						Print_Final_Tree(cps, node_type, child_array,
-								node_strings);
-						printf("\n\n\n The no. of rets eliminated: %d\n",
-								*no_break);
-						return 50;
+						return Report_Cluster(p->tree_com->label, cps, node_type,
+								child_array, no_nodes, *no_break);
 					}
 					/* remove edges related to CR(C) */
-					Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt, node_type,
+					Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
 							optional, node_strings, in_cluster, p, no_nodes, net_edges);
 
-					/* decrease B */
+					/* decrease B by the leaves removed, see Contract_Tree */
 					if (no_slf + no_opt > 1){
-						int input_leaves1[no1];
-						nlf_kept = 0;
-						for (i = 0; i < no1; i++) {
-							if (Is_In(input_leaves[i], sleaves, no_slf) == -1
-									&& Is_In(input_leaves[i], optional, no_opt)
-											== -1) {
-								input_leaves1[nlf_kept++] = input_leaves[i];
-							}
-						}
-						input_leaves1[nlf_kept++] = sleaves[0];
-						no1 = nlf_kept;
-
-						/* revise in_cluster */
-						int in_cluster1[n_l];
-						for (i = 0; i < n_l; i++) {
-							in_cluster1[i] = in_cluster[i];
-							if (Is_In(i, input_leaves1, no1) == -1) {
-								in_cluster1[i] = 0;
-							}
+						unsigned int in_cluster1[nslots];
+						nlf_kept = no1;
+						for (j = 0; j < nslots; j++) {
+							in_cluster1[j] = in_cluster[j] & ~(slf_set[j] | opt_set[j]);
+							nlf_kept -= pop(in_cluster[j] & ~in_cluster1[j]);
 						}
+						BITSET(in_cluster1, sleaves[0]);
+						no1 = nlf_kept + 1;
 						res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 								node_type, inner_flag, lf_below, node_strings, no1,
-								input_leaves1, in_cluster1, super_deg, cps,
+								in_cluster1, super_deg, cps,
 								child_array, parent_array, net_edges, n_l, no_break);
 					}
 					else{
 						res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 								node_type, inner_flag, lf_below, node_strings, no1,
-								input_leaves, in_cluster, super_deg, cps,
+								in_cluster, super_deg, cps,
 								child_array, parent_array, net_edges, n_l, no_break);
 					}
 
@@ -1798,12 +2870,12 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			}
 		} else {
 			//  Empty Component
-			Rebuilt_Component(p->tree_com, rpl_comp, node_type, node_strings);
+			Rebuilt_Component(p->tree_com, rpl_comp, node_strings);
 			unstb_ret = p->tree_com->label;
-			Modify(p->next, NULL, node_type, unstb_ret, no_nodes, net_edges, NULL);
+			Modify(p->next, NULL, unstb_ret, no_nodes, net_edges, NULL);
 			return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 					node_type, inner_flag, lf_below, node_strings, no1,
-					input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+					in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 					no_break);
 		}
 	}
@@ -1816,20 +2888,17 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 		int unstb_rets_in[n_r];
 		int unstb_rets_out[n_r];
-		int lf_in_comp[no1];
-		int lf_out_comp[no1];
+		int lf_in_comp[n_r];
+		int lf_out_comp[n_r];
 
-		Find_UnStable(p->tree_com, input_leaves, no1, unstb_rets_in,
-				&no_rets_in, unstb_rets_out, &no_rets_out, node_type,
+		Find_UnStable(p->tree_com, in_cluster, unstb_rets_in,
+				&no_rets_in, unstb_rets_out, &no_rets_out,
 				inner_flag, lf_below, lf_in_comp, &no_in_lfb, lf_out_comp, &no_out_lfb);
 
 		// check whether leaves below current component equals to B
 		if(no_in_lfb == no1){
-			printf("The input is the soft cluster of node: %s\n",
-					node_strings[p->tree_com->label]);
-			Print_Final_Tree(cps, node_type, child_array, node_strings);
-			printf("\n\n\n The no. of rets eliminated: %d\n", *no_break);
-			return 50;
+			return Report_Cluster(p->tree_com->label, cps, node_type,
+					child_array, no_nodes, *no_break);
 		}
 
 		if (no_rets_in > 0 || no_rets_out > 0){
@@ -1880,7 +2949,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 						inner_flag1[unstb_ret] = CROSS;
 					}
 				}
-				Modify(p, p1, node_type, unstb_ret, no_nodes, net_edges, net_edges1);
+				Modify(p, p1, unstb_ret, no_nodes, net_edges, net_edges1);
 			}
 
 			for (i = 0; i < no_rets_out; i++) {
@@ -1897,20 +2966,16 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 						inner_flag[unstb_ret] = CROSS;
 					}
 				}
-				Modify(p1, p, node_type, unstb_ret, no_nodes, net_edges1, net_edges);
+				Modify(p1, p, unstb_ret, no_nodes, net_edges1, net_edges);
 			}
 
 			/* copy data for spliting */
-			int input_leaves_orig[no1];
-			int in_cluster_orig[n_l];
-			for (i = 0; i < n_l; i++) {
-				in_cluster_orig[i] = in_cluster[i];
-			}
-			for (i = 0; i < no1; i++) {
-				input_leaves_orig[i] = input_leaves[i];
-			}
+			unsigned int in_cluster_orig[nslots];
+			for (j = 0; j < nslots; j++)
+				in_cluster_orig[j] = in_cluster[j];
 			no1_1 = no1;
 
+			#pragma omp atomic
 			*no_break = *no_break + 1;
 
 			// All leaves below the current component are not in B
@@ -1957,7 +3022,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			// not run the 1st network if there is a node which has children in both B and not B
 			for (i = 0; i < no_rets_out; i++) {
 				unstb_ret = unstb_rets_out[i];
-				run_1st = To_Run_Network(unstb_ret, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+				run_1st = To_Run_Network(unstb_ret, indicator, no_nodes, in_cluster, node_type, inner_flag, lf_below, node_strings, child_array,
 				parent_array, net_edges);
 				if(run_1st==0) break;
 			}
@@ -1965,64 +3030,69 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			indicator = -1;
 			for (i = 0; i < no_rets_in; i++) {
 				unstb_ret = unstb_rets_in[i];
-				run_2nd = To_Run_Network(unstb_ret, indicator, no_nodes, no1_1, input_leaves_orig, node_type, inner_flag1, lf_below1, node_strings, child_array,
+				run_2nd = To_Run_Network(unstb_ret, indicator, no_nodes, in_cluster_orig, node_type, inner_flag1, lf_below1, node_strings, child_array,
 				parent_array, net_edges1);
 				if (run_2nd==0) break;
 			}
 
 			res = 0;
+			res_2nd = 0;
 			if (run_1st == 0 && run_2nd == 0)
 			{
 				return 10;	// not a cluster in either network
 			}
+
+			/* search the two networks in parallel if there is enough left to do */
+			no_comps = 0;
+			for (p_copy = p->next; p_copy != NULL; p_copy = p_copy->next)
+				no_comps += 1;
+
 			if (run_1st == 1)
+			#pragma omp task default(shared) if (no_comps >= MINTASKCOMPS)
 			{
 				if(no_in_lfb > 1){
-					/* decrease B */
-					int input_leaves1[no1];
-					nlf_kept = 0;
-					for (i = 0; i < no1; i++) {
-						if (Is_In(input_leaves[i], lf_in_comp, no_in_lfb) == -1) {
-							input_leaves1[nlf_kept++] = input_leaves[i];
-						}
-					}
-					input_leaves1[nlf_kept++] = lf_in_comp[0];
+					/* decrease B by the leaves removed, see Contract_Tree */
+					unsigned int in_cluster1[nslots];
+					for (j = 0; j < nslots; j++)
+						in_cluster1[j] = in_cluster[j];
+					for (i = 0; i < no_in_lfb; i++)
+						BITCLEAR(in_cluster1, lf_in_comp[i]);
+					BITSET(in_cluster1, lf_in_comp[0]);
+					nlf_kept = no1;
+					for (j = 0; j < nslots; j++)
+						nlf_kept -= pop(in_cluster[j] & ~in_cluster1[j]);
 					no1 = nlf_kept;
-
-					/* revise in_cluster */
-					int in_cluster1[n_l];
-					for (i = 0; i < n_l; i++) {
-						in_cluster1[i] = in_cluster[i];
-						if (Is_In(i, input_leaves1, no1) == -1) {
-							in_cluster1[i] = 0;
-						}
-					}
 					res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves1, in_cluster1, super_deg, cps,
+							in_cluster1, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 				else{
 					res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps,
+							in_cluster, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 			}
-			if (res != 50  && run_2nd == 1) {
-				// Run on 2nd split network
-				res = Cluster_Containment(p1->next, r_nodes, n_r, no_nodes, node_type,
+			// Run on 2nd split network, which returns at once if the 1st has found a cluster
+			if (run_2nd == 1)
+			#pragma omp task default(shared) if (no_comps >= MINTASKCOMPS)
+			{
+				res_2nd = Cluster_Containment(p1->next, r_nodes, n_r, no_nodes, node_type,
 					inner_flag1, lf_below1, node_strings, no1_1,
-					input_leaves_orig, in_cluster_orig, super_deg1,
+					in_cluster_orig, super_deg1,
 					whole_copy, child_array, parent_array, net_edges1, n_l, no_break);
 			}
+			#pragma omp taskwait
+			if (res_2nd == 50)
+				res = 50;
 			return res;
 		}
 		else {
-			Modify2(p->next, node_type, p->ret_node, no_nodes, net_edges);
+			Modify2(p->next, p->ret_node, no_nodes, net_edges);
 			return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 					node_type, inner_flag, lf_below, node_strings, no1,
-					input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+					in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 					no_break);
 		}
 	}
@@ -2031,13 +3101,13 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 
 int main(int argc, char *argv[]) {
-	FILE *In;
+	gzFile In;
 	int j;
 	int no1;
 	char *leave_names[MAXSIZE / 2 + 1];
 	int *input_leaves; /* the label of input leaves in the network */
 
-	FILE *ntk_ptr;
+	gzFile ntk_ptr;
 	int *node_type, *r_nodes, *orig_rnodes;
 	int root;
 	int start[MAXEDGE], end[MAXEDGE];
@@ -2048,31 +3118,52 @@ int main(int argc, char *argv[]) {
 	int *inner_flag; /* whether a ret is inner or cross */
 	int *super_deg;
 	char **net_leaves;
-	int *in_cluster; /*  to indicate whether a network leaf is in the input cluster B or not*/
+	unsigned int *in_cluster; /*  to indicate whether a network leaf is in the input cluster B or not, as a bitset */
 	int no_edges, n_t, n_r, n_l, no_nodes; /* n_t: tree nodes, n_r: ret nodes; n_l: no. leaves */
 
 	int check_leaves;
-	char str1[20], str2[20];
-	int u1, u2;
+	char *str1, *str2;
+	int u1, u2, size1, size2;
 	int i, x;
 
-	int no_break;
+	int no_break, no_b;
 	int res;
+	unsigned __int128 key;
+	struct text form;
+	char *net_file, *leaf_file, *witness_file;
+	FILE *out;
 	struct components *all_cps, *p;
 	struct components *component_array;
 	struct components *pcurr;
 
-	if (argc != 3) {
-		printf("Command: PROGRAM(./ccp) network_file_name leaf_file_name\n");
+	witness.mode = TEXT_WITNESS;
+	witness_file = NULL;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-q") == 0)
+			witness.mode = NO_WITNESS;
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			witness.mode = BINARY_WITNESS;
+			witness_file = argv[++i];
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cache_dir = argv[++i];
+		else
+			break;
+	}
+	if (argc - i != 2) {
+		printf("Command: PROGRAM(./ccp) [-q | -b witness_file] [-c cache_dir] network_file_name leaf_file_name\n");
 		return 10;
 	}
+	net_file = argv[i];
+	leaf_file = argv[i + 1];
 
 	/* leaves processing */
+	str1 = NULL, str2 = NULL;
+	size1 = 0, size2 = 0;
 	no1 = 0;
-	In = fopen(argv[2], "r");
+	In = gzopen(leaf_file, "r");
 	if (In == NULL)
 		printf("Leaf_file_name is not readable\n");
-	while (fscanf(In, "%s\n", str1) != EOF) {
+	while (Read_Word(In, &str1, &size1) == 1) {
 		u1 = Check_Name(leave_names, no1, str1);
 		if (u1 == -1) {
 			u1 = no1;
@@ -2081,13 +3172,14 @@ int main(int argc, char *argv[]) {
 			no1 = 1 + no1;
 		}
 	}
-	fclose(In);
+	gzclose(In);
 
 	/* network processing */
-	ntk_ptr = fopen(argv[1], "r");
+	ntk_ptr = gzopen(net_file, "r");
 	no_edges = 0;
 	no_nodes = 0;
-	while (fscanf(ntk_ptr, "%s %s\n", str1, str2) != EOF) {
+	while (Read_Word(ntk_ptr, &str1, &size1) == 1
+			&& Read_Word(ntk_ptr, &str2, &size2) == 1) {
 		u1 = Check_Name(node_strings, no_nodes, str1);
 		if (u1 == -1) {
 			u1 = no_nodes, no_nodes = 1 + no_nodes;
@@ -2104,15 +3196,16 @@ int main(int argc, char *argv[]) {
 		end[no_edges] = u2;
 		no_edges += 1;
 	}
-	fclose(ntk_ptr);
-
+	gzclose(ntk_ptr);
+	free(str1);
+	free(str2);
 	node_type = (int *) calloc(no_nodes, sizeof(int));
 
 	/* no_edges, no_nodes  */
 	x = Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
 	if (x < 0) {
 		printf("\n the network graph has two or more roots or a node with");
-		printf("\n both in- and out-degree greater than 1;\n Recheck it\n");
+		printf("\n in-degree greater than 1 and out-degree other than 1;\n Recheck it\n");
 		return 10;
 	}
 
@@ -2138,17 +3231,18 @@ int main(int argc, char *argv[]) {
 
 	Move_Leaves_Front(node_strings, no_nodes, start, end, no_edges, net_leaves,
 			n_l);
+	Renumber_Nodes(node_strings, no_nodes, start, end, no_edges, n_l);
 
 	Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
 
-	in_cluster = (int *) calloc(n_l, sizeof(int));
+	in_cluster = (unsigned int *) calloc(BITNSLOTS(n_l), sizeof(unsigned int));
 	/* the labels of input leaves as in node_strings */
 	input_leaves = (int *) calloc(no1, sizeof(int));
 	j = 0;
 	check_leaves = 0;
 	for (i = 0; i < n_l; i++) {
-		in_cluster[i] = Is_In_Str(node_strings[i], leave_names, no1);
-		if (in_cluster[i] == 1) {
+		if (Is_In_Str(node_strings[i], leave_names, no1) == 1) {
+			BITSET(in_cluster, i);
 			check_leaves += 1;
 			input_leaves[j] = i;
 			j += 1;
@@ -2213,6 +3307,8 @@ int main(int argc, char *argv[]) {
 	child_array = (struct lnode **) calloc(no_nodes, sizeof(struct lnode*));
 	parent_array = (struct lnode **) calloc(no_nodes, sizeof(struct lnode*));
 	Child_Parent_Inform(child_array, parent_array, no_nodes, start, end, no_edges);
+	first_ret = n_l;
+	first_tree = n_l + n_r;
 	Sort_Rets_By_Level(orig_rnodes, r_nodes, n_r, child_array, parent_array, node_type, no_nodes);
 
 	inner_flag = (int *) calloc(no_nodes, sizeof(int));
@@ -2238,15 +3334,15 @@ int main(int argc, char *argv[]) {
 	for (i = 0; i < n_r; i++)
 		super_deg[r_nodes[i]] = 0;
 
+	int visible[no_nodes];
+	Visible_Nodes(no_nodes, root, child_array, parent_array, node_type, visible);
+	struct components *cps[n_r+1];
 	for (j = 0; j < n_r+1; j++) {
 		p= &component_array[j];
-		Build_Comp_Revised(p->tree_com, child_array, node_type, no_nodes, &p->size,
-				&p->no_tree_node);
-		for (i = 0; i < n_r; i++) {
-			super_deg[r_nodes[i]] = super_deg[r_nodes[i]]
-					+ Is_In_Comp(p->tree_com, r_nodes[i]);
-		}
+		p->visible = visible[p->ret_node];
+		cps[j] = p;
 	}
+	Build_Components(cps, n_r+1, child_array, node_type, no_nodes, super_deg);
 
 	lf_below = (int *) calloc(no_nodes, sizeof(int));
 	for (i = 0; i < no_nodes; i++)
@@ -2266,11 +3362,51 @@ int main(int argc, char *argv[]) {
 	all_cps = &component_array[0];
 	no_break = 0;
 	// p refers to current component to resolve, cps points to the beginning of the component
-	res = Cluster_Containment(p, r_nodes, n_r, no_nodes, node_type, inner_flag,
-			lf_below, node_strings, no1, input_leaves, in_cluster, super_deg,
-			all_cps, child_array, parent_array, net_edges, n_l, &no_break);
-
-	if (res != 50) {
+	/* the blob decomposition decides most inputs without CCP */
+	res = Blob_Containment(no_nodes, root, node_type, child_array, parent_array,
+			in_cluster, no1, n_l);
+	/* the cache is keyed by the form of the query, so that the labels of the internal
+	 * nodes and the order of the edges do not matter */
+	int label[no_nodes];
+	key = 0;
+	form.buf = NULL;
+	if (res == 0 && cache_dir != NULL) {
+		Query_Form(root, node_strings, no_nodes, child_array, node_type, leave_names,
+				no1, label, &form);
+		key = Hash_String128(form.buf, CANONICAL_BASIS);
+		res = Cache_Load_Answer(key, &form, node_strings, no_nodes, n_l, label,
+				&no_break);
+	}
+	if (res == 0) {
+		no_b = Contract_Components(all_cps, in_cluster, witness.top, n_l, no1);
+		#pragma omp parallel
+		#pragma omp single
+		res = Cluster_Containment(p, r_nodes, n_r, no_nodes, node_type, inner_flag,
+				lf_below, node_strings, no_b, in_cluster, super_deg,
+				all_cps, child_array, parent_array, net_edges, n_l, &no_break);
+		if (cache_dir != NULL)
+			Cache_Store_Answer(key, &form, res, res == 50 ? witness.no_break : no_break,
+					node_strings, n_l, label);
+	}
+	free(form.buf);
+
+	if (res == 50) {
+		printf("The input is the soft cluster of node: %s\n",
+				node_strings[witness.node]);
+		if (witness.mode == TEXT_WITNESS) {
+			fflush(stdout);
+			Write_Witness_Text(stdout, &witness, node_strings);
+		} else if (witness.mode == BINARY_WITNESS) {
+			out = fopen(witness_file, "wb");
+			if (out == NULL)
+				printf("File %s is not writable\n", witness_file);
+			else {
+				Write_Witness_Binary(out, &witness, node_strings, no_nodes);
+				fclose(out);
+			}
+		}
+		printf("\n\n\n The no. of rets eliminated: %d\n", witness.no_break);
+	} else {
 		printf("not a cluster!\n\n");
 		printf("The no. of rets eliminated: %d\n", no_break);
 	}
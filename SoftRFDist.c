@@ -9,9 +9,49 @@
  *   -- each reticulation node must an out-degree 1;
  *   -- only one root and no node has both in- and out-degree > 1
  *
- *   The compiling command:  gcc -o srfd SoftRFDist.c
+ *   The compiling command:  gcc -o srfd SoftRFDist.c -lz
  *   The run command:        ./srfd <network_file1_name> <network_file2_name>
+ *
+ *   Networks obtained from the 2nd one by a sequence of local edits can follow:
+ *                           ./srfd <network_file1_name> <network_file2_name> <edited_file1> ...
+ *   Each is compared to the 1st network, re-evaluating only the clusters the edit can change.
+ *
+ *   With --list names or --list mask first, each cluster that is soft in only one of
+ *   the networks is printed after the networks, as "1 {leaf,...}" or "2 {leaf,...}"
+ *   by the network it is in, or with a hexadecimal mask of the leaves instead of their
+ *   names, bit i standing for the ith leaf in the order of their names. A pendant
+ *   subnetwork the networks share is still collapsed, its leaves being put back when
+ *   the clusters are printed.
+ *
+ *   The work on each subset of leaves can be limited with --max-splits <n> (unstable
+ *   components split), --max-frames <n> (recursive calls) and --time-limit <seconds>.
+ *   A subset whose check runs out of the budget is left undecided, and the distance
+ *   is then given as bounds, with the number of undecided subsets. A network whose
+ *   clusters are found from its displayed trees counts each tree as a recursive call,
+ *   and has its subsets checked one by one if the trees run out of the budget.
+ *
+ *   To get the hardwired cluster distance and quick bounds on the soft distance instead:
+ *                           ./srfd --triage <network_file1_name> <network_file2_name>
+ *
+ *   To get the distances between every pair of networks, each distinct network being
+ *   evaluated once:
+ *                           ./srfd --pairs <network_file1_name> <network_file2_name> ...
+ *   A file may hold several networks, separated by lines with a single ';'.
+ *   Compiled with -fopenmp, the networks are parsed and evaluated on all cores.
+ *   Two networks are the same if they differ only in the labels of internal nodes and
+ *   the order of edges; they are recognised by a 128-bit hash of a canonical form.
+ *
+ *   With -c <cache_dir> first, the soft clusters of each network are kept in the cache
+ *   directory, keyed by the 128-bit hash of its canonical form, and a network seen
+ *   before is not evaluated again. The form is kept with the clusters and compared,
+ *   so that two networks with the same hash are not mistaken for one another.
+ *   The least recently used entries are removed when it grows over CACHE_LIMIT bytes.
+ *
+ *   -c, --list and the budget options only apply to the distance between two networks;
+ *   the other modes reject them.
 
+ *   The network files may be gzip-compressed.
+ *
  *   The network is represented as a set of edges, each on
  *   a line. For example, this is a file of the input network
  *      1 2
@@ -35,9 +75,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>		/* for CHAR_BIT */
+#include <ctype.h>
+#include <zlib.h>		/* to read compressed input */
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>	/* for flock */
+#include <fcntl.h>
 
 #define WLEN (sizeof(unsigned int) * CHAR_BIT)
-#define BITMASK(b) (1 << ((b) % WLEN))
+#define BITMASK(b) (1U << ((b) % WLEN))
 #define BITSLOT(b) ((b) / WLEN)
 #define BITSET(a, b) ((a)[BITSLOT(b)] |= BITMASK(b))
 #define BITCLEAR(a, b) ((a)[BITSLOT(b)] &= ~BITMASK(b))
@@ -53,15 +101,34 @@
 #define INNER 4
 #define CROSS 5
 #define REVISED 6
+/* the node types as label ranges, once Renumber_Nodes has ordered the nodes */
+#define IS_LEAF(x) ((unsigned int) (x) < (unsigned int) context.first_ret)
+#define IS_RET(x) ((unsigned int) ((x) - context.first_ret) \
+		< (unsigned int) (context.first_tree - context.first_ret))
 #define MAXDEGREE 20
 #define MAXSIZE  350
 #define MAXEDGE  500
+#define CACHE_LIMIT (64L << 20)	/* bytes kept in the result cache directory */
+#define CANONICAL_BASIS (((unsigned __int128) 0x6c62272e07bb0142ULL << 64) \
+		| 0x62b821756295c58dULL)	/* the 128-bit FNV-1a offset basis */
+#define UNKNOWN 30	/* the query ran out of its budget before being decided */
+#define MAXTREERET 15	/* the most reticulations for finding the clusters from the displayed trees */
+#define NO_LIST 0
+#define LIST_NAMES 1
+#define LIST_MASK 2
 
 struct lnode {
 	int leaf;
 	struct lnode *next;
 };
 
+/* a file of the cache directory, for eviction */
+struct cache_entry {
+	char *path;
+	long size;
+	struct timespec used;	/* when it was last read or written */
+};
+
 struct arb_tnode { /* arbitrary tree node */
 	int label;
 	int flag;
@@ -74,6 +141,7 @@ struct components {
 	int inner;
 	int size;	// used for copying network with array
 	int no_tree_node; // used for checking degenerate case
+	int visible;	/* whether the root of the component is visible in the input network */
 	struct arb_tnode *tree_com;
 	struct components *next;
 };
@@ -93,6 +161,82 @@ struct network {
 	int *node_type;
 	int *r_nodes;
 	struct components *all_cps;
+	int tree_size;	/* total size of the tree components, for copying */
+	unsigned int **lf_set;	/* the leaves below each node, as a bitset */
+	int *lf_count;	/* the number of leaves below each node */
+	int *cut_head;	/* whether the edge entering a node is a cut edge */
+	int *blob_of;	/* the blob below a cut head, -1 if there is none, -2 if not built */
+	int n_blob;
+	struct network *blobs;
+	int *orig_node;	/* for a blob, the node of the whole network of each node */
+};
+
+/*
+ * The soft clusters of a network, kept along with the network so that they can be
+ * updated after a local edit (adding or removing a reticulation edge, NNI, SPR).
+ * Subsets of leaves are indexed by their leaves as a bit mask.
+ */
+struct cluster_set {
+	struct network net;
+	unsigned int no_res;
+	unsigned int *res;	/* whether each subset is a soft cluster */
+};
+
+/* a network of a batch, as read from its file */
+struct net_input {
+	char *name;
+	int no_nodes;
+	int no_edges;
+	char **node_strings;
+	int *start;
+	int *end;
+};
+
+/*
+ * The network is only read by a query once it is built: what CCP changes as it goes,
+ * the flags and degrees of the reticulations, the edges and the components, is copied
+ * into a query context first. Each thread has its own context, so any number of threads
+ * can query one network at once. A context grows to the largest network it has served
+ * and is kept for the next query.
+ */
+struct query_context {
+	int max_nodes;
+	int max_comps;
+	int max_trees;
+	int first_ret;	/* the labels of its reticulations, see Renumber_Nodes */
+	int first_tree;
+	int *inner_flag;
+	int *lf_below;
+	int *super_deg;
+	int **net_edges;
+	int *edge_rows;	/* the rows of net_edges, one after the other */
+	struct components *network;
+	struct arb_tnode *trees;
+};
+struct query_context context;
+#pragma omp threadprivate(context)
+
+/* a set of clusters, kept as leaf bitsets in an open-addressing hash table */
+struct tree_clusters {
+	int nslots;
+	long size;	/* the number of buckets, a power of 2 */
+	long no;
+	unsigned int *sets;	/* nslots words for each bucket */
+	char *used;
+};
+
+/* a cluster soft in one network only, for listing */
+struct tree_diff {
+	unsigned int *set;
+	int nslots;
+	int side;
+};
+
+/* the leaves of a network before its common pendant subnetworks were collapsed */
+struct leaf_map {
+	int n_l;	/* 0 if nothing was collapsed */
+	char **names;	/* the leaves, in the order of the leaves of a network */
+	char **rep;	/* for each, the name of the leaf standing for it after the collapse */
 };
 
 // Used to keep track of sorted index
@@ -102,6 +246,26 @@ struct temp_node{
 	int index;
 };
 
+char *cache_dir = NULL;	/* where the soft clusters of networks are cached, if set */
+
+/* the work allowed to each query of a subset of leaves, 0 for no limit */
+struct budget {
+	int max_break;	/* splits of unstable components */
+	long max_frames;	/* calls of Cluster_Containment */
+	double max_seconds;	/* wall-clock time */
+};
+
+/* the work done so far by the query being run */
+struct query_work {
+	long no_frames;
+	double deadline;
+	int exhausted;
+};
+
+struct budget budget;
+struct query_work query;
+#pragma omp threadprivate(query)
+
 int tnode_comparator(const void *v1, const void *v2)
 {
     const struct temp_node *p1 = (struct temp_node *)v1;
@@ -161,26 +325,6 @@ struct lnode *ListExtend(struct lnode *list, int lf) {
 }
 
 
-struct arb_tnode *Search_Revised(struct arb_tnode *tree, int node) {
-	struct arb_tnode *p;
-	int i, deg;
-
-	if (tree != NULL) {
-		if (tree->label == node)
-			return tree;
-		else {
-			deg = tree->no_children;
-			p = NULL;
-			for (i = 0; i < deg; i++) {
-				p = Search_Revised((tree->child)[i], node);
-				if (p != NULL)
-					return p;
-			}
-		}
-	}
-	return NULL;
-}
-
 int Is_In(int elt, int ambig[], int n) {
 	int i;
 
@@ -190,6 +334,13 @@ int Is_In(int elt, int ambig[], int n) {
 	return -1;
 }
 
+/* same as Is_In for the input leaves, kept as a bitset */
+int Is_In_B(int leaf, unsigned int in_cluster[]) {
+	if (leaf >= 0 && BITTEST(in_cluster, leaf))
+		return 1;
+	return -1;
+}
+
 int Is_In_Str(char* node, char* leaves[], int n) {
 	int i;
 
@@ -199,70 +350,6 @@ int Is_In_Str(char* node, char* leaves[], int n) {
 	return 0;
 }
 
-/* mark forbidden nodes in the multi-labelled tree */
-void Mark_Revised(struct arb_tnode *tree, int leaf, int *no_mark) {
-	int i, deg, x, y;
-
-	if (tree == NULL)
-		return;
-	else {
-		deg = tree->no_children;
-		if (deg == 0 && tree->label == leaf) {
-			tree->flag = 1;
-			*no_mark += 1;
-			return;
-		}
-		x = 0;
-		y = -1;
-		for (i = 0; i < deg; i++) {
-			if (Search_Revised((tree->child)[i], leaf) != NULL) {
-				x = x + 1;
-				y = i;
-			}
-		}
-		if (x == 1) {
-			tree->flag = 1;
-			*no_mark += 1;
-			Mark_Revised((tree->child)[y], leaf, no_mark);
-		} else if (x > 1) {
-			tree->flag = 1;
-			*no_mark += 1;
-			return;
-		} else
-			return;
-	}
-}
-
-void Find_Vmax(struct arb_tnode *tree, int vmax[], int *no_vmax) {
-	int i, k, y, deg;
-
-	if (tree == NULL)
-		return;
-	else {
-		if (tree->flag == 1) {
-			deg = tree->no_children;
-			for (i = 0; i < deg; i++) {
-				if ((tree->child)[i]->flag == 0) {
-					y = 0;
-					for (k = 0; k < *no_vmax; k++) {
-						if (vmax[k] == (tree->child)[i]->label) {
-							y = -1;
-							break;
-						}
-					}
-					if (y == 0) {
-						vmax[*no_vmax] = (tree->child)[i]->label;
-						*no_vmax = 1 + *no_vmax;
-					}
-				} else {
-					Find_Vmax((tree->child)[i], vmax, no_vmax);
-				}
-			}
-		}
-	}
-	return;
-}
-
 int Count_Child(struct lnode *p) {
 	if (p == NULL)
 		return 0;
@@ -359,40 +446,55 @@ void Print_Comp_Revised(struct arb_tnode *tree, char *node_strings[]) {
 	}
 }
 
-int Is_In_Comp(struct arb_tnode *tree, int node) {
+/* collect the reticulations at the leaves of a component tree, return how many were found */
+int Comp_Rets(struct arb_tnode *tree, int node_type[], int rets[]) {
 	int i, k;
 
-	k = 0;
-	if (tree != NULL) {
-		if (tree->no_children == 0) {
-			if (node == tree->label)
-				k = 1;
-			else
-				k = 0;
-		} else {
-			for (i = 0; i < tree->no_children; i++) {
-				k = k + Is_In_Comp((tree->child)[i], node);
-			}
-		}
-	} else
-		k = 0;
-
-	if (k > 0)
-		return 1;
-	else
+	if (tree == NULL)
 		return 0;
+	if (tree->no_children == 0) {
+		if (node_type[tree->label] != RET)
+			return 0;
+		rets[0] = tree->label;
+		return 1;
+	}
+	k = 0;
+	for (i = 0; i < tree->no_children; i++)
+		k += Comp_Rets((tree->child)[i], node_type, rets + k);
+	return k;
 }
 
-void Initiallize(struct arb_tnode *tree) {
-	int i, deg;
+/*
+ * Build the trees of the components and count, for each reticulation, the components
+ * having it at a leaf (its super degree).
+ * The components do not depend on each other once the reticulations are known, so they
+ * are built on all cores; each lists its own reticulations, and the lists are summed up
+ * afterwards, a reticulation counting once per component however often it appears.
+ */
+void Build_Components(struct components *cps[], int no_comps,
+		struct lnode *child_array[], int node_type[], int no_nodes, int super_deg[]) {
+	int *rets[no_comps], no_rets[no_comps], last[no_nodes];
+	int i, j;
 
-	if (tree != NULL) {
-		tree->flag = 0;
-		deg = tree->no_children;
-		for (i = 0; i < deg; i++)
-			Initiallize((tree->child)[i]);
-	} else
-		return;
+	#pragma omp parallel for schedule(dynamic)
+	for (j = 0; j < no_comps; j++) {
+		Build_Comp_Revised(cps[j]->tree_com, child_array, node_type, no_nodes,
+				&cps[j]->size, &cps[j]->no_tree_node);
+		rets[j] = (int *) malloc((cps[j]->size + 1) * sizeof(int));
+		no_rets[j] = Comp_Rets(cps[j]->tree_com, node_type, rets[j]);
+	}
+
+	for (i = 0; i < no_nodes; i++)
+		last[i] = -1;
+	for (j = 0; j < no_comps; j++) {
+		for (i = 0; i < no_rets[j]; i++) {
+			if (last[rets[j][i]] != j) {
+				super_deg[rets[j][i]] += 1;
+				last[rets[j][i]] = j;
+			}
+		}
+		free(rets[j]);
+	}
 }
 
 void PostTrans_Revised(struct arb_tnode *tree, struct arb_tnode *postList[],
@@ -417,41 +519,117 @@ void PrintList_Revised(struct arb_tnode *postList[], char *names[], int no) {
 	printf("\n");
 }
 
-int Check_List(int list_a[], int no, int b) {
-	int i;
-	for (i = 0; i < no; i++) {
-		if (list_a[i] == b)
-			return i;
+/*
+ * Check whether the input leaves are the cluster of some node of a stable component,
+ * once its reticulations are replaced by leaves (a reticulation may leave several copies).
+ * A node is forbidden if all copies of a stable leaf not in B are below it, since
+ * that leaf cannot be moved away from it. Return the highest node that is not
+ * forbidden and has all the input leaves below it, or -1.
+ * This is one pass over the component with per-node counts of the input leaves,
+ * so subtrees with no input leaves or no forbidden leaf are not searched again.
+ */
+int Find_Cluster_Node(struct arb_tnode *tree, int no, int sleaves[], int no_slf,
+		int ambig[], int no_ambig, unsigned int in_cluster[], int no1, int n_l) {
+	int nslots = BITNSLOTS(n_l);
+	struct arb_tnode *pre[no], *x;
+	int parent[no], depth[no], forb[no], stack[no], first[n_l], last[n_l];
+	unsigned int in_b[no][nslots];
+	int i, j, k, n, top, u, v, leaf, count;
+
+	for (i = 0; i < n_l; i++)
+		first[i] = -1;
+
+	/* list the nodes in pre-order */
+	n = 0;
+	top = 0;
+	pre[n] = tree;
+	parent[n] = -1;
+	depth[n] = 0;
+	stack[top++] = n++;
+	while (top > 0) {
+		u = stack[--top];
+		x = pre[u];
+		forb[u] = 0;
+		for (j = 0; j < nslots; j++)
+			in_b[u][j] = 0;
+		if (x->no_children == 0 && x->label >= 0 && x->label < n_l) {
+			leaf = x->label;
+			if (first[leaf] == -1)
+				first[leaf] = u;
+			last[leaf] = u;
+			if (BITTEST(in_cluster, leaf))
+				BITSET(in_b[u], leaf);
+		}
+		for (i = x->no_children - 1; i >= 0; i--) {
+			pre[n] = (x->child)[i];
+			parent[n] = u;
+			depth[n] = depth[u] + 1;
+			stack[top++] = n++;
+		}
+	}
+
+	/* forbid the ancestors of the lowest common ancestor of the copies of each leaf not in B */
+	for (k = 0; k < no_slf + no_ambig; k++) {
+		leaf = (k < no_slf) ? sleaves[k] : ambig[k - no_slf];
+		if (BITTEST(in_cluster, leaf) || first[leaf] == -1)
+			continue;
+		u = first[leaf];
+		v = last[leaf];
+		while (depth[u] > depth[v])
+			u = parent[u];
+		while (depth[v] > depth[u])
+			v = parent[v];
+		while (u != v) {
+			u = parent[u];
+			v = parent[v];
+		}
+		forb[u] = 1;
+	}
+
+	/* children come after their parent in pre-order */
+	for (u = n - 1; u > 0; u--) {
+		if (forb[u] == 1)
+			forb[parent[u]] = 1;
+		for (j = 0; j < nslots; j++)
+			in_b[parent[u]][j] |= in_b[u][j];
+	}
+
+	for (u = 0; u < n; u++) {
+		if (forb[u] == 1)
+			continue;
+		count = 0;
+		for (j = 0; j < nslots; j++)
+			count += pop(in_b[u][j]);
+		if (count == no1)
+			return pre[u]->label;
 	}
 	return -1;
 }
 
 /*
- check whether the set of input leaves is a cluster of some node a tree component
+ * Read the next word of a file, which may be gzip-compressed: it is decompressed as it
+ * is read. *str is grown to hold the word, *size being its size, so that long node
+ * names are kept whole. Return 0 at the end of the file.
  */
-int DProgram_Revised(char *node_strings[], struct arb_tnode *super_t,
-		int n_embed, int map_nodes[][MAXSIZE], int vmax[], int no_vmax,
-		int input_leaves[], int node_type[]) {
-	int i, j, k, x;
-	struct arb_tnode *p;
-	/* each node in the cluster corresponds to a column */
-	/* each node in V_max corresponds to a row */
-	for (j = 0; j < no_vmax; j++) {
-		k = 0;
-		p = Search_Revised(super_t, vmax[j]);
-		for (i = 0; i < n_embed; i++) {
-			x = Is_Below(p, input_leaves[i], node_type);
-			if (x == 1) {
-				map_nodes[j][i] = 1;
-				k += 1;
-			}
-		}
-		/* B is a cluster of some node if there is one row of 1 */
-		if (k == n_embed) {
-			return vmax[j];
+int Read_Word(gzFile in, char **str, int *size) {
+	int c, n;
+
+	do
+		c = gzgetc(in);
+	while (c != -1 && isspace(c));
+	n = 0;
+	while (1) {
+		if (n + 1 >= *size) {
+			*size = *size > 0 ? 2 * *size : 32;
+			*str = (char *) realloc(*str, *size);
 		}
+		if (c == -1 || isspace(c))
+			break;
+		(*str)[n++] = c;
+		c = gzgetc(in);
 	}
-	return -1;
+	(*str)[n] = '\0';
+	return n > 0;
 }
 
 int Check_Name(char *node_strings[], int no_nodes, char *str1) {
@@ -518,28 +696,6 @@ int Is_Below_revised(int ret_x, int y, struct lnode *parent_array[],
 		return -1;
 }
 
-/* if a leaf y is below a node p */
-int Is_Below(struct arb_tnode *p, int y, int node_type[]) {
-	int i, x;
-
-	x = p->label;
-	if (node_type[x] == LEAVE) {
-		if (x == y) {
-			return 1;
-		} else {
-			return 0;
-		}
-	}
-
-	for (i = 0; i < p->no_children; i++) {
-		if (Is_Below((p->child)[i], y, node_type) == 1) {
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
 /*determine if all the parents of node is in a component */
 int Is_Inner_Revised(int node, struct lnode *parent_array[], int node_type[],
 		int no_nodes) {
@@ -568,49 +724,87 @@ int Is_Inner_Revised(int node, struct lnode *parent_array[], int node_type[],
 }
 
 
-int Is_Tree_Component(int rnode, int node_type[], struct lnode *child_array[]){
-	struct lnode *p;
-	p = child_array[rnode];
-	int res=0;
-	while (p != NULL) {
-		if (node_type[p->leaf] == LEAVE){
-		}
-		else if (node_type[p->leaf] == RET){ // There is a reticulate node below current reticulate node
-			return 1;
+/*
+ * A node is visible if some leaf can only be reached from the root through it, that is,
+ * if it dominates a leaf. Compute the immediate dominators in topological order, the
+ * dominator of a node with several parents being the lowest common dominator of its
+ * parents, then mark the nodes with a leaf below them in the dominator tree.
+ */
+void Visible_Nodes(int no_nodes, int root, struct lnode *child_array[],
+		struct lnode *parent_array[], int node_type[], int visible[]) {
+	int order[no_nodes], indeg[no_nodes], idom[no_nodes], depth[no_nodes];
+	int i, u, v, head, tail;
+	struct lnode *q;
+
+	for (i = 0; i < no_nodes; i++) {
+		indeg[i] = 0;
+		for (q = parent_array[i]; q != NULL; q = q->next)
+			indeg[i] += 1;
+		visible[i] = 0;
+	}
+	head = 0;
+	tail = 0;
+	order[tail++] = root;
+	idom[root] = root;
+	depth[root] = 0;
+	while (head < tail) {
+		u = order[head++];
+		if (u != root) {
+			q = parent_array[u];
+			v = q->leaf;
+			for (q = q->next; q != NULL; q = q->next) {
+				i = q->leaf;
+				while (v != i) {
+					if (depth[v] > depth[i])
+						v = idom[v];
+					else
+						i = idom[i];
+				}
+			}
+			idom[u] = v;
+			depth[u] = depth[v] + 1;
 		}
-		else // if(node_type[p->leaf] == TREE)
-		{
-			res= Is_Tree_Component(p->leaf, node_type, child_array);
-			if (res==1) return 1;
+		for (q = child_array[u]; q != NULL; q = q->next) {
+			indeg[q->leaf] -= 1;
+			if (indeg[q->leaf] == 0)
+				order[tail++] = q->leaf;
 		}
-		p = p->next;
 	}
-		return res;
+
+	for (i = tail - 1; i >= 0; i--) {
+		u = order[i];
+		if (node_type[u] == LEAVE)
+			visible[u] = 1;
+		if (visible[u] == 1)
+			visible[idom[u]] = 1;
+	}
 }
 
+/*
+ * The root of the tree component of each node: the node itself for a reticulation or
+ * the root, else the reticulation or the root found going up through tree nodes.
+ * Each node is walked over once, the nodes on the way up taking the root found.
+ */
+void Component_Roots(int no_nodes, struct lnode *parent_array[], int node_type[],
+		int comp_root[]) {
+	int path[no_nodes];
+	int i, k, v;
 
-void Count_Ret_Child(int rnode, int *count, int *flag, int *size, int n_r, int orig_rnodes[], int node_type[], struct lnode *child_array[]){
-	struct lnode *p;
-	p = child_array[rnode];
-	while (p != NULL) {
-		if (node_type[p->leaf] == LEAVE){
-			*size +=1;
-		}
-		else if (node_type[p->leaf] == RET){
-			*count += 1;
-			if (Is_In(p->leaf, orig_rnodes, n_r)==-1)
-			{
-				*flag+=1;
-			}
-		}
-		else // if(node_type[p->leaf] == TREE)
-		{
-			*size +=1;
-			Count_Ret_Child(p->leaf, count, flag, size, n_r, orig_rnodes, node_type, child_array);
+	for (i = 0; i < no_nodes; i++)
+		comp_root[i] = -1;
+	for (i = 0; i < no_nodes; i++) {
+		k = 0;
+		v = i;
+		while (comp_root[v] == -1 && node_type[v] != RET && node_type[v] != ROOT
+				&& parent_array[v] != NULL) {
+			path[k++] = v;
+			v = parent_array[v]->leaf;
 		}
-		p = p->next;
+		if (comp_root[v] == -1)
+			comp_root[v] = v;
+		while (k > 0)
+			comp_root[path[--k]] = comp_root[v];
 	}
-		return;
 }
 
 int Is_Empty(int n_r, int r_nodes[]){
@@ -629,6 +823,34 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 	int k = 0;
 	int size = 0;
 	struct lnode *p;
+	int comp_root[no_nodes], no_ret_child[no_nodes], comp_size[no_nodes], pending[no_nodes];
+	struct lnode *ret_child[no_nodes];
+
+	/*
+	 * Find once, for each tree component, its reticulate children and the number of its
+	 * other nodes, instead of walking the component again at every level.
+	 */
+	Component_Roots(no_nodes, parent_array, node_type, comp_root);
+	for (i = 0; i < no_nodes; i++) {
+		no_ret_child[i] = 0;
+		comp_size[i] = 0;
+		ret_child[i] = NULL;
+		pending[i] = 0;
+	}
+	for (i = 0; i < no_nodes; i++) {
+		if (node_type[i] != RET && node_type[i] != TREE)
+			continue;
+		for (p = child_array[i]; p != NULL; p = p->next) {
+			if (node_type[p->leaf] == RET) {
+				no_ret_child[comp_root[i]] += 1;
+				ret_child[comp_root[i]] = ListExtend(ret_child[comp_root[i]], p->leaf);
+			} else
+				comp_size[comp_root[i]] += 1;
+		}
+	}
+	for (i = 0; i < n_r; i++)
+		if (orig_rnodes[i] != -2)
+			pending[orig_rnodes[i]] = 1;
 
 	// Move reticulate nodes just above a single leaf to front
 	j = 0;
@@ -646,6 +868,7 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		}
 		if (flag == 0) {
 			r_nodes[j] = orig_rnodes[i];
+			pending[orig_rnodes[i]] = 0;
 			orig_rnodes[i] = -2;	// not consider this node later
 			j = j + 1;
 		}
@@ -654,9 +877,9 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 	// Moving reticulate nodes with only tree nodes
 	for (i = 0; i < n_r; i++) {
 		if (orig_rnodes[i]==-2) continue;
-		flag =  Is_Tree_Component(orig_rnodes[i], node_type, child_array);
-		if (flag == 0) {
+		if (no_ret_child[orig_rnodes[i]] == 0) {
 			r_nodes[j] = orig_rnodes[i];
+			pending[orig_rnodes[i]] = 0;
 			orig_rnodes[i] = -2;
 			j = j + 1;
 		}
@@ -668,10 +891,12 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		k=0;	// store the real size of the array
 		for (i = 0; i < n_r; i++) {
 			if (orig_rnodes[i]==-2) continue;
-			count = 0;	// Count the number of reticulate children
+			count = no_ret_child[orig_rnodes[i]];	// Count the number of reticulate children
 			flag = 0;	// Count the number of reticulate children which have been resolved
-			size = 0;
-			Count_Ret_Child(orig_rnodes[i], &count, &flag, &size, n_r, orig_rnodes, node_type, child_array);
+			for (p = ret_child[orig_rnodes[i]]; p != NULL; p = p->next)
+				if (pending[p->leaf] == 0)
+					flag += 1;
+			size = comp_size[orig_rnodes[i]];
 			if (flag > 0 && flag == count) {
 				struct temp_node tnode;
 				tnode.index = i;
@@ -683,16 +908,25 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		qsort(level_ret, k, sizeof(struct temp_node), tnode_comparator);
 		for (i = 0; i < k; i++){
 			r_nodes[j++] = level_ret[i].pnode;
+			pending[level_ret[i].pnode] = 0;
 			orig_rnodes[level_ret[i].index] = -2;	//update later to avoid handling reticulate nodes at a higher level
 		}
 	}
+
+	for (i = 0; i < no_nodes; i++) {
+		while (ret_child[i] != NULL) {
+			p = ret_child[i];
+			ret_child[i] = p->next;
+			free(p);
+		}
+	}
 }
 
 
 /* replace a reticulation by a leaf */
 /* leaf_set: stable leaves, no_lf: no. of stable leaves */
 void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
-		int node_type[], int leaf_below[], int leaf_set[], int *no_lf,
+		int leaf_below[], int leaf_set[], int *no_lf,
 		int ambig[], int *no_ambig, int optional[], int *no_opt,
 		char *node_strings[], int *rpl_comp, int super_deg[]) {
 	int i, k, j, x, y;
@@ -701,7 +935,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 		return;
 	if (tree != NULL) {
 		if (tree->no_children == 0) {
-			if (node_type[tree->label] == LEAVE) {
+			if (IS_LEAF(tree->label)) {
 				i = *no_lf;
 				y = 0;
 
@@ -715,7 +949,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 					leaf_set[*no_lf] = tree->label;
 					*no_lf = 1 + *no_lf;
 				}
-			} else if (node_type[tree->label] == RET) {
+			} else if (IS_RET(tree->label)) {
 				if(leaf_below[tree->label] == -2) return;
 				if (inner_flag[tree->label] == INNER) {
 					x = tree->label;
@@ -805,7 +1039,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 			/* non leaf */
 		} else {
 			for (i = 0; i < tree->no_children; i++) {
-				Replace_Ret_Revised((tree->child)[i], inner_flag, node_type,
+				Replace_Ret_Revised((tree->child)[i], inner_flag,
 						leaf_below, leaf_set, no_lf, ambig, no_ambig, optional,
 						no_opt, node_strings, rpl_comp, super_deg);
 			}
@@ -817,8 +1051,8 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 
 void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 		int start1[], int end1[], int no_edges1) {
-	int count, count1, i, j, x, y, k;
-	char str1[50];
+	int count, count1, i, j, x, y;
+	char *name;
 
 	count = 0;
 	for (i = 0; i < no1; i++) {
@@ -826,15 +1060,9 @@ void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 			count1 = node_type1[count];
 			node_type1[count] = LEAVE;
 			node_type1[i] = count1;
-			strcpy(str1, leave_names[count]);
-			k = strlen(leave_names[i]);
-			free(leave_names[count]);
-			leave_names[count] = (char *) malloc(k + 1);
-			strcpy(leave_names[count], leave_names[i]);
-			k = strlen(str1);
-			free(leave_names[i]);
-			leave_names[i] = (char *) malloc(k + 1);
-			strcpy(leave_names[i], str1);
+			name = leave_names[count];
+			leave_names[count] = leave_names[i];
+			leave_names[i] = name;
 			x = -1;
 			y = -1;
 			for (j = 0; j < no_edges1; j++) {
@@ -868,22 +1096,18 @@ void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 /* if any leaf is not in the network, report -1 */
 int Move_Leaves_Front(char *ntk_names[], int no, int start[], int end[],
 		int no_edges, char *leave_names[], int n_l) {
-	char str1[20];
+	char *name;
 	int i, j, k, count;
 
 	for (i = 0; i < n_l; i++) {
 		count = 0;
 		for (j = 0; j < no; j++) {
 			if (strcmp(leave_names[i], ntk_names[j]) == 0) {
-				strcpy(str1, ntk_names[i]);
-				free(ntk_names[i]);
-				k = strlen(ntk_names[j]);
-				ntk_names[i] = (char *) malloc(k + 1);
-				strcpy(ntk_names[i], ntk_names[j]);
-				free(ntk_names[j]);
-				k = strlen(str1);
-				ntk_names[j] = (char *) malloc(k + 1);
-				strcpy(ntk_names[j], str1);
+				if (j == i)	// already in front
+					break;
+				name = ntk_names[i];
+				ntk_names[i] = ntk_names[j];
+				ntk_names[j] = name;
 
 				for (k = 0; k < no_edges; k++) {
 					if (start[k] == i) {
@@ -925,22 +1149,91 @@ int Move_Leaves_Front(char *ntk_names[], int no, int start[], int end[],
 	return 0;
 }
 
+/*
+ * Renumber the nodes so that the per-node arrays are read in order during a traversal:
+ * the leaves keep their labels at the front, the reticulations follow in the order
+ * they are reached, then the tree nodes of each component in post-order.
+ * The search then tells a leaf or a reticulation from its label, see IS_LEAF and IS_RET.
+ */
+void Renumber_Nodes(char *ntk_names[], int no, int start[], int end[],
+		int no_edges, int n_l) {
+	int indeg[no], first[no], pos[no], label[no], stack[no], comp[no];
+	int next[no_edges];
+	char *names[no];
+	int i, j, k, u, v, top, no_comp, n_ret, n_tree;
+
+	for (i = 0; i < no; i++) {
+		indeg[i] = 0;
+		first[i] = -1;
+		label[i] = -1;
+	}
+	for (k = no_edges - 1; k >= 0; k--) {
+		next[k] = first[start[k]];
+		first[start[k]] = k;
+		indeg[end[k]] += 1;
+	}
+	n_tree = n_l;
+	no_comp = 0;
+	for (i = 0; i < no; i++) {
+		if (i < n_l)
+			label[i] = i;
+		else if (indeg[i] > 1)
+			n_tree += 1;
+		else if (indeg[i] == 0)
+			comp[no_comp++] = i;
+	}
+
+	/* each component is rooted at the root or at a reticulation */
+	n_ret = n_l;
+	for (j = 0; j < no_comp; j++) {
+		top = 0;
+		stack[top++] = comp[j];
+		pos[comp[j]] = first[comp[j]];
+		while (top > 0) {
+			u = stack[top - 1];
+			k = pos[u];
+			if (k == -1) {
+				top -= 1;
+				if (label[u] == -1)
+					label[u] = n_tree++;
+				continue;
+			}
+			pos[u] = next[k];
+			v = end[k];
+			if (label[v] != -1)
+				continue;
+			if (indeg[v] > 1) {
+				label[v] = n_ret++;
+				comp[no_comp++] = v;
+			} else {
+				stack[top++] = v;
+				pos[v] = first[v];
+			}
+		}
+	}
+	for (i = 0; i < no; i++) {
+		if (label[i] == -1)
+			label[i] = n_tree++;
+		names[label[i]] = ntk_names[i];
+	}
+	for (i = 0; i < no; i++)
+		ntk_names[i] = names[i];
+	for (k = 0; k < no_edges; k++) {
+		start[k] = label[start[k]];
+		end[k] = label[end[k]];
+	}
+}
+
 void Sort_Leaves(char *ntk_names[], int n_l, int start[], int end[],
 		int no_edges) {
 	int i, j, k;
-	char str1[20];
+	char *name;
 	for (i = 0; i < n_l; i++)
 		for (j = i + 1; j < n_l; j++) {
 			if (strcmp(ntk_names[i], ntk_names[j]) > 0) {
-				strcpy(str1, ntk_names[i]);
-				free(ntk_names[i]);
-				k = strlen(ntk_names[j]);
-				ntk_names[i] = (char *) malloc(k + 1);
-				strcpy(ntk_names[i], ntk_names[j]);
-				free(ntk_names[j]);
-				k = strlen(str1);
-				ntk_names[j] = (char *) malloc(k + 1);
-				strcpy(ntk_names[j], str1);
+				name = ntk_names[i];
+				ntk_names[i] = ntk_names[j];
+				ntk_names[j] = name;
 
 				for (k = 0; k < no_edges; k++) {
 					if (start[k] == i) {
@@ -1030,7 +1323,7 @@ int Node_Type_Inform(int node_type[], int r_nodes[], int no_nodes, int start[],
 			node_type[i] = RET;
 			n_r = n_r + 1;
 		}
-		if (in > 1 && out > 1) {
+		if (in > 1 && out != 1) {
 			check_node = check_node + 1;
 		}
 	}
@@ -1070,7 +1363,7 @@ int Node_Type_Inform1(int node_type[], int no_nodes, int start[], int end[],
 		if (in > 1 && out == 1) {
 			node_type[i] = RET;
 		}
-		if (in > 1 && out > 1) {
+		if (in > 1 && out != 1) {
 			check_node = check_node + 1;
 		}
 	}
@@ -1081,26 +1374,25 @@ int Node_Type_Inform1(int node_type[], int no_nodes, int start[], int end[],
 }
 
 /* The component is stable if it contains a leaf or a reticulation node below it is 'INNER' */
-int Is_Stable(struct arb_tnode *comp_ptr, int node_type[], int inner_flag[],
+int Is_Stable(struct arb_tnode *comp_ptr, int inner_flag[],
 		int lf_below[]) {
 	int i, deg;
 
 	if (comp_ptr == NULL)
 		return -1;
 	else {
-		if (node_type[comp_ptr->label] == LEAVE)
+		if (IS_LEAF(comp_ptr->label))
 			return 1;
-		else if (node_type[comp_ptr->label] == RET) {
+		else if (IS_RET(comp_ptr->label)) {
 			if (inner_flag[comp_ptr->label] == INNER
 					&& lf_below[comp_ptr->label] >= 0)
 				return 1;
 			else
 				return 0;
-		} else if (node_type[comp_ptr->label] == TREE
-				|| node_type[comp_ptr->label] == ROOT) {
+		} else {
 			deg = comp_ptr->no_children;
 			for (i = 0; i < deg; i++) {
-				if (Is_Stable((comp_ptr->child)[i], node_type, inner_flag,
+				if (Is_Stable((comp_ptr->child)[i], inner_flag,
 						lf_below) == 1)
 					return 1;
 			}
@@ -1110,22 +1402,22 @@ int Is_Stable(struct arb_tnode *comp_ptr, int node_type[], int inner_flag[],
 }
 
 /* lf_below_comp: the leaves below the component (to simply the component) */
-void Find_UnStable(struct arb_tnode *comp_ptr, int input_leaves[], int no_leaf,
+void Find_UnStable(struct arb_tnode *comp_ptr, unsigned int in_cluster[],
 		int unstb_rets_in[], int *no_rets_in, int unstb_rets_out[],
-		int *no_rets_out, int node_type[], int inner_flag[], int lf_below[], int lf_in_comp[], int *no_in_lfb, int lf_out_comp[], int *no_out_lfb) {
+		int *no_rets_out, int inner_flag[], int lf_below[], int lf_in_comp[], int *no_in_lfb, int lf_out_comp[], int *no_out_lfb) {
 	int i, deg;
 
 	if (comp_ptr == NULL)
 		return;
 	else {
-		if (node_type[comp_ptr->label] == LEAVE){ // should not occur, since the component is invisible
+		if (IS_LEAF(comp_ptr->label)){ // should not occur, since the component is invisible
 			return;
 		}
-		else if (node_type[comp_ptr->label] == RET) {
+		else if (IS_RET(comp_ptr->label)) {
 			if (inner_flag[comp_ptr->label] == CROSS) {
 				int leaf = lf_below[comp_ptr->label];
 				if (leaf == -2) return;
-				if (Is_In(leaf, input_leaves, no_leaf) == 1) {
+				if (BITTEST(in_cluster, leaf)) {
 					unstb_rets_in[*no_rets_in] = comp_ptr->label;
 					*no_rets_in = *no_rets_in + 1;
 					lf_in_comp[*no_in_lfb] = leaf;
@@ -1137,13 +1429,12 @@ void Find_UnStable(struct arb_tnode *comp_ptr, int input_leaves[], int no_leaf,
 					*no_out_lfb = *no_out_lfb + 1;
 				}
 			}
-		} else if (node_type[comp_ptr->label] == TREE
-				|| node_type[comp_ptr->label] == ROOT) {
+		} else {
 			deg = comp_ptr->no_children;
 			for (i = 0; i < deg; i++) {
-				Find_UnStable((comp_ptr->child)[i], input_leaves, no_leaf,
+				Find_UnStable((comp_ptr->child)[i], in_cluster,
 						unstb_rets_in, no_rets_in, unstb_rets_out, no_rets_out,
-						node_type, inner_flag, lf_below, lf_in_comp, no_in_lfb, lf_out_comp, no_out_lfb);
+						inner_flag, lf_below, lf_in_comp, no_in_lfb, lf_out_comp, no_out_lfb);
 			}
 		}
 		return;
@@ -1195,6 +1486,7 @@ void *Make_Current_Network(struct components *p, int no_comp,
 		network[i].inner = ptr->inner;
 		network[i].size = ptr->size;
 		network[i].no_tree_node = ptr->no_tree_node;
+		network[i].visible = ptr->visible;
 		//printf("copy trees\n");
 		if (ptr->size == 0){
 			network[i].tree_com = NULL;
@@ -1241,6 +1533,96 @@ void Destroy_Network(struct components *cmp) {
 	}
 }
 
+/* count the nodes below a node */
+int Count_Below(struct arb_tnode *tree) {
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < tree->no_children; i++)
+		n += 1 + Count_Below(tree->child[i]);
+	return n;
+}
+
+/*
+ * Contract the subtree below a node into its first leaf, see Contract_Tree.
+ * The nodes below it belong to the copy of the query, so they are not freed.
+ */
+void Contract_Leaf(struct arb_tnode *tree, int *size) {
+	struct arb_tnode *x;
+
+	for (x = tree; x->no_children > 0; x = x->child[0])
+		;
+	*size -= Count_Below(tree);
+	tree->no_children = 0;
+	tree->label = x->label;
+}
+
+/*
+ * Within a query, a subtree with no reticulation below it whose leaves are all
+ * in B or all outside B is a single leaf: it stays whole in every displayed tree.
+ * Contract every such subtree below a node of a component into its first leaf.
+ * The other leaves keep their bits in B, as the search still reads them in the
+ * network, but no longer count in *no1. Return the number of leaves below the
+ * node, with those in B in *no_in, or -1 if a reticulation is below it, as the
+ * caller contracts the highest nodes.
+ */
+int Contract_Tree(struct arb_tnode *tree, unsigned int in_cluster[], int *no_in,
+		int *no1, int *size) {
+	int no_lf[MAXDEGREE], in[MAXDEGREE];
+	int i, n;
+
+	*no_in = 0;
+	if (tree->no_children == 0) {
+		if (!IS_LEAF(tree->label))
+			return -1;
+		if (BITTEST(in_cluster, tree->label))
+			*no_in = 1;
+		return 1;
+	}
+	n = 0;
+	for (i = 0; i < tree->no_children; i++) {
+		no_lf[i] = Contract_Tree(tree->child[i], in_cluster, &in[i], no1, size);
+		if (no_lf[i] == -1 || n == -1)
+			n = -1;
+		else
+			n += no_lf[i];
+		*no_in += in[i];
+	}
+	if (n != -1)
+		return n;
+	for (i = 0; i < tree->no_children; i++) {
+		if (no_lf[i] < 2 || (in[i] != 0 && in[i] != no_lf[i]))
+			continue;
+		Contract_Leaf(tree->child[i], size);
+		if (in[i] != 0)
+			*no1 -= no_lf[i] - 1;
+	}
+	return -1;
+}
+
+/*
+ * Contract the subtrees of all components for the query B, so that the search
+ * runs on a network whose size depends on how B cuts it rather than on the
+ * number of leaves. Return the number of leaves of B left.
+ */
+int Contract_Components(struct components *cps, unsigned int in_cluster[],
+		int no1) {
+	struct components *p;
+	int n, no_in;
+
+	for (p = cps; p != NULL; p = p->next) {
+		if (p->tree_com == NULL)
+			continue;
+		n = Contract_Tree(p->tree_com, in_cluster, &no_in, &no1, &p->size);
+		if (n < 2 || (no_in != 0 && no_in != n))
+			continue;
+		Contract_Leaf(p->tree_com, &p->size);
+		if (no_in != 0)
+			no1 -= n - 1;
+	}
+	return no1;
+}
+
 void Free_Lnodes(struct lnode* head) {
 	struct lnode* tmp;
 
@@ -1251,63 +1633,37 @@ void Free_Lnodes(struct lnode* head) {
 	}
 }
 
-void Modify1(struct arb_tnode *p, int node_type[], int unstb_ret,
+/*
+ * Remove the edges into unstb_ret from the component tree below p. The last child of a
+ * node is moved into the slot of a deleted one, so that no compaction loop is needed,
+ * and a node is only looked into if it has children.
+ */
+void Modify1(struct arb_tnode *p, int unstb_ret,
 		int *comp_size, int no_nodes, int **net_edges) {
-	struct arb_tnode *ptr;
-	int i, k, j, deg;
-	struct arb_tnode *tmp;
+	int i;
 
 	if (p == NULL)
 		return;
+	for (i = p->no_children - 1; i >= 0; i--) {
+		if ((p->child)[i]->label == unstb_ret) {
+			net_edges[p->label][unstb_ret] = 0;
+			*comp_size = *comp_size - 1;
+			p->no_children -= 1;
+			(p->child)[i] = (p->child)[p->no_children];
+			(p->child)[p->no_children] = NULL;
+		} else if ((p->child)[i]->no_children > 0)
+			Modify1((p->child)[i], unstb_ret, comp_size, no_nodes, net_edges);
+	}
+}
 
-	if (node_type[p->label] == LEAVE) {
-		return;
-	} else if (node_type[p->label] == RET) {
-		return;
-	} else if (node_type[p->label] == TREE || node_type[p->label] == ROOT) {
-		deg = p->no_children;
-		for (i = 0; i < deg; i++) {
-			ptr = (p->child)[i];
-			if (ptr->label == unstb_ret) {
-//				tmp = (p->child)[i];
-//				Destroy_Arbtree(tmp);
-				// printf("delete edge %d\t%d\n", p->label, ptr->label);
-				net_edges[p->label][ptr->label]=0;
-				(p->child)[i] = NULL;
-				*comp_size = *comp_size - 1;
-			} else {
-				Modify1((p->child)[i], node_type, unstb_ret, comp_size, no_nodes, net_edges);
-			}
-		}
-
-		k = deg;
-		for (i = 0; i < deg; i++) {
-			if ((p->child)[i] == NULL)
-				k = k - 1;
-		}
-
-		p->no_children = k;
-
-		for (i = 0; i < deg; i++) {
-			if ((p->child)[i] == NULL) {
-				j = i + 1;
-				while ((p->child)[j] == NULL && j < deg)
-					j = j + 1;
-				(p->child)[i] = (p->child)[j];
-				(p->child)[j] = NULL;
-			}
-		}
-	}
-}
-
-void Modify2(struct components *p, int node_type[], int x, int no_nodes, int **net_edges) {
+void Modify2(struct components *p, int x, int no_nodes, int **net_edges) {
 	struct components *p_copy;
 
 	if (p != NULL) {
 		p_copy = p;
 		while (p_copy != NULL) {
 			if (p_copy->tree_com != NULL)
-				Modify1(p_copy->tree_com, node_type, x, &p_copy->size, no_nodes, net_edges);
+				Modify1(p_copy->tree_com, x, &p_copy->size, no_nodes, net_edges);
 			p_copy = p_copy->next;
 		}
 	}
@@ -1317,7 +1673,7 @@ void Modify2(struct components *p, int node_type[], int x, int no_nodes, int **n
  *	For network pointed by p, remove all parents of unstb_ret in other components. (The size of these other components reduce by 1)
  * For network pointed by p1, exclude current component from new network. (The size of current component reduce by 1)
  */
-void Modify(struct components *p, struct components *p1, int node_type[],
+void Modify(struct components *p, struct components *p1,
 		int unstb_ret, int no_nodes, int **net_edges, int **net_edges1) {
 	struct components *ptr;
 	//struct arb_tnode *tmp;
@@ -1337,7 +1693,7 @@ void Modify(struct components *p, struct components *p1, int node_type[],
 				ptr->size = ptr->size - 1;
 			} else {
 				// search the ret node recursively in the tree comp
-				Modify1(ptr->tree_com, node_type, unstb_ret, &ptr->size, no_nodes, net_edges);
+				Modify1(ptr->tree_com, unstb_ret, &ptr->size, no_nodes, net_edges);
 			}
 		}
 		ptr = ptr->next;
@@ -1353,7 +1709,7 @@ void Modify(struct components *p, struct components *p1, int node_type[],
 		p1->tree_com = NULL;
 		p1->size = p1->size - 1;
 	} else {
-		Modify1(p1->tree_com, node_type, unstb_ret, &p1->size, no_nodes, net_edges1);
+		Modify1(p1->tree_com, unstb_ret, &p1->size, no_nodes, net_edges1);
 	}
 }
 
@@ -1382,7 +1738,7 @@ void Print_tree11(struct arb_tnode *tree, int node_type[],
 }
 
 /* all the ret nodes have been replaced by leaves */
-void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
+void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp,
 		char *node_strings[]) {
 	int i, x, y;
 
@@ -1391,7 +1747,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 	if (tree != NULL) {
 		if (tree->no_children == 0) {
 			x = tree->label;
-			if (node_type[x] == LEAVE) {
+			if (IS_LEAF(x)) {
 				/* the leaf is used to replace ret node */
 				if (rpl_comp[x] >= 0) {
 					/* y is the child of tree->label, parent of x */
@@ -1403,7 +1759,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 			/* non leaf */
 		} else {
 			for (i = 0; i < tree->no_children; i++) {
-				Rebuilt_Component((tree->child)[i], rpl_comp, node_type,
+				Rebuilt_Component((tree->child)[i], rpl_comp,
 						node_strings);
 			}
 			return;
@@ -1412,7 +1768,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 }
 
 void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
-		int node_type[], int* optional, char* node_strings[], int* in_cluster,
+		int* optional, char* node_strings[], unsigned int *in_cluster,
 		struct components* p, int no_nodes, int **net_edges) {
 	int i, x;
 	/* remove edges entering CR(C) */
@@ -1420,11 +1776,11 @@ void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
 		x = lf_below[r_nodes[i]];
 		if (x >= 0) {
 			if (Is_In(x, optional, no_opt) == 1) {
-				if (in_cluster[x] == 1) {
-					Modify2(p->next, node_type, r_nodes[i], no_nodes, net_edges);
+				if (BITTEST(in_cluster, x)) {
+					Modify2(p->next, r_nodes[i], no_nodes, net_edges);
 					lf_below[r_nodes[i]] = -2;
-				} else if (in_cluster[x] == 0) {
-					Modify1(p->tree_com, node_type, r_nodes[i], &p->size, no_nodes, net_edges);
+				} else {
+					Modify1(p->tree_com, r_nodes[i], &p->size, no_nodes, net_edges);
 				}
 			}
 		}
@@ -1432,17 +1788,17 @@ void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
 }
 
 void Modify_Cross_Ret1(int n_r, int lf_below[], int r_nodes[], int no_opt,
-		int node_type[], int* optional, char* node_strings[], int* in_cluster,
+		int* optional, char* node_strings[], unsigned int *in_cluster,
 		struct components* p, int no_nodes, int **net_edges) {
 	int i, x;
 	for (i = 0; i < n_r; i++) {
 		x = lf_below[r_nodes[i]];
 		if (x >= 0 && Is_In(x, optional, no_opt) == 1) {
-			if (in_cluster[x] == 0) {
-				Modify2(p->next, node_type, r_nodes[i], no_nodes, net_edges);
+			if (!BITTEST(in_cluster, x)) {
+				Modify2(p->next, r_nodes[i], no_nodes, net_edges);
 				lf_below[r_nodes[i]] = -2;
-			} else if (in_cluster[x] == 1) {
-				Modify1(p->tree_com, node_type, r_nodes[i], &p->size, no_nodes, net_edges);
+			} else {
+				Modify1(p->tree_com, r_nodes[i], &p->size, no_nodes, net_edges);
 			}
 		}
 	}
@@ -1468,7 +1824,7 @@ int Count_Parent(int child, struct lnode *parent_array[], int no_nodes, int **ne
 
 // Check whether it is feasible for the subtree below a node to display the input cluster
 // indicator -- to show whether the leaf should be in the input or not. For 1st network, indicator=1. For 2nd network, indicator=-1.
-int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int no1, int input_leaves[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
+int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, unsigned int in_cluster[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
 	struct lnode *parent_array[], int **net_edges)
 {
 	int i;
@@ -1481,22 +1837,22 @@ int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int
 		if (a_leaf==curr_leaf){child = child->next; continue;}
 		if (net_edges[parent][a_leaf]==0 ){child = child->next; continue;}
 
-		if (node_type[a_leaf]==RET)
+		if (IS_RET(a_leaf))
 		{
 			int l_below = lf_below[a_leaf];
 			if (l_below!=-2 && l_below==curr_leaf) {child = child->next; continue;}
 			num_parent = Count_Parent(a_leaf, parent_array, no_nodes, net_edges);
 			if(num_parent>=2 && l_below==-2) return 1;	// reticulate node that has not been processed
-			if(num_parent<=1 && Is_In(l_below, input_leaves, no1) == indicator) return 0;
+			if(num_parent<=1 && Is_In_B(l_below, in_cluster) == indicator) return 0;
 		}
-		else if (node_type[a_leaf]==LEAVE)
+		else if (IS_LEAF(a_leaf))
 		{
-			if (Is_In(a_leaf, input_leaves, no1) == indicator){
+			if (Is_In_B(a_leaf, in_cluster) == indicator){
 				return 0;
 			}
 		}
 		else{ // TREE node, traverse until leaves
-			return Is_Feasible_Node(a_leaf, curr_leaf, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+			return Is_Feasible_Node(a_leaf, curr_leaf, indicator, no_nodes, in_cluster, inner_flag, lf_below, node_strings, child_array,
 				parent_array, net_edges);
 		}
 		// printf("Go to next child\n");
@@ -1507,7 +1863,7 @@ int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int
 
 
 // Check whether to continue running on one network
-int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int input_leaves[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
+int To_Run_Network(int unstb_ret, int indicator, int no_nodes, unsigned int in_cluster[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
 	struct lnode *parent_array[], int **net_edges){
 	int to_run=1;
 	int curr_leaf = lf_below[unstb_ret];
@@ -1519,7 +1875,7 @@ int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int inpu
 			continue;	// The edge has been deleted
 		}
 
-		to_run = Is_Feasible_Node(parent->leaf, curr_leaf, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+		to_run = Is_Feasible_Node(parent->leaf, curr_leaf, indicator, no_nodes, in_cluster, inner_flag, lf_below, node_strings, child_array,
 			parent_array, net_edges);
 		if (to_run==0)	break;
 
@@ -1528,34 +1884,67 @@ int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int inpu
 	return to_run;
 }
 
+double Wall_Clock() {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* reset the work done before a query is run */
+void Start_Query() {
+	query.no_frames = 0;
+	query.exhausted = 0;
+	if (budget.max_seconds > 0)
+		query.deadline = Wall_Clock() + budget.max_seconds;
+}
+
+/*
+ * Count a call of Cluster_Containment against the budget of the query, reading the
+ * clock only every 256 calls. Return 1 once the budget is exhausted.
+ */
+int Over_Budget(int no_break) {
+	query.no_frames += 1;
+	if (query.exhausted == 1)
+		return 1;
+	if ((budget.max_break > 0 && no_break > budget.max_break)
+			|| (budget.max_frames > 0 && query.no_frames > budget.max_frames)
+			|| (budget.max_seconds > 0 && (query.no_frames & 255) == 0
+					&& Wall_Clock() > query.deadline))
+		query.exhausted = 1;
+	return query.exhausted;
+}
+
 int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 		int no_nodes, int node_type[], int inner_flag[], int lf_below[],
-		char *node_strings[], int no1, int *input_leaves, int* in_cluster,
+		char *node_strings[], int no1, unsigned int *in_cluster,
 		int super_deg[], struct components *cps, struct lnode *child_array[], struct lnode *parent_array[], int **net_edges,
 		int n_l, int *no_break) {
 	int i, j;
 	int no, no_slf, no_ambig, no_opt;
 
 	int nlf_kept; /* no. of leaves to keep in B */
-	int no_vmax, no_mark;
 
 	struct components *p, *p_copy;
 	struct components *p1, *whole_copy;
 	int unstb_ret;
 	int no1_1;	// copy of no1
 	int res, is_cluster, num_inleaf, count_in, count_out;
+	int nslots = BITNSLOTS(n_l);
 
 	p = ptr;
 	if (p == NULL)
 		return 0;
+	if (Over_Budget(*no_break) == 1)
+		return UNKNOWN;
 
 	if (p->tree_com == NULL) {
-		Modify2(p->next, node_type, p->ret_node, no_nodes, net_edges);
+		Modify2(p->next, p->ret_node, no_nodes, net_edges);
 		return Cluster_Containment(p->next, r_nodes, n_r, no_nodes, node_type,
-				inner_flag, lf_below, node_strings, no1, input_leaves,
-				in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l, no_break);
+				inner_flag, lf_below, node_strings, no1, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l, no_break);
 	}
-	else if (Is_Stable(p->tree_com, node_type, inner_flag, lf_below) == 1) {
+	else if (p->visible == 1
+			|| Is_Stable(p->tree_com, inner_flag, lf_below) == 1) {
 		struct arb_tnode* postList[2 * no_nodes];
 		no = 0;
 		PostTrans_Revised(p->tree_com, postList, &no);
@@ -1569,7 +1958,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 		}
 
 		/* build a tree from the component */
-		Replace_Ret_Revised(p->tree_com, inner_flag, node_type, lf_below,
+		Replace_Ret_Revised(p->tree_com, inner_flag, lf_below,
 				sleaves, &no_slf, ambig, &no_ambig, optional, &no_opt,
 				node_strings, rpl_comp, super_deg);
 
@@ -1587,54 +1976,27 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 		if (no_slf > 0) {
 			if(no_opt == 0 && no_slf == 1 ){	// There are only one stable leaf below the component
-				if (no1 == 1 && sleaves[0] == input_leaves[0]){
+				if (no1 == 1 && BITTEST(in_cluster, sleaves[0])){
 					return 50;
 				}
 				else{	// There are more than one input leaves
 					lf_below[p->ret_node] = sleaves[0];
 					return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+							in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 							no_break);
 				}
 			}
 			else	// There are more than one stable leaves below the component
 			{
-				/* mark nodes and find Vmax */
-				Initiallize(p->tree_com);
-				no_mark = 0;
-				no_vmax = 0;
-				/* mark ambiguous leaves */
-				for (i = 0; i < no_ambig; i++) {
-					if (in_cluster[ambig[i]] == 0) {
-						Mark_Revised(p->tree_com, ambig[i], &no_mark);
-					}
-				}
-				/* mark a leaf that is neither ambiguous nor optional */
-				for (i = 0; i < no_slf; i++) {
-					if (Check_List(ambig, no_ambig, sleaves[i]) == -1
-							&& in_cluster[sleaves[i]] == 0) {
-						Mark_Revised(p->tree_com, sleaves[i], &no_mark);
-					}
-				}
-
-				int vmax[no];
-				if (no_mark == 0) {
-					vmax[0] = p->tree_com->label;
-					no_vmax = 1;
-				} else {
-					Find_Vmax(p->tree_com, vmax, &no_vmax);
-				}
-
-				int map_nodes[no_vmax][MAXSIZE];
-				is_cluster = DProgram_Revised(node_strings, p->tree_com, no1,
-						map_nodes, vmax, no_vmax, input_leaves, node_type);
-				Rebuilt_Component(p->tree_com, rpl_comp, node_type, node_strings);
+				is_cluster = Find_Cluster_Node(p->tree_com, no, sleaves, no_slf,
+						ambig, no_ambig, in_cluster, no1, n_l);
+				Rebuilt_Component(p->tree_com, rpl_comp, node_strings);
 			}
 
 			if (is_cluster >= 0) {
 				/* remove edges entering CR(C) for visualization */
-				Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt, node_type,
+				Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
 						optional, node_strings, in_cluster, p, no_nodes, net_edges);
 				return 50;
 			} else {
@@ -1648,80 +2010,69 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 					lf_below[p->ret_node] = sleaves[0];
 				}
 
+				unsigned int slf_set[nslots], opt_set[nslots];
+				for (j = 0; j < nslots; j++) {
+					slf_set[j] = 0;
+					opt_set[j] = 0;
+				}
+				for (i = 0; i < no_slf; i++)
+					BITSET(slf_set, sleaves[i]);
+				for (i = 0; i < no_opt; i++)
+					BITSET(opt_set, optional[i]);
+
 				count_out = 0;
 				count_in = 0;
-				for (i = 0; i < no_slf; i++) {
-					if (in_cluster[sleaves[i]] == 0) {
-						count_out += 1;
-					} else if (in_cluster[sleaves[i]] == 1) {
-						count_in += 1;
-					}
+				for (j = 0; j < nslots; j++) {
+					count_out += pop(slf_set[j] & ~in_cluster[j]);
+					count_in += pop(slf_set[j] & in_cluster[j]);
 				}
 
 				/* L and B are disjoint */
-				if (count_out == no_slf) {
-					Modify_Cross_Ret1(n_r, lf_below, r_nodes, no_opt, node_type,
+				if (count_in == 0) {
+					Modify_Cross_Ret1(n_r, lf_below, r_nodes, no_opt,
 							optional, node_strings, in_cluster, p, no_nodes, net_edges);
 					return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps,
+							in_cluster, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 				/* L and notB are disjoint */
-				else if (count_in == no_slf) {
+				else if (count_out == 0) {
 					/* check whether B^==B */
 					num_inleaf = 0;
-					for (i = 0; i < no_slf; i++) {
-						if (in_cluster[sleaves[i]] == 1)
-							num_inleaf += 1;
-					}
-					for (i = 0; i < no_opt; i++) {
-						if (in_cluster[optional[i]] == 1)
-							num_inleaf += 1;
-					}
+					for (j = 0; j < nslots; j++)
+						num_inleaf += pop((slf_set[j] | opt_set[j]) & in_cluster[j]);
 
 					if (num_inleaf == no1) {
 						/* remove edges related to CR(C) */
 						Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
-								node_type, optional, node_strings, in_cluster,
+								optional, node_strings, in_cluster,
 								p, no_nodes, net_edges);
 						return 50;
 					}
 					/* remove edges related to CR(C) */
-					Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt, node_type,
+					Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
 							optional, node_strings, in_cluster, p, no_nodes, net_edges);
 
-					/* decrease B */
+					/* decrease B by the leaves removed, see Contract_Tree */
 					if (no_slf + no_opt > 1){
-						int input_leaves1[no1];
-						nlf_kept = 0;
-						for (i = 0; i < no1; i++) {
-							if (Is_In(input_leaves[i], sleaves, no_slf) == -1
-									&& Is_In(input_leaves[i], optional, no_opt)
-											== -1) {
-								input_leaves1[nlf_kept++] = input_leaves[i];
-							}
-						}
-						input_leaves1[nlf_kept++] = sleaves[0];
-						no1 = nlf_kept;
-
-						/* revise in_cluster */
-						int in_cluster1[n_l];
-						for (i = 0; i < n_l; i++) {
-							in_cluster1[i] = in_cluster[i];
-							if (Is_In(i, input_leaves1, no1) == -1) {
-								in_cluster1[i] = 0;
-							}
+						unsigned int in_cluster1[nslots];
+						nlf_kept = no1;
+						for (j = 0; j < nslots; j++) {
+							in_cluster1[j] = in_cluster[j] & ~(slf_set[j] | opt_set[j]);
+							nlf_kept -= pop(in_cluster[j] & ~in_cluster1[j]);
 						}
+						BITSET(in_cluster1, sleaves[0]);
+						no1 = nlf_kept + 1;
 						res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 								node_type, inner_flag, lf_below, node_strings, no1,
-								input_leaves1, in_cluster1, super_deg, cps,
+								in_cluster1, super_deg, cps,
 								child_array, parent_array, net_edges, n_l, no_break);
 					}
 					else{
 						res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 								node_type, inner_flag, lf_below, node_strings, no1,
-								input_leaves, in_cluster, super_deg, cps,
+								in_cluster, super_deg, cps,
 								child_array, parent_array, net_edges, n_l, no_break);
 					}
 
@@ -1739,12 +2090,12 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			}
 		} else {
 			//  Empty Component
-			Rebuilt_Component(p->tree_com, rpl_comp, node_type, node_strings);
+			Rebuilt_Component(p->tree_com, rpl_comp, node_strings);
 			unstb_ret = p->tree_com->label;
-			Modify(p->next, NULL, node_type, unstb_ret, no_nodes, net_edges, NULL);
+			Modify(p->next, NULL, unstb_ret, no_nodes, net_edges, NULL);
 			return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 					node_type, inner_flag, lf_below, node_strings, no1,
-					input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+					in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 					no_break);
 		}
 	}
@@ -1757,11 +2108,11 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 		int unstb_rets_in[n_r];
 		int unstb_rets_out[n_r];
-		int lf_in_comp[no1];
-		int lf_out_comp[no1];
+		int lf_in_comp[n_r];
+		int lf_out_comp[n_r];
 
-		Find_UnStable(p->tree_com, input_leaves, no1, unstb_rets_in,
-				&no_rets_in, unstb_rets_out, &no_rets_out, node_type,
+		Find_UnStable(p->tree_com, in_cluster, unstb_rets_in,
+				&no_rets_in, unstb_rets_out, &no_rets_out,
 				inner_flag, lf_below, lf_in_comp, &no_in_lfb, lf_out_comp, &no_out_lfb);
 
 		// check whether leaves below current component equals to B
@@ -1820,7 +2171,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 						inner_flag1[unstb_ret] = CROSS;
 					}
 				}
-				Modify(p, p1, node_type, unstb_ret, no_nodes, net_edges, net_edges1);
+				Modify(p, p1, unstb_ret, no_nodes, net_edges, net_edges1);
 			}
 
 			for (i = 0; i < no_rets_out; i++) {
@@ -1837,18 +2188,13 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 						inner_flag[unstb_ret] = CROSS;
 					}
 				}
-				Modify(p1, p, node_type, unstb_ret, no_nodes, net_edges1, net_edges);
+				Modify(p1, p, unstb_ret, no_nodes, net_edges1, net_edges);
 			}
 
 			/* copy data for spliting */
-			int input_leaves_orig[no1];
-			int in_cluster_orig[n_l];
-			for (i = 0; i < n_l; i++) {
-				in_cluster_orig[i] = in_cluster[i];
-			}
-			for (i = 0; i < no1; i++) {
-				input_leaves_orig[i] = input_leaves[i];
-			}
+			unsigned int in_cluster_orig[nslots];
+			for (j = 0; j < nslots; j++)
+				in_cluster_orig[j] = in_cluster[j];
 			no1_1 = no1;
 
 			*no_break = *no_break + 1;
@@ -1897,7 +2243,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			// not run the 1st network if there is a node which has children in both B and not B
 			for (i = 0; i < no_rets_out; i++) {
 				unstb_ret = unstb_rets_out[i];
-				run_1st = To_Run_Network(unstb_ret, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+				run_1st = To_Run_Network(unstb_ret, indicator, no_nodes, in_cluster, node_type, inner_flag, lf_below, node_strings, child_array,
 				parent_array, net_edges);
 				if(run_1st==0) break;
 			}
@@ -1905,7 +2251,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			indicator = -1;
 			for (i = 0; i < no_rets_in; i++) {
 				unstb_ret = unstb_rets_in[i];
-				run_2nd = To_Run_Network(unstb_ret, indicator, no_nodes, no1_1, input_leaves_orig, node_type, inner_flag1, lf_below1, node_strings, child_array,
+				run_2nd = To_Run_Network(unstb_ret, indicator, no_nodes, in_cluster_orig, node_type, inner_flag1, lf_below1, node_strings, child_array,
 				parent_array, net_edges1);
 				if (run_2nd==0) break;
 			}
@@ -1918,34 +2264,26 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			if (run_1st == 1)
 			{
 				if(no_in_lfb > 1){
-					/* decrease B */
-					int input_leaves1[no1];
-					nlf_kept = 0;
-					for (i = 0; i < no1; i++) {
-						if (Is_In(input_leaves[i], lf_in_comp, no_in_lfb) == -1) {
-							input_leaves1[nlf_kept++] = input_leaves[i];
-						}
-					}
-					input_leaves1[nlf_kept++] = lf_in_comp[0];
+					/* decrease B by the leaves removed, see Contract_Tree */
+					unsigned int in_cluster1[nslots];
+					for (j = 0; j < nslots; j++)
+						in_cluster1[j] = in_cluster[j];
+					for (i = 0; i < no_in_lfb; i++)
+						BITCLEAR(in_cluster1, lf_in_comp[i]);
+					BITSET(in_cluster1, lf_in_comp[0]);
+					nlf_kept = no1;
+					for (j = 0; j < nslots; j++)
+						nlf_kept -= pop(in_cluster[j] & ~in_cluster1[j]);
 					no1 = nlf_kept;
-
-					/* revise in_cluster */
-					int in_cluster1[n_l];
-					for (i = 0; i < n_l; i++) {
-						in_cluster1[i] = in_cluster[i];
-						if (Is_In(i, input_leaves1, no1) == -1) {
-							in_cluster1[i] = 0;
-						}
-					}
 					res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves1, in_cluster1, super_deg, cps,
+							in_cluster1, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 				else{
 					res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps,
+							in_cluster, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 			}
@@ -1953,17 +2291,17 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 				// Run on 2nd split network
 				res = Cluster_Containment(p1->next, r_nodes, n_r, no_nodes, node_type,
 					inner_flag1, lf_below1, node_strings, no1_1,
-					input_leaves_orig, in_cluster_orig, super_deg1,
+					in_cluster_orig, super_deg1,
 					whole_copy, child_array, parent_array, net_edges1, n_l, no_break);
 			}
 			free(net_edges1);
 			return res;
 		}
 		else {
-			Modify2(p->next, node_type, p->ret_node, no_nodes, net_edges);
+			Modify2(p->next, p->ret_node, no_nodes, net_edges);
 			return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 					node_type, inner_flag, lf_below, node_strings, no1,
-					input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+					in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 					no_break);
 		}
 	}
@@ -1997,172 +2335,414 @@ void Print_Network(struct network *net) {
 	 }*/
 }
 
+/* set the query context of this thread from a network, making it big enough first */
+struct query_context *Reset_Context(struct network *net) {
+	struct query_context *ctx = &context;
+	int n = net->no_nodes;
+	int i;
+
+	if (n > ctx->max_nodes) {
+		free(ctx->inner_flag);
+		free(ctx->lf_below);
+		free(ctx->super_deg);
+		free(ctx->net_edges);
+		free(ctx->edge_rows);
+		ctx->inner_flag = (int *) malloc(n * sizeof(int));
+		ctx->lf_below = (int *) malloc(n * sizeof(int));
+		ctx->super_deg = (int *) malloc(n * sizeof(int));
+		ctx->net_edges = (int **) malloc(n * sizeof(int *));
+		ctx->edge_rows = (int *) malloc(n * n * sizeof(int));
+		ctx->max_nodes = n;
+	}
+	if (net->n_r + 1 > ctx->max_comps) {
+		free(ctx->network);
+		ctx->network = (struct components *) malloc((net->n_r + 1)
+				* sizeof(struct components));
+		ctx->max_comps = net->n_r + 1;
+	}
+	if (net->tree_size > ctx->max_trees) {
+		free(ctx->trees);
+		ctx->trees = (struct arb_tnode *) malloc(net->tree_size
+				* sizeof(struct arb_tnode));
+		ctx->max_trees = net->tree_size;
+	}
+
+	ctx->first_ret = net->n_l;
+	ctx->first_tree = net->n_l + net->n_r;
+	memcpy(ctx->inner_flag, net->inner_flag, n * sizeof(int));
+	memcpy(ctx->lf_below, net->lf_below, n * sizeof(int));
+	memcpy(ctx->super_deg, net->super_deg, n * sizeof(int));
+	for (i = 0; i < n; i++) {
+		ctx->net_edges[i] = ctx->edge_rows + i * n;
+		memcpy(ctx->net_edges[i], net->net_edges[i], n * sizeof(int));
+	}
+	return ctx;
+}
+
+/*
+ * run CCP for a subset of leaves on a copy of the components of a network
+ */
+int Run_CCP(struct network *net, int r, unsigned int in_cluster[]) {
+	struct query_context *ctx;
+	struct components *cps, *p;
+	int no_break, res;
+
+	no_break = 0;
+	ctx = Reset_Context(net);
+	int tree_index = 0;
+	Make_Current_Network((net->all_cps), net->n_r + 1, ctx->network, ctx->trees,
+			&tree_index);
+	cps = &ctx->network[0];
+	r = Contract_Components(cps, in_cluster, r);
+
+	p = cps;
+	if (net->n_r > 0) {
+		while (net->node_type[p->ret_node] != ROOT
+				&& net->node_type[(net->child_array[p->ret_node])->leaf]
+						== LEAVE) {
+			p = p->next;
+		}
+	}
+	Start_Query();
+	res = Cluster_Containment(p, net->r_nodes, net->n_r, net->no_nodes,
+			net->node_type, ctx->inner_flag, ctx->lf_below, net->node_strings, r,
+			in_cluster, ctx->super_deg, cps, net->child_array, net->parent_array,
+			ctx->net_edges, net->n_l, &no_break);
+	/* a cluster found is found, whatever was left unexplored */
+	if (res != 50 && query.exhausted == 1)
+		res = UNKNOWN;
+	return res;
+}
+
+/*
+ * Count the leaves of B and all the leaves below each node of the displayed tree
+ * in which ret keeps only its edge from p. Return a node whose cluster is B, or -1.
+ */
+int Galled_Count(int u, int p, int ret, struct lnode *child_array[],
+		unsigned int in_b[], int no1, int no_in[], int no_all[]) {
+	struct lnode *q;
+	int x, found;
+
+	found = -1;
+	no_in[u] = 0;
+	no_all[u] = 0;
+	if (child_array[u] == NULL) {
+		no_all[u] = 1;
+		if (BITTEST(in_b, u))
+			no_in[u] = 1;
+		return -1;
+	}
+	for (q = child_array[u]; q != NULL; q = q->next) {
+		x = q->leaf;
+		if (x == ret && u != p)
+			continue;
+		if (found == -1)
+			found = Galled_Count(x, p, ret, child_array, in_b, no1, no_in, no_all);
+		else
+			Galled_Count(x, p, ret, child_array, in_b, no1, no_in, no_all);
+		no_in[u] += no_in[x];
+		no_all[u] += no_all[x];
+	}
+	if (found == -1 && no_in[u] == no1 && no_all[u] == no1)
+		found = u;
+	return found;
+}
+
+/*
+ * CCP for a network with a single reticulation, such as a blob of a level-1 network (galled tree).
+ * Each parent of the reticulation gives one displayed tree, so B is a soft cluster iff
+ * it is the cluster of a node in one of them. B is a bitset over the nodes.
+ * Return 50 or 10 with the node in *node, or 0 if the network has more reticulations.
+ */
+int Galled_Containment(int no_nodes, int root, struct lnode *child_array[],
+		struct lnode *parent_array[], unsigned int in_b[], int no1, int *node) {
+	int no_in[no_nodes], no_all[no_nodes];
+	int i, ret, no_ret;
+	struct lnode *q;
+
+	ret = -1;
+	no_ret = 0;
+	for (i = 0; i < no_nodes; i++) {
+		if (parent_array[i] != NULL && parent_array[i]->next != NULL) {
+			ret = i;
+			no_ret += 1;
+		}
+	}
+	if (no_ret != 1)
+		return 0;
+
+	for (q = parent_array[ret]; q != NULL; q = q->next) {
+		*node = Galled_Count(root, q->leaf, ret, child_array, in_b, no1, no_in,
+				no_all);
+		if (*node != -1)
+			return 50;
+	}
+	return 10;
+}
+
+/*
+ * Resolve a subset of leaves B with the blob decomposition of a network.
+ * Let v be the lowest cut head with B below v. B is a soft cluster iff
+ * B is all the leaves below v, or every other cut head has none or all of
+ * its leaves in B and B is a soft cluster of the blob below v, in which
+ * the cut heads are leaves.
+ * Only a blob with one reticulation is resolved on its own (Galled_Containment).
+ * For the other blobs CCP runs on the whole network: CCP run on a blob alone can
+ * miss a soft cluster (see test/pairs/blob_m2_1.txt).
+ */
+int Blob_Containment(struct network *net, int input_leaves[], int r) {
+	int nslots = BITNSLOTS(net->n_l);
+	unsigned int b[nslots], x;
+	int i, j, v, in, full;
+	struct network *blob;
+
+	for (j = 0; j < nslots; j++)
+		b[j] = 0;
+	for (i = 0; i < r; i++)
+		BITSET(b, input_leaves[i]);
+
+	v = net->root;
+	for (i = 0; i < net->no_nodes; i++) {
+		if (net->cut_head[i] == 0 || net->node_type[i] == LEAVE
+				|| net->lf_count[i] >= net->lf_count[v])
+			continue;
+		for (j = 0; j < nslots; j++)
+			if ((b[j] & ~net->lf_set[i][j]) != 0)
+				break;
+		if (j == nslots)
+			v = i;
+	}
+	if (net->lf_count[v] == r)
+		return 50;
+
+	/* B must not cut the subnetwork below any other cut head */
+	for (i = 0; i < net->no_nodes; i++) {
+		if (net->cut_head[i] == 0 || net->node_type[i] == LEAVE
+				|| net->lf_count[i] >= net->lf_count[v])
+			continue;
+		in = 0;
+		full = 1;
+		for (j = 0; j < nslots; j++) {
+			x = b[j] & net->lf_set[i][j];
+			if (x != 0)
+				in = 1;
+			if (x != net->lf_set[i][j])
+				full = 0;
+		}
+		if (in == 1 && full == 0)
+			return 10;
+	}
+	if (net->blob_of[v] == -1)
+		return 10;
+	if (net->blob_of[v] == -2)
+		return Run_CCP(net, r, b);
+
+	blob = &net->blobs[net->blob_of[v]];
+	int bslots = BITNSLOTS(blob->n_l);
+	unsigned int in_cluster1[bslots];
+	int no1 = 0;
+	for (j = 0; j < bslots; j++)
+		in_cluster1[j] = 0;
+	for (i = 0; i < blob->n_l; i++) {
+		x = blob->orig_node[i];
+		for (j = 0; j < nslots; j++)
+			if ((net->lf_set[x][j] & ~b[j]) != 0)
+				break;
+		if (j == nslots) {
+			BITSET(in_cluster1, i);
+			no1++;
+		}
+	}
+	return Galled_Containment(blob->no_nodes, blob->root, blob->child_array,
+			blob->parent_array, in_cluster1, no1, &v);
+}
+
 /*
  * check whether a subset of leaves is a cluster of a network
+ * The subsets left undecided within the budget are marked in unk1 and unk2.
+ * A network given as NULL is skipped, so the number of leaves n_l is passed on its own.
  */
-void Is_Cluster(int input_leaves[], int r, unsigned int res1[],
-		unsigned int res2[], int *no_res, struct network *net1,
-		struct network *net2, int tree_size1, int tree_size2) {
-	int size = max((*net1).no_nodes, (*net2).no_nodes);
-	int inner_flag[size], lf_below[size], super_deg[size], **net_edges;
-	struct components *cps1, *cps2, *p1, *p2;
-	int no_break, res = 0;
-	int i, j;
-	if (r == 0 || r == net1->n_l) {
+void Is_Cluster(int input_leaves[], int r, int n_l, unsigned int res1[],
+		unsigned int res2[], unsigned int unk1[], unsigned int unk2[],
+		int *no_res, struct network *net1, struct network *net2) {
+	int x;
+
+	if (r == 0 || r == n_l) {
 		return;
 	}
 	if (r == 1) {
 		BITSET(res1, *no_res);
 		BITSET(res2, *no_res);
 	} else {
-		int *in_cluster = (int *) calloc(net1->n_l, sizeof(int));
-		net_edges = malloc((*net1).no_nodes * sizeof(int *));
-		for (i = 0; i < (*net1).no_nodes; ++i)
-				net_edges[i] = malloc((*net1).no_nodes * sizeof(int));
-		// int in_cluster[net1->n_l];
-		for (j = 0; j < r; j++) {
-			in_cluster[input_leaves[j]] = 1;
-		}
-
-		// printf("\ncheck whether this cluster is in the 1st network\n   ");
-		no_break = 0;
-		for (i = 0; i < (*net1).no_nodes; i++) {
-			inner_flag[i] = net1->inner_flag[i];
-			lf_below[i] = net1->lf_below[i];
-			super_deg[i] = net1->super_deg[i];
-			for(j = 0; j < (*net1).no_nodes; j++){
-				net_edges[i][j] = net1->net_edges[i][j];
-			}
-		}
-		// printf("Copy the 1st network\n   ");
-		struct components network1[net1->n_r + 1];
-		struct arb_tnode trees1[tree_size1];
-		int tree_index1 = 0;
-		// cps1 = Make_Current_Network((net1->all_cps));
-		Make_Current_Network((net1->all_cps), net1->n_r + 1, network1, trees1,
-				&tree_index1);
-		cps1 = &network1[0];
-		// Print_Comp_Revised(cps1->tree_com, net1->node_strings);
-		// printf("comp size: %d, no of tree node: %d\n", cps1->size,
-		// 		cps1->no_tree_node);
-		p1 = cps1;
-		if (net1->n_r > 0) {
-			while (net1->node_type[p1->ret_node] != ROOT
-					&& net1->node_type[(net1->child_array[p1->ret_node])->leaf]
-							== LEAVE) {
-				p1 = p1->next;
-			}
-		}
-		// printf("Run CCP\n   ");
-		res = Cluster_Containment(p1, net1->r_nodes, net1->n_r, net1->no_nodes,
-				net1->node_type, inner_flag, lf_below, net1->node_strings, r,
-				input_leaves, in_cluster, super_deg, cps1, net1->child_array, net1->parent_array, net_edges,
-				net1->n_l, &no_break);
-		if (res == 50) {
+		x = (net1 == NULL) ? 0 : Blob_Containment(net1, input_leaves, r);
+		if (x == 50)
 			BITSET(res1, *no_res);
-		}
+		else if (x == UNKNOWN)
+			BITSET(unk1, *no_res);
+		x = (net2 == NULL) ? 0 : Blob_Containment(net2, input_leaves, r);
+		if (x == 50)
+			BITSET(res2, *no_res);
+		else if (x == UNKNOWN)
+			BITSET(unk2, *no_res);
+	}
+	*no_res += 1;
+	return;
+}
 
-		no_break = 0;
-		for (i = 0; i < (*net2).no_nodes; i++) {
-			inner_flag[i] = net2->inner_flag[i];
-			lf_below[i] = net2->lf_below[i];
-			super_deg[i] = net2->super_deg[i];
-			for(j = 0; j < (*net2).no_nodes; j++){
-				net_edges[i][j] = net2->net_edges[i][j];
-			}
+/* collect the leaves below a node into its bitset */
+void Leaf_Set_Below(int node, struct lnode *child_array[], int node_type[],
+		unsigned int *lf_set[], int nslots, int visited[]) {
+	int i;
+	struct lnode *c;
+
+	if (visited[node] == 1)
+		return;
+	visited[node] = 1;
+	if (node_type[node] == LEAVE) {
+		BITSET(lf_set[node], node);
+		return;
+	}
+	c = child_array[node];
+	while (c != NULL) {
+		Leaf_Set_Below(c->leaf, child_array, node_type, lf_set, nslots,
+				visited);
+		for (i = 0; i < nslots; i++)
+			lf_set[node][i] |= lf_set[c->leaf][i];
+		c = c->next;
+	}
+}
+
+/* collect the leaves reached from a node without going through a reticulation */
+void Tree_Leaf_Set(int node, struct network *net, unsigned int *tl_set[],
+		int nslots, int visited[]) {
+	int i;
+	struct lnode *c;
+
+	if (visited[node] == 1)
+		return;
+	visited[node] = 1;
+	if (net->node_type[node] == LEAVE) {
+		BITSET(tl_set[node], node);
+		return;
+	}
+	c = net->child_array[node];
+	while (c != NULL) {
+		if (net->node_type[c->leaf] != RET) {
+			Tree_Leaf_Set(c->leaf, net, tl_set, nslots, visited);
+			for (i = 0; i < nslots; i++)
+				tl_set[node][i] |= tl_set[c->leaf][i];
 		}
+		c = c->next;
+	}
+}
+
+/* the edge entering a tree node is a cut edge iff no node below it has a parent outside the subnetwork below it */
+int Is_Cut_Head(int node, struct lnode *child_array[],
+		struct lnode *parent_array[], int node_type[], int no_nodes) {
+	int below[no_nodes], stack[no_nodes];
+	int i, u, top;
+	struct lnode *q;
 
-		struct components network2[net2->n_r + 1];
-		struct arb_tnode trees2[tree_size2];
-		int tree_index2 = 0;
-		Make_Current_Network((net2->all_cps), net2->n_r + 1, network2, trees2,
-				&tree_index2);
-		cps2 = &network2[0];
+	if (node_type[node] == ROOT || node_type[node] == LEAVE)
+		return 1;
+	if (node_type[node] == RET)
+		return 0;
 
-		p2 = cps2;
-		if (net2->n_r > 0) {
-			while (net2->node_type[p2->ret_node] != ROOT
-					&& net2->node_type[(net2->child_array[p2->ret_node])->leaf]
-							== LEAVE) {
-				p2 = p2->next;
+	for (i = 0; i < no_nodes; i++)
+		below[i] = 0;
+	below[node] = 1;
+	top = 0;
+	stack[top++] = node;
+	while (top > 0) {
+		u = stack[--top];
+		q = child_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0) {
+				below[q->leaf] = 1;
+				stack[top++] = q->leaf;
 			}
+			q = q->next;
 		}
-		res = Cluster_Containment(p2, net2->r_nodes, net2->n_r, net2->no_nodes,
-				net2->node_type, inner_flag, lf_below, net2->node_strings, r,
-				input_leaves, in_cluster, super_deg, cps2, net2->child_array, net2->parent_array, net_edges,
-				net2->n_l, &no_break);
+	}
 
-		if (res == 50) {
-			BITSET(res2, *no_res);
+	for (u = 0; u < no_nodes; u++) {
+		if (below[u] == 0 || u == node)
+			continue;
+		q = parent_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0)
+				return 0;
+			q = q->next;
 		}
-		free(in_cluster);
 	}
-	*no_res += 1;
-	return;
+	return 1;
 }
 
 /*
- * Read the input network
- * Build the tree component
+ * Collect the blob below cut head v, i.e. the nodes reached from v without
+ * passing another cut head. The cut heads met on the way become the leaves of
+ * the blob. blob_node maps the nodes of the blob to the nodes of the network.
  */
-void Preprocess_Network(char *arg, struct network *net) {
-	FILE *ntk_ptr;
+void Extract_Blob(int v, struct lnode *child_array[], int cut_head[],
+		int no_nodes, int blob_node[], int *no_blob_nodes, int start[],
+		int end[], int *no_edges) {
+	int local[no_nodes];
+	int i, u, n, head;
+	struct lnode *q;
+
+	for (i = 0; i < no_nodes; i++)
+		local[i] = -1;
+	local[v] = 0;
+	blob_node[0] = v;
+	n = 1;
+	head = 0;
+	*no_edges = 0;
+	while (head < n) {
+		u = blob_node[head++];
+		if (u != v && cut_head[u] == 1)
+			continue;
+		q = child_array[u];
+		while (q != NULL) {
+			if (local[q->leaf] == -1) {
+				local[q->leaf] = n;
+				blob_node[n++] = q->leaf;
+			}
+			start[*no_edges] = local[u];
+			end[*no_edges] = local[q->leaf];
+			*no_edges += 1;
+			q = q->next;
+		}
+	}
+	*no_blob_nodes = n;
+}
+
+/*
+ * Build the tree components of a network given by its edges.
+ * node_strings are freed after being copied into the network.
+ */
+void Build_Network(char *node_strings[], int no_nodes, int start[], int end[],
+		int no_edges, struct network *net) {
 	int *node_type, *r_nodes, *orig_rnodes;
 	int root;
-	int start[MAXEDGE], end[MAXEDGE];
-	char *node_strings[MAXSIZE];
 	struct lnode **child_array;
 	struct lnode **parent_array;
 	int *lf_below; /* what is the leaf below a reticulation */
 	int *inner_flag; /* whether a ret is inner or cross */
 	int *super_deg;
 	char **net_leaves; /* to denote leaves and move leaves front */
-	int *in_cluster; /*  to indicate whether a network leaf is in the input cluster B or not*/
-	int no_edges, n_t, n_r, n_l, no_nodes; /* n_t: tree nodes, n_r: ret nodes; n_l: no. leaves */
+	int n_r, n_l; /* n_r: ret nodes; n_l: no. leaves */
 	int **net_edges;	// Use adjacency matrix to store all edges to facilitate edge looking up
-
-	int check_leaves;
-	char str1[20], str2[20];
-	int u1, u2;
 	int i, x, j;
 
 	struct components *all_cps, *p;
 
-	/* network processing */
-	ntk_ptr = fopen(arg, "r");
-	if (ntk_ptr == NULL)
-		printf("File %s is not readable\n", arg);
-	no_edges = 0;
-	no_nodes = 0;
-	while (fscanf(ntk_ptr, "%s %s\n", str1, str2) != EOF) {
-		u1 = Check_Name(node_strings, no_nodes, str1);
-		if (u1 == -1) {
-			u1 = no_nodes, no_nodes = 1 + no_nodes;
-			node_strings[u1] = (char *) malloc(strlen(str1) + 1);
-			strcpy(node_strings[u1], str1);
-		}
-		u2 = Check_Name(node_strings, no_nodes, str2);
-		if (u2 == -1) {
-			u2 = no_nodes, no_nodes = 1 + no_nodes;
-			node_strings[u2] = (char *) malloc(strlen(str2) + 1);
-			strcpy(node_strings[u2], str2);
-		}
-		start[no_edges] = u1;
-		end[no_edges] = u2;
-		no_edges += 1;
-	}
-	fclose(ntk_ptr);
-
-	/*	printf("no_nodes: %d\n", no_nodes);
-	 printf("no_edges: %d\n", no_edges);*/
-
 	node_type = (int *) calloc(no_nodes, sizeof(int));
 
 	/* no_edges, no_nodes  */
 	x = Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
 	if (x < 0) {
 		printf("\n the network graph has two or more roots or a node with");
-		printf("\n both in- and out-degree greater than 1;\n Recheck it\n");
+		printf("\n in-degree greater than 1 and out-degree other than 1;\n Recheck it\n");
 		return;
 	}
 
@@ -2193,6 +2773,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 			n_l);
 	//printf("sort leaves.\n");
 	Sort_Leaves(node_strings, n_l, start, end, no_edges);
+	Renumber_Nodes(node_strings, no_nodes, start, end, no_edges, n_l);
 	//printf("inform node type.\n");
 	Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
 
@@ -2225,6 +2806,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 			no_edges);
 	//printf("sort ret nodes.\n");
 	Sort_Rets_By_Level(orig_rnodes, r_nodes, n_r, child_array, parent_array, node_type, no_nodes);
+	free(orig_rnodes);
 
 	inner_flag = (int *) calloc(no_nodes, sizeof(int));
 	for (i = 0; i < no_nodes; i++)
@@ -2247,7 +2829,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 		}
 		((*all_cps).tree_com)->flag = 0;
 		((*all_cps).tree_com)->no_children = 0;
-		for (i = i; i < MAXDEGREE; i++)
+		for (i = 0; i < MAXDEGREE; i++)
 			(((*all_cps).tree_com)->child)[i] = NULL;
 		(*all_cps).next = NULL;
 
@@ -2270,7 +2852,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 		((*all_cps).tree_com)->label = root;
 		((*all_cps).tree_com)->flag = 0;
 		((*all_cps).tree_com)->no_children = 0;
-		for (i = i; i < MAXDEGREE; i++)
+		for (i = 0; i < MAXDEGREE; i++)
 			(((*all_cps).tree_com)->child)[i] = NULL;
 		(*all_cps).next = NULL;
 	}
@@ -2280,20 +2862,19 @@ void Preprocess_Network(char *arg, struct network *net) {
 		super_deg[r_nodes[i]] = 0;
 
 	//printf("build components.\n");
-	p = all_cps;
-	while (p != NULL) {
-		Build_Comp_Revised(p->tree_com, child_array, node_type, no_nodes, &p->size,
-				&p->no_tree_node);
-		for (i = 0; i < n_r; i++) {
-			super_deg[r_nodes[i]] = super_deg[r_nodes[i]]
-					+ Is_In_Comp(p->tree_com, r_nodes[i]);
-		}
-
-		// Print_Comp_Revised(p->tree_com, node_strings);
-		// printf("---size %d--no_tree_node %d\n", p->size, p->no_tree_node);
-
-		p = p->next;
+	int visible[no_nodes];
+	Visible_Nodes(no_nodes, root, child_array, parent_array, node_type, visible);
+	struct components *cps[n_r + 1];
+	j = 0;
+	for (p = all_cps; p != NULL; p = p->next) {
+		p->visible = visible[p->ret_node];
+		cps[j++] = p;
 	}
+	Build_Components(cps, j, child_array, node_type, no_nodes, super_deg);
+
+	net->tree_size = 0;
+	for (p = all_cps; p != NULL; p = p->next)
+		net->tree_size += p->size;
 
 	lf_below = (int *) calloc(no_nodes, sizeof(int));
 	for (i = 0; i < n_r; i++)
@@ -2328,6 +2909,13 @@ void Preprocess_Network(char *arg, struct network *net) {
 	net->root = root;
 	net->super_deg = super_deg;
 	net->net_edges = net_edges;
+	net->lf_set = NULL;
+	net->lf_count = NULL;
+	net->cut_head = NULL;
+	net->blob_of = NULL;
+	net->n_blob = 0;
+	net->blobs = NULL;
+	net->orig_node = NULL;
 
 	for (i = 0; i < n_l; i++) {
 		free(net_leaves[i]);
@@ -2335,49 +2923,697 @@ void Preprocess_Network(char *arg, struct network *net) {
 	free(net_leaves);
 }
 
-void Free_Network(struct network *net) {
-	int i;
-	struct components* p;
+/*
+ * Split the network into blobs at its cut edges.
+ * A blob with one reticulation is built as a network of its own, for
+ * Galled_Containment. A blob with more is not built, as CCP runs on the whole
+ * network for it, and its cut head gets -2 in blob_of.
+ */
+void Decompose_Blobs(struct network *net) {
+	int nslots = BITNSLOTS(net->n_l);
+	int no_nodes = net->no_nodes;
+	int visited[no_nodes], blob_node[no_nodes];
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int i, j, n, v, no_blob_nodes, no_edges;
+	struct lnode *q;
+	struct network *blob;
 
-	/*	Free memory at the end */
-	for (i = 0; i < net->no_nodes; i++) {
-		free(net->node_strings[i]);
+	net->lf_set = (unsigned int **) malloc(no_nodes * sizeof(unsigned int *));
+	net->lf_count = (int *) calloc(no_nodes, sizeof(int));
+	net->cut_head = (int *) calloc(no_nodes, sizeof(int));
+	net->blob_of = (int *) malloc(no_nodes * sizeof(int));
+	for (i = 0; i < no_nodes; i++) {
+		net->lf_set[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited[i] = 0;
+		net->blob_of[i] = -1;
+	}
+	Leaf_Set_Below(net->root, net->child_array, net->node_type, net->lf_set,
+			nslots, visited);
+	for (i = 0; i < no_nodes; i++) {
+		for (j = 0; j < nslots; j++)
+			net->lf_count[i] += pop(net->lf_set[i][j]);
+		net->cut_head[i] = Is_Cut_Head(i, net->child_array, net->parent_array,
+				net->node_type, no_nodes);
 	}
-	free(net->node_strings);
-	free(net->node_type);
-	free(net->r_nodes);
-	free(net->inner_flag);
-	free(net->lf_below);
-	free(net->super_deg);
 
-	for (i = 0; i < net->no_nodes; i++) {
-		Free_Lnodes(net->child_array[i]);
-		Free_Lnodes(net->parent_array[i]);
-		free(net->net_edges[i]);
+	/* a cut head has a blob below it if one of its out-edges is not a cut edge */
+	n = 0;
+	for (v = 0; v < no_nodes; v++) {
+		if (net->cut_head[v] == 0 || net->node_type[v] == LEAVE)
+			continue;
+		q = net->child_array[v];
+		while (q != NULL && net->cut_head[q->leaf] == 1)
+			q = q->next;
+		if (q != NULL)
+			net->blob_of[v] = -2, n++;
 	}
-	free(net->child_array);
-	free(net->parent_array);
-	free(net->net_edges);
 
-	Destroy_Network(net->all_cps);
+	net->n_blob = 0;
+	net->blobs = (struct network *) calloc(n, sizeof(struct network));
+	for (v = 0; v < no_nodes; v++) {
+		if (net->blob_of[v] == -1)
+			continue;
+		Extract_Blob(v, net->child_array, net->cut_head, no_nodes, blob_node,
+				&no_blob_nodes, start, end, &no_edges);
+		n = 0;
+		for (i = 1; i < no_blob_nodes; i++)
+			if (net->node_type[blob_node[i]] == RET)
+				n++;
+		if (n != 1)
+			continue;
+		net->blob_of[v] = net->n_blob++;
+		blob = &net->blobs[net->blob_of[v]];
+		for (i = 0; i < no_blob_nodes; i++) {
+			node_strings[i] = (char *) malloc(
+					strlen(net->node_strings[blob_node[i]]) + 1);
+			strcpy(node_strings[i], net->node_strings[blob_node[i]]);
+		}
+		Build_Network(node_strings, no_blob_nodes, start, end, no_edges, blob);
+		blob->orig_node = (int *) malloc(no_blob_nodes * sizeof(int));
+		for (i = 0; i < no_blob_nodes; i++)
+			blob->orig_node[i] = Check_Name(net->node_strings, no_nodes,
+					blob->node_strings[i]);
+	}
 }
 
-void i4vec_indicator0(int n, int a[]) {
-	int i;
+/*
+ * Read the edges of the input network
+ */
+void Read_Network(char *arg, char *node_strings[], int *no_nodes, int start[],
+		int end[], int *no_edges) {
+	gzFile ntk_ptr;
+	char *str1, *str2;
+	int u1, u2, size1, size2;
 
-	for (i = 0; i < n; i++) {
-		a[i] = i;
+	/* network processing */
+	str1 = NULL, str2 = NULL;
+	size1 = 0, size2 = 0;
+	ntk_ptr = gzopen(arg, "r");
+	if (ntk_ptr == NULL)
+		printf("File %s is not readable\n", arg);
+	*no_edges = 0;
+	*no_nodes = 0;
+	while (Read_Word(ntk_ptr, &str1, &size1) == 1
+			&& Read_Word(ntk_ptr, &str2, &size2) == 1) {
+		u1 = Check_Name(node_strings, *no_nodes, str1);
+		if (u1 == -1) {
+			u1 = *no_nodes, *no_nodes = 1 + *no_nodes;
+			node_strings[u1] = (char *) malloc(strlen(str1) + 1);
+			strcpy(node_strings[u1], str1);
+		}
+		u2 = Check_Name(node_strings, *no_nodes, str2);
+		if (u2 == -1) {
+			u2 = *no_nodes, *no_nodes = 1 + *no_nodes;
+			node_strings[u2] = (char *) malloc(strlen(str2) + 1);
+			strcpy(node_strings[u2], str2);
+		}
+		start[*no_edges] = u1;
+		end[*no_edges] = u2;
+		*no_edges += 1;
 	}
-	return;
-}
+	gzclose(ntk_ptr);
+	free(str1);
+	free(str2);
 
-// generate the subsets of size K from a set of size N.
-void ksub_next(int n, int k, int a[]) {
-	int j;
-	int jsave;
+	/*	printf("no_nodes: %d\n", *no_nodes);
+	 printf("no_edges: %d\n", *no_edges);*/
+}
 
-	if (a[0] < n - k + 1) {
-		jsave = k - 1;
+/*
+ * Read the input network
+ * Build the tree component
+ */
+void Preprocess_Network(char *arg, struct network *net) {
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int no_edges, no_nodes;
+
+	Read_Network(arg, node_strings, &no_nodes, start, end, &no_edges);
+	Build_Network(node_strings, no_nodes, start, end, no_edges, net);
+	Decompose_Blobs(net);
+}
+
+int hash_comparator(const void *v1, const void *v2)
+{
+    const unsigned long long h1 = *(const unsigned long long *)v1;
+    const unsigned long long h2 = *(const unsigned long long *)v2;
+    if (h1 < h2)
+        return -1;
+    else if (h1 > h2)
+        return +1;
+    else
+        return 0;
+}
+
+unsigned long long Mix_Hash(unsigned long long h, unsigned long long x) {
+	h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	return h;
+}
+
+/* hash of the subnetwork below a node unfolded into a tree, leaves hashed by their index */
+unsigned long long Unfold_Hash(int node, struct lnode *child_array[],
+		int node_type[], unsigned long long hash[], int visited[]) {
+	int i, deg;
+	struct lnode *c;
+
+	if (visited[node] == 1)
+		return hash[node];
+	visited[node] = 1;
+	if (node_type[node] == LEAVE) {
+		hash[node] = Mix_Hash(LEAVE, node);
+		return hash[node];
+	}
+	deg = Count_Child(child_array[node]);
+	unsigned long long ch[deg];
+	c = child_array[node];
+	for (i = 0; i < deg; i++) {
+		ch[i] = Unfold_Hash(c->leaf, child_array, node_type, hash, visited);
+		c = c->next;
+	}
+	qsort(ch, deg, sizeof(unsigned long long), hash_comparator);
+	hash[node] = Mix_Hash(node_type[node] == RET ? RET : TREE, deg);
+	for (i = 0; i < deg; i++)
+		hash[node] = Mix_Hash(hash[node], ch[i]);
+	return hash[node];
+}
+
+/*
+ * Match the subnetwork below u1 in the 1st network with the one below u2 in the 2nd.
+ * Children are paired by their hashes; the match fails on equal hashes among siblings.
+ * On success map1 and map2 form an isomorphism that keeps the leaves.
+ */
+int Match_Pendant(int u1, int u2, struct lnode *child_array1[],
+		struct lnode *child_array2[], int node_type1[], int node_type2[],
+		unsigned long long hash1[], unsigned long long hash2[], int map1[],
+		int map2[]) {
+	int i, j, deg;
+	struct lnode *c;
+
+	if (map1[u1] != -1 || map2[u2] != -1)
+		return (map1[u1] == u2 && map2[u2] == u1);
+	if (hash1[u1] != hash2[u2] || node_type1[u1] != node_type2[u2])
+		return 0;
+	if (node_type1[u1] == LEAVE)
+		return (u1 == u2);
+	deg = Count_Child(child_array1[u1]);
+	if (deg != Count_Child(child_array2[u2]))
+		return 0;
+	map1[u1] = u2;
+	map2[u2] = u1;
+
+	int ch1[deg], ch2[deg];
+	c = child_array1[u1];
+	for (i = 0; i < deg; i++, c = c->next)
+		ch1[i] = c->leaf;
+	c = child_array2[u2];
+	for (i = 0; i < deg; i++, c = c->next)
+		ch2[i] = c->leaf;
+	for (i = 0; i < deg; i++) {
+		for (j = 0; j < deg; j++) {
+			if (j != i && hash1[ch1[j]] == hash1[ch1[i]])
+				return 0;
+		}
+		for (j = 0; j < deg; j++) {
+			if (hash2[ch2[j]] == hash1[ch1[i]])
+				break;
+		}
+		if (j == deg)
+			return 0;
+		if (Match_Pendant(ch1[i], ch2[j], child_array1, child_array2,
+				node_type1, node_type2, hash1, hash2, map1, map2) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Replace the subnetwork below each head by a leaf named after the first leaf below it,
+ * and renumber the remaining nodes.
+ */
+void Collapse_Pendants(char *node_strings[], int *no_nodes, int start[],
+		int end[], int *no_edges, int heads[], int no_heads,
+		unsigned int *lf_set[], struct lnode *child_array[]) {
+	int n = *no_nodes;
+	int removed[n], is_head[n], new_id[n], stack[n];
+	int i, k, u, top, rep;
+	struct lnode *q;
+
+	for (i = 0; i < n; i++) {
+		removed[i] = 0;
+		is_head[i] = 0;
+	}
+	for (k = 0; k < no_heads; k++) {
+		is_head[heads[k]] = 1;
+		top = 0;
+		stack[top++] = heads[k];
+		while (top > 0) {
+			u = stack[--top];
+			q = child_array[u];
+			while (q != NULL) {
+				if (removed[q->leaf] == 0) {
+					removed[q->leaf] = 1;
+					stack[top++] = q->leaf;
+				}
+				q = q->next;
+			}
+		}
+		rep = 0;
+		while (BITTEST(lf_set[heads[k]], rep) == 0)
+			rep += 1;
+		free(node_strings[heads[k]]);
+		node_strings[heads[k]] = (char *) malloc(strlen(node_strings[rep]) + 1);
+		strcpy(node_strings[heads[k]], node_strings[rep]);
+	}
+
+	k = 0;
+	for (i = 0; i < n; i++) {
+		if (removed[i] == 1) {
+			free(node_strings[i]);
+			continue;
+		}
+		new_id[i] = k;
+		node_strings[k++] = node_strings[i];
+	}
+	*no_nodes = k;
+
+	k = 0;
+	for (i = 0; i < *no_edges; i++) {
+		if (removed[start[i]] == 1 || is_head[start[i]] == 1)
+			continue;
+		start[k] = new_id[start[i]];
+		end[k] = new_id[end[i]];
+		k += 1;
+	}
+	*no_edges = k;
+}
+
+/*
+ * Find the leaf order, cut heads, leaf sets and hashes of a network given by its edges.
+ * Return the number of leaves, or -1 if it is not a phylogenetic network.
+ */
+int Pendant_Inform(char *node_strings[], int no_nodes, int start[], int end[],
+		int no_edges, int node_type[], struct lnode *child_array[],
+		struct lnode *parent_array[], int cut_head[], unsigned int *lf_set[],
+		int lf_count[], unsigned long long hash[], int nslots) {
+	char *net_leaves[no_nodes];
+	int visited[no_nodes];
+	int i, j, root, n_l;
+
+	if (Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root) < 0)
+		return -1;
+	n_l = 0;
+	for (i = 0; i < no_nodes; i++) {
+		if (node_type[i] == LEAVE) {
+			net_leaves[n_l] = (char *) malloc(strlen(node_strings[i]) + 1);
+			strcpy(net_leaves[n_l], node_strings[i]);
+			n_l += 1;
+		}
+	}
+	Move_Leaves_Front(node_strings, no_nodes, start, end, no_edges, net_leaves,
+			n_l);
+	Sort_Leaves(node_strings, n_l, start, end, no_edges);
+	Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
+	for (i = 0; i < n_l; i++)
+		free(net_leaves[i]);
+	if ((int) BITNSLOTS(n_l) > nslots)
+		return -1;
+
+	Child_Parent_Inform(child_array, parent_array, no_nodes, start, end,
+			no_edges);
+	for (i = 0; i < no_nodes; i++) {
+		lf_set[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited[i] = 0;
+	}
+	Leaf_Set_Below(root, child_array, node_type, lf_set, nslots, visited);
+	for (i = 0; i < no_nodes; i++) {
+		lf_count[i] = 0;
+		for (j = 0; j < nslots; j++)
+			lf_count[i] += pop(lf_set[i][j]);
+		cut_head[i] = Is_Cut_Head(i, child_array, parent_array, node_type,
+				no_nodes);
+		visited[i] = 0;
+	}
+	Unfold_Hash(root, child_array, node_type, hash, visited);
+	return n_l;
+}
+
+/* continue a 128-bit FNV-1a hash h over a string */
+unsigned __int128 Hash_String128(const char *s, unsigned __int128 h) {
+	const unsigned __int128 prime = ((unsigned __int128) 1 << 88) + 0x13B;
+
+	while (*s != '\0') {
+		h ^= (unsigned char) *s++;
+		h *= prime;
+	}
+	return h;
+}
+
+/* a string that grows as text is appended to it */
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+void Append_Text(struct text *t, const char *s) {
+	size_t n = strlen(s);
+
+	if (t->len + n + 1 > t->size) {
+		t->size = 2 * (t->len + n + 1);
+		t->buf = (char *) realloc(t->buf, t->size);
+	}
+	memcpy(t->buf + t->len, s, n + 1);
+	t->len += n;
+}
+
+/*
+ * Write the edges below u, numbering the internal nodes in the order they are reached.
+ * The children of a node are taken in the order of their unfolding hashes.
+ */
+void Canonical_Edges(int u, char *node_strings[], struct lnode *child_array[],
+		int node_type[], unsigned long long hash[], int label[], int *no_labels,
+		struct text *form) {
+	int ch[MAXDEGREE];
+	char str[32];
+	int i, j, c, deg;
+	struct lnode *q;
+
+	deg = 0;
+	for (q = child_array[u]; q != NULL; q = q->next) {
+		for (j = deg; j > 0 && hash[ch[j - 1]] > hash[q->leaf]; j--)
+			ch[j] = ch[j - 1];
+		ch[j] = q->leaf;
+		deg += 1;
+	}
+	for (i = 0; i < deg; i++) {
+		c = ch[i];
+		sprintf(str, "#%d ", label[u]);
+		Append_Text(form, str);
+		if (node_type[c] == LEAVE) {
+			Append_Text(form, node_strings[c]);
+			Append_Text(form, "\n");
+			continue;
+		}
+		j = label[c];
+		if (j == -1)
+			label[c] = (*no_labels)++;
+		sprintf(str, "#%d\n", label[c]);
+		Append_Text(form, str);
+		if (j == -1)
+			Canonical_Edges(c, node_strings, child_array, node_type, hash, label,
+					no_labels, form);
+	}
+}
+
+/*
+ * Write a network up to the labels of its internal nodes and the order of its edges.
+ * The internal nodes are numbered in the order a traversal from the root reaches
+ * them, and the edges are written with these numbers and the leaf names into
+ * form->buf, to be freed by the caller. Siblings with equal unfolding hashes are
+ * taken in input order, so the same network may get different forms then.
+ * Return -1 if it is not a phylogenetic network.
+ */
+int Canonical_Form(char *node_strings[], int no_nodes, int start[], int end[],
+		int no_edges, struct text *form) {
+	char *names[no_nodes];
+	int s[no_edges], e[no_edges];
+	int node_type[no_nodes], cut_head[no_nodes], lf_count[no_nodes], label[no_nodes];
+	unsigned int *lf_set[no_nodes];
+	unsigned long long hash[no_nodes];
+	struct lnode *child_array[no_nodes], *parent_array[no_nodes];
+	int i, no_labels, n_l;
+
+	form->buf = NULL;
+	form->len = 0;
+	form->size = 0;
+	Append_Text(form, "");
+	for (i = 0; i < no_nodes; i++) {
+		names[i] = (char *) malloc(strlen(node_strings[i]) + 1);
+		strcpy(names[i], node_strings[i]);
+	}
+	for (i = 0; i < no_edges; i++) {
+		s[i] = start[i];
+		e[i] = end[i];
+	}
+	n_l = Pendant_Inform(names, no_nodes, s, e, no_edges, node_type,
+			child_array, parent_array, cut_head, lf_set, lf_count, hash,
+			BITNSLOTS(MAXSIZE));
+	if (n_l >= 0) {
+		for (i = 0; i < no_nodes; i++)
+			label[i] = (node_type[i] == ROOT) ? 0 : -1;
+		no_labels = 1;
+		for (i = 0; i < no_nodes; i++) {
+			if (node_type[i] == ROOT)
+				Canonical_Edges(i, names, child_array, node_type, hash, label,
+						&no_labels, form);
+		}
+		for (i = 0; i < no_nodes; i++) {
+			free(lf_set[i]);
+			Free_Lnodes(child_array[i]);
+			Free_Lnodes(parent_array[i]);
+		}
+	}
+	for (i = 0; i < no_nodes; i++)
+		free(names[i]);
+	return n_l < 0 ? -1 : 0;
+}
+
+/*
+ * Hash the canonical form of a network (see Canonical_Form).
+ * Networks with the same hash are the same network.
+ * Return -1 if it is not a phylogenetic network.
+ */
+int Canonical_Hash(char *node_strings[], int no_nodes, int start[], int end[],
+		int no_edges, unsigned __int128 *h) {
+	struct text form;
+	int x;
+
+	x = Canonical_Form(node_strings, no_nodes, start, end, no_edges, &form);
+	*h = Hash_String128(form.buf, CANONICAL_BASIS);
+	free(form.buf);
+	return x;
+}
+
+/* the canonical hash of the network in a file, -1 if it is not a phylogenetic network */
+int File_Hash(char *arg, unsigned __int128 *h) {
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int no_edges, no_nodes, i, x;
+
+	Read_Network(arg, node_strings, &no_nodes, start, end, &no_edges);
+	x = Canonical_Hash(node_strings, no_nodes, start, end, no_edges, h);
+	for (i = 0; i < no_nodes; i++)
+		free(node_strings[i]);
+	return x;
+}
+
+/*
+ * Read a network and check its nodes as Build_Network does, before it is hashed or built.
+ * Return -1 with a message if it is not a phylogenetic network.
+ */
+int Check_Network(char *arg) {
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int no_edges, no_nodes, root, i, x;
+
+	Read_Network(arg, node_strings, &no_nodes, start, end, &no_edges);
+	int node_type[no_nodes + 1];
+	x = Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
+	if (x < 0) {
+		printf("\n the network graph has two or more roots or a node with");
+		printf("\n in-degree greater than 1 and out-degree other than 1;\n Recheck it\n");
+	}
+	for (i = 0; i < no_nodes; i++)
+		free(node_strings[i]);
+	return x < 0 ? -1 : 0;
+}
+
+/*
+ * Collapse the pendant subnetworks the two networks have in common.
+ * The soft clusters of a network with a pendant subnetwork P are those inside P
+ * and those of the network with P replaced by a leaf. If P is in both networks,
+ * the clusters inside P are shared, so replacing P by a leaf in both networks
+ * keeps the soft RF distance. Return the number of subnetworks collapsed; the leaves
+ * they had are kept in map.
+ */
+int Collapse_Common_Pendants(char *node_strings1[], int *no_nodes1,
+		int start1[], int end1[], int *no_edges1, char *node_strings2[],
+		int *no_nodes2, int start2[], int end2[], int *no_edges2,
+		struct leaf_map *map) {
+	int n1 = *no_nodes1, n2 = *no_nodes2;
+	int nslots = BITNSLOTS(MAXSIZE);
+	int node_type1[n1], node_type2[n2], cut_head1[n1], cut_head2[n2];
+	int lf_count1[n1], lf_count2[n2], map1[n1], map2[n2];
+	unsigned int *lf_set1[n1], *lf_set2[n2];
+	unsigned long long hash1[n1], hash2[n2];
+	struct lnode *child_array1[n1], *parent_array1[n1];
+	struct lnode *child_array2[n2], *parent_array2[n2];
+	int heads1[n1], heads2[n1], order[n1];
+	int i, j, k, w1, w2, n_l, n_l2, no_heads, covered;
+
+	no_heads = 0;
+	map->n_l = 0;
+	n_l = Pendant_Inform(node_strings1, n1, start1, end1, *no_edges1,
+			node_type1, child_array1, parent_array1, cut_head1, lf_set1,
+			lf_count1, hash1, nslots);
+	n_l2 = Pendant_Inform(node_strings2, n2, start2, end2, *no_edges2,
+			node_type2, child_array2, parent_array2, cut_head2, lf_set2,
+			lf_count2, hash2, nslots);
+	if (n_l < 0 || n_l != n_l2)
+		goto done;
+	for (i = 0; i < n_l; i++) {
+		if (strcmp(node_strings1[i], node_strings2[i]) != 0)
+			goto done;
+	}
+
+	/* try the largest subnetworks first, so that the collapsed ones are maximal */
+	k = 0;
+	for (i = 0; i < n1; i++) {
+		if (cut_head1[i] == 1 && node_type1[i] == TREE)
+			order[k++] = i;
+	}
+	for (i = 0; i < k; i++) {
+		for (j = i + 1; j < k; j++) {
+			if (lf_count1[order[j]] > lf_count1[order[i]]) {
+				w1 = order[i];
+				order[i] = order[j];
+				order[j] = w1;
+			}
+		}
+	}
+
+	for (i = 0; i < k; i++) {
+		w1 = order[i];
+		covered = 0;
+		for (j = 0; j < no_heads && covered == 0; j++) {
+			covered = 1;
+			for (w2 = 0; w2 < nslots; w2++) {
+				if ((lf_set1[w1][w2] & ~lf_set1[heads1[j]][w2]) != 0) {
+					covered = 0;
+					break;
+				}
+			}
+		}
+		if (covered == 1)
+			continue;
+
+		for (w2 = 0; w2 < n2; w2++) {
+			if (cut_head2[w2] == 0 || node_type2[w2] != TREE
+					|| hash2[w2] != hash1[w1]
+					|| memcmp(lf_set1[w1], lf_set2[w2],
+							nslots * sizeof(unsigned int)) != 0)
+				continue;
+			for (j = 0; j < n1; j++)
+				map1[j] = -1;
+			for (j = 0; j < n2; j++)
+				map2[j] = -1;
+			if (Match_Pendant(w1, w2, child_array1, child_array2, node_type1,
+					node_type2, hash1, hash2, map1, map2) == 1) {
+				heads1[no_heads] = w1;
+				heads2[no_heads] = w2;
+				no_heads += 1;
+				break;
+			}
+		}
+	}
+
+	if (no_heads > 0) {
+		/* a collapsed subnetwork is named after its first leaf, see Collapse_Pendants */
+		map->n_l = n_l;
+		map->names = (char **) malloc(n_l * sizeof(char *));
+		map->rep = (char **) malloc(n_l * sizeof(char *));
+		for (i = 0; i < n_l; i++) {
+			map->names[i] = (char *) malloc(strlen(node_strings1[i]) + 1);
+			strcpy(map->names[i], node_strings1[i]);
+			map->rep[i] = map->names[i];
+		}
+		for (k = 0; k < no_heads; k++) {
+			w1 = -1;
+			for (i = 0; i < n_l; i++) {
+				if (BITTEST(lf_set1[heads1[k]], i) == 0)
+					continue;
+				if (w1 == -1)
+					w1 = i;
+				map->rep[i] = map->names[w1];
+			}
+		}
+		Collapse_Pendants(node_strings1, no_nodes1, start1, end1, no_edges1,
+				heads1, no_heads, lf_set1, child_array1);
+		Collapse_Pendants(node_strings2, no_nodes2, start2, end2, no_edges2,
+				heads2, no_heads, lf_set2, child_array2);
+	}
+
+done:
+	for (i = 0; i < n1 && n_l >= 0; i++) {
+		free(lf_set1[i]);
+		Free_Lnodes(child_array1[i]);
+		Free_Lnodes(parent_array1[i]);
+	}
+	for (i = 0; i < n2 && n_l2 >= 0; i++) {
+		free(lf_set2[i]);
+		Free_Lnodes(child_array2[i]);
+		Free_Lnodes(parent_array2[i]);
+	}
+	return no_heads;
+}
+
+void Free_Network(struct network *net) {
+	int i;
+	struct components* p;
+
+	/*	Free memory at the end */
+	for (i = 0; i < net->no_nodes; i++) {
+		free(net->node_strings[i]);
+	}
+	free(net->node_strings);
+	free(net->node_type);
+	free(net->r_nodes);
+	free(net->inner_flag);
+	free(net->lf_below);
+	free(net->super_deg);
+
+	for (i = 0; i < net->no_nodes; i++) {
+		Free_Lnodes(net->child_array[i]);
+		Free_Lnodes(net->parent_array[i]);
+		free(net->net_edges[i]);
+	}
+	free(net->child_array);
+	free(net->parent_array);
+	free(net->net_edges);
+
+	Destroy_Network(net->all_cps);
+
+	if (net->lf_set != NULL) {
+		for (i = 0; i < net->no_nodes; i++)
+			free(net->lf_set[i]);
+		free(net->lf_set);
+	}
+	free(net->lf_count);
+	free(net->cut_head);
+	free(net->blob_of);
+	for (i = 0; i < net->n_blob; i++)
+		Free_Network(&net->blobs[i]);
+	free(net->blobs);
+	free(net->orig_node);
+}
+
+void i4vec_indicator0(int n, int a[]) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		a[i] = i;
+	}
+	return;
+}
+
+// generate the subsets of size K from a set of size N.
+void ksub_next(int n, int k, int a[]) {
+	int j;
+	int jsave;
+
+	if (a[0] < n - k + 1) {
+		jsave = k - 1;
 
 		for (j = 0; j < k - 1; j++) {
 			if (a[j] + 1 < a[j + 1]) {
@@ -2390,100 +3626,955 @@ void ksub_next(int n, int k, int a[]) {
 		a[jsave] = a[jsave] + 1;
 	}
 
-	return;
+	return;
+}
+
+/*
+ * The leaf sets a subset is tested against before any search: those below the cut heads
+ * that are not leaves, and for every node the leaves reached from it without a
+ * reticulation and its hardwired cluster.
+ */
+struct slice_model {
+	int n_l;
+	int no_cut;
+	unsigned int **cut_set;
+	int no_nodes;
+	unsigned int **tl_set;
+	unsigned int **hw_set;	/* the lf_set of the network */
+};
+
+void Build_Slice_Model(struct network *net, struct slice_model *m) {
+	int nslots = BITNSLOTS(net->n_l);
+	int visited[net->no_nodes];
+	int i;
+
+	m->n_l = net->n_l;
+	m->no_nodes = net->no_nodes;
+	m->hw_set = net->lf_set;
+	m->cut_set = (unsigned int **) malloc(net->no_nodes * sizeof(unsigned int *));
+	m->no_cut = 0;
+	for (i = 0; i < net->no_nodes; i++)
+		if (net->cut_head[i] == 1 && net->node_type[i] != LEAVE
+				&& i != net->root)
+			m->cut_set[m->no_cut++] = net->lf_set[i];
+	m->tl_set = (unsigned int **) malloc(net->no_nodes * sizeof(unsigned int *));
+	for (i = 0; i < net->no_nodes; i++) {
+		m->tl_set[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited[i] = 0;
+	}
+	for (i = 0; i < net->no_nodes; i++)
+		Tree_Leaf_Set(i, net, m->tl_set, nslots, visited);
+}
+
+void Free_Slice_Model(struct slice_model *m) {
+	int i;
+
+	for (i = 0; i < m->no_nodes; i++)
+		free(m->tl_set[i]);
+	free(m->tl_set);
+	free(m->cut_set);
+}
+
+/*
+ * Decide at once the subsets of a batch that need no search, with one bit per subset
+ * in each word: w[l] has bit t set if leaf l is in the tth subset.
+ * As the clusters of a tree nest, a subset is not soft if it cuts the leaves below a cut
+ * head without containing them, and it is soft if it is all of them.
+ * It is not soft either if it lies between the tree-leaf set and the hardwired cluster
+ * of no node (see May_Be_Soft).
+ * Return the subsets decided, those that are soft in *soft.
+ */
+unsigned long long Slice_Decide(struct slice_model *m, unsigned long long w[],
+		unsigned long long *soft) {
+	unsigned long long in_all, in_any, out_any, cut, possible;
+	int i, l;
+
+	*soft = 0;
+	cut = 0;
+	for (i = 0; i < m->no_cut; i++) {
+		in_all = ~0ULL;
+		in_any = 0;
+		out_any = 0;
+		for (l = 0; l < m->n_l; l++) {
+			if (BITTEST(m->cut_set[i], l)) {
+				in_all &= w[l];
+				in_any |= w[l];
+			} else
+				out_any |= w[l];
+		}
+		*soft |= in_all & ~out_any;
+		cut |= in_any & ~in_all & out_any;
+	}
+
+	possible = 0;
+	for (i = 0; i < m->no_nodes && possible != ~0ULL; i++) {
+		in_all = ~0ULL;
+		out_any = 0;
+		for (l = 0; l < m->n_l; l++) {
+			if (BITTEST(m->tl_set[i], l))
+				in_all &= w[l];
+			if (!BITTEST(m->hw_set[i], l))
+				out_any |= w[l];
+		}
+		possible |= in_all & ~out_any;
+	}
+	return *soft | ((cut | ~possible) & ~*soft);
+}
+
+/*
+ * Check a batch of up to 64 k-subsets, numbered from *index on, against a network.
+ * Slice_Decide settles most of them at word-parallel speed; only those left open go
+ * through Blob_Containment one by one.
+ */
+void Slice_Cluster(int k, int no, int batch[][k], int index, unsigned int res[],
+		unsigned int unk[], struct network *net, struct slice_model *m) {
+	unsigned long long w[net->n_l], soft, decided;
+	int i, t, x;
+
+	for (i = 0; i < net->n_l; i++)
+		w[i] = 0;
+	for (t = 0; t < no; t++)
+		for (i = 0; i < k; i++)
+			w[batch[t][i]] |= 1ULL << t;
+	decided = Slice_Decide(m, w, &soft);
+
+	for (t = 0; t < no; t++) {
+		if ((soft >> t) & 1ULL) {
+			BITSET(res, index + t);
+			continue;
+		}
+		if ((decided >> t) & 1ULL)
+			continue;
+		x = Blob_Containment(net, batch[t], k);
+		if (x == 50)
+			BITSET(res, index + t);
+		else if (x == UNKNOWN)
+			BITSET(unk, index + t);
+	}
+}
+
+/*
+ * The k-subsets are checked in batches of 64, as bits of a word (see Slice_Cluster).
+ * A network given as NULL is skipped, its clusters being known already.
+ */
+void Subset_CCP(int k, int *index, int no, int n_l, unsigned int *res1,
+		unsigned int *res2, unsigned int *unk1, unsigned int *unk2,
+		struct network *net1, struct network *net2, struct slice_model *m1,
+		struct slice_model *m2) {
+	int batch[64][k];
+	int i, j, t;
+
+	if (k == 1) {
+		i4vec_indicator0(k, batch[0]);
+		Is_Cluster(batch[0], k, n_l, res1, res2, unk1, unk2, index, net1,
+				net2);
+		for (j = 1; j < no; j++) {
+			ksub_next(n_l, k, batch[0]);
+			Is_Cluster(batch[0], k, n_l, res1, res2, unk1, unk2, index, net1,
+					net2);
+		}
+		return;
+	}
+
+	i4vec_indicator0(k, batch[0]);
+	t = 1;
+	for (j = 1; j <= no; j++) {
+		if (t == 64 || j == no) {
+			if (net1 != NULL)
+				Slice_Cluster(k, t, batch, *index, res1, unk1, net1, m1);
+			if (net2 != NULL)
+				Slice_Cluster(k, t, batch, *index, res2, unk2, net2, m2);
+			*index += t;
+			t = 0;
+		}
+		if (j == no)
+			break;
+		for (i = 0; i < k; i++)
+			batch[t][i] = batch[(t + 63) % 64][i];
+		ksub_next(n_l, k, batch[t]);
+		t += 1;
+	}
+	return;
+}
+
+/* open a cached entry and mark it as recently used, NULL if it is not cached */
+FILE *Cache_Open(unsigned __int128 key, const char *ext) {
+	char path[strlen(cache_dir) + 48];
+	FILE *in;
+
+	sprintf(path, "%s/%016llx%016llx.%s", cache_dir,
+			(unsigned long long) (key >> 64), (unsigned long long) key, ext);
+	in = fopen(path, "rb");
+	if (in != NULL)
+		utimensat(AT_FDCWD, path, NULL, 0);
+	return in;
+}
+
+int cache_entry_comparator(const void *v1, const void *v2)
+{
+    const struct cache_entry *p1 = (struct cache_entry *)v1;
+    const struct cache_entry *p2 = (struct cache_entry *)v2;
+    if (p1->used.tv_sec != p2->used.tv_sec)
+        return p1->used.tv_sec < p2->used.tv_sec ? -1 : +1;
+    else if (p1->used.tv_nsec != p2->used.tv_nsec)
+        return p1->used.tv_nsec < p2->used.tv_nsec ? -1 : +1;
+    else
+        return 0;
+}
+
+/*
+ * Remove the least recently used entries, by their modification times to the
+ * nanosecond, until the cache holds at most 3/4 of CACHE_LIMIT bytes, so that it is
+ * not scanned again at the next store. Return the bytes left.
+ */
+long Cache_Evict() {
+	struct cache_entry *entries;
+	DIR *dir;
+	struct dirent *e;
+	struct stat st;
+	long total, no, size, i;
+
+	dir = opendir(cache_dir);
+	if (dir == NULL)
+		return 0;
+	total = 0;
+	no = 0;
+	size = 64;
+	entries = (struct cache_entry *) malloc(size * sizeof(struct cache_entry));
+	while ((e = readdir(dir)) != NULL) {
+		if (e->d_name[0] == '.' || strstr(e->d_name, ".tmp") != NULL)
+			continue;
+		if (no == size) {
+			size = 2 * size;
+			entries = (struct cache_entry *) realloc(entries,
+					size * sizeof(struct cache_entry));
+		}
+		entries[no].path = (char *) malloc(strlen(cache_dir) + strlen(e->d_name) + 2);
+		sprintf(entries[no].path, "%s/%s", cache_dir, e->d_name);
+		if (stat(entries[no].path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			free(entries[no].path);
+			continue;
+		}
+		entries[no].size = st.st_size;
+		entries[no].used = st.st_mtim;
+		total += st.st_size;
+		no += 1;
+	}
+	closedir(dir);
+	if (total > CACHE_LIMIT) {
+		qsort(entries, no, sizeof(struct cache_entry), cache_entry_comparator);
+		for (i = 0; i < no && total > CACHE_LIMIT / 4 * 3; i++) {
+			if (unlink(entries[i].path) == 0)
+				total -= entries[i].size;
+		}
+	}
+	for (i = 0; i < no; i++)
+		free(entries[i].path);
+	free(entries);
+	return total;
+}
+
+/*
+ * Add len bytes to the size of the cache, kept in the file .size under a lock, and
+ * evict entries once it passes CACHE_LIMIT; the directory is only scanned then, or if
+ * the size is not known. A rewritten entry is counted twice, which only brings the
+ * next scan forward, the scan setting the size to what is found.
+ */
+void Cache_Account(long len) {
+	char path[strlen(cache_dir) + 16];
+	FILE *f;
+	long total;
+	int fd;
+
+	sprintf(path, "%s/.size", cache_dir);
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return;
+	f = fdopen(fd, "r+");
+	if (f == NULL) {
+		close(fd);
+		return;
+	}
+	flock(fd, LOCK_EX);
+	if (fscanf(f, "%ld", &total) != 1 || total < 0)
+		total = CACHE_LIMIT;
+	total += len;
+	if (total > CACHE_LIMIT)
+		total = Cache_Evict();
+	rewind(f);
+	fprintf(f, "%ld\n", total);
+	fflush(f);
+	if (ftruncate(fd, ftell(f)) != 0)
+		rewind(f);
+	fclose(f);
+}
+
+/*
+ * Store an entry in the cache. It is written to a temporary file first and renamed,
+ * so that concurrent readers and writers only ever see complete entries.
+ * The temporary name is numbered within the process, for the threads of --pairs.
+ */
+void Cache_Store(unsigned __int128 key, const char *ext, const void *buf,
+		size_t len) {
+	static long no_tmp = 0;
+	char path[strlen(cache_dir) + 48], tmp[strlen(cache_dir) + 96];
+	FILE *out;
+	long n;
+
+	#pragma omp atomic capture
+	n = ++no_tmp;
+	sprintf(path, "%s/%016llx%016llx.%s", cache_dir,
+			(unsigned long long) (key >> 64), (unsigned long long) key, ext);
+	sprintf(tmp, "%s.tmp%ld.%ld", path, (long) getpid(), n);
+	out = fopen(tmp, "wb");
+	if (out == NULL)
+		return;
+	if (fwrite(buf, 1, len, out) != len) {
+		fclose(out);
+		unlink(tmp);
+		return;
+	}
+	fclose(out);
+	if (rename(tmp, path) != 0)
+		unlink(tmp);
+	else
+		Cache_Account(len);
+}
+
+/*
+ * Read the soft clusters of a network from the cache into res, return 1 if they were
+ * cached. An entry holds the number of leaves, the length of the canonical form of
+ * the network and the form itself, then the clusters. It is only taken if the form
+ * is that of the network, so that networks with the same hash are told apart.
+ */
+int Cache_Load_Clusters(unsigned __int128 key, struct text *form, int n_l,
+		unsigned int res[], unsigned int rlen) {
+	unsigned int x[2];
+	char *buf;
+	FILE *in;
+	int found;
+
+	in = Cache_Open(key, "srfd");
+	if (in == NULL)
+		return 0;
+	found = fread(x, sizeof(unsigned int), 2, in) == 2 && x[0] == (unsigned int) n_l
+			&& x[1] == form->len;
+	if (found == 1) {
+		buf = (char *) malloc(form->len + 1);
+		found = fread(buf, 1, form->len, in) == form->len
+				&& memcmp(buf, form->buf, form->len) == 0
+				&& fread(res, sizeof(unsigned int), rlen, in) == rlen;
+		free(buf);
+	}
+	fclose(in);
+	if (found == 0)
+		memset(res, 0, rlen * sizeof(unsigned int));
+	return found;
+}
+
+/* keep the soft clusters of a network in the cache, after its canonical form */
+void Cache_Store_Clusters(unsigned __int128 key, struct text *form, int n_l,
+		unsigned int res[], unsigned int rlen) {
+	size_t len = 2 * sizeof(unsigned int) + form->len + rlen * sizeof(unsigned int);
+	char *buf = (char *) malloc(len);
+	unsigned int x[2];
+
+	x[0] = n_l;
+	x[1] = form->len;
+	memcpy(buf, x, sizeof(x));
+	memcpy(buf + sizeof(x), form->buf, form->len);
+	memcpy(buf + sizeof(x) + form->len, res, rlen * sizeof(unsigned int));
+	Cache_Store(key, "srfd", buf, len);
+	free(buf);
+}
+
+
+void Init_Tree_Clusters(struct tree_clusters *tc, int n_l) {
+	tc->nslots = BITNSLOTS(n_l);
+	tc->size = 1024;
+	tc->no = 0;
+	tc->sets = (unsigned int *) malloc(tc->size * tc->nslots * sizeof(unsigned int));
+	tc->used = (char *) calloc(tc->size, sizeof(char));
+}
+
+void Free_Tree_Clusters(struct tree_clusters *tc) {
+	free(tc->sets);
+	free(tc->used);
+}
+
+/* the bucket holding a cluster, or the empty bucket where it would go */
+long Cluster_Bucket(struct tree_clusters *tc, unsigned int x[]) {
+	unsigned long long h = 0;
+	long b;
+	int j;
+
+	for (j = 0; j < tc->nslots; j++)
+		h = Mix_Hash(h, x[j]);
+	h *= 1099511628211ULL;
+	b = (h ^ (h >> 32)) & (tc->size - 1);
+	while (tc->used[b] == 1 && memcmp(&tc->sets[b * tc->nslots], x,
+			tc->nslots * sizeof(unsigned int)) != 0)
+		b = (b + 1) & (tc->size - 1);
+	return b;
+}
+
+int Has_Tree_Cluster(struct tree_clusters *tc, unsigned int x[]) {
+	return tc->used[Cluster_Bucket(tc, x)];
+}
+
+void Add_Tree_Cluster(struct tree_clusters *tc, unsigned int x[]) {
+	unsigned int *sets;
+	char *used;
+	long b, i, size;
+
+	b = Cluster_Bucket(tc, x);
+	if (tc->used[b] == 1)
+		return;
+	memcpy(&tc->sets[b * tc->nslots], x, tc->nslots * sizeof(unsigned int));
+	tc->used[b] = 1;
+	tc->no += 1;
+	if (2 * tc->no <= tc->size)
+		return;
+
+	/* keep the table at most half full */
+	sets = tc->sets;
+	used = tc->used;
+	size = tc->size;
+	tc->size = 2 * size;
+	tc->sets = (unsigned int *) malloc(tc->size * tc->nslots * sizeof(unsigned int));
+	tc->used = (char *) calloc(tc->size, sizeof(char));
+	for (i = 0; i < size; i++) {
+		if (used[i] == 0)
+			continue;
+		b = Cluster_Bucket(tc, &sets[i * tc->nslots]);
+		memcpy(&tc->sets[b * tc->nslots], &sets[i * tc->nslots],
+				tc->nslots * sizeof(unsigned int));
+		tc->used[b] = 1;
+	}
+	free(sets);
+	free(used);
+}
+
+/* keep a cluster of a displayed tree, unless it is a single leaf or all the leaves */
+void Keep_Tree_Cluster(struct tree_clusters *tc, unsigned int x[], int n_l) {
+	int j, k;
+
+	k = 0;
+	for (j = 0; j < tc->nslots; j++)
+		k += pop(x[j]);
+	if (k >= 2 && k < n_l)
+		Add_Tree_Cluster(tc, x);
+}
+
+/* the number of displayed trees, one for each choice of a parent of every reticulation */
+double No_Displayed_Trees(struct network *net) {
+	double no = 1;
+	struct lnode *q;
+	int i, k;
+
+	for (i = 0; i < net->n_r; i++) {
+		k = 0;
+		for (q = net->parent_array[net->r_nodes[i]]; q != NULL; q = q->next)
+			k += 1;
+		no *= k;
+	}
+	return no;
+}
+
+/*
+ * Whether to find the soft clusters of a network from its displayed trees rather than
+ * by running CCP on every subset of leaves: with few reticulations there are far fewer
+ * trees than subsets, and a tree costs much less than a CCP run.
+ */
+int Use_Tree_Engine(struct network *net) {
+	if (net->n_r > MAXTREERET)
+		return 0;
+	return net->n_l >= 32 || No_Displayed_Trees(net) <= (double) (1U << net->n_l);
+}
+
+/* the parent of a node in the displayed tree given by the choice of parent of each reticulation */
+int Tree_Parent(struct network *net, int u, int choice[]) {
+	if (net->node_type[u] == RET)
+		return choice[u];
+	return net->parent_array[u]->leaf;
+}
+
+/*
+ * Collect the clusters of all the trees displayed by a network, that is, its soft
+ * clusters, other than the single leaves and all the leaves.
+ * A displayed tree keeps one parent of each reticulation. The trees are taken in
+ * reflected Gray-code order over these choices, so that a single reticulation moves to
+ * another parent from one tree to the next. The clusters of a tree nest, so moving ret
+ * from p to q takes its leaves out of the clusters of p and its ancestors and puts them
+ * into those of q and its ancestors; only these nodes have new clusters.
+ * The trees are one query against the budget, each tree counting as a call (see
+ * Over_Budget). Return -1 with no clusters kept if the budget runs out, 0 otherwise.
+ */
+int Displayed_Clusters(struct network *net, struct tree_clusters *tc) {
+	int no_nodes = net->no_nodes, n_r = net->n_r;
+	int nslots = BITNSLOTS(net->n_l);
+	int order[no_nodes], indeg[no_nodes], choice[no_nodes], mark[no_nodes],
+			changed[no_nodes];
+	int digit[n_r + 1], dir[n_r + 1], no_par[n_r + 1];
+	unsigned int **cl;
+	int i, j, u, v, r, head, tail, no_changed, res;
+	struct lnode *q;
+
+	Start_Query();
+	Init_Tree_Clusters(tc, net->n_l);
+	cl = (unsigned int **) malloc(no_nodes * sizeof(unsigned int *));
+	for (i = 0; i < no_nodes; i++) {
+		cl[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		indeg[i] = 0;
+		for (q = net->parent_array[i]; q != NULL; q = q->next)
+			indeg[i] += 1;
+		choice[i] = -1;
+		mark[i] = 0;
+	}
+	for (j = 0; j < n_r; j++) {
+		r = net->r_nodes[j];
+		choice[r] = net->parent_array[r]->leaf;
+		digit[j] = 0;
+		dir[j] = 1;
+		no_par[j] = indeg[r];
+	}
+
+	/* the clusters of the first tree, children before parents */
+	head = 0;
+	tail = 0;
+	order[tail++] = net->root;
+	while (head < tail) {
+		u = order[head++];
+		for (q = net->child_array[u]; q != NULL; q = q->next) {
+			indeg[q->leaf] -= 1;
+			if (indeg[q->leaf] == 0)
+				order[tail++] = q->leaf;
+		}
+	}
+	for (i = tail - 1; i >= 0; i--) {
+		u = order[i];
+		if (net->node_type[u] == LEAVE)
+			BITSET(cl[u], u);
+		for (q = net->child_array[u]; q != NULL; q = q->next) {
+			v = q->leaf;
+			if (net->node_type[v] == RET && choice[v] != u)
+				continue;
+			for (j = 0; j < nslots; j++)
+				cl[u][j] |= cl[v][j];
+		}
+		Keep_Tree_Cluster(tc, cl[u], net->n_l);
+	}
+
+	res = 0;
+	while (1) {
+		if (Over_Budget(0)) {
+			Free_Tree_Clusters(tc);
+			res = -1;
+			break;
+		}
+		for (j = 0; j < n_r; j++)
+			if (digit[j] + dir[j] >= 0 && digit[j] + dir[j] < no_par[j])
+				break;
+		if (j == n_r)
+			break;
+		for (i = 0; i < j; i++)
+			dir[i] = -dir[i];
+		digit[j] += dir[j];
+		r = net->r_nodes[j];
+
+		no_changed = 0;
+		for (u = choice[r]; u != -1; u = (u == net->root) ? -1 : Tree_Parent(net, u, choice)) {
+			for (i = 0; i < nslots; i++)
+				cl[u][i] &= ~cl[r][i];
+			if (mark[u] == 0) {
+				mark[u] = 1;
+				changed[no_changed++] = u;
+			}
+		}
+		q = net->parent_array[r];
+		for (i = 0; i < digit[j]; i++)
+			q = q->next;
+		choice[r] = q->leaf;
+		for (u = choice[r]; u != -1; u = (u == net->root) ? -1 : Tree_Parent(net, u, choice)) {
+			for (i = 0; i < nslots; i++)
+				cl[u][i] |= cl[r][i];
+			if (mark[u] == 0) {
+				mark[u] = 1;
+				changed[no_changed++] = u;
+			}
+		}
+		for (i = 0; i < no_changed; i++) {
+			Keep_Tree_Cluster(tc, cl[changed[i]], net->n_l);
+			mark[changed[i]] = 0;
+		}
+	}
+
+	for (i = 0; i < no_nodes; i++)
+		free(cl[i]);
+	free(cl);
+	return res;
+}
+
+/* mark the subsets, numbered as Subset_CCP takes them, that are in a cluster set */
+void Fill_From_Trees(struct tree_clusters *tc, int n_l, unsigned int res[]) {
+	int input_leaves[n_l];
+	unsigned int x[tc->nslots];
+	int i, j, k, no, index;
+
+	index = 0;
+	for (k = 1; k < n_l; k++) {
+		no = nChoosek(n_l, k);
+		i4vec_indicator0(k, input_leaves);
+		for (j = 0; j < no; j++) {
+			if (j > 0)
+				ksub_next(n_l, k, input_leaves);
+			for (i = 0; i < tc->nslots; i++)
+				x[i] = 0;
+			for (i = 0; i < k; i++)
+				BITSET(x, input_leaves[i]);
+			if (k == 1 || Has_Tree_Cluster(tc, x))
+				BITSET(res, index);
+			index += 1;
+		}
+	}
+}
+
+int tree_diff_comparator(const void *v1, const void *v2)
+{
+    const struct tree_diff *p1 = (struct tree_diff *)v1;
+    const struct tree_diff *p2 = (struct tree_diff *)v2;
+    int j, k1 = 0, k2 = 0;
+    for (j = 0; j < p1->nslots; j++) {
+        k1 += pop(p1->set[j]);
+        k2 += pop(p2->set[j]);
+    }
+    if (k1 != k2)
+        return k1 < k2 ? -1 : +1;
+    for (j = p1->nslots - 1; j >= 0; j--)
+        if (p1->set[j] != p2->set[j])
+            return p1->set[j] < p2->set[j] ? -1 : +1;
+    return 0;
+}
+
+void Free_Leaf_Map(struct leaf_map *map) {
+	int i;
+
+	for (i = 0; i < map->n_l; i++)
+		free(map->names[i]);
+	if (map->n_l > 0) {
+		free(map->names);
+		free(map->rep);
+	}
+	map->n_l = 0;
+}
+
+/*
+ * Print the clusters soft in one network only, each tagged with the network it is soft
+ * in, by size and then by leaf mask. If common pendant subnetworks were collapsed, a
+ * leaf standing for one is put back as all the leaves in map it stands for, so that the
+ * clusters are listed as if nothing had been collapsed.
+ */
+void Print_Differences(struct network *net, struct tree_diff diff[], long no_diff,
+		struct leaf_map *map, int list) {
+	char **names = net->node_strings;
+	int n_l = net->n_l;
+	int leaf_of[map->n_l + 1];
+	unsigned int *sets = NULL;
+	unsigned long mask;
+	long i;
+	int j, nslots, first;
+
+	if (map->n_l > 0) {
+		for (j = 0; j < map->n_l; j++)
+			leaf_of[j] = Check_Name(net->node_strings, net->n_l, map->rep[j]);
+		nslots = BITNSLOTS(map->n_l);
+		sets = (unsigned int *) calloc(no_diff * nslots + 1, sizeof(unsigned int));
+		for (i = 0; i < no_diff; i++) {
+			for (j = 0; j < map->n_l; j++)
+				if (BITTEST(diff[i].set, leaf_of[j]))
+					BITSET(&sets[i * nslots], j);
+			diff[i].set = &sets[i * nslots];
+			diff[i].nslots = nslots;
+		}
+		names = map->names;
+		n_l = map->n_l;
+	}
+	qsort(diff, no_diff, sizeof(struct tree_diff), tree_diff_comparator);
+
+	printf("\nClusters soft in one network only:\n");
+	for (i = 0; i < no_diff; i++) {
+		if (list == LIST_MASK) {
+			mask = 0;
+			for (j = 0; j < n_l; j++)
+				if (BITTEST(diff[i].set, j))
+					mask |= 1UL << j;
+			printf("%d 0x%lx\n", diff[i].side, mask);
+			continue;
+		}
+		printf("%d {", diff[i].side);
+		first = 1;
+		for (j = 0; j < n_l; j++) {
+			if (BITTEST(diff[i].set, j)) {
+				printf(first ? "%s" : ",%s", names[j]);
+				first = 0;
+			}
+		}
+		printf("}\n");
+	}
+	free(sets);
+}
+
+/*
+ * The soft RF distance between two networks from the clusters of their displayed trees,
+ * without going through all the subsets of leaves. The clusters in one set only are
+ * listed in the order of List_Differences: by size, then as subsets are numbered, which
+ * for subsets of one size is the order of their leaf masks.
+ * Return -1 if the budget runs out for either network, 0 with the distance in *dist.
+ */
+int Tree_Cluster_Distance(struct network *net1, struct network *net2,
+		struct leaf_map *map, int list, float *dist) {
+	struct tree_clusters tc1, tc2;
+	struct tree_diff *diff;
+	long i, no_diff;
+
+	if (Displayed_Clusters(net1, &tc1) < 0)
+		return -1;
+	if (Displayed_Clusters(net2, &tc2) < 0) {
+		Free_Tree_Clusters(&tc1);
+		return -1;
+	}
+	diff = (struct tree_diff *) malloc((tc1.no + tc2.no + 1) * sizeof(struct tree_diff));
+	no_diff = 0;
+	for (i = 0; i < tc1.size; i++) {
+		if (tc1.used[i] == 1 && !Has_Tree_Cluster(&tc2, &tc1.sets[i * tc1.nslots])) {
+			diff[no_diff].set = &tc1.sets[i * tc1.nslots];
+			diff[no_diff].nslots = tc1.nslots;
+			diff[no_diff++].side = 1;
+		}
+	}
+	for (i = 0; i < tc2.size; i++) {
+		if (tc2.used[i] == 1 && !Has_Tree_Cluster(&tc1, &tc2.sets[i * tc2.nslots])) {
+			diff[no_diff].set = &tc2.sets[i * tc2.nslots];
+			diff[no_diff].nslots = tc2.nslots;
+			diff[no_diff++].side = 2;
+		}
+	}
+
+	if (list != NO_LIST)
+		Print_Differences(net1, diff, no_diff, map, list);
+
+	free(diff);
+	Free_Tree_Clusters(&tc1);
+	Free_Tree_Clusters(&tc2);
+	*dist = (float) no_diff / 2;
+	return 0;
 }
 
-void Subset_CCP(int k, int *index, int no, unsigned int *res1,
-		unsigned int *res2, struct network *net1, struct network *net2, int tree_size1, int tree_size2) {
-	int j;
-	int *input_leaves = (int *) calloc(k, sizeof(int));
-	// int input_leaves[k];
-	int i;	// for debug printing
-
-	i4vec_indicator0(k, input_leaves);
-	Is_Cluster(input_leaves, k, res1, res2, index, net1, net2, tree_size1,
-			tree_size2);
-
-	//printf("\nfrom 2nd k-subset\n");
-	for (j = 1; j < no; j++) {
-		ksub_next(net1->n_l, k, input_leaves);
-		// printf("\nInitial input leaves\n   ");
-		// for (i = 0; i < k; i++) {
-		// 	printf("%d ", input_leaves[i]);
-		// }
-		// printf("\n");
-		Is_Cluster(input_leaves, k, res1, res2, index, net1, net2, tree_size1,
-				tree_size2);
-	}
-	free(input_leaves);
-	return;
+/*
+ * Print the clusters that are soft in exactly one network, given by the subsets set in
+ * diff as they were evaluated, with Print_Differences.
+ */
+void List_Differences(struct network *net, unsigned int res1[],
+		unsigned int diff[], int rlen, struct leaf_map *map, int list) {
+	int input_leaves[net->n_l];
+	int nslots = BITNSLOTS(net->n_l);
+	struct tree_diff *found;
+	unsigned int *sets;
+	long no_found;
+	int i, j, k, no, index;
+
+	no_found = 0;
+	for (i = 0; i < rlen; i++)
+		no_found += pop(diff[i]);
+	found = (struct tree_diff *) malloc((no_found + 1) * sizeof(struct tree_diff));
+	sets = (unsigned int *) calloc(no_found * nslots + 1, sizeof(unsigned int));
+	no_found = 0;
+	index = 0;
+	for (k = 1; k < net->n_l; k++) {
+		no = nChoosek(net->n_l, k);
+		i4vec_indicator0(k, input_leaves);
+		for (j = 0; j < no; j++) {
+			if (j > 0)
+				ksub_next(net->n_l, k, input_leaves);
+			if (BITTEST(diff, index) != 0) {
+				found[no_found].set = &sets[no_found * nslots];
+				found[no_found].nslots = nslots;
+				found[no_found].side = BITTEST(res1, index) ? 1 : 2;
+				for (i = 0; i < k; i++)
+					BITSET(found[no_found].set, input_leaves[i]);
+				no_found += 1;
+			}
+			index += 1;
+		}
+	}
+	Print_Differences(net, found, no_found, map, list);
+	free(sets);
+	free(found);
 }
 
-double Find_Cluster_Distance(char *arg1, char *arg2) {
+/*
+ * With list set, the clusters that are soft in one network only are printed too,
+ * on the leaves the networks had before their common pendant subnetworks were collapsed.
+ * Each subset is checked within the budget given by limits; the number of subsets left
+ * undecided in either network is put in no_unknown, the distance returned being the
+ * one over the decided subsets.
+ */
+double Find_Cluster_Distance(char *arg1, char *arg2, int list,
+		struct budget *limits, unsigned int *no_unknown) {
 	int i, k, index;
 	struct network net1, net2;
-	unsigned int *res1, *res2, *diff;
-	unsigned int no_res, rlen;
+	int start1[MAXEDGE], end1[MAXEDGE], start2[MAXEDGE], end2[MAXEDGE];
+	char *node_strings1[MAXSIZE], *node_strings2[MAXSIZE];
+	int no_edges1, no_nodes1, no_edges2, no_nodes2, no_orig_nodes, no_collapsed;
+	unsigned int *res1, *res2, *unk1, *unk2, *diff;
+	unsigned int no_res, x;
+	int rlen;
+	unsigned __int128 key1, key2;
+	struct text form1, form2;
+	struct leaf_map map;
+	int cached1, cached2, tree1, tree2, keep1, keep2;
 	float dist;
-	int tree_size1 = 0, tree_size2 = 0;
-	struct components *p1;
+
+	budget = *limits;
+	*no_unknown = 0;
 
 	/* network processing */
+	Read_Network(arg1, node_strings1, &no_nodes1, start1, end1, &no_edges1);
+	Read_Network(arg2, node_strings2, &no_nodes2, start2, end2, &no_edges2);
+	no_orig_nodes = no_nodes1;
+	no_collapsed = 0;
+	no_collapsed = Collapse_Common_Pendants(node_strings1, &no_nodes1, start1,
+			end1, &no_edges1, node_strings2, &no_nodes2, start2, end2, &no_edges2,
+			&map);
+	/* the cache is keyed by the canonical form of the networks as evaluated */
+	key1 = 0;
+	key2 = 0;
+	keep1 = 0;
+	keep2 = 0;
+	form1.buf = NULL;
+	form2.buf = NULL;
+	if (cache_dir != NULL) {
+		keep1 = Canonical_Form(node_strings1, no_nodes1, start1, end1, no_edges1,
+				&form1) == 0;
+		keep2 = Canonical_Form(node_strings2, no_nodes2, start2, end2, no_edges2,
+				&form2) == 0;
+		key1 = Hash_String128(form1.buf, CANONICAL_BASIS);
+		key2 = Hash_String128(form2.buf, CANONICAL_BASIS);
+	}
 	//printf("preprocess 1st network: \n");
-	Preprocess_Network(arg1, &net1);
+	Build_Network(node_strings1, no_nodes1, start1, end1, no_edges1, &net1);
+	Decompose_Blobs(&net1);
 	//printf("preprocess 2nd network: \n");
-	Preprocess_Network(arg2, &net2);
+	Build_Network(node_strings2, no_nodes2, start2, end2, no_edges2, &net2);
+	Decompose_Blobs(&net2);
 
 	printf("1st network: \n");
 	Print_Network(&net1);
 	printf("\n2nd network: \n");
 	Print_Network(&net2);
+	if (no_collapsed > 0) {
+		printf("\n\nCollapsed %d common pendant subnetworks (%d of %d nodes left)\n",
+				no_collapsed, no_nodes1, no_orig_nodes);
+	}
 
 	/* make sure the two networks have the same set of leaves */
 	if (net1.n_l != net2.n_l) {
 		printf(
 				"\n The networks have different number of leaves;\nRecheck it\n");
+		free(form1.buf);
+		free(form2.buf);
+		Free_Leaf_Map(&map);
 		return;
 	} else {
 		for (i = 0; i < net1.n_l; i++) {
 			if (strcmp(net1.node_strings[i], net2.node_strings[i]) != 0) {
 				printf("\n The networks have different leaves;\nRecheck it\n");
+				free(form1.buf);
+				free(form2.buf);
+				Free_Leaf_Map(&map);
 				return;
 			}
 		}
 	}
 
-	p1 = net1.all_cps;
-	while (p1 != NULL) {
-		tree_size1 += p1->size;
-		p1 = p1->next;
-	}
-
-	p1 = net2.all_cps;
-	while (p1 != NULL) {
-		tree_size2 += p1->size;
-		p1 = p1->next;
+	/*
+	 * With few reticulations, the soft clusters are found from the displayed trees,
+	 * and if both networks allow it the subsets of leaves are not gone through at all.
+	 */
+	tree1 = Use_Tree_Engine(&net1);
+	tree2 = Use_Tree_Engine(&net2);
+	if (tree1 == 1 && tree2 == 1
+			&& Tree_Cluster_Distance(&net1, &net2, &map, list, &dist) == 0) {
+		free(form1.buf);
+		free(form2.buf);
+		Free_Network(&net1);
+		Free_Network(&net2);
+		Free_Leaf_Map(&map);
+		return dist;
 	}
 
 	no_res = (1U << net1.n_l);
 	rlen = BITNSLOTS(no_res);
 	res1 = (unsigned int *) calloc(rlen, sizeof(unsigned int));
 	res2 = (unsigned int *) calloc(rlen, sizeof(unsigned int));
+	unk1 = (unsigned int *) calloc(rlen, sizeof(unsigned int));
+	unk2 = (unsigned int *) calloc(rlen, sizeof(unsigned int));
 	diff = (unsigned int *) calloc(rlen, sizeof(unsigned int));
 
-	index = 0;
-	for (k = 1; k < net1.n_l; k++) {
-		int no = nChoosek(net1.n_l, k);
-		Subset_CCP(k, &index, no, res1, res2, &net1, &net2, tree_size1,
-				tree_size2);
+	cached1 = keep1 && Cache_Load_Clusters(key1, &form1, net1.n_l, res1, rlen);
+	cached2 = keep2 && Cache_Load_Clusters(key2, &form2, net2.n_l, res2, rlen);
+	/* the sets found from the displayed trees are skipped by Subset_CCP as cached ones are */
+	if (cached1 == 0 && tree1 == 1) {
+		struct tree_clusters tc;
+		if (Displayed_Clusters(&net1, &tc) == 0) {
+			Fill_From_Trees(&tc, net1.n_l, res1);
+			Free_Tree_Clusters(&tc);
+			cached1 = 1;
+		}
+	}
+	if (cached2 == 0 && tree2 == 1) {
+		struct tree_clusters tc;
+		if (Displayed_Clusters(&net2, &tc) == 0) {
+			Fill_From_Trees(&tc, net2.n_l, res2);
+			Free_Tree_Clusters(&tc);
+			cached2 = 1;
+		}
+	}
+	if (cached1 == 0 || cached2 == 0) {
+		struct slice_model m1, m2;
+		Build_Slice_Model(&net1, &m1);
+		Build_Slice_Model(&net2, &m2);
+		index = 0;
+		for (k = 1; k < net1.n_l; k++) {
+			int no = nChoosek(net1.n_l, k);
+			Subset_CCP(k, &index, no, net1.n_l, res1, res2, unk1, unk2,
+					cached1 ? NULL : &net1, cached2 ? NULL : &net2, &m1, &m2);
+		}
+		Free_Slice_Model(&m1);
+		Free_Slice_Model(&m2);
+		/* only complete cluster sets are cached */
+		x = 0;
+		for (i = 0; i < rlen; i++)
+			x |= unk1[i];
+		if (keep1 && cached1 == 0 && x == 0)
+			Cache_Store_Clusters(key1, &form1, net1.n_l, res1, rlen);
+		x = 0;
+		for (i = 0; i < rlen; i++)
+			x |= unk2[i];
+		if (keep2 && cached2 == 0 && x == 0)
+			Cache_Store_Clusters(key2, &form2, net2.n_l, res2, rlen);
 	}
 
 	dist = 0;
 	for (i = 0; i < rlen; i++) {
-		diff[i] = (res1[i] ^ res2[i]);
+		x = unk1[i] | unk2[i];
+		diff[i] = (res1[i] ^ res2[i]) & ~x;
 		dist += pop(diff[i]);
+		*no_unknown += pop(x);
 	}
 	dist = (float) dist / 2;
+	if (list != NO_LIST)
+		List_Differences(&net1, res1, diff, rlen, &map, list);
 
 	// printf("no_res: %d\n", no_res);
 	// printf("res1: %d\n", res1);
@@ -2491,17 +4582,804 @@ double Find_Cluster_Distance(char *arg1, char *arg2) {
 	/*	Free memory at the end */
 	free(res1);
 	free(res2);
+	free(unk1);
+	free(unk2);
 	free(diff);
+	free(form1.buf);
+	free(form2.buf);
 
 	Free_Network(&net1);
 	Free_Network(&net2);
+	Free_Leaf_Map(&map);
 
 	return dist;
 }
 
+/*
+ * Re-evaluate the proper subsets of the leaves in mask, return how many were evaluated.
+ * As for two networks, they are looked up in the clusters of the displayed trees if
+ * there are few of them (see Use_Tree_Engine), and checked with CCP otherwise.
+ */
+unsigned int Evaluate_Subsets(struct cluster_set *cs, unsigned int mask) {
+	struct network *net = &cs->net;
+	unsigned int full = cs->no_res - 1, s, no_eval;
+	int input_leaves[net->n_l];
+	int i, r, tree;
+	struct tree_clusters tc;
+
+	tree = Use_Tree_Engine(net) && Displayed_Clusters(net, &tc) == 0;
+	no_eval = 0;
+	s = mask;
+	while (s != 0) {
+		if (s != full) {
+			r = 0;
+			for (i = 0; i < net->n_l; i++)
+				if ((s >> i) & 1U)
+					input_leaves[r++] = i;
+			BITCLEAR(cs->res, s);
+			if (r == 1 || (tree ? Has_Tree_Cluster(&tc, &s)
+					: Blob_Containment(net, input_leaves, r) == 50))
+				BITSET(cs->res, s);
+			no_eval += 1;
+		}
+		s = (s - 1) & mask;
+	}
+	if (tree)
+		Free_Tree_Clusters(&tc);
+	return no_eval;
+}
+
+/* mark the nodes in the subnetwork below a node */
+void Mark_Below(int node, struct network *net, int below[]) {
+	int stack[net->no_nodes];
+	int i, u, top;
+	struct lnode *q;
+
+	for (i = 0; i < net->no_nodes; i++)
+		below[i] = 0;
+	below[node] = 1;
+	top = 0;
+	stack[top++] = node;
+	while (top > 0) {
+		u = stack[--top];
+		q = net->child_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0) {
+				below[q->leaf] = 1;
+				stack[top++] = q->leaf;
+			}
+			q = q->next;
+		}
+	}
+}
+
+/*
+ * Find the lowest cut head of the edited network whose pendant subnetwork contains
+ * every edited edge, that is, outside of which both networks have the same edges.
+ * By the cut edge lemma, only the subsets of the leaves below it can change.
+ * Return the node in the edited network, the root if the edit is not local.
+ */
+int Edited_Region(struct network *old, struct network *net) {
+	int nslots = BITNSLOTS(net->n_l);
+	int below1[old->no_nodes], below2[net->no_nodes];
+	int i, j, c, c1, u, w, no_out1, no_out2, best;
+
+	best = net->root;
+	for (c = 0; c < net->no_nodes; c++) {
+		if (net->cut_head[c] == 0 || net->node_type[c] == LEAVE
+				|| net->node_type[c] == ROOT
+				|| net->lf_count[c] >= net->lf_count[best])
+			continue;
+		c1 = Check_Name(old->node_strings, old->no_nodes, net->node_strings[c]);
+		if (c1 == -1 || old->cut_head[c1] == 0 || old->node_type[c1] == LEAVE
+				|| old->node_type[c1] == ROOT)
+			continue;
+		for (j = 0; j < nslots; j++)
+			if (old->lf_set[c1][j] != net->lf_set[c][j])
+				break;
+		if (j < nslots)
+			continue;
+
+		Mark_Below(c1, old, below1);
+		Mark_Below(c, net, below2);
+		no_out1 = 0;
+		for (i = 0; i < old->no_nodes; i++)
+			for (j = 0; j < old->no_nodes; j++)
+				if (old->net_edges[i][j] == 1 && below1[i] == 0)
+					no_out1 += 1;
+		no_out2 = 0;
+		for (i = 0; i < net->no_nodes; i++) {
+			for (j = 0; j < net->no_nodes; j++) {
+				if (net->net_edges[i][j] == 0 || below2[i] == 1)
+					continue;
+				no_out2 += 1;
+				u = Check_Name(old->node_strings, old->no_nodes, net->node_strings[i]);
+				w = Check_Name(old->node_strings, old->no_nodes, net->node_strings[j]);
+				if (u == -1 || w == -1 || old->net_edges[u][w] == 0 || below1[u] == 1)
+					break;
+			}
+			if (j < net->no_nodes)
+				break;
+		}
+		if (i == net->no_nodes && no_out1 == no_out2)
+			best = c;
+	}
+	return best;
+}
+
+/* build a network from its edges and compute all its soft clusters */
+void Build_Cluster_Set(char *node_strings[], int no_nodes, int start[],
+		int end[], int no_edges, struct cluster_set *cs) {
+	Build_Network(node_strings, no_nodes, start, end, no_edges, &cs->net);
+	Decompose_Blobs(&cs->net);
+	cs->no_res = (1U << cs->net.n_l);
+	cs->res = (unsigned int *) calloc(BITNSLOTS(cs->no_res), sizeof(unsigned int));
+	Evaluate_Subsets(cs, cs->no_res - 1);
+}
+
+/*
+ * Replace the network of a cluster set by an edited version of it.
+ * Only the subsets of the leaves below the edited region are evaluated again.
+ * Return the number of subsets evaluated.
+ */
+unsigned int Update_Cluster_Set(struct cluster_set *cs, char *node_strings[],
+		int no_nodes, int start[], int end[], int no_edges) {
+	struct network old = cs->net;
+	int i, c;
+
+	Build_Network(node_strings, no_nodes, start, end, no_edges, &cs->net);
+	Decompose_Blobs(&cs->net);
+
+	if (cs->net.n_l != old.n_l) {
+		Free_Network(&old);
+		free(cs->res);
+		cs->no_res = (1U << cs->net.n_l);
+		cs->res = (unsigned int *) calloc(BITNSLOTS(cs->no_res), sizeof(unsigned int));
+		return Evaluate_Subsets(cs, cs->no_res - 1);
+	}
+	for (i = 0; i < old.n_l; i++) {
+		if (strcmp(old.node_strings[i], cs->net.node_strings[i]) != 0)
+			break;
+	}
+	if (i < old.n_l)
+		c = cs->net.root;
+	else
+		c = Edited_Region(&old, &cs->net);
+	Free_Network(&old);
+
+	return Evaluate_Subsets(cs, cs->net.lf_set[c][0]);
+}
+
+void Free_Cluster_Set(struct cluster_set *cs) {
+	free(cs->res);
+	Free_Network(&cs->net);
+}
+
+/* the soft RF distance between the networks of two cluster sets, -1 if the leaves differ */
+double Cluster_Set_Distance(struct cluster_set *cs1, struct cluster_set *cs2) {
+	unsigned int i, dist;
+
+	if (cs1->net.n_l != cs2->net.n_l)
+		return -1;
+	for (i = 0; i < (unsigned int) cs1->net.n_l; i++)
+		if (strcmp(cs1->net.node_strings[i], cs2->net.node_strings[i]) != 0)
+			return -1;
+
+	dist = 0;
+	for (i = 0; i < BITNSLOTS(cs1->no_res); i++)
+		dist += pop(cs1->res[i] ^ cs2->res[i]);
+	return (double) dist / 2;
+}
+
+/*
+ * Compute the distance from a reference network to a sequence of networks, each
+ * obtained from the previous one by a local edit, keeping the clusters up to date.
+ */
+void Track_Edits(char *ref, char *files[], int no_files) {
+	struct cluster_set cs1, cs2;
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int no_edges, no_nodes, i;
+	unsigned int no_eval;
+	double dist;
+
+	Read_Network(ref, node_strings, &no_nodes, start, end, &no_edges);
+	Build_Cluster_Set(node_strings, no_nodes, start, end, no_edges, &cs1);
+	Read_Network(files[0], node_strings, &no_nodes, start, end, &no_edges);
+	Build_Cluster_Set(node_strings, no_nodes, start, end, no_edges, &cs2);
+
+	for (i = 0; i < no_files; i++) {
+		if (i > 0) {
+			Read_Network(files[i], node_strings, &no_nodes, start, end, &no_edges);
+			no_eval = Update_Cluster_Set(&cs2, node_strings, no_nodes, start, end,
+					no_edges);
+			printf("\n%s: re-evaluated %u of %u subsets", files[i], no_eval,
+					cs2.no_res - 2);
+		}
+		dist = Cluster_Set_Distance(&cs1, &cs2);
+		if (dist < 0)
+			printf("\n%s: The networks have different leaves;\nRecheck it\n", files[i]);
+		else
+			printf("\nThe soft Robinson-Foulds distance between %s and %s is: %.1f\n",
+					ref, files[i], dist);
+	}
+
+	Free_Cluster_Set(&cs1);
+	Free_Cluster_Set(&cs2);
+}
+
+/* read a whole file, which may be gzip-compressed, into a string; NULL if it is not readable */
+char *Read_File(char *arg) {
+	gzFile in;
+	char *buf;
+	size_t len, size;
+	int n;
+
+	in = gzopen(arg, "r");
+	if (in == NULL) {
+		printf("File %s is not readable\n", arg);
+		return NULL;
+	}
+	size = 1 << 16;
+	len = 0;
+	buf = (char *) malloc(size);
+	while ((n = gzread(in, buf + len, size - len - 1)) > 0) {
+		len += n;
+		if (size - len - 1 == 0) {
+			size *= 2;
+			buf = (char *) realloc(buf, size);
+		}
+	}
+	gzclose(in);
+	buf[len] = '\0';
+	return buf;
+}
+
+/* take the next word from a string, as Read_Word does from a file */
+int Next_Word(char **p, char **str, int *size) {
+	int n;
+
+	while (isspace((unsigned char) **p))
+		*p += 1;
+	n = 0;
+	while (1) {
+		if (n + 1 >= *size) {
+			*size = *size > 0 ? 2 * *size : 32;
+			*str = (char *) realloc(*str, *size);
+		}
+		if (**p == '\0' || isspace((unsigned char) **p))
+			break;
+		(*str)[n++] = **p;
+		*p += 1;
+	}
+	(*str)[n] = '\0';
+	return n > 0;
+}
+
+/* parse the edges of a network given as text, as Read_Network does */
+void Parse_Network(char *text, struct net_input *net) {
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	char *str1, *str2;
+	int u1, u2, size1, size2, no_nodes, no_edges;
+
+	str1 = NULL, str2 = NULL;
+	size1 = 0, size2 = 0;
+	no_nodes = 0;
+	no_edges = 0;
+	while (Next_Word(&text, &str1, &size1) == 1
+			&& Next_Word(&text, &str2, &size2) == 1) {
+		u1 = Check_Name(node_strings, no_nodes, str1);
+		if (u1 == -1) {
+			u1 = no_nodes, no_nodes = 1 + no_nodes;
+			node_strings[u1] = (char *) malloc(strlen(str1) + 1);
+			strcpy(node_strings[u1], str1);
+		}
+		u2 = Check_Name(node_strings, no_nodes, str2);
+		if (u2 == -1) {
+			u2 = no_nodes, no_nodes = 1 + no_nodes;
+			node_strings[u2] = (char *) malloc(strlen(str2) + 1);
+			strcpy(node_strings[u2], str2);
+		}
+		start[no_edges] = u1;
+		end[no_edges] = u2;
+		no_edges += 1;
+	}
+	free(str1);
+	free(str2);
+	net->no_nodes = no_nodes;
+	net->no_edges = no_edges;
+	net->node_strings = (char **) malloc((no_nodes + 1) * sizeof(char *));
+	net->start = (int *) malloc((no_edges + 1) * sizeof(int));
+	net->end = (int *) malloc((no_edges + 1) * sizeof(int));
+	memcpy(net->node_strings, node_strings, no_nodes * sizeof(char *));
+	memcpy(net->start, start, no_edges * sizeof(int));
+	memcpy(net->end, end, no_edges * sizeof(int));
+}
+
+/*
+ * Read the networks in a list of files. A file holds one network or several separated
+ * by lines with a single ';'. The files are read whole and split at the separators,
+ * then the networks are parsed on all cores. They are kept in input order, those of a
+ * file with several networks being named <file>:1, <file>:2, ...
+ * Return the number of networks read.
+ */
+int Read_Batch(char *files[], int no_files, struct net_input **nets) {
+	char *buf[no_files];
+	char **text, *p, *q, *line, *chunk;
+	int i, j, k, no, size, first;
+
+	size = 16;
+	no = 0;
+	text = (char **) malloc(size * sizeof(char *));
+	*nets = (struct net_input *) malloc(size * sizeof(struct net_input));
+	for (i = 0; i < no_files; i++) {
+		buf[i] = Read_File(files[i]);
+		if (buf[i] == NULL)
+			continue;
+		first = no;
+		chunk = buf[i];
+		p = buf[i];
+		while (1) {
+			line = p;
+			for (q = p; *q == ' ' || *q == '\t'; q++)
+				;
+			if (*q == ';') {
+				for (q++; *q == ' ' || *q == '\t' || *q == '\r'; q++)
+					;
+				if (*q != '\n' && *q != '\0')
+					q = NULL;
+			} else
+				q = NULL;
+			while (*p != '\n' && *p != '\0')
+				p++;
+			if (q == NULL && *p != '\0') {
+				p++;
+				continue;
+			}
+			/* the end of a network: a separator or the end of the file */
+			if (q != NULL)
+				*line = '\0';
+			for (q = chunk; isspace((unsigned char) *q); q++)
+				;
+			if (*q != '\0') {
+				if (no == size) {
+					size *= 2;
+					text = (char **) realloc(text, size * sizeof(char *));
+					*nets = (struct net_input *) realloc(*nets,
+							size * sizeof(struct net_input));
+				}
+				text[no] = chunk;
+				(*nets)[no].name = NULL;
+				no += 1;
+			}
+			if (*p == '\0')
+				break;
+			p++;
+			chunk = p;
+		}
+		for (j = first; j < no; j++) {
+			k = strlen(files[i]);
+			(*nets)[j].name = (char *) malloc(k + 16);
+			if (no - first == 1)
+				strcpy((*nets)[j].name, files[i]);
+			else
+				sprintf((*nets)[j].name, "%s:%d", files[i], j - first + 1);
+		}
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (j = 0; j < no; j++)
+		Parse_Network(text[j], &(*nets)[j]);
+
+	for (i = 0; i < no_files; i++)
+		free(buf[i]);
+	free(text);
+	return no;
+}
+
+/*
+ * Compute the soft RF distance between every pair of networks.
+ * Networks that are the same up to the labels of internal nodes are recognised by
+ * their canonical hashes, and the clusters of each distinct network are found once.
+ * The networks are hashed and evaluated on all cores.
+ */
+void All_Pairs(char *files[], int no_files) {
+	struct net_input *nets;
+	struct cluster_set *cs;
+	unsigned __int128 *h;
+	int *same;	/* the first network with the same hash */
+	int *hashed;
+	int no, i, j;
+	double dist;
+
+	no = Read_Batch(files, no_files, &nets);
+	h = (unsigned __int128 *) malloc(no * sizeof(unsigned __int128));
+	same = (int *) malloc(no * sizeof(int));
+	hashed = (int *) malloc(no * sizeof(int));
+	cs = (struct cluster_set *) calloc(no, sizeof(struct cluster_set));
+
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < no; i++)
+		hashed[i] = Canonical_Hash(nets[i].node_strings, nets[i].no_nodes,
+				nets[i].start, nets[i].end, nets[i].no_edges, &h[i]) == 0;
+	for (i = 0; i < no; i++) {
+		same[i] = i;
+		for (j = 0; j < i && hashed[i] == 1; j++) {
+			if (same[j] == j && hashed[j] == 1 && h[j] == h[i]) {
+				same[i] = j;
+				printf("%s is the same network as %s\n", nets[i].name,
+						nets[j].name);
+				break;
+			}
+		}
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < no; i++) {
+		if (same[i] == i)
+			Build_Cluster_Set(nets[i].node_strings, nets[i].no_nodes,
+					nets[i].start, nets[i].end, nets[i].no_edges, &cs[i]);
+	}
+
+	printf("\nThe soft Robinson-Foulds distances between the input networks:\n");
+	for (i = 0; i < no; i++) {
+		for (j = 0; j < no; j++) {
+			if (same[i] == same[j])
+				dist = 0;
+			else
+				dist = Cluster_Set_Distance(&cs[same[i]], &cs[same[j]]);
+			if (dist < 0)
+				printf("-");
+			else
+				printf("%.1f", dist);
+			printf(j == no - 1 ? "\n" : "\t");
+		}
+	}
+
+	for (i = 0; i < no; i++) {
+		if (same[i] == i)
+			Free_Cluster_Set(&cs[i]);
+		else {
+			for (j = 0; j < nets[i].no_nodes; j++)
+				free(nets[i].node_strings[j]);
+		}
+		free(nets[i].node_strings);
+		free(nets[i].start);
+		free(nets[i].end);
+		free(nets[i].name);
+	}
+	free(nets);
+	free(cs);
+	free(h);
+	free(same);
+	free(hashed);
+}
+
+/*
+ * Print the clusters that are soft in more than a fraction threshold of the networks,
+ * with that fraction, by size and then by leaf mask.
+ * The networks must have the same leaves, so that the sorted leaves give every network
+ * the same leaf indices and a subset has the same bit in all the cluster sets.
+ * The soft clusters of each distinct network are found once and on all cores; then the
+ * support of each subset is counted over all the networks in one sweep.
+ */
+void Consensus(char *files[], int no_files, double threshold) {
+	struct net_input *nets;
+	struct cluster_set *cs;
+	unsigned __int128 *h;
+	int *same;	/* the first network with the same hash */
+	int *hashed;
+	int *weight;	/* the number of networks each distinct network stands for */
+	int *distinct;
+	unsigned int *support;
+	unsigned int k, no_res;
+	int no, no_used, no_distinct, n, i, j, r;
+	int input_leaves[MAXSIZE];
+
+	no = Read_Batch(files, no_files, &nets);
+	if (no == 0) {
+		printf("No network was read\n");
+		return;
+	}
+	h = (unsigned __int128 *) malloc(no * sizeof(unsigned __int128));
+	same = (int *) malloc(no * sizeof(int));
+	hashed = (int *) malloc(no * sizeof(int));
+	weight = (int *) calloc(no, sizeof(int));
+	distinct = (int *) malloc(no * sizeof(int));
+	cs = (struct cluster_set *) calloc(no, sizeof(struct cluster_set));
+
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < no; i++)
+		hashed[i] = Canonical_Hash(nets[i].node_strings, nets[i].no_nodes,
+				nets[i].start, nets[i].end, nets[i].no_edges, &h[i]) == 0;
+	for (i = 0; i < no; i++) {
+		same[i] = i;
+		for (j = 0; j < i && hashed[i] == 1; j++) {
+			if (same[j] == j && hashed[j] == 1 && h[j] == h[i]) {
+				same[i] = j;
+				break;
+			}
+		}
+		weight[same[i]] += 1;
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < no; i++) {
+		if (same[i] == i)
+			Build_Cluster_Set(nets[i].node_strings, nets[i].no_nodes,
+					nets[i].start, nets[i].end, nets[i].no_edges, &cs[i]);
+	}
+
+	/* the networks on other leaves than the first one are left out */
+	n = cs[0].net.n_l;
+	no_res = cs[0].no_res;
+	no_used = 0;
+	no_distinct = 0;
+	for (i = 0; i < no; i++) {
+		if (same[i] != i)
+			continue;
+		for (j = 0; j < n && cs[i].net.n_l == n; j++)
+			if (strcmp(cs[i].net.node_strings[j], cs[0].net.node_strings[j]) != 0)
+				break;
+		if (cs[i].net.n_l != n || j < n) {
+			printf("%s has different leaves from %s and is left out\n",
+					nets[i].name, nets[0].name);
+			continue;
+		}
+		distinct[no_distinct++] = i;
+		no_used += weight[i];
+	}
+	printf("%d networks, %d distinct\n", no_used, no_distinct);
+
+	support = (unsigned int *) calloc(no_res, sizeof(unsigned int));
+	#pragma omp parallel for private(j)
+	for (k = 1; k < no_res - 1; k++) {
+		for (j = 0; j < no_distinct; j++)
+			if (BITTEST(cs[distinct[j]].res, k))
+				support[k] += weight[distinct[j]];
+	}
+
+	printf("\nClusters soft in more than %g of the networks:\n", threshold);
+	for (r = 2; r < n; r++) {
+		for (k = 1; k < no_res - 1; k++) {
+			if (pop(k) != r || support[k] <= threshold * no_used)
+				continue;
+			for (i = 0, j = 0; i < n; i++)
+				if ((k >> i) & 1U)
+					input_leaves[j++] = i;
+			printf("%.3f {", (double) support[k] / no_used);
+			for (i = 0; i < r; i++)
+				printf(i == 0 ? "%s" : ",%s", cs[0].net.node_strings[input_leaves[i]]);
+			printf("}\n");
+		}
+	}
+
+	for (i = 0; i < no; i++) {
+		if (same[i] == i)
+			Free_Cluster_Set(&cs[i]);
+		else {
+			for (j = 0; j < nets[i].no_nodes; j++)
+				free(nets[i].node_strings[j]);
+		}
+		free(nets[i].node_strings);
+		free(nets[i].start);
+		free(nets[i].end);
+		free(nets[i].name);
+	}
+	free(nets);
+	free(cs);
+	free(h);
+	free(same);
+	free(hashed);
+	free(weight);
+	free(distinct);
+	free(support);
+}
+
+/* whether a set of leaves is in a list of sets */
+int Has_Cluster(unsigned int *cl[], int m, unsigned int x[], int nslots) {
+	int i, j;
+
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < nslots; j++)
+			if (cl[i][j] != x[j])
+				break;
+		if (j == nslots)
+			return 1;
+	}
+	return 0;
+}
+
+/* the distinct hardwired clusters of a network, other than the leaves and all the leaves */
+int Hardwired_Clusters(struct network *net, unsigned int *cl[]) {
+	int nslots = BITNSLOTS(net->n_l);
+	int i, m;
+
+	m = 0;
+	for (i = 0; i < net->no_nodes; i++) {
+		if (net->lf_count[i] < 2 || net->lf_count[i] == net->n_l)
+			continue;
+		if (Has_Cluster(cl, m, net->lf_set[i], nslots) == 0)
+			cl[m++] = net->lf_set[i];
+	}
+	return m;
+}
+
+/*
+ * In every displayed tree, the cluster of a node contains all the leaves reached from it
+ * without a reticulation and is contained in its hardwired cluster.
+ * So a set of leaves can only be a soft cluster if it lies between the two for some node.
+ */
+int May_Be_Soft(struct network *net, unsigned int *tl_set[], unsigned int x[]) {
+	int nslots = BITNSLOTS(net->n_l);
+	int i, j;
+
+	for (i = 0; i < net->no_nodes; i++) {
+		for (j = 0; j < nslots; j++)
+			if ((tl_set[i][j] & ~x[j]) != 0 || (x[j] & ~net->lf_set[i][j]) != 0)
+				break;
+		if (j == nslots)
+			return 1;
+	}
+	return 0;
+}
+
+/* an upper bound on the number of soft clusters, other than the leaves and all the leaves */
+double Soft_Cluster_Bound(struct network *net, unsigned int *tl_set[]) {
+	int nslots = BITNSLOTS(net->n_l);
+	double no_soft, no_subsets, x;
+	int i, j, k;
+
+	no_subsets = 1;
+	for (i = 0; i < net->n_l; i++)
+		no_subsets *= 2;
+	no_subsets -= net->n_l + 2;
+
+	/* the sets between the two leaf sets of each node */
+	no_soft = 0;
+	for (i = 0; i < net->no_nodes && no_soft < no_subsets; i++) {
+		if (net->node_type[i] == LEAVE)
+			continue;
+		k = net->lf_count[i];
+		for (j = 0; j < nslots; j++)
+			k -= pop(tl_set[i][j]);
+		x = 1;
+		for (j = 0; j < k; j++)
+			x *= 2;
+		no_soft += x;
+	}
+	return (no_soft < no_subsets) ? no_soft : no_subsets;
+}
+
+/*
+ * Compute in polynomial time the hardwired cluster distance and bounds on the soft
+ * Robinson-Foulds distance, to decide which pairs of networks are worth the exact computation.
+ * Every hardwired cluster is a soft cluster. A hardwired cluster of one network that cannot be
+ * a soft cluster of the other is in the difference, which gives the lower bound.
+ */
+void Triage(char *arg1, char *arg2) {
+	struct network net1, net2;
+	int nslots, i, j, m1, m2, no_common, no_only1, no_only2;
+	double bound1, bound2, lower, upper;
+
+	Preprocess_Network(arg1, &net1);
+	Preprocess_Network(arg2, &net2);
+	if (net1.n_l != net2.n_l) {
+		printf("\n The networks have different number of leaves;\nRecheck it\n");
+		return;
+	}
+	for (i = 0; i < net1.n_l; i++) {
+		if (strcmp(net1.node_strings[i], net2.node_strings[i]) != 0) {
+			printf("\n The networks have different leaves;\nRecheck it\n");
+			return;
+		}
+	}
+
+	nslots = BITNSLOTS(net1.n_l);
+	unsigned int *tl_set1[net1.no_nodes], *tl_set2[net2.no_nodes];
+	unsigned int *cl1[net1.no_nodes], *cl2[net2.no_nodes];
+	int visited1[net1.no_nodes], visited2[net2.no_nodes];
+	for (i = 0; i < net1.no_nodes; i++) {
+		tl_set1[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited1[i] = 0;
+	}
+	for (i = 0; i < net2.no_nodes; i++) {
+		tl_set2[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited2[i] = 0;
+	}
+	for (i = 0; i < net1.no_nodes; i++)
+		Tree_Leaf_Set(i, &net1, tl_set1, nslots, visited1);
+	for (i = 0; i < net2.no_nodes; i++)
+		Tree_Leaf_Set(i, &net2, tl_set2, nslots, visited2);
+
+	m1 = Hardwired_Clusters(&net1, cl1);
+	m2 = Hardwired_Clusters(&net2, cl2);
+	no_common = 0;
+	no_only1 = 0;
+	no_only2 = 0;
+	for (i = 0; i < m1; i++) {
+		no_common += Has_Cluster(cl2, m2, cl1[i], nslots);
+		if (May_Be_Soft(&net2, tl_set2, cl1[i]) == 0)
+			no_only1 += 1;
+	}
+	for (j = 0; j < m2; j++) {
+		if (May_Be_Soft(&net1, tl_set1, cl2[j]) == 0)
+			no_only2 += 1;
+	}
+	bound1 = Soft_Cluster_Bound(&net1, tl_set1);
+	bound2 = Soft_Cluster_Bound(&net2, tl_set2);
+
+	lower = no_only1 + no_only2;
+	if (m1 - bound2 > lower)
+		lower = m1 - bound2;
+	if (m2 - bound1 > lower)
+		lower = m2 - bound1;
+	upper = bound1 + bound2 - 2 * no_common;
+
+	printf("\nThe hardwired cluster distance between the two input networks is: %.1f\n",
+			(double) (m1 + m2 - 2 * no_common) / 2);
+	printf("The soft Robinson-Foulds distance between the two input networks is between %.1f and %.1f\n",
+			lower / 2, upper / 2);
+
+	for (i = 0; i < net1.no_nodes; i++)
+		free(tl_set1[i]);
+	for (i = 0; i < net2.no_nodes; i++)
+		free(tl_set2[i]);
+	Free_Network(&net1);
+	Free_Network(&net2);
+}
+
 void main(int argc, char *argv[]) {
-	if (argc != 3) {
-		printf("Command: PROGRAM(./srfd) network_file1_name network_file2_name\n");
+	unsigned __int128 h1, h2;
+	int list = NO_LIST;
+	struct budget limits = {0, 0, 0};
+	unsigned int no_unknown;
+
+	while (argc > 2) {
+		if (strcmp(argv[1], "-c") == 0)
+			cache_dir = argv[2];
+		else if (strcmp(argv[1], "--list") == 0 && strcmp(argv[2], "names") == 0)
+			list = LIST_NAMES;
+		else if (strcmp(argv[1], "--list") == 0 && strcmp(argv[2], "mask") == 0)
+			list = LIST_MASK;
+		else if (strcmp(argv[1], "--max-splits") == 0)
+			limits.max_break = atoi(argv[2]);
+		else if (strcmp(argv[1], "--max-frames") == 0)
+			limits.max_frames = atol(argv[2]);
+		else if (strcmp(argv[1], "--time-limit") == 0)
+			limits.max_seconds = atof(argv[2]);
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc < 3) {
+		printf("Command: PROGRAM(./srfd) [-c cache_dir] [--list names|mask] [--max-splits n] [--max-frames n] [--time-limit seconds] [--triage | --pairs | --consensus threshold] network_file1_name network_file2_name [network_file_name ...]\n");
+		return;
+	}
+	/* the other modes find every soft cluster of each network, with no budget */
+	if ((argc > 3 || strcmp(argv[1], "--pairs") == 0)
+			&& (cache_dir != NULL || list != NO_LIST || limits.max_break > 0
+					|| limits.max_frames > 0 || limits.max_seconds > 0)) {
+		printf("-c, --list and the budget options only apply to the distance between two networks\n");
+		return;
+	}
+	if (strcmp(argv[1], "--pairs") == 0) {
+		All_Pairs(&argv[2], argc - 2);
+		return;
+	}
+	if (argc > 3 && strcmp(argv[1], "--consensus") == 0) {
+		Consensus(&argv[3], argc - 3, atof(argv[2]));
+		return;
+	}
+	if (argc == 4 && strcmp(argv[1], "--triage") == 0) {
+		if (Check_Network(argv[2]) == 0 && Check_Network(argv[3]) == 0)
+			Triage(argv[2], argv[3]);
+		return;
+	}
+	if (argc > 3) {
+		Track_Edits(argv[1], &argv[2], argc - 2);
 		return;
 	}
 	if (strcmp(argv[1], argv[2]) == 0) {
@@ -2510,11 +5388,24 @@ void main(int argc, char *argv[]) {
 				0.0);
 		return;
 	}
+	if (Check_Network(argv[1]) < 0 || Check_Network(argv[2]) < 0)
+		return;
+	if (File_Hash(argv[1], &h1) == 0 && File_Hash(argv[2], &h2) == 0 && h1 == h2) {
+		printf(
+				"\nThe two networks are the same up to the labels of internal nodes.\nThe soft Robinson-Foulds distance between the two input networks is: %.1f\n",
+				0.0);
+		return;
+	}
 
 	float dist;
-	dist = Find_Cluster_Distance(argv[1], argv[2]);
-	printf("\nThe soft Robinson-Foulds distance between the two input networks is: %.1f\n",
-			dist);
+	dist = Find_Cluster_Distance(argv[1], argv[2], list, &limits, &no_unknown);
+	if (no_unknown > 0) {
+		printf("\n%u subsets were left undecided within the budget.", no_unknown);
+		printf("\nThe soft Robinson-Foulds distance between the two input networks is between %.1f and %.1f\n",
+				dist, dist + no_unknown / 2.0);
+	} else
+		printf("\nThe soft Robinson-Foulds distance between the two input networks is: %.1f\n",
+				dist);
 
 	return;
 }
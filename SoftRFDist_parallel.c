@@ -6,9 +6,15 @@
  *   -- each reticulation node must an out-degree 1;
  *   -- only one root and no node has both in- and out-degree > 1
  *
- *   The compiling command:  gcc -fopenmp -o psrfd SoftRFDist_parallel.c
- *   The run command:        ./psrfd <network_file1_name> <network_file2_name>
+ *   The compiling command:  gcc -fopenmp -o psrfd SoftRFDist_parallel.c -lz
+ *   Without -fopenmp the program is built to run on one thread.
+ *   The run command:        ./psrfd [--list names|mask] <network_file1_name> <network_file2_name>
+ *
+ *   With --list, each cluster that is soft in only one of the networks is printed,
+ *   tagged with the network it is in, as for srfd.
 
+ *   The network files may be gzip-compressed.
+ *
  *   The network is represented as a set of edges, each on
  *   a line. For example, this is a file of the input network
  *      1 2
@@ -31,7 +37,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>		/* for CHAR_BIT */
+#include <ctype.h>
+#include <zlib.h>		/* to read compressed input */
+#ifdef _OPENMP
 #include <omp.h>
+#else			/* built without -fopenmp: run on one thread */
+#define omp_get_num_procs() 1
+#define omp_set_num_threads(n)
+#define omp_get_thread_num() 0
+#endif
+
+#define WLEN (sizeof(unsigned int) * CHAR_BIT)
+#define BITMASK(b) (1U << ((b) % WLEN))
+#define BITSLOT(b) ((b) / WLEN)
+#define BITSET(a, b) ((a)[BITSLOT(b)] |= BITMASK(b))
+#define BITCLEAR(a, b) ((a)[BITSLOT(b)] &= ~BITMASK(b))
+#define BITTEST(a, b) ((a)[BITSLOT(b)] & BITMASK(b))
+#define BITNSLOTS(nb) ((nb + WLEN - 1) / WLEN)
 
 #define max(a,b) ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); _a > _b ? _a : _b; })
 
@@ -42,10 +65,19 @@
 #define INNER 4
 #define CROSS 5
 #define REVISED 6
+/* the node types as label ranges, once Renumber_Nodes has ordered the nodes */
+#define IS_LEAF(x) ((unsigned int) (x) < (unsigned int) context.first_ret)
+#define IS_RET(x) ((unsigned int) ((x) - context.first_ret) \
+		< (unsigned int) (context.first_tree - context.first_ret))
 #define MAXDEGREE 20
 #define MAXRET 50
 #define MAXSIZE  350
 #define MAXEDGE  500
+#define MAXTREERET 15	/* the most reticulations for finding the clusters from the displayed trees */
+#define NO_LIST 0
+#define LIST_NAMES 1
+#define LIST_MASK 2
+#define COST_CLASSES 64	/* the bit lengths a predicted cost can have */
 
 struct lnode {
 	int leaf;
@@ -64,6 +96,7 @@ struct components {
 	int inner;
 	int size;	// used for copying network with array
 	int no_tree_node; // used for checking degenerate case
+	int visible;	/* whether the root of the component is visible in the input network */
 	struct arb_tnode *tree_com;
 	struct components *next;
 };
@@ -83,6 +116,61 @@ struct network {
 	int *node_type;
 	int *r_nodes;
 	struct components *all_cps;
+	int tree_size;	/* total size of the tree components, for copying */
+	unsigned int **lf_set;	/* the leaves below each node, as a bitset */
+	int *lf_count;	/* the number of leaves below each node */
+	int *cut_head;	/* whether the edge entering a node is a cut edge */
+	int *blob_of;	/* the blob below a cut head, -1 if there is none, -2 if not built */
+	int n_blob;
+	struct network *blobs;
+	int *orig_node;	/* for a blob, the node of the whole network of each node */
+	struct tree_clusters *displayed;	/* the soft clusters, if found from the displayed trees */
+};
+
+/*
+ * The network is only read by a query once it is built: what CCP changes as it goes,
+ * the flags and degrees of the reticulations, the edges and the components, is copied
+ * into a query context first. Each thread has its own context, so any number of threads
+ * can query one network at once. A context grows to the largest network it has served
+ * and is kept for the next query.
+ */
+struct query_context {
+	int max_nodes;
+	int max_comps;
+	int max_trees;
+	int first_ret;	/* the labels of its reticulations, see Renumber_Nodes */
+	int first_tree;
+	int *inner_flag;
+	int *lf_below;
+	int *super_deg;
+	int *net_edges;
+	struct components *network;
+	struct arb_tnode *trees;
+};
+struct query_context context;
+#pragma omp threadprivate(context)
+
+/* a set of clusters, kept as leaf bitsets in an open-addressing hash table */
+struct tree_clusters {
+	int nslots;
+	long size;	/* the number of buckets, a power of 2 */
+	long no;
+	unsigned int *sets;	/* nslots words for each bucket */
+	char *used;
+};
+
+/* a cluster soft in one network only, for listing */
+struct tree_diff {
+	unsigned int *set;
+	int nslots;
+	int side;
+};
+
+/* the leaves of a network before its common pendant subnetworks were collapsed */
+struct leaf_map {
+	int n_l;	/* 0 if nothing was collapsed */
+	char **names;	/* the leaves, in the order of the leaves of a network */
+	char **rep;	/* for each, the name of the leaf standing for it after the collapse */
 };
 
 // Used to keep track of sorted index
@@ -92,6 +180,29 @@ struct temp_node{
 	int index;
 };
 
+/* a cluster soft in one network only */
+struct diff_cluster {
+	unsigned long mask;	/* the leaves in the cluster, bit i for the ith leaf */
+	int side;	/* the network it is soft in */
+};
+
+/* the clusters found by one thread, on a cache line of its own */
+struct diff_buffer {
+	struct diff_cluster *clusters;
+	long no;
+	long size;
+} __attribute__((aligned(64)));
+
+/*
+ * The expensive subsets found by one thread, as the loop counter gives them, bucketed by
+ * the bit length of their predicted cost; a bucket holds costs within a factor of 2.
+ */
+struct cost_buffer {
+	unsigned long *subsets[COST_CLASSES];
+	long no[COST_CLASSES];
+	long size[COST_CLASSES];
+} __attribute__((aligned(64)));
+
 int tnode_comparator(const void *v1, const void *v2)
 {
     const struct temp_node *p1 = (struct temp_node *)v1;
@@ -145,26 +256,6 @@ struct lnode *ListExtend(struct lnode *list, int lf) {
 	return list;
 }
 
-struct arb_tnode *Search_Revised(struct arb_tnode *tree, int node) {
-	struct arb_tnode *p;
-	int i, deg;
-
-	if (tree != NULL) {
-		if (tree->label == node)
-			return tree;
-		else {
-			deg = tree->no_children;
-			p = NULL;
-			for (i = 0; i < deg; i++) {
-				p = Search_Revised((tree->child)[i], node);
-				if (p != NULL)
-					return p;
-			}
-		}
-	}
-	return NULL;
-}
-
 int Is_In(int elt, int ambig[], int n) {
 	int i;
 
@@ -174,6 +265,13 @@ int Is_In(int elt, int ambig[], int n) {
 	return -1;
 }
 
+/* same as Is_In for the input leaves, kept as a bitset */
+int Is_In_B(int leaf, unsigned int in_cluster[]) {
+	if (leaf >= 0 && BITTEST(in_cluster, leaf))
+		return 1;
+	return -1;
+}
+
 int Is_In_Str(char* node, char* leaves[], int n) {
 	int i;
 
@@ -183,70 +281,6 @@ int Is_In_Str(char* node, char* leaves[], int n) {
 	return 0;
 }
 
-/* mark forbidden nodes in the multi-labelled tree */
-void Mark_Revised(struct arb_tnode *tree, int leaf, int *no_mark) {
-	int i, deg, x, y;
-
-	if (tree == NULL)
-		return;
-	else {
-		deg = tree->no_children;
-		if (deg == 0 && tree->label == leaf) {
-			tree->flag = 1;
-			*no_mark += 1;
-			return;
-		}
-		x = 0;
-		y = -1;
-		for (i = 0; i < deg; i++) {
-			if (Search_Revised((tree->child)[i], leaf) != NULL) {
-				x = x + 1;
-				y = i;
-			}
-		}
-		if (x == 1) {
-			tree->flag = 1;
-			*no_mark += 1;
-			Mark_Revised((tree->child)[y], leaf, no_mark);
-		} else if (x > 1) {
-			tree->flag = 1;
-			*no_mark += 1;
-			return;
-		} else
-			return;
-	}
-}
-
-void Find_Vmax(struct arb_tnode *tree, int vmax[], int *no_vmax) {
-	int i, k, y, deg;
-
-	if (tree == NULL)
-		return;
-	else {
-		if (tree->flag == 1) {
-			deg = tree->no_children;
-			for (i = 0; i < deg; i++) {
-				if ((tree->child)[i]->flag == 0) {
-					y = 0;
-					for (k = 0; k < *no_vmax; k++) {
-						if (vmax[k] == (tree->child)[i]->label) {
-							y = -1;
-							break;
-						}
-					}
-					if (y == 0) {
-						vmax[*no_vmax] = (tree->child)[i]->label;
-						*no_vmax = 1 + *no_vmax;
-					}
-				} else {
-					Find_Vmax((tree->child)[i], vmax, no_vmax);
-				}
-			}
-		}
-	}
-	return;
-}
-
 int Count_Child(struct lnode *p) {
 	if (p == NULL)
 		return 0;
@@ -342,40 +376,55 @@ void Print_Comp_Revised(struct arb_tnode *tree, char *node_strings[]) {
 	}
 }
 
-int Is_In_Comp(struct arb_tnode *tree, int node) {
+/* collect the reticulations at the leaves of a component tree, return how many were found */
+int Comp_Rets(struct arb_tnode *tree, int node_type[], int rets[]) {
 	int i, k;
 
-	k = 0;
-	if (tree != NULL) {
-		if (tree->no_children == 0) {
-			if (node == tree->label)
-				k = 1;
-			else
-				k = 0;
-		} else {
-			for (i = 0; i < tree->no_children; i++) {
-				k = k + Is_In_Comp((tree->child)[i], node);
-			}
-		}
-	} else
-		k = 0;
-
-	if (k > 0)
-		return 1;
-	else
+	if (tree == NULL)
 		return 0;
+	if (tree->no_children == 0) {
+		if (node_type[tree->label] != RET)
+			return 0;
+		rets[0] = tree->label;
+		return 1;
+	}
+	k = 0;
+	for (i = 0; i < tree->no_children; i++)
+		k += Comp_Rets((tree->child)[i], node_type, rets + k);
+	return k;
 }
 
-void Initiallize(struct arb_tnode *tree) {
-	int i, deg;
+/*
+ * Build the trees of the components and count, for each reticulation, the components
+ * having it at a leaf (its super degree).
+ * The components do not depend on each other once the reticulations are known, so they
+ * are built on all cores; each lists its own reticulations, and the lists are summed up
+ * afterwards, a reticulation counting once per component however often it appears.
+ */
+void Build_Components(struct components *cps[], int no_comps,
+		struct lnode *child_array[], int node_type[], int no_nodes, int super_deg[]) {
+	int *rets[no_comps], no_rets[no_comps], last[no_nodes];
+	int i, j;
 
-	if (tree != NULL) {
-		tree->flag = 0;
-		deg = tree->no_children;
-		for (i = 0; i < deg; i++)
-			Initiallize((tree->child)[i]);
-	} else
-		return;
+	#pragma omp parallel for schedule(dynamic)
+	for (j = 0; j < no_comps; j++) {
+		Build_Comp_Revised(cps[j]->tree_com, child_array, node_type, no_nodes,
+				&cps[j]->size, &cps[j]->no_tree_node);
+		rets[j] = (int *) malloc((cps[j]->size + 1) * sizeof(int));
+		no_rets[j] = Comp_Rets(cps[j]->tree_com, node_type, rets[j]);
+	}
+
+	for (i = 0; i < no_nodes; i++)
+		last[i] = -1;
+	for (j = 0; j < no_comps; j++) {
+		for (i = 0; i < no_rets[j]; i++) {
+			if (last[rets[j][i]] != j) {
+				super_deg[rets[j][i]] += 1;
+				last[rets[j][i]] = j;
+			}
+		}
+		free(rets[j]);
+	}
 }
 
 void PostTrans_Revised(struct arb_tnode *tree, struct arb_tnode *postList[],
@@ -400,41 +449,117 @@ void PrintList_Revised(struct arb_tnode *postList[], char *names[], int no) {
 	printf("\n");
 }
 
-int Check_List(int list_a[], int no, int b) {
-	int i;
-	for (i = 0; i < no; i++) {
-		if (list_a[i] == b)
-			return i;
+/*
+ * Check whether the input leaves are the cluster of some node of a stable component,
+ * once its reticulations are replaced by leaves (a reticulation may leave several copies).
+ * A node is forbidden if all copies of a stable leaf not in B are below it, since
+ * that leaf cannot be moved away from it. Return the highest node that is not
+ * forbidden and has all the input leaves below it, or -1.
+ * This is one pass over the component with per-node counts of the input leaves,
+ * so subtrees with no input leaves or no forbidden leaf are not searched again.
+ */
+int Find_Cluster_Node(struct arb_tnode *tree, int no, int sleaves[], int no_slf,
+		int ambig[], int no_ambig, unsigned int in_cluster[], int no1, int n_l) {
+	int nslots = BITNSLOTS(n_l);
+	struct arb_tnode *pre[no], *x;
+	int parent[no], depth[no], forb[no], stack[no], first[n_l], last[n_l];
+	unsigned int in_b[no][nslots];
+	int i, j, k, n, top, u, v, leaf, count;
+
+	for (i = 0; i < n_l; i++)
+		first[i] = -1;
+
+	/* list the nodes in pre-order */
+	n = 0;
+	top = 0;
+	pre[n] = tree;
+	parent[n] = -1;
+	depth[n] = 0;
+	stack[top++] = n++;
+	while (top > 0) {
+		u = stack[--top];
+		x = pre[u];
+		forb[u] = 0;
+		for (j = 0; j < nslots; j++)
+			in_b[u][j] = 0;
+		if (x->no_children == 0 && x->label >= 0 && x->label < n_l) {
+			leaf = x->label;
+			if (first[leaf] == -1)
+				first[leaf] = u;
+			last[leaf] = u;
+			if (BITTEST(in_cluster, leaf))
+				BITSET(in_b[u], leaf);
+		}
+		for (i = x->no_children - 1; i >= 0; i--) {
+			pre[n] = (x->child)[i];
+			parent[n] = u;
+			depth[n] = depth[u] + 1;
+			stack[top++] = n++;
+		}
+	}
+
+	/* forbid the ancestors of the lowest common ancestor of the copies of each leaf not in B */
+	for (k = 0; k < no_slf + no_ambig; k++) {
+		leaf = (k < no_slf) ? sleaves[k] : ambig[k - no_slf];
+		if (BITTEST(in_cluster, leaf) || first[leaf] == -1)
+			continue;
+		u = first[leaf];
+		v = last[leaf];
+		while (depth[u] > depth[v])
+			u = parent[u];
+		while (depth[v] > depth[u])
+			v = parent[v];
+		while (u != v) {
+			u = parent[u];
+			v = parent[v];
+		}
+		forb[u] = 1;
+	}
+
+	/* children come after their parent in pre-order */
+	for (u = n - 1; u > 0; u--) {
+		if (forb[u] == 1)
+			forb[parent[u]] = 1;
+		for (j = 0; j < nslots; j++)
+			in_b[parent[u]][j] |= in_b[u][j];
+	}
+
+	for (u = 0; u < n; u++) {
+		if (forb[u] == 1)
+			continue;
+		count = 0;
+		for (j = 0; j < nslots; j++)
+			count += pop(in_b[u][j]);
+		if (count == no1)
+			return pre[u]->label;
 	}
 	return -1;
 }
 
 /*
- check whether the set of input leaves is a cluster of some node a tree component
+ * Read the next word of a file, which may be gzip-compressed: it is decompressed as it
+ * is read. *str is grown to hold the word, *size being its size, so that long node
+ * names are kept whole. Return 0 at the end of the file.
  */
-int DProgram_Revised(char *node_strings[], struct arb_tnode *super_t,
-		int n_embed, int map_nodes[][MAXSIZE], int vmax[], int no_vmax,
-		int input_leaves[], int node_type[]) {
-	int i, j, k, x;
-	struct arb_tnode *p;
-	/* each node in the cluster corresponds to a column */
-	/* each node in V_max corresponds to a row */
-	for (j = 0; j < no_vmax; j++) {
-		k = 0;
-		p = Search_Revised(super_t, vmax[j]);
-		for (i = 0; i < n_embed; i++) {
-			x = Is_Below(p, input_leaves[i], node_type);
-			if (x == 1) {
-				map_nodes[j][i] = 1;
-				k += 1;
-			}
-		}
-		/* B is a cluster of some node if there is one row of 1 */
-		if (k == n_embed) {
-			return vmax[j];
+int Read_Word(gzFile in, char **str, int *size) {
+	int c, n;
+
+	do
+		c = gzgetc(in);
+	while (c != -1 && isspace(c));
+	n = 0;
+	while (1) {
+		if (n + 1 >= *size) {
+			*size = *size > 0 ? 2 * *size : 32;
+			*str = (char *) realloc(*str, *size);
 		}
+		if (c == -1 || isspace(c))
+			break;
+		(*str)[n++] = c;
+		c = gzgetc(in);
 	}
-	return -1;
+	(*str)[n] = '\0';
+	return n > 0;
 }
 
 int Check_Name(char *node_strings[], int no_nodes, char *str1) {
@@ -502,28 +627,6 @@ int Is_Below_revised(int ret_x, int y, struct lnode *parent_array[],
 		return -1;
 }
 
-/* if a leaf y is below a node p */
-int Is_Below(struct arb_tnode *p, int y, int node_type[]) {
-	int i, x;
-
-	x = p->label;
-	if (node_type[x] == LEAVE) {
-		if (x == y) {
-			return 1;
-		} else {
-			return 0;
-		}
-	}
-
-	for (i = 0; i < p->no_children; i++) {
-		if (Is_Below((p->child)[i], y, node_type) == 1) {
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
 /*determine if all the parents of node is in a component */
 int Is_Inner_Revised(int node, struct lnode *parent_array[], int node_type[],
 		int no_nodes) {
@@ -552,49 +655,87 @@ int Is_Inner_Revised(int node, struct lnode *parent_array[], int node_type[],
 }
 
 
-int Is_Tree_Component(int rnode, int node_type[], struct lnode *child_array[]){
-	struct lnode *p;
-	p = child_array[rnode];
-	int res=0;
-	while (p != NULL) {
-		if (node_type[p->leaf] == LEAVE){
-		}
-		else if (node_type[p->leaf] == RET){ // There is a reticulate node below current reticulate node
-			return 1;
+/*
+ * A node is visible if some leaf can only be reached from the root through it, that is,
+ * if it dominates a leaf. Compute the immediate dominators in topological order, the
+ * dominator of a node with several parents being the lowest common dominator of its
+ * parents, then mark the nodes with a leaf below them in the dominator tree.
+ */
+void Visible_Nodes(int no_nodes, int root, struct lnode *child_array[],
+		struct lnode *parent_array[], int node_type[], int visible[]) {
+	int order[no_nodes], indeg[no_nodes], idom[no_nodes], depth[no_nodes];
+	int i, u, v, head, tail;
+	struct lnode *q;
+
+	for (i = 0; i < no_nodes; i++) {
+		indeg[i] = 0;
+		for (q = parent_array[i]; q != NULL; q = q->next)
+			indeg[i] += 1;
+		visible[i] = 0;
+	}
+	head = 0;
+	tail = 0;
+	order[tail++] = root;
+	idom[root] = root;
+	depth[root] = 0;
+	while (head < tail) {
+		u = order[head++];
+		if (u != root) {
+			q = parent_array[u];
+			v = q->leaf;
+			for (q = q->next; q != NULL; q = q->next) {
+				i = q->leaf;
+				while (v != i) {
+					if (depth[v] > depth[i])
+						v = idom[v];
+					else
+						i = idom[i];
+				}
+			}
+			idom[u] = v;
+			depth[u] = depth[v] + 1;
 		}
-		else // if(node_type[p->leaf] == TREE)
-		{
-			res= Is_Tree_Component(p->leaf, node_type, child_array);
-			if (res==1) return 1;
+		for (q = child_array[u]; q != NULL; q = q->next) {
+			indeg[q->leaf] -= 1;
+			if (indeg[q->leaf] == 0)
+				order[tail++] = q->leaf;
 		}
-		p = p->next;
 	}
-		return res;
+
+	for (i = tail - 1; i >= 0; i--) {
+		u = order[i];
+		if (node_type[u] == LEAVE)
+			visible[u] = 1;
+		if (visible[u] == 1)
+			visible[idom[u]] = 1;
+	}
 }
 
+/*
+ * The root of the tree component of each node: the node itself for a reticulation or
+ * the root, else the reticulation or the root found going up through tree nodes.
+ * Each node is walked over once, the nodes on the way up taking the root found.
+ */
+void Component_Roots(int no_nodes, struct lnode *parent_array[], int node_type[],
+		int comp_root[]) {
+	int path[no_nodes];
+	int i, k, v;
 
-void Count_Ret_Child(int rnode, int *count, int *flag, int *size, int n_r, int orig_rnodes[], int node_type[], struct lnode *child_array[]){
-	struct lnode *p;
-	p = child_array[rnode];
-	while (p != NULL) {
-		if (node_type[p->leaf] == LEAVE){
-			*size +=1;
-		}
-		else if (node_type[p->leaf] == RET){
-			*count += 1;
-			if (Is_In(p->leaf, orig_rnodes, n_r)==-1)
-			{
-				*flag+=1;
-			}
-		}
-		else // if(node_type[p->leaf] == TREE)
-		{
-			*size +=1;
-			Count_Ret_Child(p->leaf, count, flag, size, n_r, orig_rnodes, node_type, child_array);
+	for (i = 0; i < no_nodes; i++)
+		comp_root[i] = -1;
+	for (i = 0; i < no_nodes; i++) {
+		k = 0;
+		v = i;
+		while (comp_root[v] == -1 && node_type[v] != RET && node_type[v] != ROOT
+				&& parent_array[v] != NULL) {
+			path[k++] = v;
+			v = parent_array[v]->leaf;
 		}
-		p = p->next;
+		if (comp_root[v] == -1)
+			comp_root[v] = v;
+		while (k > 0)
+			comp_root[path[--k]] = comp_root[v];
 	}
-		return;
 }
 
 int Is_Empty(int n_r, int r_nodes[]){
@@ -613,6 +754,34 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 	int k = 0;
 	int size = 0;
 	struct lnode *p;
+	int comp_root[no_nodes], no_ret_child[no_nodes], comp_size[no_nodes], pending[no_nodes];
+	struct lnode *ret_child[no_nodes];
+
+	/*
+	 * Find once, for each tree component, its reticulate children and the number of its
+	 * other nodes, instead of walking the component again at every level.
+	 */
+	Component_Roots(no_nodes, parent_array, node_type, comp_root);
+	for (i = 0; i < no_nodes; i++) {
+		no_ret_child[i] = 0;
+		comp_size[i] = 0;
+		ret_child[i] = NULL;
+		pending[i] = 0;
+	}
+	for (i = 0; i < no_nodes; i++) {
+		if (node_type[i] != RET && node_type[i] != TREE)
+			continue;
+		for (p = child_array[i]; p != NULL; p = p->next) {
+			if (node_type[p->leaf] == RET) {
+				no_ret_child[comp_root[i]] += 1;
+				ret_child[comp_root[i]] = ListExtend(ret_child[comp_root[i]], p->leaf);
+			} else
+				comp_size[comp_root[i]] += 1;
+		}
+	}
+	for (i = 0; i < n_r; i++)
+		if (orig_rnodes[i] != -2)
+			pending[orig_rnodes[i]] = 1;
 
 	// Move reticulate nodes just above a single leaf to front
 	j = 0;
@@ -630,6 +799,7 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		}
 		if (flag == 0) {
 			r_nodes[j] = orig_rnodes[i];
+			pending[orig_rnodes[i]] = 0;
 			orig_rnodes[i] = -2;	// not consider this node later
 			j = j + 1;
 		}
@@ -638,9 +808,9 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 	// Moving reticulate nodes with only tree nodes
 	for (i = 0; i < n_r; i++) {
 		if (orig_rnodes[i]==-2) continue;
-		flag =  Is_Tree_Component(orig_rnodes[i], node_type, child_array);
-		if (flag == 0) {
+		if (no_ret_child[orig_rnodes[i]] == 0) {
 			r_nodes[j] = orig_rnodes[i];
+			pending[orig_rnodes[i]] = 0;
 			orig_rnodes[i] = -2;
 			j = j + 1;
 		}
@@ -652,10 +822,12 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		k=0;	// store the real size of the array
 		for (i = 0; i < n_r; i++) {
 			if (orig_rnodes[i]==-2) continue;
-			count = 0;	// Count the number of reticulate children
+			count = no_ret_child[orig_rnodes[i]];	// Count the number of reticulate children
 			flag = 0;	// Count the number of reticulate children which have been resolved
-			size = 0;
-			Count_Ret_Child(orig_rnodes[i], &count, &flag, &size, n_r, orig_rnodes, node_type, child_array);
+			for (p = ret_child[orig_rnodes[i]]; p != NULL; p = p->next)
+				if (pending[p->leaf] == 0)
+					flag += 1;
+			size = comp_size[orig_rnodes[i]];
 			if (flag > 0 && flag == count) {
 				struct temp_node tnode;
 				tnode.index = i;
@@ -667,16 +839,25 @@ void Sort_Rets_By_Level(int orig_rnodes[], int r_nodes[], int n_r, struct lnode
 		qsort(level_ret, k, sizeof(struct temp_node), tnode_comparator);
 		for (i = 0; i < k; i++){
 			r_nodes[j++] = level_ret[i].pnode;
+			pending[level_ret[i].pnode] = 0;
 			orig_rnodes[level_ret[i].index] = -2;	//update later to avoid handling reticulate nodes at a higher level
 		}
 	}
+
+	for (i = 0; i < no_nodes; i++) {
+		while (ret_child[i] != NULL) {
+			p = ret_child[i];
+			ret_child[i] = p->next;
+			free(p);
+		}
+	}
 }
 
 
 /* replace a reticulation by a leaf */
 /* leaf_set: stable leaves, no_lf: no. of stable leaves */
 void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
-		int node_type[], int leaf_below[], int leaf_set[], int *no_lf,
+		int leaf_below[], int leaf_set[], int *no_lf,
 		int ambig[], int *no_ambig, int optional[], int *no_opt,
 		char *node_strings[], int *rpl_comp, int super_deg[]) {
 	int i, k, j, x, y;
@@ -685,7 +866,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 		return;
 	if (tree != NULL) {
 		if (tree->no_children == 0) {
-			if (node_type[tree->label] == LEAVE) {
+			if (IS_LEAF(tree->label)) {
 				i = *no_lf;
 				y = 0;
 
@@ -699,7 +880,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 					leaf_set[*no_lf] = tree->label;
 					*no_lf = 1 + *no_lf;
 				}
-			} else if (node_type[tree->label] == RET) {
+			} else if (IS_RET(tree->label)) {
 				if(leaf_below[tree->label] == -2) return;
 				if (inner_flag[tree->label] == INNER) {
 					x = tree->label;
@@ -789,7 +970,7 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 			/* non leaf */
 		} else {
 			for (i = 0; i < tree->no_children; i++) {
-				Replace_Ret_Revised((tree->child)[i], inner_flag, node_type,
+				Replace_Ret_Revised((tree->child)[i], inner_flag,
 						leaf_below, leaf_set, no_lf, ambig, no_ambig, optional,
 						no_opt, node_strings, rpl_comp, super_deg);
 			}
@@ -801,8 +982,8 @@ void Replace_Ret_Revised(struct arb_tnode *tree, int inner_flag[],
 
 void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 		int start1[], int end1[], int no_edges1) {
-	int count, count1, i, j, x, y, k;
-	char str1[50];
+	int count, count1, i, j, x, y;
+	char *name;
 
 	count = 0;
 	for (i = 0; i < no1; i++) {
@@ -810,15 +991,9 @@ void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 			count1 = node_type1[count];
 			node_type1[count] = LEAVE;
 			node_type1[i] = count1;
-			strcpy(str1, leave_names[count]);
-			k = strlen(leave_names[i]);
-			free(leave_names[count]);
-			leave_names[count] = (char *) malloc(k + 1);
-			strcpy(leave_names[count], leave_names[i]);
-			k = strlen(str1);
-			free(leave_names[i]);
-			leave_names[i] = (char *) malloc(k + 1);
-			strcpy(leave_names[i], str1);
+			name = leave_names[count];
+			leave_names[count] = leave_names[i];
+			leave_names[i] = name;
 			x = -1;
 			y = -1;
 			for (j = 0; j < no_edges1; j++) {
@@ -852,22 +1027,18 @@ void List_Leaves_First(char *leave_names[], int node_type1[], int no1,
 /* if any leaf is not in the network, report -1 */
 int Move_Leaves_Front(char *ntk_names[], int no, int start[], int end[],
 		int no_edges, char *leave_names[], int n_l) {
-	char str1[20];
+	char *name;
 	int i, j, k, count;
 
 	for (i = 0; i < n_l; i++) {
 		count = 0;
 		for (j = 0; j < no; j++) {
 			if (strcmp(leave_names[i], ntk_names[j]) == 0) {
-				strcpy(str1, ntk_names[i]);
-				free(ntk_names[i]);
-				k = strlen(ntk_names[j]);
-				ntk_names[i] = (char *) malloc(k + 1);
-				strcpy(ntk_names[i], ntk_names[j]);
-				free(ntk_names[j]);
-				k = strlen(str1);
-				ntk_names[j] = (char *) malloc(k + 1);
-				strcpy(ntk_names[j], str1);
+				if (j == i)	// already in front
+					break;
+				name = ntk_names[i];
+				ntk_names[i] = ntk_names[j];
+				ntk_names[j] = name;
 
 				for (k = 0; k < no_edges; k++) {
 					if (start[k] == i) {
@@ -909,22 +1080,91 @@ int Move_Leaves_Front(char *ntk_names[], int no, int start[], int end[],
 	return 0;
 }
 
+/*
+ * Renumber the nodes so that the per-node arrays are read in order during a traversal:
+ * the leaves keep their labels at the front, the reticulations follow in the order
+ * they are reached, then the tree nodes of each component in post-order.
+ * The search then tells a leaf or a reticulation from its label, see IS_LEAF and IS_RET.
+ */
+void Renumber_Nodes(char *ntk_names[], int no, int start[], int end[],
+		int no_edges, int n_l) {
+	int indeg[no], first[no], pos[no], label[no], stack[no], comp[no];
+	int next[no_edges];
+	char *names[no];
+	int i, j, k, u, v, top, no_comp, n_ret, n_tree;
+
+	for (i = 0; i < no; i++) {
+		indeg[i] = 0;
+		first[i] = -1;
+		label[i] = -1;
+	}
+	for (k = no_edges - 1; k >= 0; k--) {
+		next[k] = first[start[k]];
+		first[start[k]] = k;
+		indeg[end[k]] += 1;
+	}
+	n_tree = n_l;
+	no_comp = 0;
+	for (i = 0; i < no; i++) {
+		if (i < n_l)
+			label[i] = i;
+		else if (indeg[i] > 1)
+			n_tree += 1;
+		else if (indeg[i] == 0)
+			comp[no_comp++] = i;
+	}
+
+	/* each component is rooted at the root or at a reticulation */
+	n_ret = n_l;
+	for (j = 0; j < no_comp; j++) {
+		top = 0;
+		stack[top++] = comp[j];
+		pos[comp[j]] = first[comp[j]];
+		while (top > 0) {
+			u = stack[top - 1];
+			k = pos[u];
+			if (k == -1) {
+				top -= 1;
+				if (label[u] == -1)
+					label[u] = n_tree++;
+				continue;
+			}
+			pos[u] = next[k];
+			v = end[k];
+			if (label[v] != -1)
+				continue;
+			if (indeg[v] > 1) {
+				label[v] = n_ret++;
+				comp[no_comp++] = v;
+			} else {
+				stack[top++] = v;
+				pos[v] = first[v];
+			}
+		}
+	}
+	for (i = 0; i < no; i++) {
+		if (label[i] == -1)
+			label[i] = n_tree++;
+		names[label[i]] = ntk_names[i];
+	}
+	for (i = 0; i < no; i++)
+		ntk_names[i] = names[i];
+	for (k = 0; k < no_edges; k++) {
+		start[k] = label[start[k]];
+		end[k] = label[end[k]];
+	}
+}
+
 void Sort_Leaves(char *ntk_names[], int n_l, int start[], int end[],
 		int no_edges) {
 	int i, j, k;
-	char str1[20];
+	char *name;
 	for (i = 0; i < n_l; i++)
 		for (j = i + 1; j < n_l; j++) {
 			if (strcmp(ntk_names[i], ntk_names[j]) > 0) {
-				strcpy(str1, ntk_names[i]);
-				free(ntk_names[i]);
-				k = strlen(ntk_names[j]);
-				ntk_names[i] = (char *) malloc(k + 1);
-				strcpy(ntk_names[i], ntk_names[j]);
-				free(ntk_names[j]);
-				k = strlen(str1);
-				ntk_names[j] = (char *) malloc(k + 1);
-				strcpy(ntk_names[j], str1);
+				name = ntk_names[i];
+				ntk_names[i] = ntk_names[j];
+				ntk_names[j] = name;
 
 				for (k = 0; k < no_edges; k++) {
 					if (start[k] == i) {
@@ -1014,7 +1254,7 @@ int Node_Type_Inform(int node_type[], int r_nodes[], int no_nodes, int start[],
 			node_type[i] = RET;
 			n_r = n_r + 1;
 		}
-		if (in > 1 && out > 1) {
+		if (in > 1 && out != 1) {
 			check_node = check_node + 1;
 		}
 	}
@@ -1054,7 +1294,7 @@ int Node_Type_Inform1(int node_type[], int no_nodes, int start[], int end[],
 		if (in > 1 && out == 1) {
 			node_type[i] = RET;
 		}
-		if (in > 1 && out > 1) {
+		if (in > 1 && out != 1) {
 			check_node = check_node + 1;
 		}
 	}
@@ -1065,26 +1305,25 @@ int Node_Type_Inform1(int node_type[], int no_nodes, int start[], int end[],
 }
 
 /* The component is stable if it contains a leaf or a reticulation node below it is 'INNER' */
-int Is_Stable(struct arb_tnode *comp_ptr, int node_type[], int inner_flag[],
+int Is_Stable(struct arb_tnode *comp_ptr, int inner_flag[],
 		int lf_below[]) {
 	int i, deg;
 
 	if (comp_ptr == NULL)
 		return -1;
 	else {
-		if (node_type[comp_ptr->label] == LEAVE)
+		if (IS_LEAF(comp_ptr->label))
 			return 1;
-		else if (node_type[comp_ptr->label] == RET) {
+		else if (IS_RET(comp_ptr->label)) {
 			if (inner_flag[comp_ptr->label] == INNER
 					&& lf_below[comp_ptr->label] >= 0)
 				return 1;
 			else
 				return 0;
-		} else if (node_type[comp_ptr->label] == TREE
-				|| node_type[comp_ptr->label] == ROOT) {
+		} else {
 			deg = comp_ptr->no_children;
 			for (i = 0; i < deg; i++) {
-				if (Is_Stable((comp_ptr->child)[i], node_type, inner_flag,
+				if (Is_Stable((comp_ptr->child)[i], inner_flag,
 						lf_below) == 1)
 					return 1;
 			}
@@ -1094,22 +1333,22 @@ int Is_Stable(struct arb_tnode *comp_ptr, int node_type[], int inner_flag[],
 }
 
 /* lf_below_comp: the leaves below the component (to simply the component) */
-void Find_UnStable(struct arb_tnode *comp_ptr, int input_leaves[], int no_leaf,
+void Find_UnStable(struct arb_tnode *comp_ptr, unsigned int in_cluster[],
 		int unstb_rets_in[], int *no_rets_in, int unstb_rets_out[],
-		int *no_rets_out, int node_type[], int inner_flag[], int lf_below[], int lf_in_comp[], int *no_in_lfb, int lf_out_comp[], int *no_out_lfb) {
+		int *no_rets_out, int inner_flag[], int lf_below[], int lf_in_comp[], int *no_in_lfb, int lf_out_comp[], int *no_out_lfb) {
 	int i, deg;
 
 	if (comp_ptr == NULL)
 		return;
 	else {
-		if (node_type[comp_ptr->label] == LEAVE){ // should not occur, since the component is invisible
+		if (IS_LEAF(comp_ptr->label)){ // should not occur, since the component is invisible
 			return;
 		}
-		else if (node_type[comp_ptr->label] == RET) {
+		else if (IS_RET(comp_ptr->label)) {
 			if (inner_flag[comp_ptr->label] == CROSS) {
 				int leaf = lf_below[comp_ptr->label];
 				if (leaf == -2) return;
-				if (Is_In(leaf, input_leaves, no_leaf) == 1) {
+				if (BITTEST(in_cluster, leaf)) {
 					unstb_rets_in[*no_rets_in] = comp_ptr->label;
 					*no_rets_in = *no_rets_in + 1;
 					lf_in_comp[*no_in_lfb] = leaf;
@@ -1121,13 +1360,12 @@ void Find_UnStable(struct arb_tnode *comp_ptr, int input_leaves[], int no_leaf,
 					*no_out_lfb = *no_out_lfb + 1;
 				}
 			}
-		} else if (node_type[comp_ptr->label] == TREE
-				|| node_type[comp_ptr->label] == ROOT) {
+		} else {
 			deg = comp_ptr->no_children;
 			for (i = 0; i < deg; i++) {
-				Find_UnStable((comp_ptr->child)[i], input_leaves, no_leaf,
+				Find_UnStable((comp_ptr->child)[i], in_cluster,
 						unstb_rets_in, no_rets_in, unstb_rets_out, no_rets_out,
-						node_type, inner_flag, lf_below, lf_in_comp, no_in_lfb, lf_out_comp, no_out_lfb);
+						inner_flag, lf_below, lf_in_comp, no_in_lfb, lf_out_comp, no_out_lfb);
 			}
 		}
 		return;
@@ -1179,6 +1417,7 @@ void *Make_Current_Network(struct components *p, int no_comp,
 		network[i].inner = ptr->inner;
 		network[i].size = ptr->size;
 		network[i].no_tree_node = ptr->no_tree_node;
+		network[i].visible = ptr->visible;
 		//printf("copy trees\n");
 		if (ptr->size == 0){
 			network[i].tree_com = NULL;
@@ -1226,6 +1465,96 @@ void Destroy_Network(struct components *cmp) {
 	}
 }
 
+/* count the nodes below a node */
+int Count_Below(struct arb_tnode *tree) {
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < tree->no_children; i++)
+		n += 1 + Count_Below(tree->child[i]);
+	return n;
+}
+
+/*
+ * Contract the subtree below a node into its first leaf, see Contract_Tree.
+ * The nodes below it belong to the copy of the query, so they are not freed.
+ */
+void Contract_Leaf(struct arb_tnode *tree, int *size) {
+	struct arb_tnode *x;
+
+	for (x = tree; x->no_children > 0; x = x->child[0])
+		;
+	*size -= Count_Below(tree);
+	tree->no_children = 0;
+	tree->label = x->label;
+}
+
+/*
+ * Within a query, a subtree with no reticulation below it whose leaves are all
+ * in B or all outside B is a single leaf: it stays whole in every displayed tree.
+ * Contract every such subtree below a node of a component into its first leaf.
+ * The other leaves keep their bits in B, as the search still reads them in the
+ * network, but no longer count in *no1. Return the number of leaves below the
+ * node, with those in B in *no_in, or -1 if a reticulation is below it, as the
+ * caller contracts the highest nodes.
+ */
+int Contract_Tree(struct arb_tnode *tree, unsigned int in_cluster[], int *no_in,
+		int *no1, int *size) {
+	int no_lf[MAXDEGREE], in[MAXDEGREE];
+	int i, n;
+
+	*no_in = 0;
+	if (tree->no_children == 0) {
+		if (!IS_LEAF(tree->label))
+			return -1;
+		if (BITTEST(in_cluster, tree->label))
+			*no_in = 1;
+		return 1;
+	}
+	n = 0;
+	for (i = 0; i < tree->no_children; i++) {
+		no_lf[i] = Contract_Tree(tree->child[i], in_cluster, &in[i], no1, size);
+		if (no_lf[i] == -1 || n == -1)
+			n = -1;
+		else
+			n += no_lf[i];
+		*no_in += in[i];
+	}
+	if (n != -1)
+		return n;
+	for (i = 0; i < tree->no_children; i++) {
+		if (no_lf[i] < 2 || (in[i] != 0 && in[i] != no_lf[i]))
+			continue;
+		Contract_Leaf(tree->child[i], size);
+		if (in[i] != 0)
+			*no1 -= no_lf[i] - 1;
+	}
+	return -1;
+}
+
+/*
+ * Contract the subtrees of all components for the query B, so that the search
+ * runs on a network whose size depends on how B cuts it rather than on the
+ * number of leaves. Return the number of leaves of B left.
+ */
+int Contract_Components(struct components *cps, unsigned int in_cluster[],
+		int no1) {
+	struct components *p;
+	int n, no_in;
+
+	for (p = cps; p != NULL; p = p->next) {
+		if (p->tree_com == NULL)
+			continue;
+		n = Contract_Tree(p->tree_com, in_cluster, &no_in, &no1, &p->size);
+		if (n < 2 || (no_in != 0 && no_in != n))
+			continue;
+		Contract_Leaf(p->tree_com, &p->size);
+		if (no_in != 0)
+			no1 -= n - 1;
+	}
+	return no1;
+}
+
 void Free_Lnodes(struct lnode* head) {
 	struct lnode* tmp;
 
@@ -1236,64 +1565,37 @@ void Free_Lnodes(struct lnode* head) {
 	}
 }
 
-void Modify1(struct arb_tnode *p, int node_type[], int unstb_ret,
+/*
+ * Remove the edges into unstb_ret from the component tree below p. The last child of a
+ * node is moved into the slot of a deleted one, so that no compaction loop is needed,
+ * and a node is only looked into if it has children.
+ */
+void Modify1(struct arb_tnode *p, int unstb_ret,
 		int *comp_size, int no_nodes, int *net_edges) {
-	struct arb_tnode *ptr;
-	int i, k, j, deg;
-	struct arb_tnode *tmp;
+	int i;
 
 	if (p == NULL)
 		return;
-
-	if (node_type[p->label] == LEAVE) {
-		return;
-	} else if (node_type[p->label] == RET) {
-		return;
-	} else if (node_type[p->label] == TREE || node_type[p->label] == ROOT) {
-		deg = p->no_children;
-		for (i = 0; i < deg; i++) {
-			ptr = (p->child)[i];
-			if (ptr->label == unstb_ret) {
-//				tmp = (p->child)[i];
-//				Destroy_Arbtree(tmp);
-				// printf("delete edge %d\t%d\n", p->label, ptr->label);
-				// net_edges[p->label][ptr->label]=0;
-				*(net_edges + p->label*no_nodes + ptr->label) = 0;
-				(p->child)[i] = NULL;
-				*comp_size = *comp_size - 1;
-			} else {
-				Modify1((p->child)[i], node_type, unstb_ret, comp_size, no_nodes, net_edges);
-			}
-		}
-
-		k = deg;
-		for (i = 0; i < deg; i++) {
-			if ((p->child)[i] == NULL)
-				k = k - 1;
-		}
-
-		p->no_children = k;
-
-		for (i = 0; i < deg; i++) {
-			if ((p->child)[i] == NULL) {
-				j = i + 1;
-				while ((p->child)[j] == NULL && j < deg)
-					j = j + 1;
-				(p->child)[i] = (p->child)[j];
-				(p->child)[j] = NULL;
-			}
-		}
+	for (i = p->no_children - 1; i >= 0; i--) {
+		if ((p->child)[i]->label == unstb_ret) {
+			*(net_edges + p->label * no_nodes + unstb_ret) = 0;
+			*comp_size = *comp_size - 1;
+			p->no_children -= 1;
+			(p->child)[i] = (p->child)[p->no_children];
+			(p->child)[p->no_children] = NULL;
+		} else if ((p->child)[i]->no_children > 0)
+			Modify1((p->child)[i], unstb_ret, comp_size, no_nodes, net_edges);
 	}
 }
 
-void Modify2(struct components *p, int node_type[], int x, int no_nodes, int *net_edges) {
+void Modify2(struct components *p, int x, int no_nodes, int *net_edges) {
 	struct components *p_copy;
 
 	if (p != NULL) {
 		p_copy = p;
 		while (p_copy != NULL) {
 			if (p_copy->tree_com != NULL)
-				Modify1(p_copy->tree_com, node_type, x, &p_copy->size, no_nodes, net_edges);
+				Modify1(p_copy->tree_com, x, &p_copy->size, no_nodes, net_edges);
 			p_copy = p_copy->next;
 		}
 	}
@@ -1303,7 +1605,7 @@ void Modify2(struct components *p, int node_type[], int x, int no_nodes, int *ne
  *	For network pointed by p, remove all parents of unstb_ret in other components. (The size of these other components reduce by 1)
  * For network pointed by p1, exclude current component from new network. (The size of current component reduce by 1)
  */
-void Modify(struct components *p, struct components *p1, int node_type[],
+void Modify(struct components *p, struct components *p1,
 		int unstb_ret, int no_nodes, int *net_edges, int *net_edges1) {
 	struct components *ptr;
 	//struct arb_tnode *tmp;
@@ -1324,7 +1626,7 @@ void Modify(struct components *p, struct components *p1, int node_type[],
 				ptr->size = ptr->size - 1;
 			} else {
 				// search the ret node recursively in the tree comp
-				Modify1(ptr->tree_com, node_type, unstb_ret, &ptr->size, no_nodes, net_edges);
+				Modify1(ptr->tree_com, unstb_ret, &ptr->size, no_nodes, net_edges);
 			}
 		}
 		ptr = ptr->next;
@@ -1341,7 +1643,7 @@ void Modify(struct components *p, struct components *p1, int node_type[],
 		p1->tree_com = NULL;
 		p1->size = p1->size - 1;
 	} else {
-		Modify1(p1->tree_com, node_type, unstb_ret, &p1->size, no_nodes, net_edges1);
+		Modify1(p1->tree_com, unstb_ret, &p1->size, no_nodes, net_edges1);
 	}
 }
 
@@ -1371,7 +1673,7 @@ void Print_tree11(struct arb_tnode *tree, int node_type[],
 }
 
 /* all the ret nodes have been replaced by leaves */
-void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
+void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp,
 		char *node_strings[]) {
 	int i, x, y;
 
@@ -1380,7 +1682,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 	if (tree != NULL) {
 		if (tree->no_children == 0) {
 			x = tree->label;
-			if (node_type[x] == LEAVE) {
+			if (IS_LEAF(x)) {
 				/* the leaf is used to replace ret node */
 				// if (rpl_comp[x] != -1) {
 				if (rpl_comp[x] >= 0) {
@@ -1393,7 +1695,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 			/* non leaf */
 		} else {
 			for (i = 0; i < tree->no_children; i++) {
-				Rebuilt_Component((tree->child)[i], rpl_comp, node_type,
+				Rebuilt_Component((tree->child)[i], rpl_comp,
 						node_strings);
 			}
 			return;
@@ -1402,7 +1704,7 @@ void Rebuilt_Component(struct arb_tnode *tree, int *rpl_comp, int node_type[],
 }
 
 void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
-		int node_type[], int* optional, char* node_strings[], int* in_cluster,
+		int* optional, char* node_strings[], unsigned int *in_cluster,
 		struct components* p, int no_nodes, int *net_edges) {
 	int i, x;
 	/* remove edges entering CR(C) */
@@ -1410,11 +1712,11 @@ void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
 		x = lf_below[r_nodes[i]];
 		if (x >= 0) {
 			if (Is_In(x, optional, no_opt) == 1) {
-				if (in_cluster[x] == 1) {
-					Modify2(p->next, node_type, r_nodes[i], no_nodes, net_edges);
+				if (BITTEST(in_cluster, x)) {
+					Modify2(p->next, r_nodes[i], no_nodes, net_edges);
 					lf_below[r_nodes[i]] = -2;
-				} else if (in_cluster[x] == 0) {
-					Modify1(p->tree_com, node_type, r_nodes[i], &p->size, no_nodes, net_edges);
+				} else {
+					Modify1(p->tree_com, r_nodes[i], &p->size, no_nodes, net_edges);
 				}
 			}
 		}
@@ -1422,17 +1724,17 @@ void Modify_Cross_Ret(int n_r, int lf_below[], int r_nodes[], int no_opt,
 }
 
 void Modify_Cross_Ret1(int n_r, int lf_below[], int r_nodes[], int no_opt,
-		int node_type[], int* optional, char* node_strings[], int* in_cluster,
+		int* optional, char* node_strings[], unsigned int *in_cluster,
 		struct components* p, int no_nodes, int *net_edges) {
 	int i, x;
 	for (i = 0; i < n_r; i++) {
 		x = lf_below[r_nodes[i]];
 		if (x >= 0 && Is_In(x, optional, no_opt) == 1) {
-			if (in_cluster[x] == 0) {
-				Modify2(p->next, node_type, r_nodes[i], no_nodes, net_edges);
+			if (!BITTEST(in_cluster, x)) {
+				Modify2(p->next, r_nodes[i], no_nodes, net_edges);
 				lf_below[r_nodes[i]] = -2;
-			} else if (in_cluster[x] == 1) {
-				Modify1(p->tree_com, node_type, r_nodes[i], &p->size, no_nodes, net_edges);
+			} else {
+				Modify1(p->tree_com, r_nodes[i], &p->size, no_nodes, net_edges);
 			}
 		}
 	}
@@ -1459,7 +1761,7 @@ int Count_Parent(int child, struct lnode *parent_array[], int no_nodes, int *net
 
 // Check whether it is feasible for the subtree below a node to display the input cluster
 // indicator -- to show whether the leaf should be in the input or not. For 1st network, indicator=1. For 2nd network, indicator=-1.
-int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int no1, int input_leaves[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
+int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, unsigned int in_cluster[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
 	struct lnode *parent_array[], int *net_edges)
 {
 	int i;
@@ -1473,22 +1775,22 @@ int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int
 		// if (net_edges[parent][a_leaf]==0 ){child = child->next; continue;}
 		if(*(net_edges + parent * no_nodes + a_leaf) == 0){child = child->next; continue;}
 
-		if (node_type[a_leaf]==RET)
+		if (IS_RET(a_leaf))
 		{
 			int l_below = lf_below[a_leaf];
 			if (l_below!=-2 && l_below==curr_leaf) {child = child->next; continue;}
 			num_parent = Count_Parent(a_leaf, parent_array, no_nodes, net_edges);
 			if(num_parent>=2 && l_below==-2) return 1;	// reticulate node that has not been processed
-			if(num_parent<=1 && Is_In(l_below, input_leaves, no1) == indicator) return 0;
+			if(num_parent<=1 && Is_In_B(l_below, in_cluster) == indicator) return 0;
 		}
-		else if (node_type[a_leaf]==LEAVE)
+		else if (IS_LEAF(a_leaf))
 		{
-			if (Is_In(a_leaf, input_leaves, no1) == indicator){
+			if (Is_In_B(a_leaf, in_cluster) == indicator){
 				return 0;
 			}
 		}
 		else{ // TREE node, traverse until leaves
-			return Is_Feasible_Node(a_leaf, curr_leaf, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+			return Is_Feasible_Node(a_leaf, curr_leaf, indicator, no_nodes, in_cluster, inner_flag, lf_below, node_strings, child_array,
 				parent_array, net_edges);
 		}
 		// printf("Go to next child\n");
@@ -1499,7 +1801,7 @@ int Is_Feasible_Node(int parent, int curr_leaf, int indicator, int no_nodes, int
 
 
 // Check whether to continue running on one network
-int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int input_leaves[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
+int To_Run_Network(int unstb_ret, int indicator, int no_nodes, unsigned int in_cluster[], int node_type[], int inner_flag[], int lf_below[], char *node_strings[], struct lnode *child_array[],
 	struct lnode *parent_array[], int *net_edges){
 	int to_run=1;
 	int curr_leaf = lf_below[unstb_ret];
@@ -1512,7 +1814,7 @@ int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int inpu
 			continue;	// The edge has been deleted
 		}
 
-		to_run = Is_Feasible_Node(parent->leaf, curr_leaf, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+		to_run = Is_Feasible_Node(parent->leaf, curr_leaf, indicator, no_nodes, in_cluster, inner_flag, lf_below, node_strings, child_array,
 			parent_array, net_edges);
 		if (to_run==0)	break;
 
@@ -1524,32 +1826,32 @@ int To_Run_Network(int unstb_ret, int indicator, int no_nodes, int no1, int inpu
 
 int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 		int no_nodes, int node_type[], int inner_flag[], int lf_below[],
-		char *node_strings[], int no1, int *input_leaves, int* in_cluster,
+		char *node_strings[], int no1, unsigned int *in_cluster,
 		int super_deg[], struct components *cps, struct lnode *child_array[], struct lnode *parent_array[], int *net_edges,
 		int n_l, int *no_break) {
 	int i, j;
 	int no, no_slf, no_ambig, no_opt;
 
 	int nlf_kept; /* no. of leaves to keep in B */
-	int no_vmax, no_mark;
 
 	struct components *p, *p_copy;
 	struct components *p1, *whole_copy;
 	int unstb_ret;
 	int no1_1;	// copy of no1
 	int res, is_cluster, num_inleaf, count_in, count_out;
+	int nslots = BITNSLOTS(n_l);
 
 	p = ptr;
 	if (p == NULL)
 		return 0;
 
 	if (p->tree_com == NULL) {
-		Modify2(p->next, node_type, p->ret_node, no_nodes, net_edges);
+		Modify2(p->next, p->ret_node, no_nodes, net_edges);
 		return Cluster_Containment(p->next, r_nodes, n_r, no_nodes, node_type,
-				inner_flag, lf_below, node_strings, no1, input_leaves,
-				in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l, no_break);
+				inner_flag, lf_below, node_strings, no1, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l, no_break);
 	}
-	else if (Is_Stable(p->tree_com, node_type, inner_flag, lf_below) == 1) {
+	else if (p->visible == 1
+			|| Is_Stable(p->tree_com, inner_flag, lf_below) == 1) {
 		struct arb_tnode* postList[2 * no_nodes];
 		no = 0;
 		PostTrans_Revised(p->tree_com, postList, &no);
@@ -1563,7 +1865,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 		}
 
 		/* build a tree from the component */
-		Replace_Ret_Revised(p->tree_com, inner_flag, node_type, lf_below,
+		Replace_Ret_Revised(p->tree_com, inner_flag, lf_below,
 				sleaves, &no_slf, ambig, &no_ambig, optional, &no_opt,
 				node_strings, rpl_comp, super_deg);
 
@@ -1581,54 +1883,27 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 		if (no_slf > 0) {
 			if(no_opt == 0 && no_slf == 1 ){	// There are only one stable leaf below the component
-				if (no1 == 1 && sleaves[0] == input_leaves[0]){
+				if (no1 == 1 && BITTEST(in_cluster, sleaves[0])){
 					return 50;
 				}
 				else{	// There are more than one input leaves
 					lf_below[p->ret_node] = sleaves[0];
 					return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+							in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 							no_break);
 				}
 			}
 			else	// There are more than one stable leaves below the component
 			{
-				/* mark nodes and find Vmax */
-				Initiallize(p->tree_com);
-				no_mark = 0;
-				no_vmax = 0;
-				/* mark ambiguous leaves */
-				for (i = 0; i < no_ambig; i++) {
-					if (in_cluster[ambig[i]] == 0) {
-						Mark_Revised(p->tree_com, ambig[i], &no_mark);
-					}
-				}
-				/* mark a leaf that is neither ambiguous nor optional */
-				for (i = 0; i < no_slf; i++) {
-					if (Check_List(ambig, no_ambig, sleaves[i]) == -1
-							&& in_cluster[sleaves[i]] == 0) {
-						Mark_Revised(p->tree_com, sleaves[i], &no_mark);
-					}
-				}
-
-				int vmax[no];
-				if (no_mark == 0) {
-					vmax[0] = p->tree_com->label;
-					no_vmax = 1;
-				} else {
-					Find_Vmax(p->tree_com, vmax, &no_vmax);
-				}
-
-				int map_nodes[no_vmax][MAXSIZE];
-				is_cluster = DProgram_Revised(node_strings, p->tree_com, no1,
-						map_nodes, vmax, no_vmax, input_leaves, node_type);
-				Rebuilt_Component(p->tree_com, rpl_comp, node_type, node_strings);
+				is_cluster = Find_Cluster_Node(p->tree_com, no, sleaves, no_slf,
+						ambig, no_ambig, in_cluster, no1, n_l);
+				Rebuilt_Component(p->tree_com, rpl_comp, node_strings);
 			}
 
 			if (is_cluster >= 0) {
 				/* remove edges entering CR(C) for visualization */
-				Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt, node_type,
+				Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
 						optional, node_strings, in_cluster, p, no_nodes, net_edges);
 				return 50;
 			} else {
@@ -1642,80 +1917,69 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 					lf_below[p->ret_node] = sleaves[0];
 				}
 
+				unsigned int slf_set[nslots], opt_set[nslots];
+				for (j = 0; j < nslots; j++) {
+					slf_set[j] = 0;
+					opt_set[j] = 0;
+				}
+				for (i = 0; i < no_slf; i++)
+					BITSET(slf_set, sleaves[i]);
+				for (i = 0; i < no_opt; i++)
+					BITSET(opt_set, optional[i]);
+
 				count_out = 0;
 				count_in = 0;
-				for (i = 0; i < no_slf; i++) {
-					if (in_cluster[sleaves[i]] == 0) {
-						count_out += 1;
-					} else if (in_cluster[sleaves[i]] == 1) {
-						count_in += 1;
-					}
+				for (j = 0; j < nslots; j++) {
+					count_out += pop(slf_set[j] & ~in_cluster[j]);
+					count_in += pop(slf_set[j] & in_cluster[j]);
 				}
 
 				/* L and B are disjoint */
-				if (count_out == no_slf) {
-					Modify_Cross_Ret1(n_r, lf_below, r_nodes, no_opt, node_type,
+				if (count_in == 0) {
+					Modify_Cross_Ret1(n_r, lf_below, r_nodes, no_opt,
 							optional, node_strings, in_cluster, p, no_nodes, net_edges);
 					return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps,
+							in_cluster, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 				/* L and notB are disjoint */
-				else if (count_in == no_slf) {
+				else if (count_out == 0) {
 					/* check whether B^==B */
 					num_inleaf = 0;
-					for (i = 0; i < no_slf; i++) {
-						if (in_cluster[sleaves[i]] == 1)
-							num_inleaf += 1;
-					}
-					for (i = 0; i < no_opt; i++) {
-						if (in_cluster[optional[i]] == 1)
-							num_inleaf += 1;
-					}
+					for (j = 0; j < nslots; j++)
+						num_inleaf += pop((slf_set[j] | opt_set[j]) & in_cluster[j]);
 
 					if (num_inleaf == no1) {
 						/* remove edges related to CR(C) */
 						Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
-								node_type, optional, node_strings, in_cluster,
+								optional, node_strings, in_cluster,
 								p, no_nodes, net_edges);
 						return 50;
 					}
 					/* remove edges related to CR(C) */
-					Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt, node_type,
+					Modify_Cross_Ret(n_r, lf_below, r_nodes, no_opt,
 							optional, node_strings, in_cluster, p, no_nodes, net_edges);
 
-					/* decrease B */
+					/* decrease B by the leaves removed, see Contract_Tree */
 					if (no_slf + no_opt > 1){
-						int input_leaves1[no1];
-						nlf_kept = 0;
-						for (i = 0; i < no1; i++) {
-							if (Is_In(input_leaves[i], sleaves, no_slf) == -1
-									&& Is_In(input_leaves[i], optional, no_opt)
-											== -1) {
-								input_leaves1[nlf_kept++] = input_leaves[i];
-							}
-						}
-						input_leaves1[nlf_kept++] = sleaves[0];
-						no1 = nlf_kept;
-
-						/* revise in_cluster */
-						int in_cluster1[n_l];
-						for (i = 0; i < n_l; i++) {
-							in_cluster1[i] = in_cluster[i];
-							if (Is_In(i, input_leaves1, no1) == -1) {
-								in_cluster1[i] = 0;
-							}
+						unsigned int in_cluster1[nslots];
+						nlf_kept = no1;
+						for (j = 0; j < nslots; j++) {
+							in_cluster1[j] = in_cluster[j] & ~(slf_set[j] | opt_set[j]);
+							nlf_kept -= pop(in_cluster[j] & ~in_cluster1[j]);
 						}
+						BITSET(in_cluster1, sleaves[0]);
+						no1 = nlf_kept + 1;
 						res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 								node_type, inner_flag, lf_below, node_strings, no1,
-								input_leaves1, in_cluster1, super_deg, cps,
+								in_cluster1, super_deg, cps,
 								child_array, parent_array, net_edges, n_l, no_break);
 					}
 					else{
 						res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 								node_type, inner_flag, lf_below, node_strings, no1,
-								input_leaves, in_cluster, super_deg, cps,
+								in_cluster, super_deg, cps,
 								child_array, parent_array, net_edges, n_l, no_break);
 					}
 
@@ -1731,12 +1995,12 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			}
 		} else {
 			//  Empty Component
-			Rebuilt_Component(p->tree_com, rpl_comp, node_type, node_strings);
+			Rebuilt_Component(p->tree_com, rpl_comp, node_strings);
 			unstb_ret = p->tree_com->label;
-			Modify(p->next, NULL, node_type, unstb_ret, no_nodes, net_edges, NULL);
+			Modify(p->next, NULL, unstb_ret, no_nodes, net_edges, NULL);
 			return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 					node_type, inner_flag, lf_below, node_strings, no1,
-					input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+					in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 					no_break);
 		}
 	}
@@ -1749,11 +2013,11 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 
 		int unstb_rets_in[n_r];
 		int unstb_rets_out[n_r];
-		int lf_in_comp[no1];
-		int lf_out_comp[no1];
+		int lf_in_comp[n_r];
+		int lf_out_comp[n_r];
 
-		Find_UnStable(p->tree_com, input_leaves, no1, unstb_rets_in,
-				&no_rets_in, unstb_rets_out, &no_rets_out, node_type,
+		Find_UnStable(p->tree_com, in_cluster, unstb_rets_in,
+				&no_rets_in, unstb_rets_out, &no_rets_out,
 				inner_flag, lf_below, lf_in_comp, &no_in_lfb, lf_out_comp, &no_out_lfb);
 
 		// check whether leaves below current component equals to B
@@ -1811,7 +2075,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 						inner_flag1[unstb_ret] = CROSS;
 					}
 				}
-				Modify(p, p1, node_type, unstb_ret, no_nodes, net_edges, net_edges1);
+				Modify(p, p1, unstb_ret, no_nodes, net_edges, net_edges1);
 			}
 
 			for (i = 0; i < no_rets_out; i++) {
@@ -1828,18 +2092,13 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 						inner_flag[unstb_ret] = CROSS;
 					}
 				}
-				Modify(p1, p, node_type, unstb_ret, no_nodes, net_edges1, net_edges);
+				Modify(p1, p, unstb_ret, no_nodes, net_edges1, net_edges);
 			}
 
 			/* copy data for spliting */
-			int input_leaves_orig[no1];
-			int in_cluster_orig[n_l];
-			for (i = 0; i < n_l; i++) {
-				in_cluster_orig[i] = in_cluster[i];
-			}
-			for (i = 0; i < no1; i++) {
-				input_leaves_orig[i] = input_leaves[i];
-			}
+			unsigned int in_cluster_orig[nslots];
+			for (j = 0; j < nslots; j++)
+				in_cluster_orig[j] = in_cluster[j];
 			no1_1 = no1;
 
 			*no_break = *no_break + 1;
@@ -1888,7 +2147,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			// not run the 1st network if there is a node which has children in both B and not B
 			for (i = 0; i < no_rets_out; i++) {
 				unstb_ret = unstb_rets_out[i];
-				run_1st = To_Run_Network(unstb_ret, indicator, no_nodes, no1, input_leaves, node_type, inner_flag, lf_below, node_strings, child_array,
+				run_1st = To_Run_Network(unstb_ret, indicator, no_nodes, in_cluster, node_type, inner_flag, lf_below, node_strings, child_array,
 				parent_array, net_edges);
 				if(run_1st==0) break;
 			}
@@ -1896,7 +2155,7 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			indicator = -1;
 			for (i = 0; i < no_rets_in; i++) {
 				unstb_ret = unstb_rets_in[i];
-				run_2nd = To_Run_Network(unstb_ret, indicator, no_nodes, no1_1, input_leaves_orig, node_type, inner_flag1, lf_below1, node_strings, child_array,
+				run_2nd = To_Run_Network(unstb_ret, indicator, no_nodes, in_cluster_orig, node_type, inner_flag1, lf_below1, node_strings, child_array,
 				parent_array, net_edges1);
 				if (run_2nd==0) break;
 			}
@@ -1909,34 +2168,26 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 			if (run_1st == 1)
 			{
 				if(no_in_lfb > 1){
-					/* decrease B */
-					int input_leaves1[no1];
-					nlf_kept = 0;
-					for (i = 0; i < no1; i++) {
-						if (Is_In(input_leaves[i], lf_in_comp, no_in_lfb) == -1) {
-							input_leaves1[nlf_kept++] = input_leaves[i];
-						}
-					}
-					input_leaves1[nlf_kept++] = lf_in_comp[0];
+					/* decrease B by the leaves removed, see Contract_Tree */
+					unsigned int in_cluster1[nslots];
+					for (j = 0; j < nslots; j++)
+						in_cluster1[j] = in_cluster[j];
+					for (i = 0; i < no_in_lfb; i++)
+						BITCLEAR(in_cluster1, lf_in_comp[i]);
+					BITSET(in_cluster1, lf_in_comp[0]);
+					nlf_kept = no1;
+					for (j = 0; j < nslots; j++)
+						nlf_kept -= pop(in_cluster[j] & ~in_cluster1[j]);
 					no1 = nlf_kept;
-
-					/* revise in_cluster */
-					int in_cluster1[n_l];
-					for (i = 0; i < n_l; i++) {
-						in_cluster1[i] = in_cluster[i];
-						if (Is_In(i, input_leaves1, no1) == -1) {
-							in_cluster1[i] = 0;
-						}
-					}
 					res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves1, in_cluster1, super_deg, cps,
+							in_cluster1, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 				else{
 					res = Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 							node_type, inner_flag, lf_below, node_strings, no1,
-							input_leaves, in_cluster, super_deg, cps,
+							in_cluster, super_deg, cps,
 							child_array, parent_array, net_edges, n_l, no_break);
 				}
 			}
@@ -1944,17 +2195,17 @@ int Cluster_Containment(struct components *ptr, int r_nodes[], int n_r,
 				// Run on 2nd split network
 				res = Cluster_Containment(p1->next, r_nodes, n_r, no_nodes, node_type,
 					inner_flag1, lf_below1, node_strings, no1_1,
-					input_leaves_orig, in_cluster_orig, super_deg1,
+					in_cluster_orig, super_deg1,
 					whole_copy, child_array, parent_array, net_edges1, n_l, no_break);
 			}
 			// free(net_edges1);
 			return res;
 		}
 		else {
-			Modify2(p->next, node_type, p->ret_node, no_nodes, net_edges);
+			Modify2(p->next, p->ret_node, no_nodes, net_edges);
 			return Cluster_Containment(p->next, r_nodes, n_r, no_nodes,
 					node_type, inner_flag, lf_below, node_strings, no1,
-					input_leaves, in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
+					in_cluster, super_deg, cps, child_array, parent_array, net_edges, n_l,
 					no_break);
 		}
 	}
@@ -1990,162 +2241,349 @@ void Print_Network(struct network *net) {
 //	}
 }
 
+/* set the query context of this thread from a network, making it big enough first */
+struct query_context *Reset_Context(struct network *net) {
+	struct query_context *ctx = &context;
+	int n = net->no_nodes;
+
+	if (n > ctx->max_nodes) {
+		free(ctx->inner_flag);
+		free(ctx->lf_below);
+		free(ctx->super_deg);
+		free(ctx->net_edges);
+		ctx->inner_flag = (int *) malloc(n * sizeof(int));
+		ctx->lf_below = (int *) malloc(n * sizeof(int));
+		ctx->super_deg = (int *) malloc(n * sizeof(int));
+		ctx->net_edges = (int *) malloc(n * n * sizeof(int));
+		ctx->max_nodes = n;
+	}
+	if (net->n_r + 1 > ctx->max_comps) {
+		free(ctx->network);
+		ctx->network = (struct components *) malloc((net->n_r + 1)
+				* sizeof(struct components));
+		ctx->max_comps = net->n_r + 1;
+	}
+	if (net->tree_size > ctx->max_trees) {
+		free(ctx->trees);
+		ctx->trees = (struct arb_tnode *) malloc(net->tree_size
+				* sizeof(struct arb_tnode));
+		ctx->max_trees = net->tree_size;
+	}
+
+	ctx->first_ret = net->n_l;
+	ctx->first_tree = net->n_l + net->n_r;
+	memcpy(ctx->inner_flag, net->inner_flag, n * sizeof(int));
+	memcpy(ctx->lf_below, net->lf_below, n * sizeof(int));
+	memcpy(ctx->super_deg, net->super_deg, n * sizeof(int));
+	memcpy(ctx->net_edges, net->net_edges, n * n * sizeof(int));
+	return ctx;
+}
+
 /*
- * check whether a subset of leaves is a cluster of a network
+ * run CCP for a subset of leaves on a copy of the components of a network
  */
-int Is_Cluster(int in_cluster[], int r, struct network *net1,
-		struct network *net2, int tree_size1, int tree_size2) {
-	int size = max((*net1).no_nodes, (*net2).no_nodes);
-	int inner_flag[size], lf_below[size], super_deg[size];
-	struct components *cps1, *cps2, *p1, *p2;
-	int no_break, r1 = 0, r2 = 0, res = 0;
-	int i, j;
-	if (r == 0 || r == net1->n_l) {
-		return;
-	}
-	if (r == 1) {
-	} else {
-		int input_leaves[r];
-		j = 0;
-		for (i = 0; i < net1->n_l; i++) {
-			if (in_cluster[i] == 1) {
-				input_leaves[j] = i;
-				j += 1;
-			}
+int Run_CCP(struct network *net, int r, unsigned int in_cluster[]) {
+	struct query_context *ctx;
+	struct components *cps, *p;
+	int no_break, res;
+
+	no_break = 0;
+	ctx = Reset_Context(net);
+	int tree_index = 0;
+	Make_Current_Network((net->all_cps), net->n_r + 1, ctx->network, ctx->trees,
+			&tree_index);
+	cps = &ctx->network[0];
+	r = Contract_Components(cps, in_cluster, r);
+
+	p = cps;
+	if (net->n_r > 0) {
+		while (net->node_type[p->ret_node] != ROOT
+				&& net->node_type[(net->child_array[p->ret_node])->leaf]
+						== LEAVE) {
+			p = p->next;
 		}
-		//printf("\ncheck whether this cluster is in the 1st network\n   ");
-		no_break = 0;
-		// Coying network
-		int net_edges1[(*net1).no_nodes * (*net1).no_nodes];
-		for (i = 0; i < (*net1).no_nodes; i++) {
-			inner_flag[i] = net1->inner_flag[i];
-			lf_below[i] = net1->lf_below[i];
-			super_deg[i] = net1->super_deg[i];
-			for(j = 0; j < (*net1).no_nodes; j++){
-				*(net_edges1 + i * (*net1).no_nodes + j) = *(net1->net_edges + i * (*net1).no_nodes + j);
-			}
+	}
+	res = Cluster_Containment(p, net->r_nodes, net->n_r, net->no_nodes,
+			net->node_type, ctx->inner_flag, ctx->lf_below, net->node_strings, r,
+			in_cluster, ctx->super_deg, cps, net->child_array, net->parent_array,
+			ctx->net_edges, net->n_l, &no_break);
+
+	return res;
+}
+
+/*
+ * Count the leaves of B and all the leaves below each node of the displayed tree
+ * in which ret keeps only its edge from p. Return a node whose cluster is B, or -1.
+ */
+int Galled_Count(int u, int p, int ret, struct lnode *child_array[],
+		unsigned int in_b[], int no1, int no_in[], int no_all[]) {
+	struct lnode *q;
+	int x, found;
+
+	found = -1;
+	no_in[u] = 0;
+	no_all[u] = 0;
+	if (child_array[u] == NULL) {
+		no_all[u] = 1;
+		if (BITTEST(in_b, u))
+			no_in[u] = 1;
+		return -1;
+	}
+	for (q = child_array[u]; q != NULL; q = q->next) {
+		x = q->leaf;
+		if (x == ret && u != p)
+			continue;
+		if (found == -1)
+			found = Galled_Count(x, p, ret, child_array, in_b, no1, no_in, no_all);
+		else
+			Galled_Count(x, p, ret, child_array, in_b, no1, no_in, no_all);
+		no_in[u] += no_in[x];
+		no_all[u] += no_all[x];
+	}
+	if (found == -1 && no_in[u] == no1 && no_all[u] == no1)
+		found = u;
+	return found;
+}
+
+/*
+ * CCP for a network with a single reticulation, such as a blob of a level-1 network (galled tree).
+ * Each parent of the reticulation gives one displayed tree, so B is a soft cluster iff
+ * it is the cluster of a node in one of them. B is a bitset over the nodes.
+ * Return 50 or 10 with the node in *node, or 0 if the network has more reticulations.
+ */
+int Galled_Containment(int no_nodes, int root, struct lnode *child_array[],
+		struct lnode *parent_array[], unsigned int in_b[], int no1, int *node) {
+	int no_in[no_nodes], no_all[no_nodes];
+	int i, ret, no_ret;
+	struct lnode *q;
+
+	ret = -1;
+	no_ret = 0;
+	for (i = 0; i < no_nodes; i++) {
+		if (parent_array[i] != NULL && parent_array[i]->next != NULL) {
+			ret = i;
+			no_ret += 1;
 		}
-		struct components network1[net1->n_r + 1];
-		struct arb_tnode trees1[tree_size1];
-		int tree_index1 = 0;
-		Make_Current_Network((net1->all_cps), net1->n_r + 1, network1, trees1,
-				&tree_index1);
-		cps1 = &network1[0];
-		p1 = cps1;
-		if (net1->n_r > 0) {
-			while (net1->node_type[p1->ret_node] != ROOT
-					&& net1->node_type[(net1->child_array[p1->ret_node])->leaf]
-							== LEAVE) {
-				p1 = p1->next;
-			}
+	}
+	if (no_ret != 1)
+		return 0;
+
+	for (q = parent_array[ret]; q != NULL; q = q->next) {
+		*node = Galled_Count(root, q->leaf, ret, child_array, in_b, no1, no_in,
+				no_all);
+		if (*node != -1)
+			return 50;
+	}
+	return 10;
+}
+
+/*
+ * Resolve a subset of leaves B with the blob decomposition of a network.
+ * Let v be the lowest cut head with B below v. B is a soft cluster iff
+ * B is all the leaves below v, or every other cut head has none or all of
+ * its leaves in B and B is a soft cluster of the blob below v, in which
+ * the cut heads are leaves.
+ * Only a blob with one reticulation is resolved on its own (Galled_Containment).
+ * For the other blobs CCP runs on the whole network: CCP run on a blob alone can
+ * miss a soft cluster (see test/pairs/blob_m2_1.txt).
+ */
+int Blob_Containment(struct network *net, int input_leaves[], int r) {
+	int nslots = BITNSLOTS(net->n_l);
+	unsigned int b[nslots], x;
+	int i, j, v, in, full;
+	struct network *blob;
+
+	for (j = 0; j < nslots; j++)
+		b[j] = 0;
+	for (i = 0; i < r; i++)
+		BITSET(b, input_leaves[i]);
+
+	v = net->root;
+	for (i = 0; i < net->no_nodes; i++) {
+		if (net->cut_head[i] == 0 || net->node_type[i] == LEAVE
+				|| net->lf_count[i] >= net->lf_count[v])
+			continue;
+		for (j = 0; j < nslots; j++)
+			if ((b[j] & ~net->lf_set[i][j]) != 0)
+				break;
+		if (j == nslots)
+			v = i;
+	}
+	if (net->lf_count[v] == r)
+		return 50;
+
+	/* B must not cut the subnetwork below any other cut head */
+	for (i = 0; i < net->no_nodes; i++) {
+		if (net->cut_head[i] == 0 || net->node_type[i] == LEAVE
+				|| net->lf_count[i] >= net->lf_count[v])
+			continue;
+		in = 0;
+		full = 1;
+		for (j = 0; j < nslots; j++) {
+			x = b[j] & net->lf_set[i][j];
+			if (x != 0)
+				in = 1;
+			if (x != net->lf_set[i][j])
+				full = 0;
+		}
+		if (in == 1 && full == 0)
+			return 10;
+	}
+	if (net->blob_of[v] == -1)
+		return 10;
+	if (net->blob_of[v] == -2)
+		return Run_CCP(net, r, b);
+
+	blob = &net->blobs[net->blob_of[v]];
+	int bslots = BITNSLOTS(blob->n_l);
+	unsigned int in_cluster1[bslots];
+	int no1 = 0;
+	for (j = 0; j < bslots; j++)
+		in_cluster1[j] = 0;
+	for (i = 0; i < blob->n_l; i++) {
+		x = blob->orig_node[i];
+		for (j = 0; j < nslots; j++)
+			if ((net->lf_set[x][j] & ~b[j]) != 0)
+				break;
+		if (j == nslots) {
+			BITSET(in_cluster1, i);
+			no1++;
 		}
+	}
+	return Galled_Containment(blob->no_nodes, blob->root, blob->child_array,
+			blob->parent_array, in_cluster1, no1, &v);
+}
+
+/* collect the leaves below a node into its bitset */
+void Leaf_Set_Below(int node, struct lnode *child_array[], int node_type[],
+		unsigned int *lf_set[], int nslots, int visited[]) {
+	int i;
+	struct lnode *c;
+
+	if (visited[node] == 1)
+		return;
+	visited[node] = 1;
+	if (node_type[node] == LEAVE) {
+		BITSET(lf_set[node], node);
+		return;
+	}
+	c = child_array[node];
+	while (c != NULL) {
+		Leaf_Set_Below(c->leaf, child_array, node_type, lf_set, nslots,
+				visited);
+		for (i = 0; i < nslots; i++)
+			lf_set[node][i] |= lf_set[c->leaf][i];
+		c = c->next;
+	}
+}
+
+/* the edge entering a tree node is a cut edge iff no node below it has a parent outside the subnetwork below it */
+int Is_Cut_Head(int node, struct lnode *child_array[],
+		struct lnode *parent_array[], int node_type[], int no_nodes) {
+	int below[no_nodes], stack[no_nodes];
+	int i, u, top;
+	struct lnode *q;
 
-		r1 = Cluster_Containment(p1, net1->r_nodes, net1->n_r, net1->no_nodes,
-				net1->node_type, inner_flag, lf_below, net1->node_strings, r,
-				input_leaves, in_cluster, super_deg, cps1, net1->child_array, net1->parent_array, net_edges1,
-				net1->n_l, &no_break);
-
-		//printf("\ncheck whether this cluster is in the 2nd network\n   ");
-		no_break = 0;
-		int net_edges2[(*net2).no_nodes * (*net2).no_nodes];
-		for (i = 0; i < (*net2).no_nodes; i++) {
-			inner_flag[i] = net2->inner_flag[i];
-			lf_below[i] = net2->lf_below[i];
-			super_deg[i] = net2->super_deg[i];
-			for(j = 0; j < (*net2).no_nodes; j++){
-				*(net_edges2 + i * (*net2).no_nodes + j) = *(net2->net_edges + i * (*net2).no_nodes + j);
+	if (node_type[node] == ROOT || node_type[node] == LEAVE)
+		return 1;
+	if (node_type[node] == RET)
+		return 0;
+
+	for (i = 0; i < no_nodes; i++)
+		below[i] = 0;
+	below[node] = 1;
+	top = 0;
+	stack[top++] = node;
+	while (top > 0) {
+		u = stack[--top];
+		q = child_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0) {
+				below[q->leaf] = 1;
+				stack[top++] = q->leaf;
 			}
+			q = q->next;
 		}
-		struct components network2[net2->n_r + 1];
-		struct arb_tnode trees2[tree_size2];
-		int tree_index2 = 0;
-		Make_Current_Network((net2->all_cps), net2->n_r + 1, network2, trees2,
-				&tree_index2);
-		cps2 = &network2[0];
-		p2 = cps2;
-		if (net2->n_r > 0) {
-			while (net2->node_type[p2->ret_node] != ROOT
-					&& net2->node_type[(net2->child_array[p2->ret_node])->leaf]
-							== LEAVE) {
-				p2 = p2->next;
-			}
+	}
+
+	for (u = 0; u < no_nodes; u++) {
+		if (below[u] == 0 || u == node)
+			continue;
+		q = parent_array[u];
+		while (q != NULL) {
+			if (below[q->leaf] == 0)
+				return 0;
+			q = q->next;
 		}
+	}
+	return 1;
+}
 
-		r2 = Cluster_Containment(p2, net2->r_nodes, net2->n_r, net2->no_nodes,
-				net2->node_type, inner_flag, lf_below, net2->node_strings, r,
-				input_leaves, in_cluster, super_deg, cps2, net2->child_array, net2->parent_array, net_edges2,
-				net2->n_l, &no_break);
+/*
+ * Collect the blob below cut head v, i.e. the nodes reached from v without
+ * passing another cut head. The cut heads met on the way become the leaves of
+ * the blob. blob_node maps the nodes of the blob to the nodes of the network.
+ */
+void Extract_Blob(int v, struct lnode *child_array[], int cut_head[],
+		int no_nodes, int blob_node[], int *no_blob_nodes, int start[],
+		int end[], int *no_edges) {
+	int local[no_nodes];
+	int i, u, n, head;
+	struct lnode *q;
 
-		if ((r1 == 50 && r2 < 50) || (r2 == 50 && r1 < 50)) {
-			res = 1;
+	for (i = 0; i < no_nodes; i++)
+		local[i] = -1;
+	local[v] = 0;
+	blob_node[0] = v;
+	n = 1;
+	head = 0;
+	*no_edges = 0;
+	while (head < n) {
+		u = blob_node[head++];
+		if (u != v && cut_head[u] == 1)
+			continue;
+		q = child_array[u];
+		while (q != NULL) {
+			if (local[q->leaf] == -1) {
+				local[q->leaf] = n;
+				blob_node[n++] = q->leaf;
+			}
+			start[*no_edges] = local[u];
+			end[*no_edges] = local[q->leaf];
+			*no_edges += 1;
+			q = q->next;
 		}
 	}
-
-	return res;
+	*no_blob_nodes = n;
 }
 
 /*
- * Read the input network
- * Build the tree component
+ * Build the tree components of a network given by its edges.
+ * node_strings are freed after being copied into the network.
  */
-void Preprocess_Network(char *arg, struct network *net) {
-	FILE *ntk_ptr;
+void Build_Network(char *node_strings[], int no_nodes, int start[], int end[],
+		int no_edges, struct network *net) {
 	int *node_type, *r_nodes, *orig_rnodes;
 	int root;
-	int start[MAXEDGE], end[MAXEDGE];
-	char *node_strings[MAXSIZE];
 	struct lnode **child_array;
 	struct lnode **parent_array;
 	int *lf_below; /* what is the leaf below a reticulation */
 	int *inner_flag; /* whether a ret is inner or cross */
 	int *super_deg;
 	char **net_leaves; /* to denote leaves and move leaves front */
-	int *in_cluster; /*  to indicate whether a network leaf is in the input cluster B or not*/
-	int no_edges, n_t, n_r, n_l, no_nodes; /* n_t: tree nodes, n_r: ret nodes; n_l: no. leaves */
+	int n_r, n_l; /* n_r: ret nodes; n_l: no. leaves */
 	int *net_edges;	// Use adjacency matrix to store all edges to facilitate edge looking up
-
-	int check_leaves;
-	char str1[20], str2[20];
-	int u1, u2;
 	int i, x, j;
 
 	struct components *all_cps, *p;
 
-	/* network processing */
-	ntk_ptr = fopen(arg, "r");
-	if (ntk_ptr == NULL)
-		printf("File %s is not readable\n", arg);
-	no_edges = 0;
-	no_nodes = 0;
-	while (fscanf(ntk_ptr, "%s %s\n", str1, str2) != EOF) {
-		u1 = Check_Name(node_strings, no_nodes, str1);
-		if (u1 == -1) {
-			u1 = no_nodes, no_nodes = 1 + no_nodes;
-			node_strings[u1] = (char *) malloc(strlen(str1) + 1);
-			strcpy(node_strings[u1], str1);
-		}
-		u2 = Check_Name(node_strings, no_nodes, str2);
-		if (u2 == -1) {
-			u2 = no_nodes, no_nodes = 1 + no_nodes;
-			node_strings[u2] = (char *) malloc(strlen(str2) + 1);
-			strcpy(node_strings[u2], str2);
-		}
-		start[no_edges] = u1;
-		end[no_edges] = u2;
-		no_edges += 1;
-	}
-	fclose(ntk_ptr);
-
-	/*	printf("no_nodes: %d\n", no_nodes);
-	 printf("no_edges: %d\n", no_edges);*/
-
 	node_type = (int *) calloc(no_nodes, sizeof(int));
 
 	/* no_edges, no_nodes  */
 	x = Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
 	if (x < 0) {
 		printf("\n the network graph has two or more roots or a node with");
-		printf("\n both in- and out-degree greater than 1;\n Recheck it\n");
+		printf("\n in-degree greater than 1 and out-degree other than 1;\n Recheck it\n");
 		return;
 	}
 
@@ -2176,6 +2614,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 			n_l);
 	//printf("sort leaves.\n");
 	Sort_Leaves(node_strings, n_l, start, end, no_edges);
+	Renumber_Nodes(node_strings, no_nodes, start, end, no_edges, n_l);
 	//printf("inform node type.\n");
 	Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
 
@@ -2207,6 +2646,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 			no_edges);
 	//printf("sort ret nodes.\n");
 	Sort_Rets_By_Level(orig_rnodes, r_nodes, n_r, child_array, parent_array, node_type, no_nodes);
+	free(orig_rnodes);
 
 	inner_flag = (int *) calloc(no_nodes, sizeof(int));
 	for (i = 0; i < no_nodes; i++)
@@ -2229,7 +2669,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 		}
 		((*all_cps).tree_com)->flag = 0;
 		((*all_cps).tree_com)->no_children = 0;
-		for (i = i; i < MAXDEGREE; i++)
+		for (i = 0; i < MAXDEGREE; i++)
 			(((*all_cps).tree_com)->child)[i] = NULL;
 		(*all_cps).next = NULL;
 
@@ -2252,7 +2692,7 @@ void Preprocess_Network(char *arg, struct network *net) {
 		((*all_cps).tree_com)->label = root;
 		((*all_cps).tree_com)->flag = 0;
 		((*all_cps).tree_com)->no_children = 0;
-		for (i = i; i < MAXDEGREE; i++)
+		for (i = 0; i < MAXDEGREE; i++)
 			(((*all_cps).tree_com)->child)[i] = NULL;
 		(*all_cps).next = NULL;
 	}
@@ -2262,20 +2702,19 @@ void Preprocess_Network(char *arg, struct network *net) {
 		super_deg[r_nodes[i]] = 0;
 
 	//printf("build components.\n");
-	p = all_cps;
-	while (p != NULL) {
-		Build_Comp_Revised(p->tree_com, child_array, node_type, no_nodes, &p->size,
-				&p->no_tree_node);
-		for (i = 0; i < n_r; i++) {
-			super_deg[r_nodes[i]] = super_deg[r_nodes[i]]
-					+ Is_In_Comp(p->tree_com, r_nodes[i]);
-		}
-
-		// Print_Comp_Revised(p->tree_com, node_strings);
-		// printf("---size %d--no_tree_node %d\n", p->size, p->no_tree_node);
-
-		p = p->next;
+	int visible[no_nodes];
+	Visible_Nodes(no_nodes, root, child_array, parent_array, node_type, visible);
+	struct components *cps[n_r + 1];
+	j = 0;
+	for (p = all_cps; p != NULL; p = p->next) {
+		p->visible = visible[p->ret_node];
+		cps[j++] = p;
 	}
+	Build_Components(cps, j, child_array, node_type, no_nodes, super_deg);
+
+	net->tree_size = 0;
+	for (p = all_cps; p != NULL; p = p->next)
+		net->tree_size += p->size;
 
 	lf_below = (int *) calloc(no_nodes, sizeof(int));
 	for (i = 0; i < n_r; i++)
@@ -2310,6 +2749,14 @@ void Preprocess_Network(char *arg, struct network *net) {
 	net->root = root;
 	net->super_deg = super_deg;
 	net->net_edges = net_edges;
+	net->lf_set = NULL;
+	net->lf_count = NULL;
+	net->cut_head = NULL;
+	net->blob_of = NULL;
+	net->n_blob = 0;
+	net->blobs = NULL;
+	net->orig_node = NULL;
+	net->displayed = NULL;
 
 	for (i = 0; i < n_l; i++) {
 		free(net_leaves[i]);
@@ -2317,6 +2764,491 @@ void Preprocess_Network(char *arg, struct network *net) {
 	free(net_leaves);
 }
 
+/*
+ * Split the network into blobs at its cut edges.
+ * A blob with one reticulation is built as a network of its own, for
+ * Galled_Containment. A blob with more is not built, as CCP runs on the whole
+ * network for it, and its cut head gets -2 in blob_of.
+ */
+void Decompose_Blobs(struct network *net) {
+	int nslots = BITNSLOTS(net->n_l);
+	int no_nodes = net->no_nodes;
+	int visited[no_nodes], blob_node[no_nodes];
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int i, j, n, v, no_blob_nodes, no_edges;
+	struct lnode *q;
+	struct network *blob;
+
+	net->lf_set = (unsigned int **) malloc(no_nodes * sizeof(unsigned int *));
+	net->lf_count = (int *) calloc(no_nodes, sizeof(int));
+	net->cut_head = (int *) calloc(no_nodes, sizeof(int));
+	net->blob_of = (int *) malloc(no_nodes * sizeof(int));
+	for (i = 0; i < no_nodes; i++) {
+		net->lf_set[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited[i] = 0;
+		net->blob_of[i] = -1;
+	}
+	Leaf_Set_Below(net->root, net->child_array, net->node_type, net->lf_set,
+			nslots, visited);
+	for (i = 0; i < no_nodes; i++) {
+		for (j = 0; j < nslots; j++)
+			net->lf_count[i] += pop(net->lf_set[i][j]);
+		net->cut_head[i] = Is_Cut_Head(i, net->child_array, net->parent_array,
+				net->node_type, no_nodes);
+	}
+
+	/* a cut head has a blob below it if one of its out-edges is not a cut edge */
+	n = 0;
+	for (v = 0; v < no_nodes; v++) {
+		if (net->cut_head[v] == 0 || net->node_type[v] == LEAVE)
+			continue;
+		q = net->child_array[v];
+		while (q != NULL && net->cut_head[q->leaf] == 1)
+			q = q->next;
+		if (q != NULL)
+			net->blob_of[v] = -2, n++;
+	}
+
+	net->n_blob = 0;
+	net->blobs = (struct network *) calloc(n, sizeof(struct network));
+	for (v = 0; v < no_nodes; v++) {
+		if (net->blob_of[v] == -1)
+			continue;
+		Extract_Blob(v, net->child_array, net->cut_head, no_nodes, blob_node,
+				&no_blob_nodes, start, end, &no_edges);
+		n = 0;
+		for (i = 1; i < no_blob_nodes; i++)
+			if (net->node_type[blob_node[i]] == RET)
+				n++;
+		if (n != 1)
+			continue;
+		net->blob_of[v] = net->n_blob++;
+		blob = &net->blobs[net->blob_of[v]];
+		for (i = 0; i < no_blob_nodes; i++) {
+			node_strings[i] = (char *) malloc(
+					strlen(net->node_strings[blob_node[i]]) + 1);
+			strcpy(node_strings[i], net->node_strings[blob_node[i]]);
+		}
+		Build_Network(node_strings, no_blob_nodes, start, end, no_edges, blob);
+		blob->orig_node = (int *) malloc(no_blob_nodes * sizeof(int));
+		for (i = 0; i < no_blob_nodes; i++)
+			blob->orig_node[i] = Check_Name(net->node_strings, no_nodes,
+					blob->node_strings[i]);
+	}
+}
+
+/*
+ * Read the edges of the input network
+ */
+void Read_Network(char *arg, char *node_strings[], int *no_nodes, int start[],
+		int end[], int *no_edges) {
+	gzFile ntk_ptr;
+	char *str1, *str2;
+	int u1, u2, size1, size2;
+
+	/* network processing */
+	str1 = NULL, str2 = NULL;
+	size1 = 0, size2 = 0;
+	ntk_ptr = gzopen(arg, "r");
+	if (ntk_ptr == NULL)
+		printf("File %s is not readable\n", arg);
+	*no_edges = 0;
+	*no_nodes = 0;
+	while (Read_Word(ntk_ptr, &str1, &size1) == 1
+			&& Read_Word(ntk_ptr, &str2, &size2) == 1) {
+		u1 = Check_Name(node_strings, *no_nodes, str1);
+		if (u1 == -1) {
+			u1 = *no_nodes, *no_nodes = 1 + *no_nodes;
+			node_strings[u1] = (char *) malloc(strlen(str1) + 1);
+			strcpy(node_strings[u1], str1);
+		}
+		u2 = Check_Name(node_strings, *no_nodes, str2);
+		if (u2 == -1) {
+			u2 = *no_nodes, *no_nodes = 1 + *no_nodes;
+			node_strings[u2] = (char *) malloc(strlen(str2) + 1);
+			strcpy(node_strings[u2], str2);
+		}
+		start[*no_edges] = u1;
+		end[*no_edges] = u2;
+		*no_edges += 1;
+	}
+	gzclose(ntk_ptr);
+	free(str1);
+	free(str2);
+
+	/*	printf("no_nodes: %d\n", *no_nodes);
+	 printf("no_edges: %d\n", *no_edges);*/
+}
+
+/*
+ * Read a network and check its nodes as Build_Network does, before it is built.
+ * Return -1 with a message if it is not a phylogenetic network.
+ */
+int Check_Network(char *arg) {
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int no_edges, no_nodes, root, i, x;
+
+	Read_Network(arg, node_strings, &no_nodes, start, end, &no_edges);
+	int node_type[no_nodes + 1];
+	x = Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
+	if (x < 0) {
+		printf("\n the network graph has two or more roots or a node with");
+		printf("\n in-degree greater than 1 and out-degree other than 1;\n Recheck it\n");
+	}
+	for (i = 0; i < no_nodes; i++)
+		free(node_strings[i]);
+	return x < 0 ? -1 : 0;
+}
+
+/*
+ * Read the input network
+ * Build the tree component
+ */
+void Preprocess_Network(char *arg, struct network *net) {
+	int start[MAXEDGE], end[MAXEDGE];
+	char *node_strings[MAXSIZE];
+	int no_edges, no_nodes;
+
+	Read_Network(arg, node_strings, &no_nodes, start, end, &no_edges);
+	Build_Network(node_strings, no_nodes, start, end, no_edges, net);
+	Decompose_Blobs(net);
+}
+
+int hash_comparator(const void *v1, const void *v2)
+{
+    const unsigned long long h1 = *(const unsigned long long *)v1;
+    const unsigned long long h2 = *(const unsigned long long *)v2;
+    if (h1 < h2)
+        return -1;
+    else if (h1 > h2)
+        return +1;
+    else
+        return 0;
+}
+
+unsigned long long Mix_Hash(unsigned long long h, unsigned long long x) {
+	h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	return h;
+}
+
+/* hash of the subnetwork below a node unfolded into a tree, leaves hashed by their index */
+unsigned long long Unfold_Hash(int node, struct lnode *child_array[],
+		int node_type[], unsigned long long hash[], int visited[]) {
+	int i, deg;
+	struct lnode *c;
+
+	if (visited[node] == 1)
+		return hash[node];
+	visited[node] = 1;
+	if (node_type[node] == LEAVE) {
+		hash[node] = Mix_Hash(LEAVE, node);
+		return hash[node];
+	}
+	deg = Count_Child(child_array[node]);
+	unsigned long long ch[deg];
+	c = child_array[node];
+	for (i = 0; i < deg; i++) {
+		ch[i] = Unfold_Hash(c->leaf, child_array, node_type, hash, visited);
+		c = c->next;
+	}
+	qsort(ch, deg, sizeof(unsigned long long), hash_comparator);
+	hash[node] = Mix_Hash(node_type[node] == RET ? RET : TREE, deg);
+	for (i = 0; i < deg; i++)
+		hash[node] = Mix_Hash(hash[node], ch[i]);
+	return hash[node];
+}
+
+/*
+ * Match the subnetwork below u1 in the 1st network with the one below u2 in the 2nd.
+ * Children are paired by their hashes; the match fails on equal hashes among siblings.
+ * On success map1 and map2 form an isomorphism that keeps the leaves.
+ */
+int Match_Pendant(int u1, int u2, struct lnode *child_array1[],
+		struct lnode *child_array2[], int node_type1[], int node_type2[],
+		unsigned long long hash1[], unsigned long long hash2[], int map1[],
+		int map2[]) {
+	int i, j, deg;
+	struct lnode *c;
+
+	if (map1[u1] != -1 || map2[u2] != -1)
+		return (map1[u1] == u2 && map2[u2] == u1);
+	if (hash1[u1] != hash2[u2] || node_type1[u1] != node_type2[u2])
+		return 0;
+	if (node_type1[u1] == LEAVE)
+		return (u1 == u2);
+	deg = Count_Child(child_array1[u1]);
+	if (deg != Count_Child(child_array2[u2]))
+		return 0;
+	map1[u1] = u2;
+	map2[u2] = u1;
+
+	int ch1[deg], ch2[deg];
+	c = child_array1[u1];
+	for (i = 0; i < deg; i++, c = c->next)
+		ch1[i] = c->leaf;
+	c = child_array2[u2];
+	for (i = 0; i < deg; i++, c = c->next)
+		ch2[i] = c->leaf;
+	for (i = 0; i < deg; i++) {
+		for (j = 0; j < deg; j++) {
+			if (j != i && hash1[ch1[j]] == hash1[ch1[i]])
+				return 0;
+		}
+		for (j = 0; j < deg; j++) {
+			if (hash2[ch2[j]] == hash1[ch1[i]])
+				break;
+		}
+		if (j == deg)
+			return 0;
+		if (Match_Pendant(ch1[i], ch2[j], child_array1, child_array2,
+				node_type1, node_type2, hash1, hash2, map1, map2) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Replace the subnetwork below each head by a leaf named after the first leaf below it,
+ * and renumber the remaining nodes.
+ */
+void Collapse_Pendants(char *node_strings[], int *no_nodes, int start[],
+		int end[], int *no_edges, int heads[], int no_heads,
+		unsigned int *lf_set[], struct lnode *child_array[]) {
+	int n = *no_nodes;
+	int removed[n], is_head[n], new_id[n], stack[n];
+	int i, k, u, top, rep;
+	struct lnode *q;
+
+	for (i = 0; i < n; i++) {
+		removed[i] = 0;
+		is_head[i] = 0;
+	}
+	for (k = 0; k < no_heads; k++) {
+		is_head[heads[k]] = 1;
+		top = 0;
+		stack[top++] = heads[k];
+		while (top > 0) {
+			u = stack[--top];
+			q = child_array[u];
+			while (q != NULL) {
+				if (removed[q->leaf] == 0) {
+					removed[q->leaf] = 1;
+					stack[top++] = q->leaf;
+				}
+				q = q->next;
+			}
+		}
+		rep = 0;
+		while (BITTEST(lf_set[heads[k]], rep) == 0)
+			rep += 1;
+		free(node_strings[heads[k]]);
+		node_strings[heads[k]] = (char *) malloc(strlen(node_strings[rep]) + 1);
+		strcpy(node_strings[heads[k]], node_strings[rep]);
+	}
+
+	k = 0;
+	for (i = 0; i < n; i++) {
+		if (removed[i] == 1) {
+			free(node_strings[i]);
+			continue;
+		}
+		new_id[i] = k;
+		node_strings[k++] = node_strings[i];
+	}
+	*no_nodes = k;
+
+	k = 0;
+	for (i = 0; i < *no_edges; i++) {
+		if (removed[start[i]] == 1 || is_head[start[i]] == 1)
+			continue;
+		start[k] = new_id[start[i]];
+		end[k] = new_id[end[i]];
+		k += 1;
+	}
+	*no_edges = k;
+}
+
+/*
+ * Find the leaf order, cut heads, leaf sets and hashes of a network given by its edges.
+ * Return the number of leaves, or -1 if it is not a phylogenetic network.
+ */
+int Pendant_Inform(char *node_strings[], int no_nodes, int start[], int end[],
+		int no_edges, int node_type[], struct lnode *child_array[],
+		struct lnode *parent_array[], int cut_head[], unsigned int *lf_set[],
+		int lf_count[], unsigned long long hash[], int nslots) {
+	char *net_leaves[no_nodes];
+	int visited[no_nodes];
+	int i, j, root, n_l;
+
+	if (Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root) < 0)
+		return -1;
+	n_l = 0;
+	for (i = 0; i < no_nodes; i++) {
+		if (node_type[i] == LEAVE) {
+			net_leaves[n_l] = (char *) malloc(strlen(node_strings[i]) + 1);
+			strcpy(net_leaves[n_l], node_strings[i]);
+			n_l += 1;
+		}
+	}
+	Move_Leaves_Front(node_strings, no_nodes, start, end, no_edges, net_leaves,
+			n_l);
+	Sort_Leaves(node_strings, n_l, start, end, no_edges);
+	Node_Type_Inform1(node_type, no_nodes, start, end, no_edges, &root);
+	for (i = 0; i < n_l; i++)
+		free(net_leaves[i]);
+	if ((int) BITNSLOTS(n_l) > nslots)
+		return -1;
+
+	Child_Parent_Inform(child_array, parent_array, no_nodes, start, end,
+			no_edges);
+	for (i = 0; i < no_nodes; i++) {
+		lf_set[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		visited[i] = 0;
+	}
+	Leaf_Set_Below(root, child_array, node_type, lf_set, nslots, visited);
+	for (i = 0; i < no_nodes; i++) {
+		lf_count[i] = 0;
+		for (j = 0; j < nslots; j++)
+			lf_count[i] += pop(lf_set[i][j]);
+		cut_head[i] = Is_Cut_Head(i, child_array, parent_array, node_type,
+				no_nodes);
+		visited[i] = 0;
+	}
+	Unfold_Hash(root, child_array, node_type, hash, visited);
+	return n_l;
+}
+
+/*
+ * Collapse the pendant subnetworks the two networks have in common.
+ * The soft clusters of a network with a pendant subnetwork P are those inside P
+ * and those of the network with P replaced by a leaf. If P is in both networks,
+ * the clusters inside P are shared, so replacing P by a leaf in both networks
+ * keeps the soft RF distance. Return the number of subnetworks collapsed; the leaves
+ * they had are kept in map.
+ */
+int Collapse_Common_Pendants(char *node_strings1[], int *no_nodes1,
+		int start1[], int end1[], int *no_edges1, char *node_strings2[],
+		int *no_nodes2, int start2[], int end2[], int *no_edges2,
+		struct leaf_map *map) {
+	int n1 = *no_nodes1, n2 = *no_nodes2;
+	int nslots = BITNSLOTS(MAXSIZE);
+	int node_type1[n1], node_type2[n2], cut_head1[n1], cut_head2[n2];
+	int lf_count1[n1], lf_count2[n2], map1[n1], map2[n2];
+	unsigned int *lf_set1[n1], *lf_set2[n2];
+	unsigned long long hash1[n1], hash2[n2];
+	struct lnode *child_array1[n1], *parent_array1[n1];
+	struct lnode *child_array2[n2], *parent_array2[n2];
+	int heads1[n1], heads2[n1], order[n1];
+	int i, j, k, w1, w2, n_l, n_l2, no_heads, covered;
+
+	no_heads = 0;
+	map->n_l = 0;
+	n_l = Pendant_Inform(node_strings1, n1, start1, end1, *no_edges1,
+			node_type1, child_array1, parent_array1, cut_head1, lf_set1,
+			lf_count1, hash1, nslots);
+	n_l2 = Pendant_Inform(node_strings2, n2, start2, end2, *no_edges2,
+			node_type2, child_array2, parent_array2, cut_head2, lf_set2,
+			lf_count2, hash2, nslots);
+	if (n_l < 0 || n_l != n_l2)
+		goto done;
+	for (i = 0; i < n_l; i++) {
+		if (strcmp(node_strings1[i], node_strings2[i]) != 0)
+			goto done;
+	}
+
+	/* try the largest subnetworks first, so that the collapsed ones are maximal */
+	k = 0;
+	for (i = 0; i < n1; i++) {
+		if (cut_head1[i] == 1 && node_type1[i] == TREE)
+			order[k++] = i;
+	}
+	for (i = 0; i < k; i++) {
+		for (j = i + 1; j < k; j++) {
+			if (lf_count1[order[j]] > lf_count1[order[i]]) {
+				w1 = order[i];
+				order[i] = order[j];
+				order[j] = w1;
+			}
+		}
+	}
+
+	for (i = 0; i < k; i++) {
+		w1 = order[i];
+		covered = 0;
+		for (j = 0; j < no_heads && covered == 0; j++) {
+			covered = 1;
+			for (w2 = 0; w2 < nslots; w2++) {
+				if ((lf_set1[w1][w2] & ~lf_set1[heads1[j]][w2]) != 0) {
+					covered = 0;
+					break;
+				}
+			}
+		}
+		if (covered == 1)
+			continue;
+
+		for (w2 = 0; w2 < n2; w2++) {
+			if (cut_head2[w2] == 0 || node_type2[w2] != TREE
+					|| hash2[w2] != hash1[w1]
+					|| memcmp(lf_set1[w1], lf_set2[w2],
+							nslots * sizeof(unsigned int)) != 0)
+				continue;
+			for (j = 0; j < n1; j++)
+				map1[j] = -1;
+			for (j = 0; j < n2; j++)
+				map2[j] = -1;
+			if (Match_Pendant(w1, w2, child_array1, child_array2, node_type1,
+					node_type2, hash1, hash2, map1, map2) == 1) {
+				heads1[no_heads] = w1;
+				heads2[no_heads] = w2;
+				no_heads += 1;
+				break;
+			}
+		}
+	}
+
+	if (no_heads > 0) {
+		/* a collapsed subnetwork is named after its first leaf, see Collapse_Pendants */
+		map->n_l = n_l;
+		map->names = (char **) malloc(n_l * sizeof(char *));
+		map->rep = (char **) malloc(n_l * sizeof(char *));
+		for (i = 0; i < n_l; i++) {
+			map->names[i] = (char *) malloc(strlen(node_strings1[i]) + 1);
+			strcpy(map->names[i], node_strings1[i]);
+			map->rep[i] = map->names[i];
+		}
+		for (k = 0; k < no_heads; k++) {
+			w1 = -1;
+			for (i = 0; i < n_l; i++) {
+				if (BITTEST(lf_set1[heads1[k]], i) == 0)
+					continue;
+				if (w1 == -1)
+					w1 = i;
+				map->rep[i] = map->names[w1];
+			}
+		}
+		Collapse_Pendants(node_strings1, no_nodes1, start1, end1, no_edges1,
+				heads1, no_heads, lf_set1, child_array1);
+		Collapse_Pendants(node_strings2, no_nodes2, start2, end2, no_edges2,
+				heads2, no_heads, lf_set2, child_array2);
+	}
+
+done:
+	for (i = 0; i < n1 && n_l >= 0; i++) {
+		free(lf_set1[i]);
+		Free_Lnodes(child_array1[i]);
+		Free_Lnodes(parent_array1[i]);
+	}
+	for (i = 0; i < n2 && n_l2 >= 0; i++) {
+		free(lf_set2[i]);
+		Free_Lnodes(child_array2[i]);
+		Free_Lnodes(parent_array2[i]);
+	}
+	return no_heads;
+}
+
 void Free_Network(struct network *net) {
 	int i;
 	struct components* p;
@@ -2335,15 +3267,26 @@ void Free_Network(struct network *net) {
 	for (i = 0; i < net->no_nodes; i++) {
 		Free_Lnodes(net->child_array[i]);
 		Free_Lnodes(net->parent_array[i]);
-		// free(net->net_edges[i]);
 	}
 	free(net->child_array);
 	free(net->parent_array);
 	free(net->net_edges);
 
 	Destroy_Network(net->all_cps);
-}
 
+	if (net->lf_set != NULL) {
+		for (i = 0; i < net->no_nodes; i++)
+			free(net->lf_set[i]);
+		free(net->lf_set);
+	}
+	free(net->lf_count);
+	free(net->cut_head);
+	free(net->blob_of);
+	for (i = 0; i < net->n_blob; i++)
+		Free_Network(&net->blobs[i]);
+	free(net->blobs);
+	free(net->orig_node);
+}
 
 void print_array(int n, int array[]) {
 	int i;
@@ -2353,86 +3296,721 @@ void print_array(int n, int array[]) {
 	printf("\n");
 }
 
-double Find_Cluster_Distance(char *arg1, char *arg2) {
+
+/* keep a cluster found by the thread owning the buffer */
+void Add_Difference(struct diff_buffer *buf, unsigned long mask, int side) {
+	if (buf->no == buf->size) {
+		buf->size = (buf->size == 0) ? 64 : 2 * buf->size;
+		buf->clusters = (struct diff_cluster *) realloc(buf->clusters,
+				buf->size * sizeof(struct diff_cluster));
+	}
+	buf->clusters[buf->no].mask = mask;
+	buf->clusters[buf->no].side = side;
+	buf->no += 1;
+}
+
+void Init_Tree_Clusters(struct tree_clusters *tc, int n_l) {
+	tc->nslots = BITNSLOTS(n_l);
+	tc->size = 1024;
+	tc->no = 0;
+	tc->sets = (unsigned int *) malloc(tc->size * tc->nslots * sizeof(unsigned int));
+	tc->used = (char *) calloc(tc->size, sizeof(char));
+}
+
+void Free_Tree_Clusters(struct tree_clusters *tc) {
+	free(tc->sets);
+	free(tc->used);
+}
+
+/* the bucket holding a cluster, or the empty bucket where it would go */
+long Cluster_Bucket(struct tree_clusters *tc, unsigned int x[]) {
+	unsigned long long h = 0;
+	long b;
+	int j;
+
+	for (j = 0; j < tc->nslots; j++)
+		h = Mix_Hash(h, x[j]);
+	h *= 1099511628211ULL;
+	b = (h ^ (h >> 32)) & (tc->size - 1);
+	while (tc->used[b] == 1 && memcmp(&tc->sets[b * tc->nslots], x,
+			tc->nslots * sizeof(unsigned int)) != 0)
+		b = (b + 1) & (tc->size - 1);
+	return b;
+}
+
+int Has_Tree_Cluster(struct tree_clusters *tc, unsigned int x[]) {
+	return tc->used[Cluster_Bucket(tc, x)];
+}
+
+void Add_Tree_Cluster(struct tree_clusters *tc, unsigned int x[]) {
+	unsigned int *sets;
+	char *used;
+	long b, i, size;
+
+	b = Cluster_Bucket(tc, x);
+	if (tc->used[b] == 1)
+		return;
+	memcpy(&tc->sets[b * tc->nslots], x, tc->nslots * sizeof(unsigned int));
+	tc->used[b] = 1;
+	tc->no += 1;
+	if (2 * tc->no <= tc->size)
+		return;
+
+	/* keep the table at most half full */
+	sets = tc->sets;
+	used = tc->used;
+	size = tc->size;
+	tc->size = 2 * size;
+	tc->sets = (unsigned int *) malloc(tc->size * tc->nslots * sizeof(unsigned int));
+	tc->used = (char *) calloc(tc->size, sizeof(char));
+	for (i = 0; i < size; i++) {
+		if (used[i] == 0)
+			continue;
+		b = Cluster_Bucket(tc, &sets[i * tc->nslots]);
+		memcpy(&tc->sets[b * tc->nslots], &sets[i * tc->nslots],
+				tc->nslots * sizeof(unsigned int));
+		tc->used[b] = 1;
+	}
+	free(sets);
+	free(used);
+}
+
+/* keep a cluster of a displayed tree, unless it is a single leaf or all the leaves */
+void Keep_Tree_Cluster(struct tree_clusters *tc, unsigned int x[], int n_l) {
+	int j, k;
+
+	k = 0;
+	for (j = 0; j < tc->nslots; j++)
+		k += pop(x[j]);
+	if (k >= 2 && k < n_l)
+		Add_Tree_Cluster(tc, x);
+}
+
+/* the number of displayed trees, one for each choice of a parent of every reticulation */
+double No_Displayed_Trees(struct network *net) {
+	double no = 1;
+	struct lnode *q;
+	int i, k;
+
+	for (i = 0; i < net->n_r; i++) {
+		k = 0;
+		for (q = net->parent_array[net->r_nodes[i]]; q != NULL; q = q->next)
+			k += 1;
+		no *= k;
+	}
+	return no;
+}
+
+/*
+ * Whether to find the soft clusters of a network from its displayed trees rather than
+ * by running CCP on every subset of leaves: with few reticulations there are far fewer
+ * trees than subsets, and a tree costs much less than a CCP run.
+ */
+int Use_Tree_Engine(struct network *net) {
+	if (net->n_r > MAXTREERET)
+		return 0;
+	return net->n_l >= 32 || No_Displayed_Trees(net) <= (double) (1U << net->n_l);
+}
+
+/* the parent of a node in the displayed tree given by the choice of parent of each reticulation */
+int Tree_Parent(struct network *net, int u, int choice[]) {
+	if (net->node_type[u] == RET)
+		return choice[u];
+	return net->parent_array[u]->leaf;
+}
+
+/*
+ * Collect the clusters of all the trees displayed by a network, that is, its soft
+ * clusters, other than the single leaves and all the leaves.
+ * A displayed tree keeps one parent of each reticulation. The trees are taken in
+ * reflected Gray-code order over these choices, so that a single reticulation moves to
+ * another parent from one tree to the next. The clusters of a tree nest, so moving ret
+ * from p to q takes its leaves out of the clusters of p and its ancestors and puts them
+ * into those of q and its ancestors; only these nodes have new clusters.
+ */
+void Displayed_Clusters(struct network *net, struct tree_clusters *tc) {
+	int no_nodes = net->no_nodes, n_r = net->n_r;
+	int nslots = BITNSLOTS(net->n_l);
+	int order[no_nodes], indeg[no_nodes], choice[no_nodes], mark[no_nodes],
+			changed[no_nodes];
+	int digit[n_r + 1], dir[n_r + 1], no_par[n_r + 1];
+	unsigned int **cl;
+	int i, j, u, v, r, head, tail, no_changed;
+	struct lnode *q;
+
+	Init_Tree_Clusters(tc, net->n_l);
+	cl = (unsigned int **) malloc(no_nodes * sizeof(unsigned int *));
+	for (i = 0; i < no_nodes; i++) {
+		cl[i] = (unsigned int *) calloc(nslots, sizeof(unsigned int));
+		indeg[i] = 0;
+		for (q = net->parent_array[i]; q != NULL; q = q->next)
+			indeg[i] += 1;
+		choice[i] = -1;
+		mark[i] = 0;
+	}
+	for (j = 0; j < n_r; j++) {
+		r = net->r_nodes[j];
+		choice[r] = net->parent_array[r]->leaf;
+		digit[j] = 0;
+		dir[j] = 1;
+		no_par[j] = indeg[r];
+	}
+
+	/* the clusters of the first tree, children before parents */
+	head = 0;
+	tail = 0;
+	order[tail++] = net->root;
+	while (head < tail) {
+		u = order[head++];
+		for (q = net->child_array[u]; q != NULL; q = q->next) {
+			indeg[q->leaf] -= 1;
+			if (indeg[q->leaf] == 0)
+				order[tail++] = q->leaf;
+		}
+	}
+	for (i = tail - 1; i >= 0; i--) {
+		u = order[i];
+		if (net->node_type[u] == LEAVE)
+			BITSET(cl[u], u);
+		for (q = net->child_array[u]; q != NULL; q = q->next) {
+			v = q->leaf;
+			if (net->node_type[v] == RET && choice[v] != u)
+				continue;
+			for (j = 0; j < nslots; j++)
+				cl[u][j] |= cl[v][j];
+		}
+		Keep_Tree_Cluster(tc, cl[u], net->n_l);
+	}
+
+	while (1) {
+		for (j = 0; j < n_r; j++)
+			if (digit[j] + dir[j] >= 0 && digit[j] + dir[j] < no_par[j])
+				break;
+		if (j == n_r)
+			break;
+		for (i = 0; i < j; i++)
+			dir[i] = -dir[i];
+		digit[j] += dir[j];
+		r = net->r_nodes[j];
+
+		no_changed = 0;
+		for (u = choice[r]; u != -1; u = (u == net->root) ? -1 : Tree_Parent(net, u, choice)) {
+			for (i = 0; i < nslots; i++)
+				cl[u][i] &= ~cl[r][i];
+			if (mark[u] == 0) {
+				mark[u] = 1;
+				changed[no_changed++] = u;
+			}
+		}
+		q = net->parent_array[r];
+		for (i = 0; i < digit[j]; i++)
+			q = q->next;
+		choice[r] = q->leaf;
+		for (u = choice[r]; u != -1; u = (u == net->root) ? -1 : Tree_Parent(net, u, choice)) {
+			for (i = 0; i < nslots; i++)
+				cl[u][i] |= cl[r][i];
+			if (mark[u] == 0) {
+				mark[u] = 1;
+				changed[no_changed++] = u;
+			}
+		}
+		for (i = 0; i < no_changed; i++) {
+			Keep_Tree_Cluster(tc, cl[changed[i]], net->n_l);
+			mark[changed[i]] = 0;
+		}
+	}
+
+	for (i = 0; i < no_nodes; i++)
+		free(cl[i]);
+	free(cl);
+}
+
+int tree_diff_comparator(const void *v1, const void *v2)
+{
+    const struct tree_diff *p1 = (struct tree_diff *)v1;
+    const struct tree_diff *p2 = (struct tree_diff *)v2;
+    int j, k1 = 0, k2 = 0;
+    for (j = 0; j < p1->nslots; j++) {
+        k1 += pop(p1->set[j]);
+        k2 += pop(p2->set[j]);
+    }
+    if (k1 != k2)
+        return k1 < k2 ? -1 : +1;
+    for (j = p1->nslots - 1; j >= 0; j--)
+        if (p1->set[j] != p2->set[j])
+            return p1->set[j] < p2->set[j] ? -1 : +1;
+    return 0;
+}
+
+void Free_Leaf_Map(struct leaf_map *map) {
+	int i;
+
+	for (i = 0; i < map->n_l; i++)
+		free(map->names[i]);
+	if (map->n_l > 0) {
+		free(map->names);
+		free(map->rep);
+	}
+	map->n_l = 0;
+}
+
+/*
+ * Print the clusters soft in one network only, each tagged with the network it is soft
+ * in, by size and then by leaf mask. If common pendant subnetworks were collapsed, a
+ * leaf standing for one is put back as all the leaves in map it stands for, so that the
+ * clusters are listed as if nothing had been collapsed.
+ */
+void Print_Differences(struct network *net, struct tree_diff diff[], long no_diff,
+		struct leaf_map *map, int list) {
+	char **names = net->node_strings;
+	int n_l = net->n_l;
+	int leaf_of[map->n_l + 1];
+	unsigned int *sets = NULL;
+	unsigned long mask;
+	long i;
+	int j, nslots, first;
+
+	if (map->n_l > 0) {
+		for (j = 0; j < map->n_l; j++)
+			leaf_of[j] = Check_Name(net->node_strings, net->n_l, map->rep[j]);
+		nslots = BITNSLOTS(map->n_l);
+		sets = (unsigned int *) calloc(no_diff * nslots + 1, sizeof(unsigned int));
+		for (i = 0; i < no_diff; i++) {
+			for (j = 0; j < map->n_l; j++)
+				if (BITTEST(diff[i].set, leaf_of[j]))
+					BITSET(&sets[i * nslots], j);
+			diff[i].set = &sets[i * nslots];
+			diff[i].nslots = nslots;
+		}
+		names = map->names;
+		n_l = map->n_l;
+	}
+	qsort(diff, no_diff, sizeof(struct tree_diff), tree_diff_comparator);
+
+	printf("\nClusters soft in one network only:\n");
+	for (i = 0; i < no_diff; i++) {
+		if (list == LIST_MASK) {
+			mask = 0;
+			for (j = 0; j < n_l; j++)
+				if (BITTEST(diff[i].set, j))
+					mask |= 1UL << j;
+			printf("%d 0x%lx\n", diff[i].side, mask);
+			continue;
+		}
+		printf("%d {", diff[i].side);
+		first = 1;
+		for (j = 0; j < n_l; j++) {
+			if (BITTEST(diff[i].set, j)) {
+				printf(first ? "%s" : ",%s", names[j]);
+				first = 0;
+			}
+		}
+		printf("}\n");
+	}
+	free(sets);
+}
+
+/*
+ * Print the clusters that are soft in exactly one network. Each thread has kept its own
+ * in its buffer; they are copied into place at offsets known in advance, so the threads
+ * need no lock, then printed with Print_Differences.
+ */
+void List_Differences(struct network *net, struct diff_buffer buf[],
+		int no_buf, struct leaf_map *map, int list) {
+	long offset[no_buf + 1];
+	int nslots = BITNSLOTS(net->n_l);
+	struct tree_diff *all;
+	unsigned int *sets;
+	int i, t;
+	long j;
+
+	offset[0] = 0;
+	for (t = 0; t < no_buf; t++)
+		offset[t + 1] = offset[t] + buf[t].no;
+	all = (struct tree_diff *) malloc((offset[no_buf] + 1) * sizeof(struct tree_diff));
+	sets = (unsigned int *) calloc(offset[no_buf] * nslots + 1, sizeof(unsigned int));
+#pragma omp parallel for private(i, j)
+	for (t = 0; t < no_buf; t++) {
+		for (j = 0; j < buf[t].no; j++) {
+			all[offset[t] + j].set = &sets[(offset[t] + j) * nslots];
+			all[offset[t] + j].nslots = nslots;
+			all[offset[t] + j].side = buf[t].clusters[j].side;
+			for (i = 0; i < net->n_l; i++)
+				if ((buf[t].clusters[j].mask >> i) & 1UL)
+					BITSET(all[offset[t] + j].set, i);
+		}
+		free(buf[t].clusters);
+	}
+	Print_Differences(net, all, offset[no_buf], map, list);
+	free(sets);
+	free(all);
+}
+
+/*
+ * The soft RF distance between two networks from the clusters of their displayed trees,
+ * without going through all the subsets of leaves. The clusters in one set only are
+ * listed in the order of List_Differences: by size, then as subsets are numbered, which
+ * for subsets of one size is the order of their leaf masks.
+ */
+double Tree_Cluster_Distance(struct network *net1, struct network *net2,
+		struct leaf_map *map, int list) {
+	struct tree_clusters tc1, tc2;
+	struct tree_diff *diff;
+	long i, no_diff;
+
+	Displayed_Clusters(net1, &tc1);
+	Displayed_Clusters(net2, &tc2);
+	diff = (struct tree_diff *) malloc((tc1.no + tc2.no + 1) * sizeof(struct tree_diff));
+	no_diff = 0;
+	for (i = 0; i < tc1.size; i++) {
+		if (tc1.used[i] == 1 && !Has_Tree_Cluster(&tc2, &tc1.sets[i * tc1.nslots])) {
+			diff[no_diff].set = &tc1.sets[i * tc1.nslots];
+			diff[no_diff].nslots = tc1.nslots;
+			diff[no_diff++].side = 1;
+		}
+	}
+	for (i = 0; i < tc2.size; i++) {
+		if (tc2.used[i] == 1 && !Has_Tree_Cluster(&tc1, &tc2.sets[i * tc2.nslots])) {
+			diff[no_diff].set = &tc2.sets[i * tc2.nslots];
+			diff[no_diff].nslots = tc2.nslots;
+			diff[no_diff++].side = 2;
+		}
+	}
+
+	if (list != NO_LIST)
+		Print_Differences(net1, diff, no_diff, map, list);
+
+	free(diff);
+	Free_Tree_Clusters(&tc1);
+	Free_Tree_Clusters(&tc2);
+	return (double) no_diff / 2;
+}
+
+/*
+ * Guess how hard a subset B of r leaves is to check against a network.
+ * CCP has to branch on the invisible reticulations that have leaves of B
+ * and leaves outside B below them; there are at most 2^k ways to split k
+ * of them, and every step works on the r leaves of B.
+ * A subset with no such reticulation costs 0, it is resolved without search.
+ */
+unsigned long Predict_Cost(struct network *net, int in_cluster[], int r) {
+	int nslots = BITNSLOTS(net->n_l);
+	unsigned int b[nslots], x;
+	int i, j, in, full, no_split;
+	struct components *p;
+
+	if (net->displayed != NULL)
+		return 0;
+	for (j = 0; j < nslots; j++)
+		b[j] = 0;
+	for (i = 0; i < net->n_l; i++)
+		if (in_cluster[i] == 1)
+			BITSET(b, i);
+
+	no_split = 0;
+	for (p = net->all_cps; p != NULL; p = p->next) {
+		if (p->visible == 1 || net->node_type[p->ret_node] != RET)
+			continue;
+		in = 0;
+		full = 1;
+		for (j = 0; j < nslots; j++) {
+			x = b[j] & net->lf_set[p->ret_node][j];
+			if (x != 0)
+				in = 1;
+			if (x != net->lf_set[p->ret_node][j])
+				full = 0;
+		}
+		if (in == 1 && full == 0)
+			no_split++;
+	}
+	if (no_split == 0)
+		return 0;
+	if (no_split > 20)
+		no_split = 20;
+	return (1UL << no_split) * r;
+}
+
+/* keep a subset predicted to be expensive by the thread owning the buffer */
+void Add_Subset(struct cost_buffer *buf, unsigned long mask, unsigned long cost) {
+	int c;
+
+	for (c = 0; cost > 1; c++)
+		cost >>= 1;
+	if (buf->no[c] == buf->size[c]) {
+		buf->size[c] = (buf->size[c] == 0) ? 64 : 2 * buf->size[c];
+		buf->subsets[c] = (unsigned long *) realloc(buf->subsets[c],
+				buf->size[c] * sizeof(unsigned long));
+	}
+	buf->subsets[c][buf->no[c]] = mask;
+	buf->no[c] += 1;
+}
+
+/* CCP for a subset of leaves, or a look-up if the soft clusters were found from the displayed trees */
+int Soft_Cluster(struct network *net, int input_leaves[], int r) {
+	unsigned int x[BITNSLOTS(net->n_l)];
+	int i, j;
+
+	if (net->displayed == NULL)
+		return Blob_Containment(net, input_leaves, r);
+	for (j = 0; j < net->displayed->nslots; j++)
+		x[j] = 0;
+	for (i = 0; i < r; i++)
+		BITSET(x, input_leaves[i]);
+	return Has_Tree_Cluster(net->displayed, x) ? 50 : 10;
+}
+
+/*
+ * check whether a subset of leaves is a cluster of one network but not the other
+ */
+int Is_Cluster(int in_cluster[], int r, struct network *net1,
+		struct network *net2) {
+	int r1 = 0, r2 = 0, res = 0;
+	int i, j;
+	if (r == 0 || r == net1->n_l || r == 1) {
+		return res;
+	} else {
+		int input_leaves[r];
+		j = 0;
+		for (i = 0; i < net1->n_l; i++) {
+			if (in_cluster[i] == 1) {
+				input_leaves[j] = i;
+				j += 1;
+			}
+		}
+		r1 = Soft_Cluster(net1, input_leaves, r);
+		r2 = Soft_Cluster(net2, input_leaves, r);
+		if (r1 == 50 && r2 < 50) {
+			res = 1;
+		} else if (r2 == 50 && r1 < 50) {
+			res = 2;
+		}
+	}
+
+	return res;
+}
+
+/*
+ * Check the subset given by the bits of k against both networks.
+ * Return 1 if it is a soft cluster of exactly one of them; it is then kept in buf
+ * if the clusters are listed.
+ */
+int Check_Subset(unsigned long k, int n, struct network *net1,
+		struct network *net2, int list, struct diff_buffer *buf) {
+	int in_cluster[n];
+	int j, r, x;
+	unsigned long mask;
+
+	int_to_bin_digit(k, n, in_cluster);
+	r = pop(k);
+	x = Is_Cluster(in_cluster, r, net1, net2);
+	if (x == 0)
+		return 0;
+	if (list != NO_LIST) {
+		mask = 0;
+		for (j = 0; j < n; j++)
+			if (in_cluster[j] == 1)
+				mask |= 1UL << j;
+		Add_Difference(buf, mask, x);
+	}
+	return 1;
+}
+
+/*
+ * With list set, the clusters that are soft in one network only are printed too,
+ * on the leaves the networks had before their common pendant subnetworks were collapsed.
+ */
+double Find_Cluster_Distance(char *arg1, char *arg2, int list) {
 	int i;
 	struct network net1, net2;
+	int start1[MAXEDGE], end1[MAXEDGE], start2[MAXEDGE], end2[MAXEDGE];
+	char *node_strings1[MAXSIZE], *node_strings2[MAXSIZE];
+	int no_edges1, no_nodes1, no_edges2, no_nodes2, no_orig_nodes, no_collapsed;
 	unsigned long no_res;
 	float dist;
+	struct leaf_map map;
 	unsigned long k;
-	int tree_size1 = 0, tree_size2 = 0;
-	struct components *p1;
 	/* network processing */
-//printf("preprocess 1st network: \n");
-	Preprocess_Network(arg1, &net1);
-//printf("preprocess 2nd network: \n");
-	Preprocess_Network(arg2, &net2);
+	Read_Network(arg1, node_strings1, &no_nodes1, start1, end1, &no_edges1);
+	Read_Network(arg2, node_strings2, &no_nodes2, start2, end2, &no_edges2);
+	no_orig_nodes = no_nodes1;
+	no_collapsed = 0;
+	no_collapsed = Collapse_Common_Pendants(node_strings1, &no_nodes1, start1,
+			end1, &no_edges1, node_strings2, &no_nodes2, start2, end2, &no_edges2,
+			&map);
+	//printf("preprocess 1st network: \n");
+	Build_Network(node_strings1, no_nodes1, start1, end1, no_edges1, &net1);
+	Decompose_Blobs(&net1);
+	//printf("preprocess 2nd network: \n");
+	Build_Network(node_strings2, no_nodes2, start2, end2, no_edges2, &net2);
+	Decompose_Blobs(&net2);
 
 	printf("1st network: \n");
 	Print_Network(&net1);
 	printf("\n2nd network: \n");
 	Print_Network(&net2);
+	if (no_collapsed > 0) {
+		printf("\n\nCollapsed %d common pendant subnetworks (%d of %d nodes left)\n",
+				no_collapsed, no_nodes1, no_orig_nodes);
+	}
 
 	/* make sure the two networks have the same set of leaves */
 	if (net1.n_l != net2.n_l) {
 		printf(
 				"\n The networks have different number of leaves;\nRecheck it\n");
+		Free_Leaf_Map(&map);
 		return;
 	} else {
 		for (i = 0; i < net1.n_l; i++) {
 			if (strcmp(net1.node_strings[i], net2.node_strings[i]) != 0) {
 				printf("\n The networks have different leaves;\nRecheck it\n");
+				Free_Leaf_Map(&map);
 				return;
 			}
 		}
 	}
 
-	p1 = net1.all_cps;
-	while (p1 != NULL) {
-		tree_size1 += p1->size;
-		p1 = p1->next;
-	}
+	int num_thread = omp_get_num_procs();
+	printf("\nThe number of threads: %d\n", num_thread);
+	omp_set_num_threads(num_thread);
 
-	p1 = net2.all_cps;
-	while (p1 != NULL) {
-		tree_size2 += p1->size;
-		p1 = p1->next;
+	/*
+	 * With few reticulations, the soft clusters are found from the displayed trees as
+	 * srfd does, one network per thread, and if both networks allow it the subsets of
+	 * leaves are not gone through at all.
+	 */
+	struct tree_clusters tc1, tc2;
+	int tree1 = Use_Tree_Engine(&net1);
+	int tree2 = Use_Tree_Engine(&net2);
+	if (tree1 == 1 && tree2 == 1) {
+		dist = Tree_Cluster_Distance(&net1, &net2, &map, list);
+		Free_Network(&net1);
+		Free_Network(&net2);
+		Free_Leaf_Map(&map);
+		return dist;
+	}
+#pragma omp parallel sections
+	{
+#pragma omp section
+		if (tree1 == 1) {
+			Displayed_Clusters(&net1, &tc1);
+			net1.displayed = &tc1;
+		}
+#pragma omp section
+		if (tree2 == 1) {
+			Displayed_Clusters(&net2, &tc2);
+			net2.displayed = &tc2;
+		}
 	}
 
 	int n = net1.n_l;
 	no_res = (1U << n);
-
-	int num_thread = omp_get_num_procs();
-	printf("\nThe number of threads: %d\n", num_thread);
-	omp_set_num_threads(num_thread);
 	int chunksize = no_res / num_thread;
 	printf("The size of chunk: %d\n", chunksize);
 
 	int no_diff = 0;
-
-#pragma omp parallel for schedule(static,chunksize) reduction (+:no_diff)
+	struct diff_buffer buf[num_thread];
+	for (i = 0; i < num_thread; i++) {
+		buf[i].clusters = NULL;
+		buf[i].no = 0;
+		buf[i].size = 0;
+	}
+
+	/*
+	 * A few subsets need a long search while the rest are resolved at once, so with
+	 * static chunks one thread may be left with all the slow ones at the end.
+	 * The subsets predicted to be expensive are taken out first and handed out one
+	 * at a time, the most expensive first; the others follow in chunks, picked up by
+	 * each thread as soon as it runs out of expensive ones. The predicted costs fall
+	 * into few classes, so the subsets are ordered by bucketing them rather than by a
+	 * sort.
+	 */
+	struct cost_buffer heavy_buf[num_thread];
+	unsigned long *heavy;
+	unsigned int *is_heavy;	/* the subsets in heavy, as a bitset */
+	long no_heavy, offset[num_thread][COST_CLASSES], h;
+	int c;
+	memset(heavy_buf, 0, sizeof(heavy_buf));
+#pragma omp parallel for schedule(static,chunksize)
 	for (k = 1; k < no_res - 1; k++) {
-		printf("");
 		int in_cluster[n];
 		int_to_bin_digit(k, n, in_cluster);
 		int r = pop(k);
-		//print_array(n, in_cluster);
-		//printf("r %d\n",r);
-		no_diff += Is_Cluster(in_cluster, r, &net1, &net2, tree_size1,
-				tree_size2);
-	}
+		unsigned long cost = Predict_Cost(&net1, in_cluster, r)
+				+ Predict_Cost(&net2, in_cluster, r);
+		if (cost > 0)
+			Add_Subset(&heavy_buf[omp_get_thread_num()], k, cost);
+	}
+	no_heavy = 0;
+	for (c = COST_CLASSES - 1; c >= 0; c--) {
+		for (i = 0; i < num_thread; i++) {
+			offset[i][c] = no_heavy;
+			no_heavy += heavy_buf[i].no[c];
+		}
+	}
+	heavy = (unsigned long *) malloc((no_heavy + 1) * sizeof(unsigned long));
+#pragma omp parallel for private(c)
+	for (i = 0; i < num_thread; i++) {
+		for (c = 0; c < COST_CLASSES; c++) {
+			if (heavy_buf[i].no[c] > 0)
+				memcpy(heavy + offset[i][c], heavy_buf[i].subsets[c],
+						heavy_buf[i].no[c] * sizeof(unsigned long));
+			free(heavy_buf[i].subsets[c]);
+		}
+	}
+	printf("Subsets predicted to be expensive: %ld\n", no_heavy);
+	is_heavy = (unsigned int *) calloc(BITNSLOTS(no_res), sizeof(unsigned int));
+	for (h = 0; h < no_heavy; h++)
+		BITSET(is_heavy, heavy[h]);
+
+	chunksize = (no_res - no_heavy) / (16 * num_thread) + 1;
+#pragma omp parallel reduction (+:no_diff)
+	{
+		struct diff_buffer *own = &buf[omp_get_thread_num()];
+#pragma omp for schedule(dynamic,1) nowait
+		for (h = 0; h < no_heavy; h++)
+			no_diff += Check_Subset(heavy[h], n, &net1, &net2, list, own);
+
+#pragma omp for schedule(dynamic,chunksize)
+		for (k = 1; k < no_res - 1; k++) {
+			if (BITTEST(is_heavy, k))
+				continue;
+			no_diff += Check_Subset(k, n, &net1, &net2, list, own);
+		}
+	}
+	free(heavy);
+	free(is_heavy);
 
 	dist = (float) (no_diff) / 2;
+	if (list != NO_LIST)
+		List_Differences(&net1, buf, num_thread, &map, list);
 
 	/*	Free memory at the end */
+	if (tree1 == 1)
+		Free_Tree_Clusters(&tc1);
+	if (tree2 == 1)
+		Free_Tree_Clusters(&tc2);
 	Free_Network(&net1);
 	Free_Network(&net2);
+	Free_Leaf_Map(&map);
 
 	return dist;
 }
 
 void main(int argc, char *argv[]) {
+	int list = NO_LIST;
+
+	while (argc > 3 && strcmp(argv[1], "--list") == 0) {
+		if (strcmp(argv[2], "names") == 0)
+			list = LIST_NAMES;
+		else if (strcmp(argv[2], "mask") == 0)
+			list = LIST_MASK;
+		else
+			break;
+		argv += 2;
+		argc -= 2;
+	}
 	if (argc != 3) {
-		printf("Command: PROGRAM(./psrfd) network_file1_name network_file2_name\n");
+		printf("Command: PROGRAM(./psrfd) [--list names|mask] network_file1_name network_file2_name\n");
 		return;
 	}
 	if (strcmp(argv[1], argv[2]) == 0) {
@@ -2441,9 +4019,11 @@ void main(int argc, char *argv[]) {
 				0.0);
 		return;
 	}
+	if (Check_Network(argv[1]) < 0 || Check_Network(argv[2]) < 0)
+		return;
 
 	float dist;
-	dist = Find_Cluster_Distance(argv[1], argv[2]);
+	dist = Find_Cluster_Distance(argv[1], argv[2], list);
 
 	printf(
 			"\nThe soft Robinson-Foulds distance between the two input networks is: %.1f\n",
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Brute-force answers for the tests, for small networks only.
+
+The soft clusters of a network are the clusters of its displayed trees. A displayed
+tree keeps one parent of each reticulation, so all of them are found by trying every
+choice of parents.
+
+  oracle.py dist <network_file1> <network_file2>   print the soft RF distance
+  oracle.py soft <network_file>                    print the soft clusters with two leaves
+                                                   or more, other than all the leaves
+  oracle.py hard <network_file1> <network_file2>   print the hardwired cluster distance
+"""
+import itertools
+import sys
+
+
+def read_network(path):
+    words = open(path).read().split()
+    return list(zip(words[0::2], words[1::2]))
+
+
+def soft_clusters(edges):
+    """Return the leaves of a network and its soft clusters, as frozensets."""
+    children, parents = {}, {}
+    for u, v in edges:
+        children.setdefault(u, []).append(v)
+        parents.setdefault(v, []).append(u)
+    nodes = set(children) | set(parents)
+    leaves = sorted(n for n in nodes if n not in children)
+    rets = sorted(n for n in nodes if len(parents.get(n, [])) > 1)
+    clusters = set()
+    for choice in itertools.product(*[parents[r] for r in rets]):
+        keep = dict(zip(rets, choice))
+        below = {}
+
+        def cluster(u):
+            if u not in below:
+                if u not in children:
+                    below[u] = frozenset([u])
+                else:
+                    below[u] = frozenset().union(*[cluster(v) for v in children[u]
+                            if keep.get(v, u) == u])
+            return below[u]
+
+        for u in nodes:
+            if cluster(u):
+                clusters.add(cluster(u))
+    return leaves, clusters
+
+
+def hardwired_clusters(edges):
+    """The clusters of the nodes of a network, each with all the leaves below it."""
+    children = {}
+    for u, v in edges:
+        children.setdefault(u, []).append(v)
+    below = {}
+
+    def cluster(u):
+        if u not in below:
+            below[u] = frozenset([u]) if u not in children else frozenset().union(
+                    *[cluster(v) for v in children[u]])
+        return below[u]
+
+    return {cluster(u) for u, v in edges} | {cluster(v) for u, v in edges}
+
+
+def hardwired_distance(path1, path2):
+    hard1 = hardwired_clusters(read_network(path1))
+    hard2 = hardwired_clusters(read_network(path2))
+    n = max(len(c) for c in hard1)
+    hard1 = {c for c in hard1 if 1 < len(c) < n}
+    hard2 = {c for c in hard2 if 1 < len(c) < n}
+    return len(hard1 ^ hard2) / 2
+
+
+def distance(path1, path2):
+    leaves, soft1 = soft_clusters(read_network(path1))
+    _, soft2 = soft_clusters(read_network(path2))
+    n = len(leaves)
+    soft1 = {c for c in soft1 if 0 < len(c) < n}
+    soft2 = {c for c in soft2 if 0 < len(c) < n}
+    return len(soft1 ^ soft2) / 2
+
+
+def main():
+    if len(sys.argv) == 4 and sys.argv[1] == 'dist':
+        print('%.1f' % distance(sys.argv[2], sys.argv[3]))
+    elif len(sys.argv) == 3 and sys.argv[1] == 'soft':
+        leaves, soft = soft_clusters(read_network(sys.argv[2]))
+        for c in sorted(sorted(c) for c in soft if 1 < len(c) < len(leaves)):
+            print(' '.join(c))
+    elif len(sys.argv) == 4 and sys.argv[1] == 'hard':
+        print('%.1f' % hardwired_distance(sys.argv[2], sys.argv[3]))
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,669 @@
+#!/usr/bin/env python3
+"""
+Run the tests of ccp, srfd and psrfd.
+
+  run_tests.py [bin_dir]
+
+The programs are built from the sources with -Wall, once without and once with
+-fopenmp, into the serial/ and openmp/ directories of bin_dir (a temporary directory
+if it is not given), unless they are already there. Each check is run on both
+builds. The expected answers were found by oracle.py.
+
+  pairs/<case>_1.txt, pairs/<case>_2.txt   two networks, with their soft RF distance
+                                           in pairs/expected. srfd and psrfd must give
+                                           it, and list the same clusters with --list.
+  srfd -c                                  each pair is run again with all, one or
+                                           none of its networks in the cache.
+  <file>.gz                                some pairs and leaf sets compressed, for
+                                           which the answers must be the same.
+  invalid/<name>.txt                       files that are not a network, which srfd
+                                           and psrfd must reject with a message.
+  srfd options                             -c, --list and the budgets must be rejected
+                                           outside the distance between two networks.
+  srfd --max-splits, ...                   each pair with small budgets, for which the
+                                           distance must be exact or bounds that hold
+                                           it, by the undecided subsets.
+  srfd --pairs                             the distances between random networks, some
+                                           of them read from one file, compressed or
+                                           not, must be those of oracle.py.
+  srfd --consensus                         the support of the soft clusters of random
+                                           networks on the same leaves must be that of
+                                           oracle.py.
+  srfd --triage                            each pair must get the hardwired cluster
+                                           distance of oracle.py, and bounds that hold
+                                           its soft RF distance.
+  srfd <net1> <net2> <edit>...             a chain of random local edits of the 2nd
+                                           network, each checked against oracle.py.
+  ccp/<name>.soft                          the soft clusters of the network
+                                           ccp/<name>.txt, or pairs/<name>.txt. ccp is
+                                           asked about every subset of its leaves.
+  ccp/known                                the subsets ccp is known to answer wrongly,
+                                           reported but not counted as failures.
+  ccp -q, ccp -b                           the answer of ccp, without the witness tree
+                                           or with it written in binary. The tree must
+                                           display the input.
+  ccp -c                                   the answers and witness trees must be those
+                                           of ccp, also for a relabelled network found
+                                           in the cache.
+"""
+import gzip
+import itertools
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+import oracle
+
+TEST = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.dirname(TEST)
+BUILD = [
+    ('ccp', ['gcc', '-O2', '-Wall', '-o', 'ccp', 'ClusterContainment.c', '-lz']),
+    ('srfd', ['gcc', '-O2', '-Wall', '-o', 'srfd', 'SoftRFDist.c', '-lz']),
+    ('psrfd', ['gcc', '-O2', '-Wall', '-o', 'psrfd', 'SoftRFDist_parallel.c', '-lz']),
+]
+# the pragmas are ignored without -fopenmp, so they are not reported there
+VARIANTS = [('serial', ['-Wno-unknown-pragmas']), ('openmp', ['-fopenmp'])]
+failures = []
+
+
+def build(bin_dir, flags):
+    for prog, cmd in BUILD:
+        if os.path.exists(os.path.join(bin_dir, prog)):
+            continue
+        cmd = [os.path.join(REPO, c) if c.endswith('.c') else c for c in cmd]
+        cmd[cmd.index('-o') + 1] = os.path.join(bin_dir, prog)
+        subprocess.run(cmd[:3] + flags + cmd[3:], check=True)
+
+
+def run(bin_dir, prog, *args):
+    out = subprocess.run([os.path.join(bin_dir, prog)] + list(args),
+            capture_output=True, text=True, timeout=600)
+    if out.returncode < 0:
+        return 'signal %d' % -out.returncode
+    return out.stdout
+
+
+def distance(out):
+    for line in out.splitlines():
+        if 'distance between the two input networks is' in line:
+            return line.split(':')[-1].strip()
+    return out.splitlines()[-1] if out.strip() else 'no output'
+
+
+def listed(out):
+    """The clusters listed, none if srfd found the networks to be the same."""
+    i = out.find('Clusters soft in one network only')
+    if i == -1:
+        return [] if 'The two networks are the same' in out else None
+    return [line for line in out[i:].splitlines()[1:] if line.startswith(('1 ', '2 '))]
+
+
+def check_pairs(bin_dir):
+    no = 0
+    for line in open(os.path.join(TEST, 'pairs', 'expected')):
+        case, expected = line.split()
+        net1 = os.path.join(TEST, 'pairs', case + '_1.txt')
+        net2 = os.path.join(TEST, 'pairs', case + '_2.txt')
+        for prog in ('srfd', 'psrfd'):
+            got = distance(run(bin_dir, prog, net1, net2))
+            if got != expected:
+                failures.append('%s %s: distance %s, expected %s'
+                        % (prog, case, got, expected))
+        list1 = listed(run(bin_dir, 'srfd', '--list', 'names', net1, net2))
+        list2 = listed(run(bin_dir, 'psrfd', '--list', 'names', net1, net2))
+        if list1 is None or list1 != list2:
+            failures.append('%s: srfd and psrfd list different clusters' % case)
+        elif len(list1) != 2 * float(expected):
+            failures.append('%s: %d clusters listed for distance %s'
+                    % (case, len(list1), expected))
+        no += 1
+    print('pairs: %d checked' % no)
+
+
+def check_cache(bin_dir):
+    """Run srfd -c on each pair with all, one or none of its networks in the cache."""
+    no = 0
+    for line in open(os.path.join(TEST, 'pairs', 'expected')):
+        case, expected = line.split()
+        net1 = os.path.join(TEST, 'pairs', case + '_1.txt')
+        net2 = os.path.join(TEST, 'pairs', case + '_2.txt')
+        with tempfile.TemporaryDirectory() as cache:
+            got = [distance(run(bin_dir, 'srfd', '-c', cache, net1, net2))]
+            entries = sorted(os.listdir(cache))
+            for e in entries:
+                data = open(os.path.join(cache, e), 'rb').read()
+                os.remove(os.path.join(cache, e))
+                got.append(distance(run(bin_dir, 'srfd', '-c', cache, net1, net2)))
+                open(os.path.join(cache, e), 'wb').write(data)
+            got.append(distance(run(bin_dir, 'srfd', '-c', cache, net1, net2)))
+        if any(g != expected for g in got):
+            failures.append('srfd -c %s: distances %s, expected %s'
+                    % (case, ' '.join(got), expected))
+        no += len(entries)
+    print('cache: %d networks cached' % no)
+
+
+def check_gzip(bin_dir):
+    """The programs must read gzip-compressed networks and leaves as the plain files."""
+    no = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        for line in open(os.path.join(TEST, 'pairs', 'expected')):
+            case, expected = line.split()
+            if not case.startswith(('random0', 'long_labels')):
+                continue
+            nets = []
+            for i in (1, 2):
+                net = os.path.join(TEST, 'pairs', '%s_%d.txt' % (case, i))
+                nets.append(os.path.join(tmp, '%s_%d.txt.gz' % (case, i)))
+                with gzip.open(nets[-1], 'wb') as f:
+                    f.write(open(net, 'rb').read())
+            for prog in ('srfd', 'psrfd'):
+                got = distance(run(bin_dir, prog, nets[0], nets[1]))
+                if got != expected:
+                    failures.append('%s %s.gz: distance %s, expected %s'
+                            % (prog, case, got, expected))
+            net = os.path.join(TEST, 'pairs', case + '_1.txt')
+            leaves, soft = oracle.soft_clusters(oracle.read_network(net))
+            soft = [sorted(c) for c in soft if 1 < len(c) < len(leaves)]
+            for subset in (leaves[:2], leaves[1:4], min(soft)):
+                leaf_file = os.path.join(tmp, 'leaves.txt.gz')
+                with gzip.open(leaf_file, 'wt') as f:
+                    f.write('\n'.join(subset) + '\n')
+                open(leaf_file[:-3], 'w').write('\n'.join(subset) + '\n')
+                plain = witness(run(bin_dir, 'ccp', net, leaf_file[:-3]))
+                if plain is None or witness(run(bin_dir, 'ccp', nets[0],
+                        leaf_file)) != plain:
+                    failures.append('ccp %s.gz {%s}: not the answer for the plain files'
+                            % (case, ','.join(subset)))
+            no += 1
+    print('gzip: %d checked' % no)
+
+
+def check_invalid(bin_dir, progs):
+    """Each file in invalid/ must be rejected with a message, not crash."""
+    no = 0
+    net = os.path.join(TEST, 'pairs', 'random00_2.txt')
+    for f in sorted(os.listdir(os.path.join(TEST, 'invalid'))):
+        bad = os.path.join(TEST, 'invalid', f)
+        for prog in progs:
+            for args in ([bad, net], [net, bad]):
+                out = run(bin_dir, prog, *args)
+                if 'Recheck it' not in out or 'distance between' in out:
+                    failures.append('%s %s: not rejected (%s)' % (prog, f,
+                            out.splitlines()[-1] if out.strip() else 'no output'))
+        no += 1
+    print('invalid: %d checked' % no)
+
+
+def check_options(bin_dir):
+    """srfd must reject the options it cannot apply in the modes other than two networks."""
+    nets = [os.path.join(TEST, 'pairs', 'random03_%d.txt' % i) for i in (1, 2)]
+    no = 0
+    for option in (['-c', tempfile.gettempdir()], ['--list', 'names'],
+            ['--max-frames', '5'], ['--time-limit', '1']):
+        for mode in (['--pairs'], ['--consensus', '0.5'], ['--triage'], [nets[0]]):
+            out = run(bin_dir, 'srfd', *(option + mode + nets))
+            if 'only apply to the distance between two networks' not in out:
+                failures.append('srfd %s: options not rejected' % ' '.join(option + mode))
+            no += 1
+    print('options: %d checked' % no)
+
+
+def is_network(edges, leaves):
+    """Whether the edges form a network the programs take, on the given leaves."""
+    if len(set(edges)) != len(edges):
+        return False
+    children, parents = {}, {}
+    for u, v in edges:
+        children.setdefault(u, []).append(v)
+        parents.setdefault(v, []).append(u)
+    nodes = set(children) | set(parents)
+    if sorted(n for n in nodes if n not in children) != leaves:
+        return False
+    if len([n for n in nodes if n not in parents]) != 1:
+        return False
+    for n in nodes:
+        if len(parents.get(n, [])) > 1 and len(children.get(n, [])) != 1:
+            return False
+        if n in children and n in parents and len(children[n]) == 1 \
+                and len(parents[n]) == 1:
+            return False
+    seen, done = set(), set()
+
+    def acyclic(u):
+        if u in done:
+            return True
+        if u in seen:
+            return False
+        seen.add(u)
+        ok = all(acyclic(v) for v in children.get(u, []))
+        done.add(u)
+        return ok
+
+    return all(acyclic(n) for n in nodes)
+
+
+def suppress(edges):
+    """Remove the nodes with one parent and one child, joining their two edges."""
+    while True:
+        parents, children = {}, {}
+        for u, v in edges:
+            children.setdefault(u, []).append(v)
+            parents.setdefault(v, []).append(u)
+        u = next((u for u in children if len(children[u]) == 1
+                and len(parents.get(u, [])) == 1), None)
+        if u is None:
+            return edges
+        p, c = parents[u][0], children[u][0]
+        edges = [e for e in edges if u not in e] + [(p, c)]
+
+
+def edit(edges, leaves, rng, no):
+    """A random local edit: add or remove a reticulation edge, or move a subtree."""
+    while True:
+        kind = rng.choice(('add', 'remove', 'move'))
+        (a, b), (c, d) = rng.sample(edges, 2)
+        if kind == 'add':
+            x, y = 'edit%d_x' % no, 'edit%d_y' % no
+            new = [e for e in edges if e not in ((a, b), (c, d))] + [(a, x), (x, b),
+                    (c, y), (y, d), (x, y)]
+        elif kind == 'remove':
+            new = suppress([e for e in edges if e != (a, b)])
+        else:
+            z = 'edit%d_z' % no
+            new = suppress([e for e in edges if e != (a, b)])
+            if (c, d) not in new:
+                continue
+            new = [e for e in new if e != (c, d)] + [(c, z), (z, d), (z, b)]
+        if is_network(new, leaves):
+            return new
+
+
+def check_budget(bin_dir):
+    """With a budget, srfd must give the distance, or bounds that hold it with half a
+    unit for each subset it left undecided. The subsets of a network whose displayed
+    trees run out of the budget are checked with CCP, so the errors in ccp/known are
+    reported but not counted as failures."""
+    known = {name for name, _ in known_errors()}
+    no = no_bounds = 0
+    for line in open(os.path.join(TEST, 'pairs', 'expected')):
+        case, expected = line.split()
+        net1 = os.path.join(TEST, 'pairs', case + '_1.txt')
+        net2 = os.path.join(TEST, 'pairs', case + '_2.txt')
+        for budget in (['--max-splits', '1'], ['--max-frames', '1'],
+                ['--max-frames', '20'], ['--time-limit', '60']):
+            out = run(bin_dir, 'srfd', *(budget + [net1, net2]))
+            what = 'srfd %s %s' % (' '.join(budget), case)
+            no += 1
+            if 'is between' not in out:
+                if distance(out) != expected or 'undecided' in out:
+                    what += ': distance %s, expected %s' % (distance(out), expected)
+                else:
+                    continue
+            else:
+                no_bounds += 1
+                low, high = [float(w) for w in out.split('is between')[1].split()[0::2]]
+                undecided = [int(line.split()[0]) for line in out.splitlines()
+                        if 'subsets were left undecided' in line]
+                if not low <= float(expected) <= high \
+                        or undecided != [2 * (high - low)]:
+                    what += ': bounds %.1f and %.1f for %s, %s undecided' % (low, high,
+                            expected, undecided)
+                elif budget[0] == '--time-limit':
+                    what += ': undecided subsets'
+                else:
+                    continue
+            if case + '_1' in known or case + '_2' in known:
+                print('known: ' + what)
+            else:
+                failures.append(what)
+    if no_bounds == 0:
+        failures.append('srfd: no budget ran out')
+    print('budget: %d checked, %d with bounds' % (no, no_bounds))
+
+
+def check_batch(bin_dir):
+    """srfd --pairs must give the distance between every two networks, in the order
+    of the input, with several networks in a file, compressed or not."""
+    nets = [os.path.join(TEST, 'pairs', 'random%02d_%d.txt' % (c, i))
+            for c in range(8) for i in (1, 2)]
+    soft = []
+    for net in nets:
+        leaves, clusters = oracle.soft_clusters(oracle.read_network(net))
+        soft.append((leaves, {c for c in clusters if len(c) < len(leaves)}))
+    # the same network as the 5th one, with other labels and the edges reversed
+    words = open(nets[4]).read().split()
+    relabel = {w: 'x_' + w for w in words[0::2]}
+    edges = [(relabel.get(u, u), relabel.get(v, v)) for u, v in zip(words[0::2],
+            words[1::2])]
+    soft.append(soft[4])
+    expected = [['-' if a[0] != b[0] else '%.1f' % (len(a[1] ^ b[1]) / 2)
+            for b in soft] for a in soft]
+    with tempfile.TemporaryDirectory() as tmp:
+        files = [os.path.join(tmp, 'batch.txt'), os.path.join(tmp, 'batch.txt.gz')]
+        text = [open(net).read() for net in nets]
+        text.append(''.join('%s %s\n' % e for e in reversed(edges)))
+        open(files[0], 'w').write(';\n'.join(text[:7]))
+        with gzip.open(files[1], 'wt') as f:
+            f.write(';\n'.join(text[7:13]))
+        files += nets[13:] + [os.path.join(tmp, 'relabelled.txt')]
+        open(files[-1], 'w').write(text[-1])
+        out = run(bin_dir, 'srfd', '--pairs', *files)
+    i = out.find('distances between the input networks')
+    got = [line.split('\t') for line in out[i:].splitlines()[1:] if '\t' in line]
+    if got != expected:
+        failures.append('srfd --pairs: not the distances of oracle.py')
+    elif 'is the same network as' not in out:
+        failures.append('srfd --pairs: relabelled network not found the same')
+    print('batch: %d networks checked' % len(expected))
+
+
+def check_consensus(bin_dir):
+    """srfd --consensus must list the clusters soft in more than the threshold of the
+    networks on the leaves of the 1st one, with their support, as oracle.py finds them."""
+    groups = {}
+    for c in range(24):
+        for i in (1, 2):
+            net = os.path.join(TEST, 'pairs', 'random%02d_%d.txt' % (c, i))
+            leaves, soft = oracle.soft_clusters(oracle.read_network(net))
+            groups.setdefault(tuple(leaves), []).append((net, soft))
+    leaves, nets = max(groups.items(), key=lambda g: len(g[1]))
+    # a network counted twice, and one on other leaves, which is left out
+    nets.append(nets[1])
+    other = next(g[0][0] for g in groups.values() if g is not nets)
+    support = {}
+    for _, soft in nets:
+        for c in soft:
+            if 1 < len(c) < len(leaves):
+                support[c] = support.get(c, 0) + 1
+    # by size, then by the mask of the leaves in the order of their names
+    order = sorted(support, key=lambda c: (len(c), sum(1 << leaves.index(x) for x in c)))
+    files = [nets[0][0], nets[1][0], other] + [net for net, _ in nets[2:]]
+    no = 0
+    for threshold in ('0', '0.5', '%g' % (2 / len(nets))):
+        out = run(bin_dir, 'srfd', '--consensus', threshold, *files)
+        expected = ['%.3f {%s}' % (support[c] / len(nets), ','.join(sorted(c)))
+                for c in order if support[c] > float(threshold) * len(nets)]
+        i = out.find('Clusters soft in more than')
+        got = out[i:].splitlines()[1:] if i != -1 else None
+        if '%d networks, %d distinct' % (len(nets), len(nets) - 1) not in out \
+                or 'is left out' not in out:
+            failures.append('srfd --consensus %s: networks not counted' % threshold)
+        elif got != expected:
+            failures.append('srfd --consensus %s: not the support of oracle.py'
+                    % threshold)
+        no += len(expected)
+    print('consensus: %d networks, %d clusters checked' % (len(nets), no))
+
+
+def check_triage(bin_dir):
+    """srfd --triage must give the hardwired cluster distance, and bounds that hold the
+    soft RF distance."""
+    no = 0
+    for line in open(os.path.join(TEST, 'pairs', 'expected')):
+        case, expected = line.split()
+        net1 = os.path.join(TEST, 'pairs', case + '_1.txt')
+        net2 = os.path.join(TEST, 'pairs', case + '_2.txt')
+        out = run(bin_dir, 'srfd', '--triage', net1, net2)
+        hard = '%.1f' % oracle.hardwired_distance(net1, net2)
+        if 'hardwired cluster distance between the two input networks is: ' + hard \
+                not in out:
+            failures.append('srfd --triage %s: hardwired distance not %s' % (case, hard))
+        bounds = [line.split()[-3::2] for line in out.splitlines()
+                if 'distance between the two input networks is between' in line]
+        if len(bounds) != 1 or not float(bounds[0][0]) <= float(expected) \
+                <= float(bounds[0][1]):
+            failures.append('srfd --triage %s: bounds do not hold %s' % (case, expected))
+        no += 1
+    print('triage: %d checked' % no)
+
+
+def check_edits(bin_dir):
+    """srfd given a sequence of edited networks must give the distance of each to the
+    1st network, evaluating the subsets of the leaves below the edits only."""
+    rng = random.Random(1)
+    no = partial = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        for case in ('random01', 'random04', 'random07', 'shared00', 'shared03'):
+            ref = os.path.join(TEST, 'pairs', case + '_1.txt')
+            net = os.path.join(TEST, 'pairs', case + '_2.txt')
+            edges = oracle.read_network(net)
+            leaves, _ = oracle.soft_clusters(edges)
+            files = [net]
+            for i in range(4):
+                edges = edit(edges, leaves, rng, i)
+                files.append(os.path.join(tmp, '%s_edit%d.txt' % (case, i)))
+                open(files[-1], 'w').write(''.join('%s %s\n' % e for e in edges))
+            out = run(bin_dir, 'srfd', ref, *files)
+            for f in files:
+                expected = '%.1f' % oracle.distance(ref, f)
+                line = 'distance between %s and %s is: %s' % (ref, f, expected)
+                if line not in out:
+                    failures.append('srfd %s %s: distance not %s' % (case,
+                            os.path.basename(f), expected))
+                no += 1
+            for line in out.splitlines():
+                if 're-evaluated' in line:
+                    done, total = int(line.split()[-4]), int(line.split()[-2])
+                    partial += done < total
+    if not partial:
+        failures.append('srfd: every edit re-evaluated all the subsets')
+    print('edits: %d checked, %d re-evaluated in part' % (no, partial))
+
+
+def known_errors():
+    """The subsets of ccp/known, with the name of their network."""
+    known = set()
+    path = os.path.join(TEST, 'ccp', 'known')
+    if os.path.exists(path):
+        for line in open(path):
+            if line.strip() and not line.startswith('#'):
+                name, leaves = line.split()
+                known.add((name, frozenset(leaves.split(','))))
+    return known
+
+
+def check_ccp(bin_dir):
+    known = known_errors()
+    no = no_known = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        leaf_file = os.path.join(tmp, 'leaves.txt')
+        for f in sorted(os.listdir(os.path.join(TEST, 'ccp'))):
+            if not f.endswith('.soft'):
+                continue
+            name = f[:-5]
+            net = os.path.join(TEST, 'ccp', name + '.txt')
+            if not os.path.exists(net):
+                net = os.path.join(TEST, 'pairs', name + '.txt')
+            words = open(net).read().split()
+            heads = set(words[0::2])
+            leaves = sorted(set(words[1::2]) - heads)
+            soft = {frozenset(line.split())
+                    for line in open(os.path.join(TEST, 'ccp', f)) if line.strip()}
+            for k in range(2, len(leaves)):
+                for subset in itertools.combinations(leaves, k):
+                    open(leaf_file, 'w').write('\n'.join(subset) + '\n')
+                    out = run(bin_dir, 'ccp', '-q', net, leaf_file)
+                    got = 'The input is the soft cluster of node' in out
+                    expected = frozenset(subset) in soft
+                    no += 1
+                    if got == expected:
+                        continue
+                    what = 'ccp %s {%s}: %s, expected %s' % (name, ','.join(subset),
+                            'soft' if got else 'not soft',
+                            'soft' if expected else 'not soft')
+                    if (name, frozenset(subset)) in known:
+                        no_known += 1
+                        print('known: ' + what)
+                    else:
+                        failures.append(what)
+    print('ccp: %d subsets checked, %d known errors' % (no, no_known))
+
+
+def read_witness(path):
+    """The edges of a witness tree written by ccp -b, sorted, as ccp prints them."""
+    data = open(path, 'rb').read()
+    no, = struct.unpack_from('<H', data)
+    names = data[2:].split(b'\0')[:no]
+    i = 2 + sum(len(n) + 1 for n in names)
+    m, = struct.unpack_from('<H', data, i)
+    ends = struct.unpack_from('<%dH' % (2 * m), data, i + 2)
+    return sorted('%s %s' % (names[ends[j]].decode(), names[ends[j + 1]].decode())
+            for j in range(0, 2 * m, 2))
+
+
+def displays(tree, node, subset, leaves):
+    """Whether the node has the subset below it in a tree displayed by the witness, which
+    may keep both parents of the reticulations ccp did not need to resolve."""
+    parents = {}
+    for u, v in tree:
+        parents.setdefault(v, []).append(u)
+    rets = [v for v in parents if len(parents[v]) > 1]
+    for choice in itertools.product(*[parents[r] for r in rets]):
+        keep = dict(zip(rets, choice))
+        children = {}
+        for u, v in tree:
+            if keep.get(v, u) == u:
+                children.setdefault(u, []).append(v)
+        below, stack = set(), [node]
+        while stack:
+            u = stack.pop()
+            below.add(u)
+            stack.extend(children.get(u, []))
+        if below & set(leaves) == subset:
+            return True
+    return False
+
+
+def check_witness(bin_dir):
+    """ccp -q must give the answer of ccp without the witness tree, and ccp -b must
+    write the tree ccp prints. The tree must be made of edges of the network, and
+    display the input at the node ccp names."""
+    no = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        leaf_file = os.path.join(tmp, 'leaves.txt')
+        bin_file = os.path.join(tmp, 'witness.bin')
+        for name in ('random03_1', 'random05_1', 'blob_m2_1', 'shared02_2'):
+            net = os.path.join(TEST, 'pairs', name + '.txt')
+            edges = set(oracle.read_network(net))
+            leaves, _ = oracle.soft_clusters(list(edges))
+            for k in range(2, len(leaves)):
+                for subset in itertools.combinations(leaves, k):
+                    open(leaf_file, 'w').write('\n'.join(subset) + '\n')
+                    what = 'ccp %s {%s}' % (name, ','.join(subset))
+                    plain = witness(run(bin_dir, 'ccp', net, leaf_file))
+                    quiet = witness(run(bin_dir, 'ccp', '-q', net, leaf_file))
+                    if os.path.exists(bin_file):
+                        os.remove(bin_file)
+                    binary = witness(run(bin_dir, 'ccp', '-b', bin_file, net, leaf_file))
+                    no += 1
+                    if plain is None or quiet != (plain if plain == 'not soft'
+                            else plain[:1]):
+                        failures.append('%s -q: not the answer of ccp' % what)
+                        continue
+                    if binary != quiet:
+                        failures.append('%s -b: not the answer of ccp' % what)
+                    if plain == 'not soft':
+                        if os.path.exists(bin_file):
+                            failures.append('%s -b: witness written' % what)
+                        continue
+                    if not os.path.exists(bin_file) or read_witness(bin_file) != plain[1:]:
+                        failures.append('%s -b: not the tree ccp prints' % what)
+                    tree = [tuple(line.split()) for line in plain[1:]]
+                    if not set(tree) <= edges or not displays(tree, plain[0].split()[-1],
+                            set(subset), leaves):
+                        failures.append('%s: the witness does not display the input'
+                                % what)
+    print('ccp witness: %d subsets checked' % no)
+
+
+def witness(out):
+    """The answer of ccp and its witness tree, with the edges sorted."""
+    i = out.find('The input is the soft cluster of node')
+    if i == -1:
+        return 'not soft' if 'not a cluster' in out else None
+    lines = out[i:].split('The no. of rets eliminated')[0].splitlines()
+    return [lines[0]] + sorted(line for line in lines[1:] if line.strip())
+
+
+def check_ccp_cache(bin_dir):
+    """ccp -c must answer as ccp does, and take the cached answer for the same network
+    with other labels on its internal nodes and its edges in another order."""
+    no = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        leaf_file = os.path.join(tmp, 'leaves.txt')
+        for name in ('random05_1', 'long_labels_1'):
+            net = os.path.join(TEST, 'pairs', name + '.txt')
+            words = open(net).read().split()
+            heads = set(words[0::2])
+            leaves = sorted(set(words[1::2]) - heads)
+            relabel = {w: 'x_' + w for w in heads}
+            unlabel = lambda out: out.replace(' x_', ' ').replace('\nx_', '\n')
+            other = os.path.join(tmp, 'other.txt')
+            edges = [(relabel.get(u, u), relabel.get(v, v))
+                    for u, v in zip(words[0::2], words[1::2])]
+            open(other, 'w').write(''.join('%s %s\n' % e for e in reversed(edges)))
+            cache = os.path.join(tmp, 'cache_' + name)
+            os.mkdir(cache)
+            for k in range(2, len(leaves)):
+                for subset in itertools.combinations(leaves, k):
+                    open(leaf_file, 'w').write('\n'.join(subset) + '\n')
+                    plain = witness(run(bin_dir, 'ccp', net, leaf_file))
+                    entries = len(os.listdir(cache))
+                    got = [witness(run(bin_dir, 'ccp', '-c', cache, net, leaf_file))]
+                    stored = len(os.listdir(cache)) != entries
+                    entries = len(os.listdir(cache))
+                    if not stored:
+                        # decided without the search, so not cached: the witness is
+                        # the one ccp finds on the relabelled network
+                        plain = [plain, witness(unlabel(run(bin_dir, 'ccp', other,
+                                leaf_file)))]
+                    got.append(witness(unlabel(run(bin_dir, 'ccp', '-c', cache, other,
+                            leaf_file))))
+                    no += 1
+                    if (stored and any(g != plain for g in got)) or (not stored
+                            and (got[0] != plain[0] or got[1] != plain[1])):
+                        failures.append('ccp -c %s {%s}: answers differ from ccp'
+                                % (name, ','.join(subset)))
+                    elif len(os.listdir(cache)) != entries:
+                        failures.append('ccp -c %s {%s}: relabelled network not found'
+                                ' in the cache' % (name, ','.join(subset)))
+    print('ccp cache: %d subsets checked' % no)
+
+
+def main():
+    if len(sys.argv) > 2:
+        sys.exit(__doc__)
+    with tempfile.TemporaryDirectory() as tmp:
+        top = sys.argv[1] if len(sys.argv) == 2 else tmp
+        for variant, flags in VARIANTS:
+            print('%s:' % variant)
+            bin_dir = os.path.join(top, variant)
+            os.makedirs(bin_dir, exist_ok=True)
+            build(bin_dir, flags)
+            first = len(failures)
+            check_pairs(bin_dir)
+            check_cache(bin_dir)
+            check_gzip(bin_dir)
+            check_invalid(bin_dir, ['srfd', 'psrfd'])
+            check_options(bin_dir)
+            check_budget(bin_dir)
+            check_batch(bin_dir)
+            check_consensus(bin_dir)
+            check_triage(bin_dir)
+            check_edits(bin_dir)
+            check_ccp(bin_dir)
+            check_witness(bin_dir)
+            check_ccp_cache(bin_dir)
+            failures[first:] = ['%s %s' % (variant, f) for f in failures[first:]]
+    for f in failures:
+        print('FAIL ' + f)
+    print('%d failures' % len(failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()